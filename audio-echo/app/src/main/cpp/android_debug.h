@@ -16,11 +16,16 @@
  */
 #ifndef NATIVE_AUDIO_ANDROID_DEBUG_H_H
 #define NATIVE_AUDIO_ANDROID_DEBUG_H_H
+#ifdef __ANDROID__
 #include <android/log.h>
+#else
+#include <cstdio>
+#endif
 
 #if 1
 
 #define MODULE_NAME "AUDIO-ECHO"
+#ifdef __ANDROID__
 #define LOGV(...) \
   __android_log_print(ANDROID_LOG_VERBOSE, MODULE_NAME, __VA_ARGS__)
 #define LOGD(...) \
@@ -33,6 +38,21 @@
   __android_log_print(ANDROID_LOG_ERROR, MODULE_NAME, __VA_ARGS__)
 #define LOGF(...) \
   __android_log_print(ANDROID_LOG_FATAL, MODULE_NAME, __VA_ARGS__)
+#else
+// host builds (audio-echo/tools) log to stderr
+#define HOST_LOG(level, ...)                          \
+  do {                                                \
+    fprintf(stderr, MODULE_NAME " " level ": ");      \
+    fprintf(stderr, __VA_ARGS__);                     \
+    fprintf(stderr, "\n");                            \
+  } while (0)
+#define LOGV(...)
+#define LOGD(...)
+#define LOGI(...) HOST_LOG("I", __VA_ARGS__)
+#define LOGW(...) HOST_LOG("W", __VA_ARGS__)
+#define LOGE(...) HOST_LOG("E", __VA_ARGS__)
+#define LOGF(...) HOST_LOG("F", __VA_ARGS__)
+#endif
 
 #else
 
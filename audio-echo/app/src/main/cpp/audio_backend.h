@@ -0,0 +1,74 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NATIVE_AUDIO_AUDIO_BACKEND_H
+#define NATIVE_AUDIO_AUDIO_BACKEND_H
+
+#include <cstdint>
+#include "audio_common.h"
+
+/*
+ * AudioBackend: the device end of AudioRecorder and AudioPlayer.
+ *
+ * It is modeled after the OpenSL ES simple buffer queue: the caller enqueues
+ * its buffers, the device fills (recording) or drains (playing) them in
+ * order and calls back once for every buffer it is done with. Recorder and
+ * player only talk to the device through this interface, so the same
+ * buffer handling runs on OpenSL ES or on the simulated device of
+ * audio_backend_sim.h.
+ */
+class AudioBackend {
+ public:
+  typedef void (*BufferCallback)(void *ctx);
+
+  virtual ~AudioBackend() {}
+
+  virtual bool Enqueue(void *buf, uint32_t size) = 0;
+  virtual void Clear(void) = 0;
+  virtual bool Start(void) = 0;
+  virtual bool Stop(void) = 0;
+  virtual bool IsRunning(void) = 0;
+
+  // time base of the buffer callbacks, in micro seconds
+  virtual uint64_t GetTicks(void) { return GetSystemTicks(); }
+
+  void RegisterCallback(BufferCallback cb, void *ctx) {
+    callback_ = cb;
+    ctx_ = ctx;
+  }
+
+ protected:
+  AudioBackend() : callback_(nullptr), ctx_(nullptr) {}
+
+  // one device buffer is done
+  void BufferDone(void) {
+    if (callback_) callback_(ctx_);
+  }
+
+ private:
+  BufferCallback callback_;
+  void *ctx_;
+};
+
+/*
+ * OpenSL ES buffer queue devices, see audio_backend_sl.cpp
+ */
+AudioBackend *CreateSLPlayerBackend(SampleFormat *sampleFormat,
+                                    SLEngineItf slEngine);
+AudioBackend *CreateSLRecorderBackend(SampleFormat *sampleFormat,
+                                      SLEngineItf slEngine);
+
+#endif  // NATIVE_AUDIO_AUDIO_BACKEND_H
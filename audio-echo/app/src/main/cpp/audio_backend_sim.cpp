@@ -0,0 +1,248 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "audio_backend_sim.h"
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+static const uint64_t kNoEvent = UINT64_MAX;
+
+SimAudioBackend::SimAudioBackend(SimAudioClock *clock, Direction direction,
+                                 const SampleFormat *sampleFormat,
+                                 const char *pcmFile)
+    : clock_(clock),
+      direction_(direction),
+      pcmFile_(nullptr),
+      running_(false),
+      nextPeriod_(0),
+      bufCount_(0),
+      xrunCount_(0),
+      maxQueueDepth_(0) {
+  assert(clock_ && sampleFormat);
+  periodBytes_ = sampleFormat->framesPerBuf_ * sampleFormat->channels_ *
+                 (sampleFormat->pcmFormat_ >> 3);
+  if (pcmFile) {
+    pcmFile_ = fopen(pcmFile, direction_ == SIM_RECORD ? "rb" : "wb");
+    if (!pcmFile_) {
+      LOGE("====failed to open %s for the simulated device", pcmFile);
+    }
+  }
+  clock_->Attach(this);
+}
+
+SimAudioBackend::~SimAudioBackend() {
+  clock_->Detach(this);
+  if (pcmFile_) fclose(pcmFile_);
+}
+
+bool SimAudioBackend::Enqueue(void *buf, uint32_t size) {
+  if (queue_.size() >= DEVICE_SHADOW_BUFFER_QUEUE_LEN) {
+    return false;
+  }
+  queue_.push_back({static_cast<uint8_t *>(buf), size, 0});
+  return true;
+}
+
+void SimAudioBackend::Clear(void) {
+  queue_.clear();
+  doneAt_.clear();
+}
+
+/*
+ * A recording device hands out its first buffer one period after starting,
+ * a playing device takes its first buffer right away
+ */
+bool SimAudioBackend::Start(void) {
+  if (running_) return true;
+  running_ = true;
+  nextPeriod_ = clock_->Now();
+  if (direction_ == SIM_RECORD) nextPeriod_ += clock_->PeriodInUs();
+  return true;
+}
+
+bool SimAudioBackend::Stop(void) {
+  running_ = false;
+  return true;
+}
+
+bool SimAudioBackend::IsRunning(void) { return running_; }
+
+uint64_t SimAudioBackend::GetTicks(void) { return clock_->Now(); }
+
+uint64_t SimAudioBackend::nextEventTime(void) const {
+  if (!running_) return kNoEvent;
+  if (!doneAt_.empty() && doneAt_.front() < nextPeriod_) {
+    return doneAt_.front();
+  }
+  return nextPeriod_;
+}
+
+void SimAudioBackend::RunEvent(void) {
+  if (!doneAt_.empty() && doneAt_.front() < nextPeriod_) {
+    doneAt_.pop_front();
+    BufferDone();
+    return;
+  }
+  if (direction_ == SIM_RECORD) {
+    RecordPeriod();
+  } else {
+    PlayPeriod();
+  }
+  nextPeriod_ += clock_->PeriodInUs();
+}
+
+void SimAudioBackend::RecordPeriod(void) {
+  uint64_t now = clock_->Now();
+  maxQueueDepth_ =
+      std::max(maxQueueDepth_, static_cast<uint32_t>(queue_.size()));
+  if (queue_.empty()) {
+    xrunCount_++;
+    return;
+  }
+
+  QueuedBuf &cur = queue_.front();
+  size_t size = 0;
+  if (pcmFile_) size = fread(cur.buf_, 1, cur.size_, pcmFile_);
+  memset(cur.buf_ + size, 0, cur.size_ - size);
+  clock_->Captured(cur.buf_, now - clock_->PeriodInUs());
+  FinishBuf(now);
+}
+
+void SimAudioBackend::PlayPeriod(void) {
+  uint64_t now = clock_->Now();
+  uint64_t periodInUs = clock_->PeriodInUs();
+  maxQueueDepth_ =
+      std::max(maxQueueDepth_, static_cast<uint32_t>(queue_.size()));
+
+  uint32_t played = 0;
+  while (played < periodBytes_ && !queue_.empty()) {
+    QueuedBuf &cur = queue_.front();
+    uint64_t offsetInUs = periodInUs * played / periodBytes_;
+    if (!cur.played_) clock_->Played(cur.buf_, now + offsetInUs);
+
+    uint32_t bytes = std::min(periodBytes_ - played, cur.size_ - cur.played_);
+    if (pcmFile_) fwrite(cur.buf_ + cur.played_, 1, bytes, pcmFile_);
+    cur.played_ += bytes;
+    played += bytes;
+    if (cur.played_ == cur.size_) {
+      FinishBuf(now + periodInUs * played / periodBytes_);
+    }
+  }
+  if (played < periodBytes_) xrunCount_++;
+}
+
+/*
+ * The buffer at the head of the queue is done at doneTime; its callback is
+ * late by the scheduling noise, but stays in order
+ */
+void SimAudioBackend::FinishBuf(uint64_t doneTime) {
+  queue_.pop_front();
+  bufCount_++;
+  doneTime += clock_->CallbackDelay();
+  if (!doneAt_.empty()) doneTime = std::max(doneTime, doneAt_.back());
+  doneAt_.push_back(doneTime);
+}
+
+/**
+ * Constructor for SimAudioClock
+ * @param sampleRate in milliHz
+ * @param framesPerBuf frames the devices handle every period
+ * @param seed for the scheduling noise
+ */
+SimAudioClock::SimAudioClock(uint32_t sampleRate, uint32_t framesPerBuf,
+                             uint32_t seed)
+    : now_(0),
+      random_(seed),
+      maxJitterUs_(0),
+      stallUs_(0),
+      stallProbability_(0.0f),
+      latencyCount_(0),
+      latencySum_(0),
+      minLatency_(UINT64_MAX),
+      maxLatency_(0) {
+  assert(sampleRate);
+  periodInUs_ = static_cast<uint64_t>(framesPerBuf) * 1000000 * 1000 /
+                sampleRate;
+}
+
+void SimAudioClock::SetJitter(uint32_t maxJitterUs, uint32_t stallUs,
+                              float stallProbability) {
+  maxJitterUs_ = maxJitterUs;
+  stallUs_ = stallUs;
+  stallProbability_ = stallProbability;
+}
+
+bool SimAudioClock::Step(uint64_t endTime) {
+  SimAudioBackend *next = nullptr;
+  uint64_t nextTime = kNoEvent;
+  for (SimAudioBackend *backend : backends_) {
+    uint64_t time = backend->nextEventTime();
+    if (time < nextTime) {
+      nextTime = time;
+      next = backend;
+    }
+  }
+  if (!next || nextTime > endTime) return false;
+
+  now_ = std::max(now_, nextTime);
+  next->RunEvent();
+  return true;
+}
+
+void SimAudioClock::Run(uint64_t durationInUs) {
+  uint64_t endTime = now_ + durationInUs;
+  while (Step(endTime)) {
+  }
+  now_ = endTime;
+}
+
+void SimAudioClock::Attach(SimAudioBackend *backend) {
+  backends_.push_back(backend);
+}
+
+void SimAudioClock::Detach(SimAudioBackend *backend) {
+  backends_.erase(std::remove(backends_.begin(), backends_.end(), backend),
+                  backends_.end());
+}
+
+uint64_t SimAudioClock::CallbackDelay(void) {
+  uint64_t delay = 0;
+  if (maxJitterUs_) {
+    delay = std::uniform_int_distribution<uint32_t>(0, maxJitterUs_)(random_);
+  }
+  if (stallProbability_ > 0.0f &&
+      std::uniform_real_distribution<float>(0.0f, 1.0f)(random_) <
+          stallProbability_) {
+    delay += stallUs_;
+  }
+  return delay;
+}
+
+void SimAudioClock::Captured(const void *buf, uint64_t time) {
+  captureTime_[buf] = time;
+}
+
+void SimAudioClock::Played(const void *buf, uint64_t time) {
+  auto it = captureTime_.find(buf);
+  if (it == captureTime_.end()) return;  // silence made up by the player
+
+  uint64_t latency = time - it->second;
+  captureTime_.erase(it);
+  latencyCount_++;
+  latencySum_ += latency;
+  minLatency_ = std::min(minLatency_, latency);
+  maxLatency_ = std::max(maxLatency_, latency);
+}
@@ -0,0 +1,157 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NATIVE_AUDIO_AUDIO_BACKEND_SIM_H
+#define NATIVE_AUDIO_AUDIO_BACKEND_SIM_H
+
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <random>
+#include <unordered_map>
+#include <vector>
+#include "audio_backend.h"
+
+class SimAudioClock;
+
+/*
+ * SimAudioBackend: a buffer queue device ticked by a SimAudioClock instead
+ * of audio hardware.
+ *
+ * Every period:
+ *   - a recording device fills the buffer at the head of its queue with
+ *     the period just captured, read from a raw PCM file (silence without
+ *     a file or past its end);
+ *   - a playing device plays the next period worth of frames from its
+ *     queue, writing them to a raw PCM file (or dropping them without a
+ *     file). Buffers may be shorter or longer than a period.
+ * Running out of queued buffers is an overrun (recording) or an underrun
+ * (playing). The callback for a finished buffer comes a scheduling delay
+ * later, drawn by the clock, but never out of order.
+ */
+class SimAudioBackend : public AudioBackend {
+ public:
+  enum Direction { SIM_RECORD, SIM_PLAY };
+
+  explicit SimAudioBackend(SimAudioClock *clock, Direction direction,
+                           const SampleFormat *sampleFormat,
+                           const char *pcmFile);
+  ~SimAudioBackend();
+
+  bool Enqueue(void *buf, uint32_t size) override;
+  void Clear(void) override;
+  bool Start(void) override;
+  bool Stop(void) override;
+  bool IsRunning(void) override;
+  uint64_t GetTicks(void) override;
+
+  uint32_t bufCount(void) const { return bufCount_; }
+  uint32_t xrunCount(void) const { return xrunCount_; }
+  uint32_t maxQueueDepth(void) const { return maxQueueDepth_; }
+
+ private:
+  friend class SimAudioClock;
+
+  // the next event of this device, UINT64_MAX when there is none
+  uint64_t nextEventTime(void) const;
+  void RunEvent(void);
+  void RecordPeriod(void);
+  void PlayPeriod(void);
+  void FinishBuf(uint64_t doneTime);
+
+  struct QueuedBuf {
+    uint8_t *buf_;
+    uint32_t size_;
+    uint32_t played_;  // bytes already played
+  };
+
+  SimAudioClock *clock_;
+  Direction direction_;
+  FILE *pcmFile_;
+  uint32_t periodBytes_;
+  bool running_;
+  uint64_t nextPeriod_;
+  std::deque<QueuedBuf> queue_;   // enqueued, not taken by the device yet
+  std::deque<uint64_t> doneAt_;   // callback time of every finished buffer
+
+  uint32_t bufCount_;
+  uint32_t xrunCount_;
+  uint32_t maxQueueDepth_;
+};
+
+/*
+ * SimAudioClock: virtual time for a set of SimAudioBackends, in micro
+ * seconds. Events run one at a time on the calling thread, so a simulated
+ * session is deterministic for a given seed.
+ *
+ * It also matches recorded buffers with the moment they are played: the
+ * echo path hands the very same buffer from recorder to player, so the
+ * end-to-end latency of a buffer is its play time minus its capture time.
+ */
+class SimAudioClock {
+ public:
+  explicit SimAudioClock(uint32_t sampleRate, uint32_t framesPerBuf,
+                         uint32_t seed);
+
+  /*
+   * Callback delay injected for every buffer: uniform in [0, maxJitterUs],
+   * plus stallUs with stallProbability to model a descheduled audio thread
+   */
+  void SetJitter(uint32_t maxJitterUs, uint32_t stallUs,
+                 float stallProbability);
+
+  uint64_t Now(void) const { return now_; }
+  uint64_t PeriodInUs(void) const { return periodInUs_; }
+
+  // run the next event due no later than endTime, false if there is none
+  bool Step(uint64_t endTime);
+  void Run(uint64_t durationInUs);
+
+  uint32_t latencyCount(void) const { return latencyCount_; }
+  uint64_t minLatency(void) const {
+    return latencyCount_ ? minLatency_ : 0;
+  }
+  uint64_t maxLatency(void) const { return maxLatency_; }
+  uint64_t avgLatency(void) const {
+    return latencyCount_ ? latencySum_ / latencyCount_ : 0;
+  }
+
+ private:
+  friend class SimAudioBackend;
+
+  void Attach(SimAudioBackend *backend);
+  void Detach(SimAudioBackend *backend);
+  uint64_t CallbackDelay(void);
+  void Captured(const void *buf, uint64_t time);
+  void Played(const void *buf, uint64_t time);
+
+  uint64_t now_;
+  uint64_t periodInUs_;
+  std::vector<SimAudioBackend *> backends_;
+
+  std::mt19937 random_;
+  uint32_t maxJitterUs_;
+  uint32_t stallUs_;
+  float stallProbability_;
+
+  std::unordered_map<const void *, uint64_t> captureTime_;
+  uint32_t latencyCount_;
+  uint64_t latencySum_;
+  uint64_t minLatency_;
+  uint64_t maxLatency_;
+};
+
+#endif  // NATIVE_AUDIO_AUDIO_BACKEND_SIM_H
@@ -0,0 +1,271 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "audio_backend.h"
+
+/*
+ * SLPlayerBackend: OpenSL ES fast path buffer queue player
+ */
+class SLPlayerBackend : public AudioBackend {
+  SLObjectItf outputMixObjectItf_;
+  SLObjectItf playerObjectItf_;
+  SLPlayItf playItf_;
+  SLAndroidSimpleBufferQueueItf playBufferQueueItf_;
+
+  /*
+   * Called by OpenSL SimpleBufferQueue for every audio buffer played
+   */
+  static void bqPlayerCallback(SLAndroidSimpleBufferQueueItf bq, void *ctx) {
+    static_cast<SLPlayerBackend *>(ctx)->BufferDone();
+  }
+
+ public:
+  explicit SLPlayerBackend(SampleFormat *sampleFormat, SLEngineItf slEngine);
+  ~SLPlayerBackend();
+  bool Enqueue(void *buf, uint32_t size) override;
+  void Clear(void) override;
+  bool Start(void) override;
+  bool Stop(void) override;
+  bool IsRunning(void) override;
+};
+
+SLPlayerBackend::SLPlayerBackend(SampleFormat *sampleFormat,
+                                 SLEngineItf slEngine)
+    : outputMixObjectItf_(NULL), playerObjectItf_(NULL) {
+  SLresult result;
+  result = (*slEngine)
+               ->CreateOutputMix(slEngine, &outputMixObjectItf_, 0, NULL, NULL);
+  SLASSERT(result);
+
+  // realize the output mix
+  result =
+      (*outputMixObjectItf_)->Realize(outputMixObjectItf_, SL_BOOLEAN_FALSE);
+  SLASSERT(result);
+
+  // configure audio source
+  SLDataLocator_AndroidSimpleBufferQueue loc_bufq = {
+      SL_DATALOCATOR_ANDROIDSIMPLEBUFFERQUEUE, DEVICE_SHADOW_BUFFER_QUEUE_LEN};
+
+  SLAndroidDataFormat_PCM_EX format_pcm;
+  ConvertToSLSampleFormat(&format_pcm, sampleFormat);
+  SLDataSource audioSrc = {&loc_bufq, &format_pcm};
+
+  // configure audio sink
+  SLDataLocator_OutputMix loc_outmix = {SL_DATALOCATOR_OUTPUTMIX,
+                                        outputMixObjectItf_};
+  SLDataSink audioSnk = {&loc_outmix, NULL};
+  /*
+   * create fast path audio player: SL_IID_BUFFERQUEUE and SL_IID_VOLUME
+   * and other non-signal processing interfaces are ok.
+   */
+  SLInterfaceID ids[2] = {SL_IID_BUFFERQUEUE, SL_IID_VOLUME};
+  SLboolean req[2] = {SL_BOOLEAN_TRUE, SL_BOOLEAN_TRUE};
+  result = (*slEngine)->CreateAudioPlayer(
+      slEngine, &playerObjectItf_, &audioSrc, &audioSnk,
+      sizeof(ids) / sizeof(ids[0]), ids, req);
+  SLASSERT(result);
+
+  // realize the player
+  result = (*playerObjectItf_)->Realize(playerObjectItf_, SL_BOOLEAN_FALSE);
+  SLASSERT(result);
+
+  // get the play interface
+  result = (*playerObjectItf_)
+               ->GetInterface(playerObjectItf_, SL_IID_PLAY, &playItf_);
+  SLASSERT(result);
+
+  // get the buffer queue interface
+  result = (*playerObjectItf_)
+               ->GetInterface(playerObjectItf_, SL_IID_BUFFERQUEUE,
+                              &playBufferQueueItf_);
+  SLASSERT(result);
+
+  // register callback on the buffer queue
+  result = (*playBufferQueueItf_)
+               ->RegisterCallback(playBufferQueueItf_, bqPlayerCallback, this);
+  SLASSERT(result);
+
+  result = (*playItf_)->SetPlayState(playItf_, SL_PLAYSTATE_STOPPED);
+  SLASSERT(result);
+}
+
+SLPlayerBackend::~SLPlayerBackend() {
+  // destroy buffer queue audio player object, and invalidate all associated
+  // interfaces
+  if (playerObjectItf_ != NULL) {
+    (*playerObjectItf_)->Destroy(playerObjectItf_);
+  }
+
+  // destroy output mix object, and invalidate all associated interfaces
+  if (outputMixObjectItf_) {
+    (*outputMixObjectItf_)->Destroy(outputMixObjectItf_);
+  }
+}
+
+bool SLPlayerBackend::Enqueue(void *buf, uint32_t size) {
+  SLresult result =
+      (*playBufferQueueItf_)->Enqueue(playBufferQueueItf_, buf, size);
+  return result == SL_RESULT_SUCCESS;
+}
+
+void SLPlayerBackend::Clear(void) {
+  (*playBufferQueueItf_)->Clear(playBufferQueueItf_);
+}
+
+bool SLPlayerBackend::Start(void) {
+  SLresult result = (*playItf_)->SetPlayState(playItf_, SL_PLAYSTATE_PLAYING);
+  return result == SL_RESULT_SUCCESS;
+}
+
+bool SLPlayerBackend::Stop(void) {
+  SLresult result = (*playItf_)->SetPlayState(playItf_, SL_PLAYSTATE_STOPPED);
+  return result == SL_RESULT_SUCCESS;
+}
+
+bool SLPlayerBackend::IsRunning(void) {
+  SLuint32 state;
+  SLresult result = (*playItf_)->GetPlayState(playItf_, &state);
+  SLASSERT(result);
+  return result == SL_RESULT_SUCCESS && state == SL_PLAYSTATE_PLAYING;
+}
+
+/*
+ * SLRecorderBackend: OpenSL ES buffer queue recorder on the default input
+ */
+class SLRecorderBackend : public AudioBackend {
+  SLObjectItf recObjectItf_;
+  SLRecordItf recItf_;
+  SLAndroidSimpleBufferQueueItf recBufQueueItf_;
+
+  /*
+   * bqRecorderCallback(): called for every buffer is full
+   */
+  static void bqRecorderCallback(SLAndroidSimpleBufferQueueItf bq,
+                                 void *ctx) {
+    static_cast<SLRecorderBackend *>(ctx)->BufferDone();
+  }
+
+ public:
+  explicit SLRecorderBackend(SampleFormat *sampleFormat,
+                             SLEngineItf slEngine);
+  ~SLRecorderBackend();
+  bool Enqueue(void *buf, uint32_t size) override;
+  void Clear(void) override;
+  bool Start(void) override;
+  bool Stop(void) override;
+  bool IsRunning(void) override;
+};
+
+SLRecorderBackend::SLRecorderBackend(SampleFormat *sampleFormat,
+                                     SLEngineItf slEngine)
+    : recObjectItf_(NULL) {
+  SLresult result;
+  SLAndroidDataFormat_PCM_EX format_pcm;
+  ConvertToSLSampleFormat(&format_pcm, sampleFormat);
+
+  // configure audio source
+  SLDataLocator_IODevice loc_dev = {SL_DATALOCATOR_IODEVICE,
+                                    SL_IODEVICE_AUDIOINPUT,
+                                    SL_DEFAULTDEVICEID_AUDIOINPUT, NULL};
+  SLDataSource audioSrc = {&loc_dev, NULL};
+
+  // configure audio sink
+  SLDataLocator_AndroidSimpleBufferQueue loc_bq = {
+      SL_DATALOCATOR_ANDROIDSIMPLEBUFFERQUEUE, DEVICE_SHADOW_BUFFER_QUEUE_LEN};
+
+  SLDataSink audioSnk = {&loc_bq, &format_pcm};
+
+  // create audio recorder
+  // (requires the RECORD_AUDIO permission)
+  const SLInterfaceID id[2] = {SL_IID_ANDROIDSIMPLEBUFFERQUEUE,
+                               SL_IID_ANDROIDCONFIGURATION};
+  const SLboolean req[2] = {SL_BOOLEAN_TRUE, SL_BOOLEAN_TRUE};
+  result = (*slEngine)->CreateAudioRecorder(
+      slEngine, &recObjectItf_, &audioSrc, &audioSnk,
+      sizeof(id) / sizeof(id[0]), id, req);
+  SLASSERT(result);
+
+  // Configure the voice recognition preset which has no
+  // signal processing for lower latency.
+  SLAndroidConfigurationItf inputConfig;
+  result = (*recObjectItf_)
+               ->GetInterface(recObjectItf_, SL_IID_ANDROIDCONFIGURATION,
+                              &inputConfig);
+  if (SL_RESULT_SUCCESS == result) {
+    SLuint32 presetValue = SL_ANDROID_RECORDING_PRESET_VOICE_RECOGNITION;
+    (*inputConfig)
+        ->SetConfiguration(inputConfig, SL_ANDROID_KEY_RECORDING_PRESET,
+                           &presetValue, sizeof(SLuint32));
+  }
+  result = (*recObjectItf_)->Realize(recObjectItf_, SL_BOOLEAN_FALSE);
+  SLASSERT(result);
+  result =
+      (*recObjectItf_)->GetInterface(recObjectItf_, SL_IID_RECORD, &recItf_);
+  SLASSERT(result);
+
+  result = (*recObjectItf_)
+               ->GetInterface(recObjectItf_, SL_IID_ANDROIDSIMPLEBUFFERQUEUE,
+                              &recBufQueueItf_);
+  SLASSERT(result);
+
+  result = (*recBufQueueItf_)
+               ->RegisterCallback(recBufQueueItf_, bqRecorderCallback, this);
+  SLASSERT(result);
+}
+
+SLRecorderBackend::~SLRecorderBackend() {
+  // destroy audio recorder object, and invalidate all associated interfaces
+  if (recObjectItf_ != NULL) {
+    (*recObjectItf_)->Destroy(recObjectItf_);
+  }
+}
+
+bool SLRecorderBackend::Enqueue(void *buf, uint32_t size) {
+  SLresult result = (*recBufQueueItf_)->Enqueue(recBufQueueItf_, buf, size);
+  return result == SL_RESULT_SUCCESS;
+}
+
+void SLRecorderBackend::Clear(void) {
+  SLresult result = (*recBufQueueItf_)->Clear(recBufQueueItf_);
+  SLASSERT(result);
+}
+
+bool SLRecorderBackend::Start(void) {
+  SLresult result =
+      (*recItf_)->SetRecordState(recItf_, SL_RECORDSTATE_RECORDING);
+  return result == SL_RESULT_SUCCESS;
+}
+
+bool SLRecorderBackend::Stop(void) {
+  SLresult result = (*recItf_)->SetRecordState(recItf_, SL_RECORDSTATE_STOPPED);
+  return result == SL_RESULT_SUCCESS;
+}
+
+bool SLRecorderBackend::IsRunning(void) {
+  SLuint32 curState;
+  SLresult result = (*recItf_)->GetRecordState(recItf_, &curState);
+  SLASSERT(result);
+  return result == SL_RESULT_SUCCESS && curState != SL_RECORDSTATE_STOPPED;
+}
+
+AudioBackend *CreateSLPlayerBackend(SampleFormat *sampleFormat,
+                                    SLEngineItf slEngine) {
+  return new SLPlayerBackend(sampleFormat, slEngine);
+}
+
+AudioBackend *CreateSLRecorderBackend(SampleFormat *sampleFormat,
+                                      SLEngineItf slEngine) {
+  return new SLRecorderBackend(sampleFormat, slEngine);
+}
@@ -36,6 +36,21 @@
 #define PLAY_KICKSTART_BUFFER_COUNT 3
 #define DEVICE_SHADOW_BUFFER_QUEUE_LEN 4
 #define BUF_COUNT 16
+#define BUF_COUNT_MAX 64
+
+/*
+ * Adaptive jitter buffer of the player: depth range in buffers, and the
+ * underruns per player callback it tolerates before queuing deeper
+ */
+#define PLAY_MIN_BUFFER_DEPTH 2
+#define PLAY_MAX_BUFFER_DEPTH 8
+#define PLAY_MAX_UNDERRUN_RATE 0.002f
+
+/*
+ * Binary trace of the audio callbacks, see debug_utils.h; decode it with
+ * audio-echo/tools/trace_decode.cpp. Written whenever the engine runs.
+ */
+#define AUDIO_TRACE_FILE "/sdcard/data/audio_echo.trace"
 
 struct SampleFormat {
   uint32_t sampleRate_;
@@ -71,9 +86,4 @@ __inline__ uint64_t GetSystemTicks(void) {
 #define ENGINE_SERVICE_MSG_RECORDED_AUDIO_AVAILABLE 3
 typedef bool (*ENGINE_CALLBACK)(void* pCTX, uint32_t msg, void* pData);
 
-/*
- * flag to enable file dumping
- */
-// #define ENABLE_LOG  1
-
 #endif  // NATIVE_AUDIO_AUDIO_COMMON_H
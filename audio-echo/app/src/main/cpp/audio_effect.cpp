@@ -15,15 +15,40 @@
  */
 #include "audio_effect.h"
 #include "audio_common.h"
-#include <climits>
+#include <algorithm>
 #include <cstring>
 
 /*
  * Mixing Audio in integer domain to avoid FP calculation
  *   (FG * ( MixFactor * 16 ) + BG * ( (1.0f-MixFactor) * 16 )) / 16
  */
-static const int32_t kFloatToIntMapFactor = 128;
+static const int32_t kFloatToIntMapFactor = kDelayMixScale;
 static const uint32_t kMsPerSec = 1000;
+
+/*
+ * Longest delay the delay line is sized for: the UI goes up to 1 second.
+ * Buffers are mixed in chunks of at most kChunkFrames, the delay line has
+ * that much room on top of the longest delay so the read tap and the write
+ * head of one chunk never overlap.
+ */
+static const size_t kMaxDelayTimeInMs = 1000;
+static const size_t kChunkFrames = 256;
+
+static const int kDelayShift = 32;
+static const uint64_t kFeedbackMask = 0xFFFFFFFF;
+static const uint64_t kDelayMask = kFeedbackMask << kDelayShift;
+
+static inline size_t ParamsDelayFrames(uint64_t params) {
+  return static_cast<size_t>(params >> kDelayShift);
+}
+static inline int32_t ParamsFeedback(uint64_t params) {
+  return static_cast<int32_t>(params & kFeedbackMask);
+}
+// fixed point feedback factor of a decay weight in [0.0, 1.0], rounded
+static inline int32_t FeedbackFactor(float weight) {
+  return static_cast<int32_t>(weight * kFloatToIntMapFactor + 0.5f);
+}
+
 /**
  * Constructor for AudioDelay
  * @param sampleRate
@@ -36,68 +61,69 @@ AudioDelay::AudioDelay(int32_t sampleRate, int32_t channelCount,
                        float decayWeight)
     : AudioFormat(sampleRate, channelCount, format),
       delayTime_(delayTimeInMs),
-      decayWeight_(decayWeight) {
-  feedbackFactor_ = static_cast<int32_t>(decayWeight_ * kFloatToIntMapFactor);
-  liveAudioFactor_ = kFloatToIntMapFactor - feedbackFactor_;
-  allocateBuffer();
+      decayWeight_(decayWeight),
+      kernels_(GetDelayMixKernels()) {
+  uint32_t bytePerSample = format_ / 8;
+  assert(bytePerSample == sizeof(int16_t) || bytePerSample == sizeof(float));
+  size_t bytePerFrame = channelCount_ * bytePerSample;
+
+  maxDelayFrames_ = getDelayFrames(kMaxDelayTimeInMs);
+  capacityFrames_ = maxDelayFrames_ + kChunkFrames;
+  buffer_ = new uint8_t[capacityFrames_ * bytePerFrame];
+  memset(buffer_, 0, capacityFrames_ * bytePerFrame);
+  scratch_ = new uint8_t[4 * kChunkFrames * bytePerFrame];
+
+  if (delayTime_ > kMaxDelayTimeInMs) delayTime_ = kMaxDelayTimeInMs;
+  if (decayWeight_ < 0.0f) decayWeight_ = 0.0f;
+  if (decayWeight_ > 1.0f) decayWeight_ = 1.0f;
+  activeParams_ =
+      (static_cast<uint64_t>(getDelayFrames(delayTime_)) << kDelayShift) |
+      static_cast<uint64_t>(FeedbackFactor(decayWeight_));
+  params_.store(activeParams_, std::memory_order_release);
 }
 
 /**
  * Destructor
  */
 AudioDelay::~AudioDelay() {
-  if (buffer_) delete static_cast<uint8_t*>(buffer_);
+  delete[] static_cast<uint8_t*>(buffer_);
+  delete[] scratch_;
 }
 
 /**
- * Configure for delay time ( in miliseconds ), dynamically adjustable
- * @param delayTimeInMS in miliseconds
- * @return true if delay time is set successfully
+ * Convert delay time to frames of the delay line
  */
-bool AudioDelay::setDelayTime(size_t delayTimeInMS) {
-  if (delayTimeInMS == delayTime_) return true;
-
-  std::lock_guard<std::mutex> lock(lock_);
+size_t AudioDelay::getDelayFrames(size_t delayTimeInMs) const {
+  float floatDelayTime = (float)delayTimeInMs / kMsPerSec;
+  float fNumFrames = floatDelayTime * (float)sampleRate_ / kMsPerSec;
+  return static_cast<size_t>(fNumFrames + 0.5f);
+}
 
-  if (buffer_) {
-    delete static_cast<uint8_t*>(buffer_);
-    buffer_ = nullptr;
+/**
+ * Replace the bits in mask of the parameter word; the audio thread picks
+ * the new word up at its next buffer
+ */
+void AudioDelay::publishParams(uint64_t mask, uint64_t value) {
+  uint64_t params = params_.load(std::memory_order_relaxed);
+  while (!params_.compare_exchange_weak(params, (params & ~mask) | value,
+                                        std::memory_order_release,
+                                        std::memory_order_relaxed)) {
   }
-
-  delayTime_ = delayTimeInMS;
-  allocateBuffer();
-  return buffer_ != nullptr;
 }
 
 /**
- * Internal helper function to allocate buffer for the delay
- *  - calculate the buffer size for the delay time
- *  - allocate and zero out buffer (0 means silent audio)
- *  - configure bufSize_ to be size of audioFrames
+ * Configure for delay time ( in miliseconds ), dynamically adjustable
+ * @param delayTimeInMS in miliseconds
+ * @return true if delay time is set successfully
  */
-void AudioDelay::allocateBuffer(void) {
-  float floatDelayTime = (float)delayTime_ / kMsPerSec;
-  float fNumFrames = floatDelayTime * (float)sampleRate_ / kMsPerSec;
-  size_t sampleCount = static_cast<uint32_t>(fNumFrames + 0.5f) * channelCount_;
-
-  uint32_t bytePerSample = format_ / 8;
-  assert(bytePerSample <= 4 && bytePerSample);
-
-  uint32_t bytePerFrame = channelCount_ * bytePerSample;
-
-  // get bufCapacity in bytes
-  bufCapacity_ = sampleCount * bytePerSample;
-  bufCapacity_ =
-      ((bufCapacity_ + bytePerFrame - 1) / bytePerFrame) * bytePerFrame;
-
-  buffer_ = new uint8_t[bufCapacity_];
-  assert(buffer_);
-
-  memset(buffer_, 0, bufCapacity_);
-  curPos_ = 0;
+bool AudioDelay::setDelayTime(size_t delayTimeInMS) {
+  if (delayTimeInMS == delayTime_) return true;
+  if (delayTimeInMS > kMaxDelayTimeInMs) return false;
 
-  // bufSize_ is in Frames ( not samples, not bytes )
-  bufSize_ = bufCapacity_ / bytePerFrame;
+  delayTime_ = delayTimeInMS;
+  publishParams(kDelayMask, static_cast<uint64_t>(getDelayFrames(delayTime_))
+                                << kDelayShift);
+  return true;
 }
 
 size_t AudioDelay::getDelayTime(void) const { return delayTime_; }
@@ -111,60 +137,126 @@ size_t AudioDelay::getDelayTime(void) const { return delayTime_; }
  */
 void AudioDelay::setDecayWeight(float weight) {
   if (weight > 0.0f && weight < 1.0f) {
-    float feedback = (weight * kFloatToIntMapFactor + 0.5f);
-    feedbackFactor_ = static_cast<int32_t>(feedback);
-    liveAudioFactor_ = kFloatToIntMapFactor - feedbackFactor_;
+    publishParams(kFeedbackMask,
+                  static_cast<uint64_t>(FeedbackFactor(weight)));
+    decayWeight_ = weight;
   }
 }
 
 float AudioDelay::getDecayWeight(void) const { return decayWeight_; }
 
+/**
+ * mixChunk(): run the mixing kernel for one parameter set over frames,
+ * reading from the delay tap of params and writing to delayOut.
+ * No delay (or no feedback) bypasses the effect: live audio passes thru
+ * and silence goes into the delay line
+ */
+template <typename T, typename F>
+void AudioDelay::mixChunk(uint64_t params, T* live, T* delayOut,
+                          size_t frames, F mixer) {
+  size_t delayFrames = ParamsDelayFrames(params);
+  int32_t feedbackFactor = ParamsFeedback(params);
+  if (feedbackFactor == 0 || delayFrames == 0) {
+    memset(delayOut, 0, frames * channelCount_ * sizeof(T));
+    return;
+  }
+  size_t readPos =
+      (writePos_ + capacityFrames_ - delayFrames) % capacityFrames_;
+  const T* delayIn = &static_cast<T*>(buffer_)[readPos * channelCount_];
+  mixer(live, delayIn, delayOut, static_cast<int32_t>(frames * channelCount_),
+        feedbackFactor);
+}
+
+/**
+ * Common body of the process() variants: walk the delay line in chunks
+ * that keep the read tap and the write head contiguous. When new parameters
+ * were published, the buffer is rendered with both the old and the new ones
+ * and crossfaded from old to new across the buffer.
+ */
+template <typename T, typename F>
+void AudioDelay::process(T* liveAudio, int32_t numFrames, F mixer) {
+  uint64_t prevParams = activeParams_;
+  activeParams_ = params_.load(std::memory_order_acquire);
+  bool crossfade = (prevParams != activeParams_);
+
+  size_t chunkSamples = kChunkFrames * channelCount_;
+  T* liveOld = reinterpret_cast<T*>(scratch_);
+  T* delayOld = liveOld + chunkSamples;
+  T* liveNew = delayOld + chunkSamples;
+  T* delayNew = liveNew + chunkSamples;
+
+  size_t frame = 0;
+  while (frame < static_cast<size_t>(numFrames)) {
+    // limit the chunk so both read taps and the write head are contiguous
+    size_t frames = std::min(numFrames - frame, kChunkFrames);
+    frames = std::min(frames, capacityFrames_ - writePos_);
+    for (uint64_t params : {prevParams, activeParams_}) {
+      size_t delayFrames = ParamsDelayFrames(params);
+      if (!delayFrames) continue;
+      size_t readPos =
+          (writePos_ + capacityFrames_ - delayFrames) % capacityFrames_;
+      frames = std::min(frames, capacityFrames_ - readPos);
+      frames = std::min(frames, delayFrames);
+    }
+
+    T* live = liveAudio + frame * channelCount_;
+    T* delayOut = &static_cast<T*>(buffer_)[writePos_ * channelCount_];
+    size_t samples = frames * channelCount_;
+    if (!crossfade) {
+      mixChunk(activeParams_, live, delayOut, frames, mixer);
+    } else {
+      memcpy(liveOld, live, samples * sizeof(T));
+      memcpy(liveNew, live, samples * sizeof(T));
+      mixChunk(prevParams, liveOld, delayOld, frames, mixer);
+      mixChunk(activeParams_, liveNew, delayNew, frames, mixer);
+      for (size_t idx = 0; idx < samples; idx++) {
+        float weight = static_cast<float>(frame + idx / channelCount_ + 1) /
+                       static_cast<float>(numFrames);
+        live[idx] = static_cast<T>(liveOld[idx] +
+                                   (liveNew[idx] - liveOld[idx]) * weight);
+        delayOut[idx] = static_cast<T>(
+            delayOld[idx] + (delayNew[idx] - delayOld[idx]) * weight);
+      }
+    }
+
+    writePos_ += frames;
+    if (writePos_ == capacityFrames_) writePos_ = 0;
+    frame += frames;
+  }
+}
+
 /**
  * process() filter live audio with "echo" effect:
  *   delay time is run-time adjustable
  *   decay time could also be adjustable, but not used
  *   in this sample, hardcoded to .5
  *
+ * The mixing itself is done by the fastest kernel for this CPU
+ * (see audio_effect_kernels.h)
+ *
  * @param liveAudio is recorded audio stream
  * @param channelCount for liveAudio, must be 2 for stereo
  * @param numFrames is length of liveAudio in Frames ( not in byte )
  */
 void AudioDelay::process(int16_t* liveAudio, int32_t numFrames) {
-  if (feedbackFactor_ == 0 || bufSize_ < numFrames) {
-    return;
-  }
-
-  if (!lock_.try_lock()) {
-    return;
-  }
-
-  if (numFrames + curPos_ > bufSize_) {
-    curPos_ = 0;
-  }
-
-  // process every sample
-  int32_t sampleCount = channelCount_ * numFrames;
-  int16_t* samples = &static_cast<int16_t*>(buffer_)[curPos_ * channelCount_];
-  for (size_t idx = 0; idx < sampleCount; idx++) {
-#if 1
-    int32_t curSample =
-        (samples[idx] * feedbackFactor_ + liveAudio[idx] * liveAudioFactor_) /
-        kFloatToIntMapFactor;
-    if (curSample > SHRT_MAX)
-      curSample = SHRT_MAX;
-    else if (curSample < SHRT_MIN)
-      curSample = SHRT_MIN;
- 
-    liveAudio[idx] = samples[idx];
-    samples[idx] = static_cast<int16_t>(curSample);
-#else
-    // Pure delay
-    int16_t tmp = liveAudio[idx];
-    liveAudio[idx] = samples[idx];
-    samples[idx] = tmp;
-#endif
-  }
+  assert(format_ == SL_PCMSAMPLEFORMAT_FIXED_16);
+  process(liveAudio, numFrames,
+          [this](int16_t* live, const int16_t* delayIn, int16_t* delayOut,
+                 int32_t sampleCount, int32_t feedbackFactor) {
+            kernels_.mixI16_(live, delayIn, delayOut, sampleCount,
+                             feedbackFactor,
+                             kFloatToIntMapFactor - feedbackFactor);
+          });
+}
 
-  curPos_ += numFrames;
-  lock_.unlock();
+void AudioDelay::process(float* liveAudio, int32_t numFrames) {
+  assert(format_ == SL_PCMSAMPLEFORMAT_FIXED_32);
+  process(liveAudio, numFrames,
+          [this](float* live, const float* delayIn, float* delayOut,
+                 int32_t sampleCount, int32_t feedbackFactor) {
+            float feedback =
+                static_cast<float>(feedbackFactor) / kFloatToIntMapFactor;
+            kernels_.mixF32_(live, delayIn, delayOut, sampleCount, feedback,
+                             1.0f - feedback);
+          });
 }
@@ -20,7 +20,7 @@
 #include <SLES/OpenSLES_Android.h>
 #include <cstdint>
 #include <atomic>
-#include <mutex>
+#include "audio_effect_kernels.h"
 
 class AudioFormat {
  protected:
@@ -38,6 +38,13 @@ class AudioFormat {
  * An audio delay effect:
  *   - decay is for feedback(echo)weight
  *   - delay time is adjustable
+ *   - SL_PCMSAMPLEFORMAT_FIXED_16 streams go through process(int16_t*),
+ *     SL_PCMSAMPLEFORMAT_FIXED_32 (float) ones through process(float*)
+ *
+ * The delay line is allocated once for the longest delay supported.
+ * setDelayTime()/setDecayWeight() only publish a new parameter word;
+ * process() picks it up at the next buffer boundary and crossfades from
+ * the old parameters over that buffer, without locking or allocating.
  */
 class AudioDelay : public AudioFormat {
  public:
@@ -50,17 +57,31 @@ class AudioDelay : public AudioFormat {
   void setDecayWeight(float weight);
   float getDecayWeight(void) const;
   void process(int16_t *liveAudio, int32_t numFrames);
+  void process(float *liveAudio, int32_t numFrames);
 
  private:
+  // control thread side
   size_t delayTime_ = 0;
   float decayWeight_ = 0.5;
+
+  // parameter word: delay in frames (high 32 bits), feedback factor (low)
+  std::atomic<uint64_t> params_;
+
+  // audio thread side
+  uint64_t activeParams_;
   void *buffer_ = nullptr;
-  size_t bufCapacity_ = 0;
-  size_t bufSize_ = 0;
-  size_t curPos_ = 0;
-  std::mutex lock_;
-  int32_t feedbackFactor_;
-  int32_t liveAudioFactor_;
-  void allocateBuffer(void);
+  size_t maxDelayFrames_ = 0;
+  size_t capacityFrames_ = 0;  // delay line length, in frames
+  size_t writePos_ = 0;
+  uint8_t *scratch_ = nullptr;  // crossfade work buffers
+  const DelayMixKernels &kernels_;
+
+  size_t getDelayFrames(size_t delayTimeInMs) const;
+  void publishParams(uint64_t mask, uint64_t value);
+  template <typename T, typename F>
+  void process(T *liveAudio, int32_t numFrames, F mixer);
+  template <typename T, typename F>
+  void mixChunk(uint64_t params, T *live, T *delayOut, size_t frames,
+                F mixer);
 };
 #endif  // EFFECT_PROCESSOR_H
@@ -0,0 +1,451 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "audio_effect_chain.h"
+#include <algorithm>
+#include <cassert>
+#include <climits>
+#include <cmath>
+#include <cstring>
+
+/*
+ * Frames handled by one stage before moving on to the next tile: small
+ * enough for a tile of every buffer a stage touches to stay in L1
+ */
+static const int32_t kTileFrames = 64;
+static const float kPi = 3.14159265358979f;
+static const uint32_t kMsPerSec = 1000;
+static const float kInt16Scale = 32768.0f;
+
+struct AudioEffectChain::Node {
+  NodeFunc func_ = nullptr;  // nullptr for the chain input and mix nodes
+  std::vector<NodeId> inputs_;
+  std::vector<float> weights_;  // mix nodes
+  uint32_t consumers_ = 0;
+  int32_t stage_ = -1;
+
+  // gain, clamp limit or limiter threshold
+  float level_ = 1.0f;
+
+  // limiter
+  float release_ = 0.0f;
+  float envelope_ = 0.0f;
+
+  // biquad, transposed direct form II, state per channel
+  float b0_ = 1.0f, b1_ = 0.0f, b2_ = 0.0f, a1_ = 0.0f, a2_ = 0.0f;
+  std::vector<float> z1_, z2_;
+
+  // delay, the same feedback echo as AudioDelay
+  std::vector<float> delayLine_;
+  size_t delayFrames_ = 0;
+  size_t delayPos_ = 0;
+  float feedback_ = 0.0f;
+};
+
+/*
+ * A stage produces one buffer: it fills it from its source (nothing when it
+ * works in place on its input, a copy at split points, or a weighted sum of
+ * the inputs for mix nodes), then runs its fused in-place nodes.
+ */
+struct AudioEffectChain::Stage {
+  int32_t buffer_;
+  std::vector<int32_t> sources_;  // source buffers, empty when in place
+  std::vector<float> weights_;
+  std::vector<Node *> nodes_;
+};
+
+/**
+ * Constructor for AudioEffectChain
+ * @param sampleRate in milliHz, like AudioDelay
+ * @param channelCount interleaved channels of the audio
+ * @param format of the audio handed to process()
+ * @param maxFramesPerBlock longest buffer process() works on at once; longer
+ *        buffers are split
+ */
+AudioEffectChain::AudioEffectChain(int32_t sampleRate, int32_t channelCount,
+                                   SLuint32 format, int32_t maxFramesPerBlock)
+    : AudioFormat(sampleRate, channelCount, format),
+      maxFramesPerBlock_(maxFramesPerBlock) {
+  assert(maxFramesPerBlock_ > 0);
+  convertBuffer_.assign(maxFramesPerBlock_ * channelCount_, 0.0f);
+  // node 0 stands for the audio handed to process()
+  nodes_.emplace_back(new Node());
+}
+
+AudioEffectChain::~AudioEffectChain() {}
+
+AudioEffectChain::NodeId AudioEffectChain::addNode(
+    NodeFunc func, const std::vector<NodeId> &inputs) {
+  for (NodeId input : inputs) {
+    if (input < 0 || input >= static_cast<NodeId>(nodes_.size())) {
+      return kInvalidNode;
+    }
+  }
+  std::unique_ptr<Node> node(new Node());
+  node->func_ = func;
+  node->inputs_ = inputs;
+  nodes_.push_back(std::move(node));
+  output_ = kInvalidNode;  // graph changed, build() again
+  return static_cast<NodeId>(nodes_.size() - 1);
+}
+
+AudioEffectChain::NodeId AudioEffectChain::addGain(NodeId input, float gain) {
+  NodeId id = addNode(
+      [](Node *node, float *samples, int32_t frames, int32_t channelCount) {
+        int32_t count = frames * channelCount;
+        float gain = node->level_;
+        for (int32_t idx = 0; idx < count; idx++) {
+          samples[idx] *= gain;
+        }
+      },
+      {input});
+  if (id != kInvalidNode) nodes_[id]->level_ = gain;
+  return id;
+}
+
+/**
+ * Hard clip to [-limit, limit]
+ */
+AudioEffectChain::NodeId AudioEffectChain::addClamp(NodeId input,
+                                                    float limit) {
+  NodeId id = addNode(
+      [](Node *node, float *samples, int32_t frames, int32_t channelCount) {
+        int32_t count = frames * channelCount;
+        float limit = node->level_;
+        for (int32_t idx = 0; idx < count; idx++) {
+          samples[idx] = std::min(std::max(samples[idx], -limit), limit);
+        }
+      },
+      {input});
+  if (id != kInvalidNode) nodes_[id]->level_ = std::fabs(limit);
+  return id;
+}
+
+/**
+ * Peak limiter: instant attack, exponential release, channels linked
+ */
+AudioEffectChain::NodeId AudioEffectChain::addLimiter(NodeId input,
+                                                      float threshold,
+                                                      float releaseInMs) {
+  NodeId id = addNode(
+      [](Node *node, float *samples, int32_t frames, int32_t channelCount) {
+        float envelope = node->envelope_;
+        for (int32_t frame = 0; frame < frames; frame++) {
+          float *cur = samples + frame * channelCount;
+          float peak = 0.0f;
+          for (int32_t ch = 0; ch < channelCount; ch++) {
+            peak = std::max(peak, std::fabs(cur[ch]));
+          }
+          envelope = std::max(peak, envelope * node->release_);
+          if (envelope > node->level_) {
+            float gain = node->level_ / envelope;
+            for (int32_t ch = 0; ch < channelCount; ch++) {
+              cur[ch] *= gain;
+            }
+          }
+        }
+        node->envelope_ = envelope;
+      },
+      {input});
+  if (id != kInvalidNode) {
+    float releaseFrames = releaseInMs * sampleRate_ / kMsPerSec / kMsPerSec;
+    nodes_[id]->level_ = std::fabs(threshold);
+    nodes_[id]->release_ =
+        releaseFrames > 1.0f ? std::exp(-1.0f / releaseFrames) : 0.0f;
+  }
+  return id;
+}
+
+/**
+ * Biquad filter, coefficients from the RBJ audio EQ cookbook
+ * @param frequency cutoff / center frequency in Hz
+ * @param gainInDb only used by peaking and shelving filters
+ */
+AudioEffectChain::NodeId AudioEffectChain::addBiquad(NodeId input,
+                                                     BiquadType type,
+                                                     float frequency, float q,
+                                                     float gainInDb) {
+  NodeId id = addNode(
+      [](Node *node, float *samples, int32_t frames, int32_t channelCount) {
+        for (int32_t ch = 0; ch < channelCount; ch++) {
+          float z1 = node->z1_[ch], z2 = node->z2_[ch];
+          for (int32_t frame = 0; frame < frames; frame++) {
+            float x = samples[frame * channelCount + ch];
+            float y = node->b0_ * x + z1;
+            z1 = node->b1_ * x - node->a1_ * y + z2;
+            z2 = node->b2_ * x - node->a2_ * y;
+            samples[frame * channelCount + ch] = y;
+          }
+          node->z1_[ch] = z1;
+          node->z2_[ch] = z2;
+        }
+      },
+      {input});
+  if (id == kInvalidNode) return id;
+
+  float sampleRateInHz = static_cast<float>(sampleRate_) / kMsPerSec;
+  float w0 = 2.0f * kPi * frequency / sampleRateInHz;
+  float cosW0 = std::cos(w0);
+  float alpha = std::sin(w0) / (2.0f * q);
+  float A = std::pow(10.0f, gainInDb / 40.0f);
+  float sqrtA2Alpha = 2.0f * std::sqrt(A) * alpha;
+  float b0, b1, b2, a0, a1, a2;
+  switch (type) {
+    case BIQUAD_LOWPASS:
+      b0 = b2 = (1.0f - cosW0) / 2.0f;
+      b1 = 1.0f - cosW0;
+      a0 = 1.0f + alpha;
+      a1 = -2.0f * cosW0;
+      a2 = 1.0f - alpha;
+      break;
+    case BIQUAD_HIGHPASS:
+      b0 = b2 = (1.0f + cosW0) / 2.0f;
+      b1 = -(1.0f + cosW0);
+      a0 = 1.0f + alpha;
+      a1 = -2.0f * cosW0;
+      a2 = 1.0f - alpha;
+      break;
+    case BIQUAD_PEAKING:
+      b0 = 1.0f + alpha * A;
+      b1 = -2.0f * cosW0;
+      b2 = 1.0f - alpha * A;
+      a0 = 1.0f + alpha / A;
+      a1 = -2.0f * cosW0;
+      a2 = 1.0f - alpha / A;
+      break;
+    case BIQUAD_LOWSHELF:
+      b0 = A * ((A + 1.0f) - (A - 1.0f) * cosW0 + sqrtA2Alpha);
+      b1 = 2.0f * A * ((A - 1.0f) - (A + 1.0f) * cosW0);
+      b2 = A * ((A + 1.0f) - (A - 1.0f) * cosW0 - sqrtA2Alpha);
+      a0 = (A + 1.0f) + (A - 1.0f) * cosW0 + sqrtA2Alpha;
+      a1 = -2.0f * ((A - 1.0f) + (A + 1.0f) * cosW0);
+      a2 = (A + 1.0f) + (A - 1.0f) * cosW0 - sqrtA2Alpha;
+      break;
+    case BIQUAD_HIGHSHELF:
+    default:
+      b0 = A * ((A + 1.0f) + (A - 1.0f) * cosW0 + sqrtA2Alpha);
+      b1 = -2.0f * A * ((A - 1.0f) + (A + 1.0f) * cosW0);
+      b2 = A * ((A + 1.0f) + (A - 1.0f) * cosW0 - sqrtA2Alpha);
+      a0 = (A + 1.0f) - (A - 1.0f) * cosW0 + sqrtA2Alpha;
+      a1 = 2.0f * ((A - 1.0f) - (A + 1.0f) * cosW0);
+      a2 = (A + 1.0f) - (A - 1.0f) * cosW0 - sqrtA2Alpha;
+      break;
+  }
+  Node *node = nodes_[id].get();
+  node->b0_ = b0 / a0;
+  node->b1_ = b1 / a0;
+  node->b2_ = b2 / a0;
+  node->a1_ = a1 / a0;
+  node->a2_ = a2 / a0;
+  node->z1_.assign(channelCount_, 0.0f);
+  node->z2_.assign(channelCount_, 0.0f);
+  return id;
+}
+
+/**
+ * Feedback echo, see AudioDelay
+ */
+AudioEffectChain::NodeId AudioEffectChain::addDelay(NodeId input,
+                                                    size_t delayTimeInMs,
+                                                    float decayWeight) {
+  NodeId id = addNode(
+      [](Node *node, float *samples, int32_t frames, int32_t channelCount) {
+        float feedback = node->feedback_;
+        float liveWeight = 1.0f - feedback;
+        size_t pos = node->delayPos_;
+        for (int32_t frame = 0; frame < frames; frame++) {
+          float *cur = samples + frame * channelCount;
+          float *line = &node->delayLine_[pos * channelCount];
+          for (int32_t ch = 0; ch < channelCount; ch++) {
+            float delayed = line[ch];
+            line[ch] = delayed * feedback + cur[ch] * liveWeight;
+            cur[ch] = delayed;
+          }
+          if (++pos == node->delayFrames_) pos = 0;
+        }
+        node->delayPos_ = pos;
+      },
+      {input});
+  if (id == kInvalidNode) return id;
+
+  Node *node = nodes_[id].get();
+  float frames = static_cast<float>(delayTimeInMs) / kMsPerSec *
+                 static_cast<float>(sampleRate_) / kMsPerSec;
+  node->delayFrames_ = std::max(static_cast<size_t>(frames + 0.5f),
+                                static_cast<size_t>(1));
+  node->delayLine_.assign(node->delayFrames_ * channelCount_, 0.0f);
+  node->feedback_ = std::min(std::max(decayWeight, 0.0f), 1.0f);
+  return id;
+}
+
+/**
+ * Weighted sum of several nodes
+ */
+AudioEffectChain::NodeId AudioEffectChain::addMix(
+    const std::vector<NodeId> &inputs, const std::vector<float> &weights) {
+  if (inputs.empty() || inputs.size() != weights.size()) {
+    return kInvalidNode;
+  }
+  NodeId id = addNode(nullptr, inputs);
+  if (id != kInvalidNode) nodes_[id]->weights_ = weights;
+  return id;
+}
+
+/**
+ * build(): compile the nodes feeding output into the stage schedule and
+ * allocate all buffers. Must be called after the graph changes and before
+ * process(); it allocates, so do not call it from the audio callback.
+ */
+bool AudioEffectChain::build(NodeId output) {
+  if (output < 0 || output >= static_cast<NodeId>(nodes_.size())) {
+    return false;
+  }
+
+  // ids are in topological order: walk back from the output to find the
+  // live nodes, then count how many live nodes consume each one
+  std::vector<bool> live(nodes_.size(), false);
+  live[output] = true;
+  for (NodeId id = output; id > 0; id--) {
+    if (!live[id]) continue;
+    for (NodeId input : nodes_[id]->inputs_) live[input] = true;
+  }
+  for (auto &node : nodes_) {
+    node->consumers_ = 0;
+    node->stage_ = -1;
+  }
+  for (NodeId id = 1; id <= output; id++) {
+    if (!live[id]) continue;
+    for (NodeId input : nodes_[id]->inputs_) nodes_[input]->consumers_++;
+  }
+
+  // buffer 0 is the audio handed to process(); the chain input is the
+  // first stage, with nothing to do unless its only consumer fuses into it
+  schedule_.clear();
+  schedule_.push_back(Stage{0, {}, {}, {}});
+  nodes_[kChainInput]->stage_ = 0;
+
+  for (NodeId id = 1; id <= output; id++) {
+    if (!live[id]) continue;
+    Node *node = nodes_[id].get();
+
+    if (node->func_) {
+      // in-place node: fuse into the stage of its input when nothing else
+      // reads that input, otherwise start a new stage from a copy of it
+      Node *input = nodes_[node->inputs_[0]].get();
+      if (input->consumers_ == 1) {
+        node->stage_ = input->stage_;
+      } else {
+        int32_t buffer = static_cast<int32_t>(schedule_.size());
+        schedule_.push_back(
+            Stage{buffer, {schedule_[input->stage_].buffer_}, {1.0f}, {}});
+        node->stage_ = buffer;
+      }
+      schedule_[node->stage_].nodes_.push_back(node);
+    } else {
+      int32_t buffer = static_cast<int32_t>(schedule_.size());
+      Stage stage{buffer, {}, node->weights_, {}};
+      for (NodeId input : node->inputs_) {
+        stage.sources_.push_back(schedule_[nodes_[input]->stage_].buffer_);
+      }
+      schedule_.push_back(stage);
+      node->stage_ = buffer;
+    }
+  }
+
+  // every stage owns one buffer, stage 0 borrows the caller's
+  buffers_.assign(schedule_.size() * maxFramesPerBlock_ * channelCount_, 0.0f);
+  output_ = output;
+  return true;
+}
+
+/**
+ * Run the schedule over one block of at most maxFramesPerBlock_ frames,
+ * in place
+ */
+void AudioEffectChain::processBlock(float *block, int32_t numFrames) {
+  size_t slotSize = static_cast<size_t>(maxFramesPerBlock_) * channelCount_;
+  auto getBuffer = [&](int32_t buffer) -> float * {
+    return buffer ? &buffers_[buffer * slotSize] : block;
+  };
+
+  for (Stage &stage : schedule_) {
+    float *dst = getBuffer(stage.buffer_);
+    for (int32_t frame = 0; frame < numFrames; frame += kTileFrames) {
+      int32_t frames = std::min(kTileFrames, numFrames - frame);
+      int32_t offset = frame * channelCount_;
+      int32_t count = frames * channelCount_;
+      float *tile = dst + offset;
+
+      for (size_t src = 0; src < stage.sources_.size(); src++) {
+        const float *in = getBuffer(stage.sources_[src]) + offset;
+        float weight = stage.weights_[src];
+        if (src == 0) {
+          for (int32_t idx = 0; idx < count; idx++) {
+            tile[idx] = in[idx] * weight;
+          }
+        } else {
+          for (int32_t idx = 0; idx < count; idx++) {
+            tile[idx] += in[idx] * weight;
+          }
+        }
+      }
+      for (Node *node : stage.nodes_) {
+        node->func_(node, tile, frames, channelCount_);
+      }
+    }
+  }
+
+  int32_t outBuffer = schedule_[nodes_[output_]->stage_].buffer_;
+  if (outBuffer) {
+    memcpy(block, getBuffer(outBuffer),
+           numFrames * channelCount_ * sizeof(float));
+  }
+}
+
+void AudioEffectChain::process(float *liveAudio, int32_t numFrames) {
+  assert(format_ == SL_PCMSAMPLEFORMAT_FIXED_32);
+  if (output_ == kInvalidNode) return;
+
+  for (int32_t frame = 0; frame < numFrames; frame += maxFramesPerBlock_) {
+    int32_t frames = std::min(maxFramesPerBlock_, numFrames - frame);
+    processBlock(liveAudio + frame * channelCount_, frames);
+  }
+}
+
+/**
+ * int16 audio is converted into a preallocated float block, processed and
+ * saturated back
+ */
+void AudioEffectChain::process(int16_t *liveAudio, int32_t numFrames) {
+  assert(format_ == SL_PCMSAMPLEFORMAT_FIXED_16);
+  if (output_ == kInvalidNode) return;
+
+  for (int32_t frame = 0; frame < numFrames; frame += maxFramesPerBlock_) {
+    int32_t frames = std::min(maxFramesPerBlock_, numFrames - frame);
+    int32_t count = frames * channelCount_;
+    int16_t *samples = liveAudio + frame * channelCount_;
+    float *block = &convertBuffer_[0];
+    for (int32_t idx = 0; idx < count; idx++) {
+      block[idx] = samples[idx] / kInt16Scale;
+    }
+    processBlock(block, frames);
+    for (int32_t idx = 0; idx < count; idx++) {
+      float sample = block[idx] * kInt16Scale;
+      sample = std::min(std::max(sample, static_cast<float>(SHRT_MIN)),
+                        static_cast<float>(SHRT_MAX));
+      samples[idx] = static_cast<int16_t>(sample);
+    }
+  }
+}
@@ -0,0 +1,90 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AUDIO_EFFECT_CHAIN_H
+#define AUDIO_EFFECT_CHAIN_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "audio_effect.h"
+
+/**
+ * AudioEffectChain: a small graph of in-place audio processors
+ *
+ *   - nodes are added with their inputs, so node ids are already in
+ *     topological order and the graph can not have cycles. A node used as
+ *     input by several others is a split point; addMix() joins branches.
+ *   - build() picks the nodes feeding the output, assigns preallocated
+ *     buffers and fuses every run of single input nodes (gain, clamp,
+ *     limiter, biquad, delay) into one stage. A stage walks the block in
+ *     small tiles and applies all of its nodes to a tile while it is still
+ *     in L1, so a gain + clamp + delay run is one pass over the buffer.
+ *   - process() does not allocate or lock; nodes are dispatched once per
+ *     tile through a function pointer, never per sample.
+ *
+ * Everything is computed in float, full scale being [-1.0, 1.0]; the int16
+ * process() converts at the edges and saturates on the way out.
+ */
+class AudioEffectChain : public AudioFormat {
+ public:
+  typedef int32_t NodeId;
+  static const NodeId kInvalidNode = -1;
+  static const NodeId kChainInput = 0;  // the audio passed to process()
+
+  enum BiquadType {
+    BIQUAD_LOWPASS,
+    BIQUAD_HIGHPASS,
+    BIQUAD_PEAKING,
+    BIQUAD_LOWSHELF,
+    BIQUAD_HIGHSHELF,
+  };
+
+  explicit AudioEffectChain(int32_t sampleRate, int32_t channelCount,
+                            SLuint32 format, int32_t maxFramesPerBlock);
+  ~AudioEffectChain();
+
+  NodeId addGain(NodeId input, float gain);
+  NodeId addClamp(NodeId input, float limit);
+  NodeId addLimiter(NodeId input, float threshold, float releaseInMs);
+  NodeId addBiquad(NodeId input, BiquadType type, float frequency, float q,
+                   float gainInDb);
+  NodeId addDelay(NodeId input, size_t delayTimeInMs, float decayWeight);
+  NodeId addMix(const std::vector<NodeId> &inputs,
+                const std::vector<float> &weights);
+
+  bool build(NodeId output);
+  void process(int16_t *liveAudio, int32_t numFrames);
+  void process(float *liveAudio, int32_t numFrames);
+
+ private:
+  struct Node;
+  struct Stage;
+  typedef void (*NodeFunc)(Node *node, float *samples, int32_t frames,
+                           int32_t channelCount);
+
+  NodeId addNode(NodeFunc func, const std::vector<NodeId> &inputs);
+  void processBlock(float *block, int32_t numFrames);
+
+  int32_t maxFramesPerBlock_;
+  std::vector<std::unique_ptr<Node>> nodes_;
+  std::vector<Stage> schedule_;
+  std::vector<float> buffers_;  // one slot of maxFramesPerBlock_ per stage
+  std::vector<float> convertBuffer_;  // int16 audio converted to float
+  NodeId output_ = kInvalidNode;
+};
+
+#endif  // AUDIO_EFFECT_CHAIN_H
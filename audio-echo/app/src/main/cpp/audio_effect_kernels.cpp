@@ -0,0 +1,279 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "audio_effect_kernels.h"
+#include <climits>
+
+#ifdef __ANDROID__
+#include <cpu-features.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define DELAY_MIX_NEON 1
+#elif defined(__SSE2__)
+#include <immintrin.h>
+#define DELAY_MIX_SSE2 1
+#if defined(__GNUC__) || defined(__clang__)
+#define DELAY_MIX_AVX2 1
+#endif
+#endif
+
+// the vectorized int16 kernels divide by shifting
+static_assert(kDelayMixScale == (1 << 7), "kernels assume a 2^7 mix scale");
+
+/*
+ * Scalar kernels: the reference implementation, and the tail handler
+ * for the vectorized ones
+ */
+static void DelayMixI16Scalar(int16_t *live, const int16_t *delayIn,
+                              int16_t *delayOut, int32_t sampleCount,
+                              int32_t feedbackFactor, int32_t liveFactor) {
+  for (int32_t idx = 0; idx < sampleCount; idx++) {
+    int16_t delayed = delayIn[idx];
+    int32_t curSample =
+        (delayed * feedbackFactor + live[idx] * liveFactor) / kDelayMixScale;
+    if (curSample > SHRT_MAX)
+      curSample = SHRT_MAX;
+    else if (curSample < SHRT_MIN)
+      curSample = SHRT_MIN;
+
+    live[idx] = delayed;
+    delayOut[idx] = static_cast<int16_t>(curSample);
+  }
+}
+
+static void DelayMixF32Scalar(float *live, const float *delayIn,
+                              float *delayOut, int32_t sampleCount,
+                              float feedback, float liveWeight) {
+  for (int32_t idx = 0; idx < sampleCount; idx++) {
+    float delayed = delayIn[idx];
+    float curSample = delayed * feedback + live[idx] * liveWeight;
+    live[idx] = delayed;
+    delayOut[idx] = curSample;
+  }
+}
+
+#ifdef DELAY_MIX_NEON
+/*
+ * NEON: 8 samples per iteration. vqshrn does the shift and the
+ * saturating narrow in one instruction; negative sums are biased by
+ * (scale - 1) first so the shift rounds toward zero like the C division.
+ */
+static inline int16x4_t MixHalfNeon(int16x4_t delay, int16x4_t live,
+                                    int16_t feedbackFactor,
+                                    int16_t liveFactor) {
+  int32x4_t sum = vmull_n_s16(delay, feedbackFactor);
+  sum = vmlal_n_s16(sum, live, liveFactor);
+  uint32x4_t sign = vreinterpretq_u32_s32(vshrq_n_s32(sum, 31));
+  sum = vaddq_s32(sum, vreinterpretq_s32_u32(vshrq_n_u32(sign, 25)));
+  return vqshrn_n_s32(sum, 7);
+}
+
+static void DelayMixI16Neon(int16_t *live, const int16_t *delayIn,
+                            int16_t *delayOut, int32_t sampleCount,
+                            int32_t feedbackFactor, int32_t liveFactor) {
+  int16_t fb = static_cast<int16_t>(feedbackFactor);
+  int16_t lf = static_cast<int16_t>(liveFactor);
+  int32_t idx = 0;
+  for (; idx + 8 <= sampleCount; idx += 8) {
+    int16x8_t d = vld1q_s16(delayIn + idx);
+    int16x8_t l = vld1q_s16(live + idx);
+    int16x4_t lo = MixHalfNeon(vget_low_s16(d), vget_low_s16(l), fb, lf);
+    int16x4_t hi = MixHalfNeon(vget_high_s16(d), vget_high_s16(l), fb, lf);
+    vst1q_s16(live + idx, d);
+    vst1q_s16(delayOut + idx, vcombine_s16(lo, hi));
+  }
+  DelayMixI16Scalar(live + idx, delayIn + idx, delayOut + idx,
+                    sampleCount - idx, feedbackFactor, liveFactor);
+}
+
+static void DelayMixF32Neon(float *live, const float *delayIn, float *delayOut,
+                            int32_t sampleCount, float feedback,
+                            float liveWeight) {
+  int32_t idx = 0;
+  for (; idx + 4 <= sampleCount; idx += 4) {
+    float32x4_t d = vld1q_f32(delayIn + idx);
+    float32x4_t l = vld1q_f32(live + idx);
+    float32x4_t mix = vmlaq_n_f32(vmulq_n_f32(d, feedback), l, liveWeight);
+    vst1q_f32(live + idx, d);
+    vst1q_f32(delayOut + idx, mix);
+  }
+  DelayMixF32Scalar(live + idx, delayIn + idx, delayOut + idx,
+                    sampleCount - idx, feedback, liveWeight);
+}
+#endif  // DELAY_MIX_NEON
+
+#ifdef DELAY_MIX_SSE2
+/*
+ * SSE2: delay and live samples are interleaved so one pmaddwd yields
+ * delay * feedback + live * liveWeight per 32 bit lane; packssdw saturates
+ * back to int16.
+ */
+static inline __m128i MixHalfSse2(__m128i pairs, __m128i factors) {
+  __m128i sum = _mm_madd_epi16(pairs, factors);
+  __m128i bias = _mm_srli_epi32(_mm_srai_epi32(sum, 31), 25);
+  return _mm_srai_epi32(_mm_add_epi32(sum, bias), 7);
+}
+
+static void DelayMixI16Sse2(int16_t *live, const int16_t *delayIn,
+                            int16_t *delayOut, int32_t sampleCount,
+                            int32_t feedbackFactor, int32_t liveFactor) {
+  const __m128i factors = _mm_set1_epi32(
+      static_cast<int32_t>((static_cast<uint32_t>(liveFactor) << 16) |
+                           (static_cast<uint32_t>(feedbackFactor) & 0xFFFF)));
+  int32_t idx = 0;
+  for (; idx + 8 <= sampleCount; idx += 8) {
+    __m128i d =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(delayIn + idx));
+    __m128i l = _mm_loadu_si128(reinterpret_cast<__m128i *>(live + idx));
+    __m128i lo = MixHalfSse2(_mm_unpacklo_epi16(d, l), factors);
+    __m128i hi = MixHalfSse2(_mm_unpackhi_epi16(d, l), factors);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(live + idx), d);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(delayOut + idx),
+                     _mm_packs_epi32(lo, hi));
+  }
+  DelayMixI16Scalar(live + idx, delayIn + idx, delayOut + idx,
+                    sampleCount - idx, feedbackFactor, liveFactor);
+}
+
+static void DelayMixF32Sse2(float *live, const float *delayIn, float *delayOut,
+                            int32_t sampleCount, float feedback,
+                            float liveWeight) {
+  const __m128 fb = _mm_set1_ps(feedback);
+  const __m128 lw = _mm_set1_ps(liveWeight);
+  int32_t idx = 0;
+  for (; idx + 4 <= sampleCount; idx += 4) {
+    __m128 d = _mm_loadu_ps(delayIn + idx);
+    __m128 l = _mm_loadu_ps(live + idx);
+    __m128 mix = _mm_add_ps(_mm_mul_ps(d, fb), _mm_mul_ps(l, lw));
+    _mm_storeu_ps(live + idx, d);
+    _mm_storeu_ps(delayOut + idx, mix);
+  }
+  DelayMixF32Scalar(live + idx, delayIn + idx, delayOut + idx,
+                    sampleCount - idx, feedback, liveWeight);
+}
+#endif  // DELAY_MIX_SSE2
+
+#ifdef DELAY_MIX_AVX2
+/*
+ * AVX2: same as SSE2 on 16 samples. unpack and pack both work per 128 bit
+ * lane, so the output comes back in the original order.
+ */
+__attribute__((target("avx2"))) static void DelayMixI16Avx2(
+    int16_t *live, const int16_t *delayIn, int16_t *delayOut,
+    int32_t sampleCount, int32_t feedbackFactor, int32_t liveFactor) {
+  const __m256i factors = _mm256_set1_epi32(
+      static_cast<int32_t>((static_cast<uint32_t>(liveFactor) << 16) |
+                           (static_cast<uint32_t>(feedbackFactor) & 0xFFFF)));
+  int32_t idx = 0;
+  for (; idx + 16 <= sampleCount; idx += 16) {
+    __m256i d =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(delayIn + idx));
+    __m256i l = _mm256_loadu_si256(reinterpret_cast<__m256i *>(live + idx));
+    __m256i lo = _mm256_madd_epi16(_mm256_unpacklo_epi16(d, l), factors);
+    __m256i hi = _mm256_madd_epi16(_mm256_unpackhi_epi16(d, l), factors);
+    __m256i loBias = _mm256_srli_epi32(_mm256_srai_epi32(lo, 31), 25);
+    __m256i hiBias = _mm256_srli_epi32(_mm256_srai_epi32(hi, 31), 25);
+    lo = _mm256_srai_epi32(_mm256_add_epi32(lo, loBias), 7);
+    hi = _mm256_srai_epi32(_mm256_add_epi32(hi, hiBias), 7);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(live + idx), d);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(delayOut + idx),
+                        _mm256_packs_epi32(lo, hi));
+  }
+  DelayMixI16Sse2(live + idx, delayIn + idx, delayOut + idx,
+                  sampleCount - idx, feedbackFactor, liveFactor);
+}
+
+__attribute__((target("avx2"))) static void DelayMixF32Avx2(
+    float *live, const float *delayIn, float *delayOut, int32_t sampleCount,
+    float feedback, float liveWeight) {
+  const __m256 fb = _mm256_set1_ps(feedback);
+  const __m256 lw = _mm256_set1_ps(liveWeight);
+  int32_t idx = 0;
+  for (; idx + 8 <= sampleCount; idx += 8) {
+    __m256 d = _mm256_loadu_ps(delayIn + idx);
+    __m256 l = _mm256_loadu_ps(live + idx);
+    __m256 mix = _mm256_add_ps(_mm256_mul_ps(d, fb), _mm256_mul_ps(l, lw));
+    _mm256_storeu_ps(live + idx, d);
+    _mm256_storeu_ps(delayOut + idx, mix);
+  }
+  DelayMixF32Sse2(live + idx, delayIn + idx, delayOut + idx,
+                  sampleCount - idx, feedback, liveWeight);
+}
+#endif  // DELAY_MIX_AVX2
+
+static const DelayMixKernels kScalarKernels = {"scalar", DelayMixI16Scalar,
+                                               DelayMixF32Scalar};
+#ifdef DELAY_MIX_NEON
+static const DelayMixKernels kNeonKernels = {"neon", DelayMixI16Neon,
+                                             DelayMixF32Neon};
+#endif
+#ifdef DELAY_MIX_SSE2
+static const DelayMixKernels kSse2Kernels = {"sse2", DelayMixI16Sse2,
+                                             DelayMixF32Sse2};
+#endif
+#ifdef DELAY_MIX_AVX2
+static const DelayMixKernels kAvx2Kernels = {"avx2", DelayMixI16Avx2,
+                                             DelayMixF32Avx2};
+#endif
+
+int32_t GetSupportedDelayMixKernels(const DelayMixKernels **kernels,
+                                    int32_t maxCount) {
+  const DelayMixKernels *supported[kMaxDelayMixKernels];
+  int32_t count = 0;
+  supported[count++] = &kScalarKernels;
+#ifdef DELAY_MIX_NEON
+  bool hasNeon = true;
+#if defined(__ANDROID__) && defined(__arm__)
+  // armeabi-v7a does not guarantee NEON, ask the CPU
+  hasNeon = (android_getCpuFeatures() & ANDROID_CPU_ARM_FEATURE_NEON) != 0;
+#endif
+  if (hasNeon) {
+    supported[count++] = &kNeonKernels;
+  }
+#elif defined(DELAY_MIX_SSE2)
+  supported[count++] = &kSse2Kernels;
+#ifdef DELAY_MIX_AVX2
+#ifdef __ANDROID__
+  bool hasAvx2 =
+      (android_getCpuFeatures() & ANDROID_CPU_X86_FEATURE_AVX2) != 0;
+#else
+  bool hasAvx2 = __builtin_cpu_supports("avx2");
+#endif
+  if (hasAvx2) {
+    supported[count++] = &kAvx2Kernels;
+  }
+#endif
+#endif
+  if (count > maxCount) count = maxCount;
+  for (int32_t idx = 0; idx < count; idx++) {
+    kernels[idx] = supported[idx];
+  }
+  return count;
+}
+
+static const DelayMixKernels &SelectDelayMixKernels(void) {
+  const DelayMixKernels *supported[kMaxDelayMixKernels];
+  int32_t count = GetSupportedDelayMixKernels(supported, kMaxDelayMixKernels);
+  return *supported[count - 1];
+}
+
+const DelayMixKernels &GetDelayMixKernels(void) {
+  static const DelayMixKernels &kernels = SelectDelayMixKernels();
+  return kernels;
+}
+
+const DelayMixKernels &GetScalarDelayMixKernels(void) { return kScalarKernels; }
@@ -0,0 +1,67 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef AUDIO_EFFECT_KERNELS_H
+#define AUDIO_EFFECT_KERNELS_H
+
+#include <cstdint>
+
+/*
+ * Echo mixing kernels used by AudioDelay::process(). For every sample:
+ *    out         = delayIn[i]
+ *    delayOut[i] = delayIn[i] * feedback + live[i] * liveWeight
+ *    live[i]     = out
+ * delayIn and delayOut are the read tap and the write head of the delay
+ * line; they may be the same buffer, but must not partially overlap.
+ * The int16 kernels work in the integer domain with weights scaled by
+ * kDelayMixScale and round toward zero, then saturate to int16; every
+ * vectorized version is bit-exact with the scalar one.
+ */
+static const int32_t kDelayMixScale = 128;
+
+typedef void (*DelayMixI16Func)(int16_t *live, const int16_t *delayIn,
+                                int16_t *delayOut, int32_t sampleCount,
+                                int32_t feedbackFactor, int32_t liveFactor);
+typedef void (*DelayMixF32Func)(float *live, const float *delayIn,
+                                float *delayOut, int32_t sampleCount,
+                                float feedback, float liveWeight);
+
+struct DelayMixKernels {
+  const char *name_;
+  DelayMixI16Func mixI16_;
+  DelayMixF32Func mixF32_;
+};
+
+/*
+ * Kernels best fitting the running CPU, selected once at first call:
+ *   NEON on ARM, AVX2 or SSE2 on x86, plain C elsewhere
+ */
+const DelayMixKernels &GetDelayMixKernels(void);
+
+/*
+ * Portable C kernels, also the reference for the vectorized ones
+ */
+const DelayMixKernels &GetScalarDelayMixKernels(void);
+
+/*
+ * Every kernel set the running CPU can run, for tests and benchmarks: the
+ * scalar one first, the one GetDelayMixKernels() selects last
+ * @return number of sets stored in kernels[], at most maxCount
+ */
+static const int32_t kMaxDelayMixKernels = 3;
+int32_t GetSupportedDelayMixKernels(const DelayMixKernels **kernels,
+                                    int32_t maxCount);
+
+#endif  // AUDIO_EFFECT_KERNELS_H
@@ -35,11 +35,10 @@ struct EchoAudioEngine {
 
   AudioRecorder *recorder_;
   AudioPlayer *player_;
-  AudioQueue *freeBufQueue_;  // Owner of the queue
-  AudioQueue *recBufQueue_;   // Owner of the queue
+  SampleBufPool *bufPool_;       // Owner of the pool
+  BufHandleQueue *recBufQueue_;  // Owner of the queue
 
-  sample_buf *bufs_;
-  uint32_t bufCount_;
+  uint32_t starvationCount_;  // pool starvation seen at last startPlay()
   uint32_t frameCount_;
   int64_t echoDelay_;
   float echoDecay_;
@@ -81,16 +80,13 @@ JNIEXPORT void JNICALL Java_com_google_sample_echo_MainActivity_createSLEngine(
   uint32_t bufSize = engine.fastPathFramesPerBuf_ * engine.sampleChannels_ *
                      engine.bitsPerSample_;
   bufSize = (bufSize + 7) >> 3;  // bits --> byte
-  engine.bufCount_ = BUF_COUNT;
-  engine.bufs_ = allocateSampleBufs(engine.bufCount_, bufSize);
-  assert(engine.bufs_);
-
-  engine.freeBufQueue_ = new AudioQueue(engine.bufCount_);
-  engine.recBufQueue_ = new AudioQueue(engine.bufCount_);
-  assert(engine.freeBufQueue_ && engine.recBufQueue_);
-  for (uint32_t i = 0; i < engine.bufCount_; i++) {
-    engine.freeBufQueue_->push(&engine.bufs_[i]);
-  }
+  engine.bufPool_ = new SampleBufPool(bufSize);
+  engine.bufPool_->Grow(BUF_COUNT);
+  assert(engine.bufPool_->bufCount());
+
+  // recBufQueue_ has to be able to hold every buffer the pool could grow to
+  engine.recBufQueue_ = new BufHandleQueue(BUF_COUNT_MAX);
+  assert(engine.recBufQueue_);
 
   engine.echoDelay_ = delayInMs;
   engine.echoDecay_ = decay;
@@ -98,6 +94,11 @@ JNIEXPORT void JNICALL Java_com_google_sample_echo_MainActivity_createSLEngine(
       engine.fastPathSampleRate_, engine.sampleChannels_, engine.bitsPerSample_,
       engine.echoDelay_, engine.echoDecay_);
   assert(engine.delayEffect_);
+
+  // always on: the drain thread rotates the file at 8 MB
+  if (!TraceStart(AUDIO_TRACE_FILE)) {
+    LOGW("Cannot write the audio trace to %s", AUDIO_TRACE_FILE);
+  }
 }
 
 JNIEXPORT jboolean JNICALL
@@ -124,13 +125,19 @@ Java_com_google_sample_echo_MainActivity_createSLBufferQueueAudioPlayer(
   sampleFormat.channels_ = (uint16_t)engine.sampleChannels_;
   sampleFormat.sampleRate_ = engine.fastPathSampleRate_;
 
-  engine.player_ = new AudioPlayer(&sampleFormat, engine.slEngineItf_);
+  engine.player_ = new AudioPlayer(
+      &sampleFormat, CreateSLPlayerBackend(&sampleFormat, engine.slEngineItf_));
   assert(engine.player_);
   if (engine.player_ == nullptr) return JNI_FALSE;
 
-  engine.player_->SetBufQueue(engine.recBufQueue_, engine.freeBufQueue_);
+  engine.player_->SetBufQueue(engine.recBufQueue_, engine.bufPool_);
   engine.player_->RegisterCallback(EngineService, (void *)&engine);
 
+  JitterBufferConfig jitterConfig = {true, PLAY_MAX_UNDERRUN_RATE,
+                                     PLAY_MIN_BUFFER_DEPTH,
+                                     PLAY_MAX_BUFFER_DEPTH};
+  engine.player_->SetJitterBuffer(jitterConfig);
+
   return JNI_TRUE;
 }
 
@@ -154,11 +161,13 @@ Java_com_google_sample_echo_MainActivity_createAudioRecorder(JNIEnv *env,
   sampleFormat.channels_ = engine.sampleChannels_;
   sampleFormat.sampleRate_ = engine.fastPathSampleRate_;
   sampleFormat.framesPerBuf_ = engine.fastPathFramesPerBuf_;
-  engine.recorder_ = new AudioRecorder(&sampleFormat, engine.slEngineItf_);
+  engine.recorder_ = new AudioRecorder(
+      &sampleFormat,
+      CreateSLRecorderBackend(&sampleFormat, engine.slEngineItf_));
   if (!engine.recorder_) {
     return JNI_FALSE;
   }
-  engine.recorder_->SetBufQueues(engine.freeBufQueue_, engine.recBufQueue_);
+  engine.recorder_->SetBufQueues(engine.bufPool_, engine.recBufQueue_);
   engine.recorder_->RegisterCallback(EngineService, (void *)&engine);
   return JNI_TRUE;
 }
@@ -174,6 +183,17 @@ Java_com_google_sample_echo_MainActivity_deleteAudioRecorder(JNIEnv *env,
 JNIEXPORT void JNICALL
 Java_com_google_sample_echo_MainActivity_startPlay(JNIEnv *env, jclass type) {
   engine.frameCount_ = 0;
+
+  /*
+   * The recorder starved during the last session: grow the pool here on
+   * the control thread, the audio callbacks never allocate
+   */
+  uint32_t starvation = engine.bufPool_->starvationCount();
+  if (starvation != engine.starvationCount_ &&
+      engine.bufPool_->bufCount() + BUF_COUNT <= BUF_COUNT_MAX) {
+    engine.bufPool_->Grow(BUF_COUNT);
+  }
+  engine.starvationCount_ = starvation;
   /*
    * start player: make it into waitForData state
    */
@@ -198,8 +218,7 @@ Java_com_google_sample_echo_MainActivity_stopPlay(JNIEnv *env, jclass type) {
 JNIEXPORT void JNICALL Java_com_google_sample_echo_MainActivity_deleteSLEngine(
     JNIEnv *env, jclass type) {
   delete engine.recBufQueue_;
-  delete engine.freeBufQueue_;
-  releaseSampleBufs(engine.bufs_, engine.bufCount_);
+  delete engine.bufPool_;
   if (engine.slEngineObj_ != NULL) {
     (*engine.slEngineObj_)->Destroy(engine.slEngineObj_);
     engine.slEngineObj_ = NULL;
@@ -210,23 +229,32 @@ JNIEXPORT void JNICALL Java_com_google_sample_echo_MainActivity_deleteSLEngine(
     delete engine.delayEffect_;
     engine.delayEffect_ = nullptr;
   }
+  TraceStop();
 }
 
 uint32_t dbgEngineGetBufCount(void) {
   uint32_t count = engine.player_->dbgGetDevBufCount();
   count += engine.recorder_->dbgGetDevBufCount();
-  count += engine.freeBufQueue_->size();
+  count += engine.bufPool_->freeCount();
   count += engine.recBufQueue_->size();
 
   LOGE(
-      "Buf Disrtibutions: PlayerDev=%d, RecDev=%d, FreeQ=%d, "
-      "RecQ=%d",
+      "Buf Disrtibutions: PlayerDev=%d, RecDev=%d, FreePool=%d, "
+      "RecQ=%d, PoolHighWater=%d, PoolStarved=%d",
       engine.player_->dbgGetDevBufCount(),
-      engine.recorder_->dbgGetDevBufCount(), engine.freeBufQueue_->size(),
-      engine.recBufQueue_->size());
-  if (count != engine.bufCount_) {
-    LOGE("====Lost Bufs among the queue(supposed = %d, found = %d)", BUF_COUNT,
-         count);
+      engine.recorder_->dbgGetDevBufCount(), engine.bufPool_->freeCount(),
+      engine.recBufQueue_->size(), engine.bufPool_->highWaterMark(),
+      engine.bufPool_->starvationCount());
+  JitterBufferStats jitter;
+  engine.player_->GetJitterStats(&jitter);
+  LOGE(
+      "Jitter buffer: depth=%d, target=%d, underruns=%d, jitter=%dus, "
+      "latency=%dus",
+      jitter.depth_, jitter.targetDepth_, jitter.underrunCount_,
+      jitter.jitterUs_, jitter.latencyUs_);
+  if (count != engine.bufPool_->bufCount()) {
+    LOGE("====Lost Bufs among the queue(supposed = %d, found = %d)",
+         engine.bufPool_->bufCount(), count);
   }
   return count;
 }
@@ -246,8 +274,10 @@ bool EngineService(void *ctx, uint32_t msg, void *data) {
       sample_buf *buf = static_cast<sample_buf *>(data);
       assert(engine.fastPathFramesPerBuf_ ==
              buf->size_ / engine.sampleChannels_ / (engine.bitsPerSample_ / 8));
+      Trace(TRACE_EFFECT_BEGIN, engine.fastPathFramesPerBuf_);
       engine.delayEffect_->process(reinterpret_cast<int16_t *>(buf->buf_),
                                    engine.fastPathFramesPerBuf_);
+      Trace(TRACE_EFFECT_END, engine.fastPathFramesPerBuf_);
       break;
     }
     default:
@@ -13,11 +13,12 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include <algorithm>
 #include <cstdlib>
 #include "audio_player.h"
 
 /*
- * Called by OpenSL SimpleBufferQueue for every audio buffer played
+ * Called by the device for every audio buffer played
  * directly pass thru to our handler.
  * The regularity of this callback from openSL/Android System affects
  * playback continuity. If it does not callback in the regular time
@@ -27,16 +28,14 @@
  * very regular, you could buffer much less audio samples between
  * recorder and player, hence lower latency.
  */
-void bqPlayerCallback(SLAndroidSimpleBufferQueueItf bq, void *ctx) {
-  (static_cast<AudioPlayer *>(ctx))->ProcessSLCallback(bq);
+static void PlayerDeviceCallback(void *ctx) {
+  (static_cast<AudioPlayer *>(ctx))->ProcessDeviceCallback();
 }
-void AudioPlayer::ProcessSLCallback(SLAndroidSimpleBufferQueueItf bq) {
-#ifdef ENABLE_LOG
-  logFile_->logTime();
-#endif
+void AudioPlayer::ProcessDeviceCallback(void) {
+  Trace(TRACE_PLAY_CALLBACK, devShadowQueue_->size(), playQueue_->size());
   std::lock_guard<std::mutex> lock(stopMutex_);
 
-  // retrieve the finished device buf and put onto the free queue
+  // retrieve the finished device buf and put back into the free pool
   // so recorder could re-use it
   sample_buf *buf;
   if (!devShadowQueue_->front(&buf)) {
@@ -53,201 +52,193 @@ void AudioPlayer::ProcessSLCallback(SLAndroidSimpleBufferQueueItf bq) {
   }
   devShadowQueue_->pop();
 
-  if (buf != &silentBuf_) {
-    buf->size_ = 0;
-    freeQueue_->push(buf);
+  jitter_.OnCallback(device_->GetTicks(), devShadowQueue_->size(),
+                     playQueue_->size());
 
-    if (!playQueue_->front(&buf)) {
-#ifdef ENABLE_LOG
-      logFile_->log("%s", "====Warning: running out of the Audio buffers");
-#endif
+  if (buf == &stretchBuf_) {
+    // frames added behind the previous buffer, nothing to refill
+    stretchQueued_ = false;
+    return;
+  }
+
+  if (buf != &silentBuf_) {
+    freePool_->Release(buf);
+
+    SampleBufHandle handle;
+    if (!playQueue_->front(&handle)) {
+      Trace(TRACE_PLAY_UNDERRUN, devShadowQueue_->size());
+      jitter_.OnUnderrun();
+      if (jitter_.adaptive()) {
+        // keep the device going, and prime the queue again
+        EnqueueSilence();
+      }
       return;
     }
 
-    devShadowQueue_->push(buf);
-    (*bq)->Enqueue(bq, buf->buf_, buf->size_);
     playQueue_->pop();
+    EnqueueBuf(freePool_->GetBuf(handle), jitter_.Correction());
     return;
   }
 
-  if (playQueue_->size() < PLAY_KICKSTART_BUFFER_COUNT) {
-    (*bq)->Enqueue(bq, buf->buf_, buf->size_);
-    devShadowQueue_->push(&silentBuf_);
+  uint32_t kickstartCount = PLAY_KICKSTART_BUFFER_COUNT;
+  if (jitter_.adaptive()) {
+    kickstartCount =
+        std::min(jitter_.targetDepth(),
+                 DEVICE_SHADOW_BUFFER_QUEUE_LEN - devShadowQueue_->size());
+  }
+  if (playQueue_->size() < kickstartCount) {
+    EnqueueSilence();
     return;
   }
 
-  assert(PLAY_KICKSTART_BUFFER_COUNT <=
+  assert(kickstartCount <=
          (DEVICE_SHADOW_BUFFER_QUEUE_LEN - devShadowQueue_->size()));
-  for (int32_t idx = 0; idx < PLAY_KICKSTART_BUFFER_COUNT; idx++) {
-    playQueue_->front(&buf);
-    playQueue_->pop();
-    devShadowQueue_->push(buf);
-    (*bq)->Enqueue(bq, buf->buf_, buf->size_);
+  SampleBufHandle kickstartBufs[DEVICE_SHADOW_BUFFER_QUEUE_LEN];
+  uint32_t count = playQueue_->pop_n(kickstartBufs, kickstartCount);
+  for (uint32_t idx = 0; idx < count; idx++) {
+    EnqueueBuf(freePool_->GetBuf(kickstartBufs[idx]), 0);
   }
 }
 
-AudioPlayer::AudioPlayer(SampleFormat *sampleFormat, SLEngineItf slEngine)
-    : freeQueue_(nullptr),
+/*
+ * Queue buf to the device. With a correction from the jitter buffer, a few
+ * frames are dropped from buf or added behind it in stretchBuf_
+ */
+void AudioPlayer::EnqueueBuf(sample_buf *buf, int32_t correction) {
+  uint32_t frameSize = sampleInfo_.channels_ * (sampleInfo_.pcmFormat_ >> 3);
+  int32_t frames = buf->size_ / frameSize;
+  int16_t *audio = reinterpret_cast<int16_t *>(buf->buf_);
+  bool canCorrect = sampleInfo_.pcmFormat_ == SL_PCMSAMPLEFORMAT_FIXED_16 &&
+                    frames >= 2 * std::abs(correction);
+  bool stretch = canCorrect && correction > 0 && !stretchQueued_ &&
+                 devShadowQueue_->size() + 2 <= DEVICE_SHADOW_BUFFER_QUEUE_LEN;
+
+  if (canCorrect && correction < 0) {
+    frames = ShrinkAudio16(audio, frames, -correction, sampleInfo_.channels_);
+    buf->size_ = frames * frameSize;
+  } else if (stretch) {
+    StretchAudio16(audio, frames, reinterpret_cast<int16_t *>(stretchBuf_.buf_),
+                   correction, sampleInfo_.channels_);
+    stretchBuf_.size_ = correction * frameSize;
+  }
+
+  devShadowQueue_->push(buf);
+  device_->Enqueue(buf->buf_, buf->size_);
+  jitter_.OnQueued(frames);
+  if (stretch) {
+    devShadowQueue_->push(&stretchBuf_);
+    device_->Enqueue(stretchBuf_.buf_, stretchBuf_.size_);
+    jitter_.OnQueued(correction);
+    stretchQueued_ = true;
+  }
+}
+
+void AudioPlayer::EnqueueSilence(void) {
+  devShadowQueue_->push(&silentBuf_);
+  device_->Enqueue(silentBuf_.buf_, silentBuf_.size_);
+  jitter_.OnQueued(sampleInfo_.framesPerBuf_);
+}
+
+static uint32_t PeriodInUs(const SampleFormat *sampleFormat) {
+  return static_cast<uint32_t>(
+      static_cast<uint64_t>(sampleFormat->framesPerBuf_) * 1000000 * 1000 /
+      sampleFormat->sampleRate_);
+}
+
+AudioPlayer::AudioPlayer(SampleFormat *sampleFormat, AudioBackend *device)
+    : device_(device),
+      freePool_(nullptr),
       playQueue_(nullptr),
       devShadowQueue_(nullptr),
+      jitter_(PeriodInUs(sampleFormat), sampleFormat->framesPerBuf_,
+              PLAY_KICKSTART_BUFFER_COUNT),
+      stretchQueued_(false),
       callback_(nullptr) {
-  SLresult result;
-  assert(sampleFormat);
+  assert(sampleFormat && device);
   sampleInfo_ = *sampleFormat;
 
-  result = (*slEngine)
-               ->CreateOutputMix(slEngine, &outputMixObjectItf_, 0, NULL, NULL);
-  SLASSERT(result);
-
-  // realize the output mix
-  result =
-      (*outputMixObjectItf_)->Realize(outputMixObjectItf_, SL_BOOLEAN_FALSE);
-  SLASSERT(result);
-
-  // configure audio source
-  SLDataLocator_AndroidSimpleBufferQueue loc_bufq = {
-      SL_DATALOCATOR_ANDROIDSIMPLEBUFFERQUEUE, DEVICE_SHADOW_BUFFER_QUEUE_LEN};
-
-  SLAndroidDataFormat_PCM_EX format_pcm;
-  ConvertToSLSampleFormat(&format_pcm, &sampleInfo_);
-  SLDataSource audioSrc = {&loc_bufq, &format_pcm};
-
-  // configure audio sink
-  SLDataLocator_OutputMix loc_outmix = {SL_DATALOCATOR_OUTPUTMIX,
-                                        outputMixObjectItf_};
-  SLDataSink audioSnk = {&loc_outmix, NULL};
-  /*
-   * create fast path audio player: SL_IID_BUFFERQUEUE and SL_IID_VOLUME
-   * and other non-signal processing interfaces are ok.
-   */
-  SLInterfaceID ids[2] = {SL_IID_BUFFERQUEUE, SL_IID_VOLUME};
-  SLboolean req[2] = {SL_BOOLEAN_TRUE, SL_BOOLEAN_TRUE};
-  result = (*slEngine)->CreateAudioPlayer(
-      slEngine, &playerObjectItf_, &audioSrc, &audioSnk,
-      sizeof(ids) / sizeof(ids[0]), ids, req);
-  SLASSERT(result);
-
-  // realize the player
-  result = (*playerObjectItf_)->Realize(playerObjectItf_, SL_BOOLEAN_FALSE);
-  SLASSERT(result);
-
-  // get the play interface
-  result = (*playerObjectItf_)
-               ->GetInterface(playerObjectItf_, SL_IID_PLAY, &playItf_);
-  SLASSERT(result);
-
-  // get the buffer queue interface
-  result = (*playerObjectItf_)
-               ->GetInterface(playerObjectItf_, SL_IID_BUFFERQUEUE,
-                              &playBufferQueueItf_);
-  SLASSERT(result);
-
-  // register callback on the buffer queue
-  result = (*playBufferQueueItf_)
-               ->RegisterCallback(playBufferQueueItf_, bqPlayerCallback, this);
-  SLASSERT(result);
-
-  result = (*playItf_)->SetPlayState(playItf_, SL_PLAYSTATE_STOPPED);
-  SLASSERT(result);
+  device_->RegisterCallback(PlayerDeviceCallback, this);
+  device_->Stop();
 
   // create an empty queue to track deviceQueue
   devShadowQueue_ = new AudioQueue(DEVICE_SHADOW_BUFFER_QUEUE_LEN);
   assert(devShadowQueue_);
 
+  SLAndroidDataFormat_PCM_EX format_pcm;
+  ConvertToSLSampleFormat(&format_pcm, &sampleInfo_);
   silentBuf_.cap_ = (format_pcm.containerSize >> 3) * format_pcm.numChannels *
                     sampleInfo_.framesPerBuf_;
   silentBuf_.buf_ = new uint8_t[silentBuf_.cap_];
   memset(silentBuf_.buf_, 0, silentBuf_.cap_);
   silentBuf_.size_ = silentBuf_.cap_;
 
-#ifdef ENABLE_LOG
-  std::string name = "play";
-  logFile_ = new AndroidLog(name);
-#endif
+  stretchBuf_.cap_ = (format_pcm.containerSize >> 3) *
+                     format_pcm.numChannels * jitter_.maxCorrectionFrames();
+  stretchBuf_.buf_ = new uint8_t[stretchBuf_.cap_];
+  stretchBuf_.size_ = 0;
 }
 
 AudioPlayer::~AudioPlayer() {
   std::lock_guard<std::mutex> lock(stopMutex_);
 
-  // destroy buffer queue audio player object, and invalidate all associated
-  // interfaces
-  if (playerObjectItf_ != NULL) {
-    (*playerObjectItf_)->Destroy(playerObjectItf_);
-  }
+  // destroy the device first, no more callbacks after this
+  delete device_;
   // Consume all non-completed audio buffers
   sample_buf *buf = NULL;
   while (devShadowQueue_->front(&buf)) {
-    buf->size_ = 0;
     devShadowQueue_->pop();
-    if(buf != &silentBuf_) {
-      freeQueue_->push(buf);
+    if (buf != &silentBuf_ && buf != &stretchBuf_) {
+      freePool_->Release(buf);
     }
   }
   delete devShadowQueue_;
 
-  while (playQueue_->front(&buf)) {
-    buf->size_ = 0;
+  SampleBufHandle handle;
+  while (playQueue_->front(&handle)) {
     playQueue_->pop();
-    freeQueue_->push(buf);
-  }
-
-  // destroy output mix object, and invalidate all associated interfaces
-  if (outputMixObjectItf_) {
-    (*outputMixObjectItf_)->Destroy(outputMixObjectItf_);
+    freePool_->Release(freePool_->GetBuf(handle));
   }
 
   delete[] silentBuf_.buf_;
+  delete[] stretchBuf_.buf_;
 }
 
-void AudioPlayer::SetBufQueue(AudioQueue *playQ, AudioQueue *freeQ) {
+void AudioPlayer::SetBufQueue(BufHandleQueue *playQ,
+                              SampleBufPool *freePool) {
   playQueue_ = playQ;
-  freeQueue_ = freeQ;
+  freePool_ = freePool;
 }
 
 SLresult AudioPlayer::Start(void) {
-  SLuint32 state;
-  SLresult result = (*playItf_)->GetPlayState(playItf_, &state);
-  if (result != SL_RESULT_SUCCESS) {
-    return SL_BOOLEAN_FALSE;
-  }
-  if (state == SL_PLAYSTATE_PLAYING) {
+  if (device_->IsRunning()) {
     return SL_BOOLEAN_TRUE;
   }
 
-  result = (*playItf_)->SetPlayState(playItf_, SL_PLAYSTATE_STOPPED);
-  SLASSERT(result);
+  device_->Stop();
+  jitter_.OnStart(device_->GetTicks());
+  EnqueueSilence();
 
-  result =
-      (*playBufferQueueItf_)
-          ->Enqueue(playBufferQueueItf_, silentBuf_.buf_, silentBuf_.size_);
-  SLASSERT(result);
-  devShadowQueue_->push(&silentBuf_);
-
-  result = (*playItf_)->SetPlayState(playItf_, SL_PLAYSTATE_PLAYING);
-  SLASSERT(result);
-  return SL_BOOLEAN_TRUE;
+  bool result = device_->Start();
+  assert(result);
+  return result ? SL_BOOLEAN_TRUE : SL_BOOLEAN_FALSE;
 }
 
 void AudioPlayer::Stop(void) {
-  SLuint32 state;
+  if (!device_->IsRunning()) return;
 
-  SLresult result = (*playItf_)->GetPlayState(playItf_, &state);
-  SLASSERT(result);
+  std::lock_guard<std::mutex> lock(stopMutex_);
 
-  if (state == SL_PLAYSTATE_STOPPED) return;
+  device_->Stop();
+  device_->Clear();
+}
 
+void AudioPlayer::SetJitterBuffer(const JitterBufferConfig &config) {
   std::lock_guard<std::mutex> lock(stopMutex_);
+  jitter_.Configure(config);
+}
 
-  result = (*playItf_)->SetPlayState(playItf_, SL_PLAYSTATE_STOPPED);
-  SLASSERT(result);
-  (*playBufferQueueItf_)->Clear(playBufferQueueItf_);
-
-#ifdef ENABLE_LOG
-  if (logFile_) {
-    delete logFile_;
-    logFile_ = nullptr;
-  }
-#endif
+void AudioPlayer::GetJitterStats(JitterBufferStats *stats) {
+  jitter_.GetStats(stats);
 }
 
 void AudioPlayer::RegisterCallback(ENGINE_CALLBACK cb, void *ctx) {
@@ -17,38 +17,41 @@
 #ifndef NATIVE_AUDIO_AUDIO_PLAYER_H
 #define NATIVE_AUDIO_AUDIO_PLAYER_H
 #include <sys/types.h>
+#include "audio_backend.h"
 #include "audio_common.h"
 #include "buf_manager.h"
 #include "debug_utils.h"
+#include "jitter_buffer.h"
 
 class AudioPlayer {
-  // buffer queue player interfaces
-  SLObjectItf outputMixObjectItf_;
-  SLObjectItf playerObjectItf_;
-  SLPlayItf playItf_;
-  SLAndroidSimpleBufferQueueItf playBufferQueueItf_;
+  AudioBackend *device_;  // owner
 
   SampleFormat sampleInfo_;
-  AudioQueue *freeQueue_;       // user
-  AudioQueue *playQueue_;       // user
+  SampleBufPool *freePool_;     // user
+  BufHandleQueue *playQueue_;   // user
   AudioQueue *devShadowQueue_;  // owner
+  JitterBufferController jitter_;
+  sample_buf stretchBuf_;  // frames added by the jitter buffer
+  bool stretchQueued_;
 
   ENGINE_CALLBACK callback_;
   void *ctx_;
   sample_buf silentBuf_;
-#ifdef ENABLE_LOG
-  AndroidLog *logFile_;
-#endif
   std::mutex stopMutex_;
 
+  void EnqueueBuf(sample_buf *buf, int32_t correction);
+  void EnqueueSilence(void);
+
  public:
-  explicit AudioPlayer(SampleFormat *sampleFormat, SLEngineItf engine);
+  explicit AudioPlayer(SampleFormat *sampleFormat, AudioBackend *device);
   ~AudioPlayer();
-  void SetBufQueue(AudioQueue *playQ, AudioQueue *freeQ);
+  void SetBufQueue(BufHandleQueue *playQ, SampleBufPool *freePool);
   SLresult Start(void);
   void Stop(void);
-  void ProcessSLCallback(SLAndroidSimpleBufferQueueItf bq);
+  void ProcessDeviceCallback(void);
   uint32_t dbgGetDevBufCount(void);
+  void SetJitterBuffer(const JitterBufferConfig &config);
+  void GetJitterStats(JitterBufferStats *stats);
   void RegisterCallback(ENGINE_CALLBACK cb, void *ctx);
 };
 
@@ -17,20 +17,17 @@
 #ifndef NATIVE_AUDIO_AUDIO_RECORDER_H
 #define NATIVE_AUDIO_AUDIO_RECORDER_H
 #include <sys/types.h>
-#include <SLES/OpenSLES.h>
-#include <SLES/OpenSLES_Android.h>
+#include "audio_backend.h"
 #include "audio_common.h"
 #include "buf_manager.h"
 #include "debug_utils.h"
 
 class AudioRecorder {
-  SLObjectItf recObjectItf_;
-  SLRecordItf recItf_;
-  SLAndroidSimpleBufferQueueItf recBufQueueItf_;
+  AudioBackend *device_;  // owner
 
   SampleFormat sampleInfo_;
-  AudioQueue *freeQueue_;       // user
-  AudioQueue *recQueue_;        // user
+  SampleBufPool *freePool_;     // user
+  BufHandleQueue *recQueue_;    // user
   AudioQueue *devShadowQueue_;  // owner
   uint32_t audioBufCount;
 
@@ -38,18 +35,14 @@ class AudioRecorder {
   void *ctx_;
 
  public:
-  explicit AudioRecorder(SampleFormat *, SLEngineItf engineEngine);
+  explicit AudioRecorder(SampleFormat *, AudioBackend *device);
   ~AudioRecorder();
   SLboolean Start(void);
   SLboolean Stop(void);
-  void SetBufQueues(AudioQueue *freeQ, AudioQueue *recQ);
-  void ProcessSLCallback(SLAndroidSimpleBufferQueueItf bq);
+  void SetBufQueues(SampleBufPool *freePool, BufHandleQueue *recQ);
+  void ProcessDeviceCallback(void);
   void RegisterCallback(ENGINE_CALLBACK cb, void *ctx);
   int32_t dbgGetDevBufCount(void);
-
-#ifdef ENABLE_LOG
-  AndroidLog *recLog_;
-#endif
 };
 
 #endif  // NATIVE_AUDIO_AUDIO_RECORDER_H
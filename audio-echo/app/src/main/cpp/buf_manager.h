@@ -20,183 +20,198 @@
 #include <atomic>
 #include <cassert>
 #include <memory>
+#include <new>
 #include <limits>
+#include <mutex>
+#include <cstdlib>
+#include <cstring>
+#include "android_debug.h"
+#include "producer_consumer_queue.h"
 
-#ifndef CACHE_ALIGN
-#define CACHE_ALIGN 64
-#endif
+struct sample_buf {
+  uint8_t* buf_;   // audio sample container
+  uint32_t cap_;   // buffer capacity in byte
+  uint32_t size_;  // audio sample size (n buf) in byte
+};
+
+/*
+ * SampleBufHandle: a SampleBufPool buffer by its slab and index in it.
+ * Queues between the engine's threads carry only pool buffers and hold
+ * handles; the device shadow queues also track buffers the player owns
+ * (silence, stretched frames) and hold pointers.
+ */
+typedef uint32_t SampleBufHandle;
+
+using AudioQueue = ProducerConsumerQueue<sample_buf*>;
+using BufHandleQueue = ProducerConsumerQueue<SampleBufHandle>;
 
 /*
- * ProducerConsumerQueue, borrowed from Ian NiLewis
+ * SampleBufPool: lock-free, allocation-free pool of sample_bufs
+ *   - buffers are carved out of slabs: one cache line aligned allocation
+ *     holds the descriptors and all of the audio data for a batch of buffers
+ *   - Acquire()/Release() go through a tagged Treiber stack, safe to call
+ *     from the audio callbacks and from any other thread; they never touch
+ *     the heap
+ *   - Grow() adds a new slab without moving existing buffers; call it from
+ *     a control thread, never from the audio callbacks
+ *   - starvation (Acquire() on an empty pool) and the high-water mark of
+ *     buffers in use are tracked so the pool could be sized from real data
  */
-template <typename T>
-class ProducerConsumerQueue {
+class SampleBufPool {
  public:
-  explicit ProducerConsumerQueue(int size)
-      : ProducerConsumerQueue(size, new T[size]) {}
-
-  explicit ProducerConsumerQueue(int size, T* buffer)
-      : size_(size), buffer_(buffer) {
-    // This is necessary because we depend on twos-complement wraparound
-    // to take care of overflow conditions.
-    assert(size < std::numeric_limits<int>::max());
+  explicit SampleBufPool(uint32_t bufSizeInByte)
+      : bufSize_(bufSizeInByte),
+        bufStride_((bufSizeInByte + CACHE_ALIGN - 1) & ~(CACHE_ALIGN - 1)) {
+    for (auto& slab : slabs_) {
+      slab.store(nullptr, std::memory_order_relaxed);
+    }
   }
-
-  bool push(const T& item) {
-    return push([&](T* ptr) -> bool {
-      *ptr = item;
-      return true;
-    });
+  ~SampleBufPool() {
+    for (auto& slab : slabs_) {
+      free(slab.load(std::memory_order_relaxed));
+    }
   }
 
-  // get() is idempotent between calls to commit().
-  T* getWriteablePtr() {
-    T* result = nullptr;
-
-    bool check __attribute__((unused));  //= false;
+  /*
+   * Grow(): add count buffers to the pool
+   * @return number of buffers actually added
+   */
+  uint32_t Grow(uint32_t count) {
+    std::lock_guard<std::mutex> lock(growLock_);
+    if (!count || slabCount_ >= kMaxSlabs) {
+      return 0;
+    }
+    if (count > kMaxBufsPerSlab) count = kMaxBufsPerSlab;
+
+    size_t entrySize = (sizeof(Entry) * count + CACHE_ALIGN - 1) &
+                       ~static_cast<size_t>(CACHE_ALIGN - 1);
+    void* mem = nullptr;
+    if (posix_memalign(&mem, CACHE_ALIGN,
+                       entrySize + static_cast<size_t>(bufStride_) * count)) {
+      LOGW("====Failed to grow %s by %d buffers", __FUNCTION__, count);
+      return 0;
+    }
+    memset(mem, 0, entrySize + static_cast<size_t>(bufStride_) * count);
+
+    Entry* slab = static_cast<Entry*>(mem);
+    uint8_t* data = static_cast<uint8_t*>(mem) + entrySize;
+    uint32_t slabIdx = slabCount_++;
+    for (uint32_t i = 0; i < count; i++) {
+      Entry* entry = new (&slab[i]) Entry();
+      entry->buf_.buf_ = data + static_cast<size_t>(bufStride_) * i;
+      entry->buf_.cap_ = bufSize_;
+      entry->buf_.size_ = 0;
+      entry->handle_ = (slabIdx << kSlabShift) | i;
+    }
+    slabs_[slabIdx].store(slab, std::memory_order_release);
 
-    check = push([&](T* head) -> bool {
-      result = head;
-      return false;  // don't increment
-    });
+    for (uint32_t i = 0; i < count; i++) {
+      pushFree(&slab[i]);
+    }
+    bufCount_.fetch_add(count, std::memory_order_relaxed);
+    return count;
+  }
 
-    // if there's no space, result should not have been set, and vice versa
-    assert(check == (result != nullptr));
+  // take a buffer out of the pool, nullptr if the pool is starving
+  sample_buf* Acquire(void) {
+    uint64_t head = head_.load(std::memory_order_acquire);
+    Entry* entry;
+    do {
+      uint32_t handle = static_cast<uint32_t>(head);
+      if (handle == kInvalidHandle) {
+        starvationCount_.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+      }
+      entry = getEntry(handle);
+      uint64_t next = ((head >> 32) + 1) << 32 |
+                      entry->next_.load(std::memory_order_relaxed);
+      if (head_.compare_exchange_weak(head, next, std::memory_order_acq_rel,
+                                      std::memory_order_acquire)) {
+        break;
+      }
+    } while (true);
 
-    return result;
+    uint32_t inUse = inUse_.fetch_add(1, std::memory_order_relaxed) + 1;
+    uint32_t highWater = highWaterMark_.load(std::memory_order_relaxed);
+    while (inUse > highWater &&
+           !highWaterMark_.compare_exchange_weak(highWater, inUse,
+                                                 std::memory_order_relaxed)) {
+    }
+    return &entry->buf_;
   }
 
-  bool commitWriteablePtr(T* ptr) {
-    bool result = push([&](T* head) -> bool {
-      // this writer func does nothing, because we assume that the caller
-      // has already written to *ptr after acquiring it from a call to get().
-      // So just double-check that ptr is actually at the write head, and
-      // return true to indicate that it's safe to advance.
-
-      // if this isn't the same pointer we got from a call to get(), then
-      // something has gone terribly wrong. Either there was an intervening
-      // call to push() or commit(), or the pointer is spurious.
-      assert(ptr == head);
-      return true;
-    });
-    return result;
+  // return a buffer previously handed out by Acquire()
+  void Release(sample_buf* buf) {
+    assert(buf);
+    buf->size_ = 0;
+    inUse_.fetch_sub(1, std::memory_order_relaxed);
+    pushFree(reinterpret_cast<Entry*>(buf));
   }
 
-  // writer() can return false, which indicates that the caller
-  // of push() changed its mind while writing (e.g. ran out of bytes)
-  template <typename F>
-  bool push(const F& writer) {
-    bool result = false;
-    int readptr = read_.load(std::memory_order_acquire);
-    int writeptr = write_.load(std::memory_order_relaxed);
-
-    // note that while readptr and writeptr will eventually
-    // wrap around, taking their difference is still valid as
-    // long as size_ < MAXINT.
-    int space = size_ - (int)(writeptr - readptr);
-    if (space >= 1) {
-      result = true;
-
-      // writer
-      if (writer(buffer_.get() + (writeptr % size_))) {
-        ++writeptr;
-        write_.store(writeptr, std::memory_order_release);
-      }
-    }
-    return result;
+  // handle of a buffer handed out by Acquire(), and back
+  SampleBufHandle GetHandle(const sample_buf* buf) const {
+    return reinterpret_cast<const Entry*>(buf)->handle_;
   }
-  // front out the queue, but not pop-out
-  bool front(T* out_item) {
-    return front([&](T* ptr) -> bool {
-      *out_item = *ptr;
-      return true;
-    });
+  sample_buf* GetBuf(SampleBufHandle handle) {
+    assert((handle >> kSlabShift) < kMaxSlabs);
+    return &getEntry(handle)->buf_;
   }
 
-  void pop(void) {
-    int readptr = read_.load(std::memory_order_relaxed);
-    ++readptr;
-    read_.store(readptr, std::memory_order_release);
+  uint32_t bufCount(void) const {
+    return bufCount_.load(std::memory_order_relaxed);
   }
-
-  template <typename F>
-  bool front(const F& reader) {
-    bool result = false;
-
-    int writeptr = write_.load(std::memory_order_acquire);
-    int readptr = read_.load(std::memory_order_relaxed);
-
-    // As above, wraparound is ok
-    int available = (int)(writeptr - readptr);
-    if (available >= 1) {
-      result = true;
-      reader(buffer_.get() + (readptr % size_));
-    }
-
-    return result;
+  uint32_t freeCount(void) const {
+    return bufCount() - inUse_.load(std::memory_order_relaxed);
   }
-  uint32_t size(void) {
-    int writeptr = write_.load(std::memory_order_acquire);
-    int readptr = read_.load(std::memory_order_relaxed);
-
-    return (uint32_t)(writeptr - readptr);
+  uint32_t highWaterMark(void) const {
+    return highWaterMark_.load(std::memory_order_relaxed);
+  }
+  uint32_t starvationCount(void) const {
+    return starvationCount_.load(std::memory_order_relaxed);
   }
 
  private:
-  int size_;
-  std::unique_ptr<T> buffer_;
-
-  // forcing cache line alignment to eliminate false sharing of the
-  // frequently-updated read and write pointers. The object is to never
-  // let these get into the "shared" state where they'd cause a cache miss
-  // for every write.
-  alignas(CACHE_ALIGN) std::atomic<int> read_{0};
-  alignas(CACHE_ALIGN) std::atomic<int> write_{0};
-};
+  static const uint32_t kMaxSlabs = 8;
+  static const uint32_t kSlabShift = 16;
+  static const uint32_t kMaxBufsPerSlab = (1u << kSlabShift) - 1;
+  static const uint32_t kInvalidHandle = 0xFFFFFFFF;
+
+  // buf_ must stay the first member: Release() casts sample_buf* back
+  struct Entry {
+    sample_buf buf_;
+    uint32_t handle_;
+    std::atomic<uint32_t> next_;
+  };
+  Entry* getEntry(uint32_t handle) {
+    Entry* slab = slabs_[handle >> kSlabShift].load(std::memory_order_acquire);
+    return &slab[handle & kMaxBufsPerSlab];
+  }
 
-struct sample_buf {
-  uint8_t* buf_;   // audio sample container
-  uint32_t cap_;   // buffer capacity in byte
-  uint32_t size_;  // audio sample size (n buf) in byte
-};
+  void pushFree(Entry* entry) {
+    uint64_t head = head_.load(std::memory_order_relaxed);
+    uint64_t next;
+    do {
+      entry->next_.store(static_cast<uint32_t>(head),
+                         std::memory_order_relaxed);
+      next = ((head >> 32) + 1) << 32 | entry->handle_;
+    } while (!head_.compare_exchange_weak(head, next,
+                                          std::memory_order_release,
+                                          std::memory_order_relaxed));
+  }
 
-using AudioQueue = ProducerConsumerQueue<sample_buf*>;
+  const uint32_t bufSize_;
+  const uint32_t bufStride_;  // bufSize_ padded to cache line
 
-__inline__ void releaseSampleBufs(sample_buf* bufs, uint32_t& count) {
-  if (!bufs || !count) {
-    return;
-  }
-  for (uint32_t i = 0; i < count; i++) {
-    if (bufs[i].buf_) delete[] bufs[i].buf_;
-  }
-  delete[] bufs;
-}
-__inline__ sample_buf* allocateSampleBufs(uint32_t count, uint32_t sizeInByte) {
-  if (count <= 0 || sizeInByte <= 0) {
-    return nullptr;
-  }
-  sample_buf* bufs = new sample_buf[count];
-  assert(bufs);
-  memset(bufs, 0, sizeof(sample_buf) * count);
-
-  uint32_t allocSize = (sizeInByte + 3) & ~3;  // padding to 4 bytes aligned
-  uint32_t i;
-  for (i = 0; i < count; i++) {
-    bufs[i].buf_ = new uint8_t[allocSize];
-    if (bufs[i].buf_ == nullptr) {
-      LOGW("====Requesting %d buffers, allocated %d in %s", count, i,
-           __FUNCTION__);
-      break;
-    }
-    bufs[i].cap_ = sizeInByte;
-    bufs[i].size_ = 0;  // 0 data in it
-  }
-  if (i < 2) {
-    releaseSampleBufs(bufs, i);
-    bufs = nullptr;
-  }
-  count = i;
-  return bufs;
-}
+  // free list head: ABA tag in the upper 32 bits, handle in the lower
+  alignas(CACHE_ALIGN) std::atomic<uint64_t> head_{kInvalidHandle};
+  alignas(CACHE_ALIGN) std::atomic<uint32_t> inUse_{0};
+  std::atomic<uint32_t> highWaterMark_{0};
+  std::atomic<uint32_t> starvationCount_{0};
+  std::atomic<uint32_t> bufCount_{0};
+
+  std::atomic<Entry*> slabs_[kMaxSlabs];
+  uint32_t slabCount_ = 0;
+  std::mutex growLock_;
+};
 
 #endif  // NATIVE_AUDIO_BUF_MANAGER_H
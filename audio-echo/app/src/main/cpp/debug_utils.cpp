@@ -13,92 +13,192 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include <time.h>
+#include <atomic>
+#include <chrono>
 #include <cstdio>
-#include <sys/stat.h>
+#include <string>
+#include <thread>
 
 #include "debug_utils.h"
 #include "android_debug.h"
-#include <inttypes.h>
+#include "producer_consumer_queue.h"
 
-static const char* FILE_PREFIX = "/sdcard/data/audio";
+static_assert(sizeof(TraceRecord) == 24, "trace file layout changed");
 
-volatile uint32_t AndroidLog::fileIdx_ = 0;
-AndroidLog::AndroidLog() : fp_(NULL), prevTick_(static_cast<uint64_t>(0)) {
-  fileName_ = FILE_PREFIX;
-  openFile();
-}
+/*
+ * One ring per tracing thread, all allocated up front so Trace() never
+ * allocates. A thread claims a free ring on its first Trace() and gives it
+ * back when it exits; rings are single producer (that thread) and single
+ * consumer (the drain thread). Threads beyond kMaxTraceThreads only count
+ * drops.
+ */
+static const uint32_t kMaxTraceThreads = 8;
+static const uint32_t kTraceRingSize = 1024;
+static const uint32_t kDrainPeriodInMs = 20;
 
-AndroidLog::AndroidLog(std::string& file_name)
-    : fp_(NULL), prevTick_(static_cast<uint64_t>(0)) {
-  fileName_ = std::string(FILE_PREFIX) + std::string("_") + file_name;
-  openFile();
-}
+/*
+ * A full trace file is renamed to <fileName>.1, replacing the previous
+ * one, and a new file is started: a trace takes at most twice this much
+ * room, and always holds the last kMaxTraceFileBytes at least
+ */
+static const long kMaxTraceFileBytes = 8 * 1024 * 1024;
 
-AndroidLog::~AndroidLog() { flush(); }
+struct TraceRing {
+  TraceRing() : used_(false), queue_(kTraceRingSize) {}
+  std::atomic<bool> used_;
+  ProducerConsumerQueue<TraceRecord> queue_;
+};
 
-void AndroidLog::flush() {
-  if (fp_) {
-    fflush(fp_);
-    fclose(fp_);
-    fp_ = NULL;
-  }
-  prevTick_ = static_cast<uint64_t>(0);
-}
+static TraceRing traceRings[kMaxTraceThreads];
+static std::atomic<bool> traceOn(false);
+static std::atomic<uint32_t> traceDropped(0);
+static FILE *traceFile = nullptr;
+static std::string traceFileName;
+static std::thread *drainThread = nullptr;
 
-void AndroidLog::log(void* buf, uint32_t size) {
-  Lock fileLock(&mutex_);
-  if (!buf || !size) return;
+class TraceSlot {
+ public:
+  TraceSlot() : ring_(-1), claimed_(false) {}
+  ~TraceSlot() {
+    if (ring_ >= 0) {
+      traceRings[ring_].used_.store(false, std::memory_order_release);
+    }
+  }
 
-  if (fp_ || openFile()) {
-    fwrite(buf, size, 1, fp_);
+  // the ring of the calling thread, -1 if all of them are taken
+  int32_t ring(void) {
+    if (claimed_) return ring_;
+    claimed_ = true;
+    for (uint32_t idx = 0; idx < kMaxTraceThreads; idx++) {
+      bool expected = false;
+      if (traceRings[idx].used_.compare_exchange_strong(
+              expected, true, std::memory_order_acquire)) {
+        ring_ = static_cast<int32_t>(idx);
+        break;
+      }
+    }
+    return ring_;
   }
+
+ private:
+  int32_t ring_;
+  bool claimed_;
+};
+static thread_local TraceSlot traceSlot;
+
+static uint64_t GetTraceTime(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return static_cast<uint64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
 }
 
-void AndroidLog::log(const char* fmt, ...) {
-  Lock fileLock(&mutex_);
-  if (!fmt) {
+void Trace(uint32_t event, int32_t arg0, int32_t arg1) {
+  if (!traceOn.load(std::memory_order_relaxed)) return;
+
+  int32_t ring = traceSlot.ring();
+  if (ring < 0) {
+    traceDropped.fetch_add(1, std::memory_order_relaxed);
     return;
   }
-  if (fp_ || openFile()) {
-    va_list vp;
-    va_start(vp, fmt);
-    vfprintf(fp_, fmt, vp);
-    va_end(vp);
+  TraceRecord record;
+  record.time_ = GetTraceTime();
+  record.event_ = event;
+  record.thread_ = static_cast<uint32_t>(ring);
+  record.arg0_ = arg0;
+  record.arg1_ = arg1;
+  if (!traceRings[ring].queue_.push(record)) {
+    traceDropped.fetch_add(1, std::memory_order_relaxed);
   }
 }
 
-FILE* AndroidLog::openFile() {
-  Lock fileLock(&mutex_);
+/*
+ * Move everything queued so far into the file (or nowhere, when fp is
+ * nullptr), followed by a TRACE_DROPPED record if records were lost
+ */
+static void DrainTraceRings(FILE *fp, uint32_t *reportedDrops) {
+  TraceRecord records[64];
+  for (uint32_t idx = 0; idx < kMaxTraceThreads; idx++) {
+    uint32_t count;
+    while ((count = traceRings[idx].queue_.pop_n(
+                records, sizeof(records) / sizeof(records[0]))) != 0) {
+      if (fp) fwrite(records, sizeof(records[0]), count, fp);
+    }
+  }
+
+  uint32_t dropped = traceDropped.load(std::memory_order_relaxed);
+  if (fp && dropped != *reportedDrops) {
+    TraceRecord record = {GetTraceTime(), TRACE_DROPPED, kMaxTraceThreads,
+                          static_cast<int32_t>(dropped), 0};
+    fwrite(&record, sizeof(record), 1, fp);
+    *reportedDrops = dropped;
+  }
+}
 
-  if (fp_) {
-    return fp_;
+static FILE *OpenTraceFile(const char *fileName) {
+  FILE *fp = fopen(fileName, "wb");
+  if (!fp) {
+    LOGW("====failed to open trace file %s", fileName);
+    return nullptr;
   }
+  TraceFileHeader header = {TRACE_FILE_MAGIC, TRACE_FILE_VERSION,
+                            sizeof(TraceRecord), 0};
+  fwrite(&header, sizeof(header), 1, fp);
+  return fp;
+}
+
+/*
+ * Keep the trace within kMaxTraceFileBytes (x2, with the previous file);
+ * records are dropped while no new file can be opened
+ */
+static void RotateTraceFile(void) {
+  if (!traceFile || ftell(traceFile) < kMaxTraceFileBytes) return;
+
+  fclose(traceFile);
+  std::string oldName = traceFileName + ".1";
+  rename(traceFileName.c_str(), oldName.c_str());
+  traceFile = OpenTraceFile(traceFileName.c_str());
+}
 
-  char fileName[64];
-  sprintf(fileName, "%s_%d", fileName_.c_str(), AndroidLog::fileIdx_++);
-  fp_ = fopen(fileName, "wb");
-  if (fp_ == NULL) {
-    LOGE("====failed to open file %s", fileName);
+static void DrainTraceThread(void) {
+  uint32_t reportedDrops = 0;
+  while (traceOn.load(std::memory_order_relaxed)) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(kDrainPeriodInMs));
+    DrainTraceRings(traceFile, &reportedDrops);
+    RotateTraceFile();
   }
-  return fp_;
+  DrainTraceRings(traceFile, &reportedDrops);
 }
-void AndroidLog::logTime() {
-  if (prevTick_ == static_cast<uint64_t>(0)) {
-    /*
-     * init counter, bypass the first one
-     */
-    prevTick_ = getCurrentTicks();
-    return;
+
+bool TraceStart(const char *fileName) {
+  if (drainThread) return true;
+
+  traceFile = OpenTraceFile(fileName);
+  if (!traceFile) {
+    return false;
   }
-  uint64_t curTick = getCurrentTicks();
-  uint64_t delta = curTick - prevTick_;
-  log("%" PRIu64 "    %" PRIu64 "\n", curTick, delta);
-  prevTick_ = curTick;
+  traceFileName = fileName;
+
+  // records left behind by a previous session
+  uint32_t reportedDrops = 0;
+  DrainTraceRings(nullptr, &reportedDrops);
+  traceDropped.store(0, std::memory_order_relaxed);
+
+  traceOn.store(true, std::memory_order_relaxed);
+  drainThread = new std::thread(DrainTraceThread);
+  return true;
 }
 
-uint64_t AndroidLog::getCurrentTicks() {
-  struct timeval Time;
-  gettimeofday(&Time, NULL);
+void TraceStop(void) {
+  if (!drainThread) return;
+
+  traceOn.store(false, std::memory_order_relaxed);
+  drainThread->join();
+  delete drainThread;
+  drainThread = nullptr;
 
-  return (static_cast<uint64_t>(1000000) * Time.tv_sec + Time.tv_usec);
-}
\ No newline at end of file
+  if (traceFile) {
+    fclose(traceFile);
+    traceFile = nullptr;
+  }
+}
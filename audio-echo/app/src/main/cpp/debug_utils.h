@@ -15,47 +15,58 @@
  */
 #ifndef NATIVE_AUDIO_DEBUG_UTILS_H
 #define NATIVE_AUDIO_DEBUG_UTILS_H
-#include <cstdio>
-#include <mutex>
-#include <string>
+#include <cstdint>
 
 /*
- * debug_write_file()
- *  Write given data to a file as binary file. File name is
- *     "/sdcard/data/audio_%d", file_index++
- *  requirement: must have /sdcard/data already created on android device
+ * Binary tracing, cheap enough to stay on in the audio callbacks.
+ *
+ *   - Trace() stamps a fixed size TraceRecord and pushes it into a lock
+ *     free ring owned by the calling thread: no lock, no formatting, no
+ *     allocation and no system call but reading the monotonic clock.
+ *     When the ring is full the record is dropped and counted.
+ *   - a drain thread started by TraceStart() empties the rings every few
+ *     milliseconds into the trace file: a TraceFileHeader followed by
+ *     records, in order for each thread. A full file (8 MB) is moved to
+ *     <fileName>.1 and a new one started.
+ *   - nothing is traced until TraceStart(); audio-echo starts it with
+ *     the engine, into AUDIO_TRACE_FILE (audio_common.h).
+ *   - audio-echo/tools/trace_decode.cpp renders a trace file as
+ *     histograms of callback periods, queue depths and effect timings.
  */
-class Lock {
- public:
-  explicit Lock(std::recursive_mutex* mtx) {
-    mutex_ = mtx;
-    mutex_->lock();
-  }
-  ~Lock() { mutex_->unlock(); }
+enum TraceEvent : uint32_t {
+  TRACE_PLAY_CALLBACK = 1,  // arg0: device queue, arg1: play queue
+  TRACE_PLAY_UNDERRUN,      // arg0: device queue
+  TRACE_REC_CALLBACK,       // arg0: device queue, arg1: recorded queue
+  TRACE_EFFECT_BEGIN,       // arg0: frames
+  TRACE_EFFECT_END,         // arg0: frames
+  TRACE_DROPPED,            // arg0: records dropped so far
+};
 
- private:
-  std::recursive_mutex* mutex_;
+struct TraceRecord {
+  uint64_t time_;    // CLOCK_MONOTONIC, in nano seconds
+  uint32_t event_;   // TraceEvent
+  uint32_t thread_;  // ring the record went through
+  int32_t arg0_;
+  int32_t arg1_;
 };
-class AndroidLog {
- public:
-  AndroidLog();
-  AndroidLog(std::string& fileName);
-  ~AndroidLog();
-  void log(void* buf, uint32_t size);
-  void log(const char* fmt, ...);
-  void logTime();
-  void flush();
-  static volatile uint32_t fileIdx_;
 
- private:
-  uint64_t getCurrentTicks();
-  FILE* fp_;
-  FILE* openFile();
-  uint64_t prevTick_;  // Tick in milisecond
-  std::recursive_mutex mutex_;
-  std::string fileName_;
+#define TRACE_FILE_MAGIC 0x43525441  // "ATRC"
+#define TRACE_FILE_VERSION 1
+
+struct TraceFileHeader {
+  uint32_t magic_;
+  uint32_t version_;
+  uint32_t recordSize_;
+  uint32_t reserved_;
 };
 
-void debug_write_file(void* buf, uint32_t size);
+/*
+ * Start draining the rings into fileName; false if it can not be created,
+ * Trace() then stays a no-op
+ */
+bool TraceStart(const char* fileName);
+void TraceStop(void);
+
+void Trace(uint32_t event, int32_t arg0 = 0, int32_t arg1 = 0);
 
 #endif  // NATIVE_AUDIO_DEBUG_UTILS_H
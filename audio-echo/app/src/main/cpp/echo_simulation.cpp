@@ -0,0 +1,138 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "echo_simulation.h"
+#include <algorithm>
+#include <cstring>
+#include "audio_backend_sim.h"
+#include "audio_effect.h"
+#include "audio_player.h"
+#include "audio_recorder.h"
+
+/*
+ * What EngineService() of audio_main.cpp works on, for one simulated run
+ */
+struct EchoSimEngine {
+  uint32_t framesPerBuf_;
+  SampleBufPool *bufPool_;
+  BufHandleQueue *recBufQueue_;
+  AudioDelay *delayEffect_;
+  AudioRecorder *recorder_;
+  AudioPlayer *player_;
+};
+
+static bool SimEngineService(void *ctx, uint32_t msg, void *data) {
+  EchoSimEngine *engine = static_cast<EchoSimEngine *>(ctx);
+  switch (msg) {
+    case ENGINE_SERVICE_MSG_RETRIEVE_DUMP_BUFS: {
+      uint32_t count = engine->player_->dbgGetDevBufCount();
+      count += engine->recorder_->dbgGetDevBufCount();
+      count += engine->bufPool_->freeCount();
+      count += engine->recBufQueue_->size();
+      *(static_cast<uint32_t *>(data)) = count;
+      break;
+    }
+    case ENGINE_SERVICE_MSG_RECORDED_AUDIO_AVAILABLE: {
+      sample_buf *buf = static_cast<sample_buf *>(data);
+      engine->delayEffect_->process(reinterpret_cast<int16_t *>(buf->buf_),
+                                    engine->framesPerBuf_);
+      break;
+    }
+    default:
+      assert(false);
+      return false;
+  }
+  return true;
+}
+
+bool RunEchoSimulation(const EchoSimConfig &config, uint64_t durationInUs,
+                       EchoSimStats *stats) {
+  if (!stats || !config.sampleRate_ || !config.framesPerBuf_ ||
+      !config.channels_) {
+    return false;
+  }
+  memset(stats, 0, sizeof(*stats));
+
+  SampleFormat sampleFormat;
+  memset(&sampleFormat, 0, sizeof(sampleFormat));
+  sampleFormat.pcmFormat_ = SL_PCMSAMPLEFORMAT_FIXED_16;
+  sampleFormat.channels_ = config.channels_;
+  sampleFormat.sampleRate_ = config.sampleRate_;
+  sampleFormat.framesPerBuf_ = config.framesPerBuf_;
+
+  SimAudioClock clock(config.sampleRate_, config.framesPerBuf_, config.seed_);
+  clock.SetJitter(config.maxJitterUs_, config.stallUs_,
+                  config.stallProbability_);
+
+  EchoSimEngine engine;
+  engine.framesPerBuf_ = config.framesPerBuf_;
+  engine.bufPool_ = new SampleBufPool(config.framesPerBuf_ * config.channels_ *
+                                      sizeof(int16_t));
+  engine.bufPool_->Grow(BUF_COUNT);
+  engine.recBufQueue_ = new BufHandleQueue(BUF_COUNT_MAX);
+  engine.delayEffect_ =
+      new AudioDelay(config.sampleRate_, config.channels_,
+                     SL_PCMSAMPLEFORMAT_FIXED_16, config.delayInMs_,
+                     config.decay_);
+
+  SimAudioBackend *playDevice = new SimAudioBackend(
+      &clock, SimAudioBackend::SIM_PLAY, &sampleFormat, config.outputFile_);
+  SimAudioBackend *recDevice = new SimAudioBackend(
+      &clock, SimAudioBackend::SIM_RECORD, &sampleFormat, config.inputFile_);
+  engine.player_ = new AudioPlayer(&sampleFormat, playDevice);
+  engine.player_->SetBufQueue(engine.recBufQueue_, engine.bufPool_);
+  engine.player_->RegisterCallback(SimEngineService, &engine);
+  engine.player_->SetJitterBuffer(config.jitterBuffer_);
+  engine.recorder_ = new AudioRecorder(&sampleFormat, recDevice);
+  engine.recorder_->SetBufQueues(engine.bufPool_, engine.recBufQueue_);
+  engine.recorder_->RegisterCallback(SimEngineService, &engine);
+
+  // same order as startPlay()
+  engine.player_->Start();
+  engine.recorder_->Start();
+
+  uint64_t endTime = clock.Now() + durationInUs;
+  uint64_t depthSum = 0, depthSamples = 0;
+  while (clock.Step(endTime)) {
+    uint32_t depth = engine.recBufQueue_->size();
+    stats->maxRecQueueDepth_ = std::max(stats->maxRecQueueDepth_, depth);
+    depthSum += depth;
+    depthSamples++;
+  }
+
+  stats->recordedBufs_ = recDevice->bufCount();
+  stats->playedBufs_ = playDevice->bufCount();
+  stats->recOverruns_ = recDevice->xrunCount();
+  stats->playUnderruns_ = playDevice->xrunCount();
+  stats->latencyCount_ = clock.latencyCount();
+  stats->minLatencyUs_ = clock.minLatency();
+  stats->avgLatencyUs_ = clock.avgLatency();
+  stats->maxLatencyUs_ = clock.maxLatency();
+  stats->avgRecQueueDepth_ =
+      depthSamples ? static_cast<float>(depthSum) / depthSamples : 0.0f;
+  engine.player_->GetJitterStats(&stats->jitterBuffer_);
+  stats->poolHighWaterMark_ = engine.bufPool_->highWaterMark();
+  stats->poolStarvationCount_ = engine.bufPool_->starvationCount();
+
+  // same order as stopPlay(); the devices go with their owners
+  engine.recorder_->Stop();
+  engine.player_->Stop();
+  delete engine.recorder_;
+  delete engine.player_;
+  delete engine.delayEffect_;
+  delete engine.recBufQueue_;
+  delete engine.bufPool_;
+  return true;
+}
@@ -0,0 +1,81 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NATIVE_AUDIO_ECHO_SIMULATION_H
+#define NATIVE_AUDIO_ECHO_SIMULATION_H
+
+#include <cstddef>
+#include <cstdint>
+#include "jitter_buffer.h"
+
+/*
+ * Offline replay of the echo path
+ *    AudioRecorder -> recBufQueue -> AudioDelay -> AudioPlayer
+ * on simulated devices (audio_backend_sim.h) instead of OpenSL ES. It wires
+ * the same recorder, player, buffer pool and queues as audio_main.cpp, so
+ * buffer counts like PLAY_KICKSTART_BUFFER_COUNT can be tuned from the
+ * latency / underrun numbers of a run with scheduling noise.
+ */
+struct EchoSimConfig {
+  uint32_t sampleRate_;  // milliHz, like SLmilliHertz
+  uint32_t framesPerBuf_;
+  uint16_t channels_;
+  size_t delayInMs_;
+  float decay_;
+
+  // scheduling noise, see SimAudioClock::SetJitter()
+  uint32_t seed_;
+  uint32_t maxJitterUs_;
+  uint32_t stallUs_;
+  float stallProbability_;
+
+  JitterBufferConfig jitterBuffer_;
+
+  // raw 16 bit PCM files, nullptr for silence / no output
+  const char *inputFile_;
+  const char *outputFile_;
+};
+
+struct EchoSimStats {
+  uint32_t recordedBufs_;
+  uint32_t playedBufs_;
+  uint32_t recOverruns_;    // periods the recorder had no buffer to fill
+  uint32_t playUnderruns_;  // periods the player had nothing to play
+
+  // capture to playback of recorded audio, in micro seconds
+  uint32_t latencyCount_;
+  uint64_t minLatencyUs_;
+  uint64_t avgLatencyUs_;
+  uint64_t maxLatencyUs_;
+
+  // recorded buffers waiting for the player, sampled at every event
+  uint32_t maxRecQueueDepth_;
+  float avgRecQueueDepth_;
+
+  JitterBufferStats jitterBuffer_;  // player side, at the end of the run
+
+  uint32_t poolHighWaterMark_;
+  uint32_t poolStarvationCount_;
+};
+
+/*
+ * Run the echo path for durationInUs of simulated time
+ * @return false if the configuration could not be set up
+ */
+bool RunEchoSimulation(const EchoSimConfig &config, uint64_t durationInUs,
+                       EchoSimStats *stats);
+
+#endif  // NATIVE_AUDIO_ECHO_SIMULATION_H
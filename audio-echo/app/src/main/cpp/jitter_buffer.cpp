@@ -0,0 +1,261 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "jitter_buffer.h"
+#include <algorithm>
+#include <cmath>
+
+/*
+ * Callback interval statistics are exponentially weighted over about
+ * 1 / kIntervalWeight callbacks, the queue depth over 1 / kDepthWeight.
+ * The target is revisited every kWindowCallbacks callbacks; the underrun
+ * rate is taken over kRateWindows windows, and at least kMinUnderruns
+ * have to be seen before it counts, so a lone stall does not add latency
+ * for good. Depth corrections are at least kCorrectionInterval callbacks
+ * apart so one has shown up in the average before the next one is
+ * considered.
+ */
+static const float kIntervalWeight = 1.0f / 32;
+static const float kDepthWeight = 1.0f / 16;
+static const float kJitterSigma = 3.0f;
+static const float kDepthTolerance = 0.75f;
+static const uint32_t kWindowCallbacks = 256;
+static const uint32_t kMinUnderruns = 2;
+static const uint32_t kCorrectionInterval = 8;
+static const uint32_t kStepDivider = 16;  // correction: 1/16 of a buffer
+
+JitterBufferController::JitterBufferController(uint32_t periodInUs,
+                                               uint32_t framesPerBuf,
+                                               uint32_t initialDepth)
+    : periodInUs_(periodInUs),
+      framesPerBuf_(framesPerBuf),
+      startTime_(0),
+      queuedFrames_(0),
+      lastCallback_(0),
+      meanInterval_(static_cast<float>(periodInUs)),
+      varInterval_(0.0f),
+      avgDepth_(static_cast<float>(initialDepth)),
+      windowCallbacks_(0),
+      windowUnderruns_(0),
+      pastUnderruns_(),
+      pastSlot_(0),
+      pastWindows_(0),
+      sinceCorrection_(0),
+      targetDepth_(initialDepth),
+      depth_(0),
+      target_(initialDepth),
+      underrunCount_(0),
+      jitterUs_(0),
+      latencyUs_(0) {
+  config_.adaptive_ = false;
+  config_.maxUnderrunRate_ = 0.0f;
+  config_.minDepth_ = initialDepth;
+  config_.maxDepth_ = initialDepth;
+  stepFrames_ = std::max(framesPerBuf_ / kStepDivider, 1u);
+}
+
+void JitterBufferController::Configure(const JitterBufferConfig &config) {
+  config_ = config;
+  config_.minDepth_ = std::max(config_.minDepth_, 1u);
+  config_.maxDepth_ = std::max(config_.maxDepth_, config_.minDepth_);
+  targetDepth_ =
+      std::min(std::max(targetDepth_, config_.minDepth_), config_.maxDepth_);
+  target_.store(targetDepth_, std::memory_order_relaxed);
+}
+
+void JitterBufferController::OnStart(uint64_t nowInUs) {
+  startTime_ = nowInUs;
+  queuedFrames_ = 0;
+  lastCallback_ = 0;
+}
+
+void JitterBufferController::OnQueued(uint32_t frames) {
+  queuedFrames_ += frames;
+}
+
+void JitterBufferController::OnCallback(uint64_t nowInUs, uint32_t deviceBufs,
+                                        uint32_t backlogBufs) {
+  if (lastCallback_) {
+    float interval = static_cast<float>(nowInUs - lastCallback_);
+    float diff = interval - meanInterval_;
+    meanInterval_ += kIntervalWeight * diff;
+    varInterval_ = (1.0f - kIntervalWeight) *
+                   (varInterval_ + kIntervalWeight * diff * diff);
+  }
+  lastCallback_ = nowInUs;
+
+  // the device ran dry since the last callback: it played silence instead
+  uint64_t playedFrames = (nowInUs - startTime_) * framesPerBuf_ / periodInUs_;
+  if (playedFrames > queuedFrames_) {
+    OnUnderrun();
+    queuedFrames_ = playedFrames;
+  }
+  // never more ahead than what the device still holds, so the estimate
+  // does not drift with the device clock
+  uint64_t aheadFrames = queuedFrames_ - playedFrames;
+  uint64_t maxAheadFrames = static_cast<uint64_t>(deviceBufs) * framesPerBuf_;
+  if (aheadFrames > maxAheadFrames) {
+    queuedFrames_ -= aheadFrames - maxAheadFrames;
+    aheadFrames = maxAheadFrames;
+  }
+
+  float depth = static_cast<float>(aheadFrames) / framesPerBuf_ + backlogBufs;
+  avgDepth_ += kDepthWeight * (depth - avgDepth_);
+  sinceCorrection_++;
+
+  depth_.store(static_cast<uint32_t>(depth + 0.5f), std::memory_order_relaxed);
+  latencyUs_.store(static_cast<uint32_t>(depth * periodInUs_),
+                   std::memory_order_relaxed);
+  jitterUs_.store(static_cast<uint32_t>(std::sqrt(varInterval_)),
+                  std::memory_order_relaxed);
+
+  if (++windowCallbacks_ >= kWindowCallbacks) {
+    EndWindow();
+  }
+}
+
+void JitterBufferController::OnUnderrun(void) {
+  underrunCount_.fetch_add(1, std::memory_order_relaxed);
+  windowUnderruns_++;
+  if (config_.adaptive_ && TooManyUnderruns()) {
+    RaiseTarget();
+  }
+}
+
+uint32_t JitterBufferController::RecentUnderruns(void) const {
+  uint32_t underruns = windowUnderruns_;
+  for (uint32_t count : pastUnderruns_) {
+    underruns += count;
+  }
+  return underruns;
+}
+
+/*
+ * The underrun rate since the last raise, over no less than the full
+ * kRateWindows windows, is above maxUnderrunRate_
+ */
+bool JitterBufferController::TooManyUnderruns(void) const {
+  uint32_t callbacks = std::max(pastWindows_ * kWindowCallbacks +
+                                    windowCallbacks_,
+                                kRateWindows * kWindowCallbacks);
+  uint32_t underruns = RecentUnderruns();
+  return underruns >= kMinUnderruns &&
+         underruns > config_.maxUnderrunRate_ * callbacks;
+}
+
+/*
+ * One buffer more; the underruns that asked for it are forgotten, the new
+ * target has to earn the next raise by itself
+ */
+void JitterBufferController::RaiseTarget(void) {
+  targetDepth_ = std::min(targetDepth_ + 1, config_.maxDepth_);
+  target_.store(targetDepth_, std::memory_order_relaxed);
+
+  std::fill(pastUnderruns_, pastUnderruns_ + kRateWindows, 0u);
+  pastWindows_ = 0;
+  windowCallbacks_ = 0;
+  windowUnderruns_ = 0;
+}
+
+/*
+ * End of a window: never below what the jitter needs; one buffer less
+ * when the underrun rate over the last kRateWindows windows stayed below
+ * half of maxUnderrunRate_
+ */
+void JitterBufferController::EndWindow(void) {
+  if (config_.adaptive_ && TooManyUnderruns()) {
+    RaiseTarget();
+    return;
+  }
+  pastUnderruns_[pastSlot_] = windowUnderruns_;
+  pastSlot_ = (pastSlot_ + 1) % kRateWindows;
+  if (pastWindows_ < kRateWindows) pastWindows_++;
+  windowCallbacks_ = 0;
+  windowUnderruns_ = 0;
+  if (!config_.adaptive_) return;
+
+  float deviation = std::sqrt(varInterval_);
+  uint32_t jitterDepth =
+      1 + static_cast<uint32_t>(std::ceil(kJitterSigma * deviation /
+                                          static_cast<float>(periodInUs_)));
+  uint32_t neededDepth = std::max(config_.minDepth_, jitterDepth);
+
+  float allowed = config_.maxUnderrunRate_ * kRateWindows * kWindowCallbacks;
+  if (targetDepth_ < neededDepth) {
+    targetDepth_ = neededDepth;
+  } else if (targetDepth_ > neededDepth && pastWindows_ >= kRateWindows &&
+             RecentUnderruns() <= allowed / 2) {
+    targetDepth_--;
+  }
+  targetDepth_ =
+      std::min(std::max(targetDepth_, config_.minDepth_), config_.maxDepth_);
+  target_.store(targetDepth_, std::memory_order_relaxed);
+}
+
+int32_t JitterBufferController::Correction(void) {
+  if (!config_.adaptive_ || sinceCorrection_ < kCorrectionInterval) {
+    return 0;
+  }
+  float target = static_cast<float>(targetDepth_);
+  if (avgDepth_ > target + kDepthTolerance) {
+    sinceCorrection_ = 0;
+    return -static_cast<int32_t>(stepFrames_);
+  }
+  if (avgDepth_ < target - kDepthTolerance) {
+    sinceCorrection_ = 0;
+    return static_cast<int32_t>(stepFrames_);
+  }
+  return 0;
+}
+
+void JitterBufferController::GetStats(JitterBufferStats *stats) const {
+  stats->depth_ = depth_.load(std::memory_order_relaxed);
+  stats->targetDepth_ = target_.load(std::memory_order_relaxed);
+  stats->underrunCount_ = underrunCount_.load(std::memory_order_relaxed);
+  stats->jitterUs_ = jitterUs_.load(std::memory_order_relaxed);
+  stats->latencyUs_ = latencyUs_.load(std::memory_order_relaxed);
+}
+
+void StretchAudio16(int16_t *audio, int32_t frames, int16_t *tail,
+                    int32_t extraFrames, int32_t channelCount) {
+  int32_t fadeStart = (frames - extraFrames) * channelCount;
+  int32_t shift = extraFrames * channelCount;
+  std::copy(audio + fadeStart, audio + frames * channelCount, tail);
+
+  for (int32_t frame = 0; frame < extraFrames; frame++) {
+    float weight = static_cast<float>(frame + 1) / (extraFrames + 1);
+    int16_t *cur = audio + fadeStart + frame * channelCount;
+    for (int32_t ch = 0; ch < channelCount; ch++) {
+      cur[ch] = static_cast<int16_t>(cur[ch] * (1.0f - weight) +
+                                     cur[ch - shift] * weight);
+    }
+  }
+}
+
+int32_t ShrinkAudio16(int16_t *audio, int32_t frames, int32_t dropFrames,
+                      int32_t channelCount) {
+  int32_t fadeStart = (frames - 2 * dropFrames) * channelCount;
+  int32_t shift = dropFrames * channelCount;
+
+  for (int32_t frame = 0; frame < dropFrames; frame++) {
+    float weight = static_cast<float>(frame + 1) / (dropFrames + 1);
+    int16_t *cur = audio + fadeStart + frame * channelCount;
+    for (int32_t ch = 0; ch < channelCount; ch++) {
+      cur[ch] = static_cast<int16_t>(cur[ch] * (1.0f - weight) +
+                                     cur[ch + shift] * weight);
+    }
+  }
+  return frames - dropFrames;
+}
@@ -0,0 +1,140 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NATIVE_AUDIO_JITTER_BUFFER_H
+#define NATIVE_AUDIO_JITTER_BUFFER_H
+
+#include <atomic>
+#include <cstdint>
+
+struct JitterBufferConfig {
+  bool adaptive_;          // false: fixed PLAY_KICKSTART_BUFFER_COUNT
+  float maxUnderrunRate_;  // tolerated underruns per player callback
+  uint32_t minDepth_;      // in buffers
+  uint32_t maxDepth_;
+};
+
+struct JitterBufferStats {
+  uint32_t depth_;         // buffers queued ahead of the play head
+  uint32_t targetDepth_;
+  uint32_t underrunCount_;
+  uint32_t jitterUs_;      // deviation of the callback intervals
+  uint32_t latencyUs_;     // audio queued ahead of the play head
+};
+
+/*
+ * JitterBufferController: picks how many buffers the player keeps queued.
+ *
+ *   - the device play head is extrapolated from the time since Start()
+ *     and the frames queued so far: audio queued ahead of it is the depth,
+ *     a play head past the queued audio is an underrun, even one that the
+ *     late callbacks do not show in the shadow queue;
+ *   - the spread of the player callback intervals gives the least depth
+ *     that rides over the observed jitter;
+ *   - the underrun rate is counted over the last few windows of
+ *     callbacks: above maxUnderrunRate_ it raises the target by a buffer,
+ *     and the next raise waits for the new depth to underrun as often on
+ *     its own; while it stays below half of that the target decays by a
+ *     buffer per window, down to what the jitter needs;
+ *   - the queue follows the target through Correction(): the player adds
+ *     or drops a few frames of the next buffer (see StretchAudio16() and
+ *     ShrinkAudio16()), so the depth converges without silent gaps.
+ *
+ * Everything but GetStats() runs on the player callback thread.
+ */
+class JitterBufferController {
+ public:
+  explicit JitterBufferController(uint32_t periodInUs, uint32_t framesPerBuf,
+                                  uint32_t initialDepth);
+
+  void Configure(const JitterBufferConfig &config);
+  bool adaptive(void) const { return config_.adaptive_; }
+  uint32_t targetDepth(void) const { return targetDepth_; }
+  uint32_t maxCorrectionFrames(void) const { return stepFrames_; }
+
+  // the device starts playing, and frames more were queued to it
+  void OnStart(uint64_t nowInUs);
+  void OnQueued(uint32_t frames);
+
+  /*
+   * a player callback: deviceBufs still in the device queue, backlogBufs
+   * waiting in the player
+   */
+  void OnCallback(uint64_t nowInUs, uint32_t deviceBufs,
+                  uint32_t backlogBufs);
+  void OnUnderrun(void);
+
+  /*
+   * frames to add to (> 0) or drop from (< 0) the buffer about to be
+   * queued, 0 to leave it alone
+   */
+  int32_t Correction(void);
+
+  void GetStats(JitterBufferStats *stats) const;
+
+ private:
+  static const uint32_t kRateWindows = 4;
+
+  uint32_t RecentUnderruns(void) const;
+  bool TooManyUnderruns(void) const;
+  void RaiseTarget(void);
+  void EndWindow(void);
+
+  JitterBufferConfig config_;
+  uint32_t periodInUs_;
+  uint32_t framesPerBuf_;
+  uint32_t stepFrames_;  // frames added or dropped by one correction
+
+  uint64_t startTime_;
+  uint64_t queuedFrames_;  // since startTime_
+  uint64_t lastCallback_;
+  float meanInterval_;
+  float varInterval_;
+  float avgDepth_;
+  uint32_t windowCallbacks_;
+  uint32_t windowUnderruns_;
+  uint32_t pastUnderruns_[kRateWindows];  // of the windows before, a ring
+  uint32_t pastSlot_;                     // where the next window goes
+  uint32_t pastWindows_;                  // in pastUnderruns_ since a raise
+  uint32_t sinceCorrection_;
+  uint32_t targetDepth_;
+
+  // published for GetStats()
+  std::atomic<uint32_t> depth_;
+  std::atomic<uint32_t> target_;
+  std::atomic<uint32_t> underrunCount_;
+  std::atomic<uint32_t> jitterUs_;
+  std::atomic<uint32_t> latencyUs_;
+};
+
+/*
+ * Make interleaved int16 audio extraFrames longer: its last extraFrames
+ * frames are crossfaded into the audio extraFrames earlier and moved to
+ * tail, so audio followed by tail plays on without a discontinuity.
+ * frames has to be at least 2 * extraFrames.
+ */
+void StretchAudio16(int16_t *audio, int32_t frames, int16_t *tail,
+                    int32_t extraFrames, int32_t channelCount);
+
+/*
+ * Make interleaved int16 audio dropFrames shorter by crossfading its end
+ * into its last dropFrames frames; frames has to be at least 2 * dropFrames.
+ * @return the new frame count
+ */
+int32_t ShrinkAudio16(int16_t *audio, int32_t frames, int32_t dropFrames,
+                      int32_t channelCount);
+
+#endif  // NATIVE_AUDIO_JITTER_BUFFER_H
@@ -0,0 +1,244 @@
+/*
+ * Copyright 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef NATIVE_AUDIO_PRODUCER_CONSUMER_QUEUE_H
+#define NATIVE_AUDIO_PRODUCER_CONSUMER_QUEUE_H
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <memory>
+
+#ifndef CACHE_ALIGN
+#define CACHE_ALIGN 64
+#endif
+
+/*
+ * ProducerConsumerQueue, borrowed from Ian NiLewis
+ *
+ * Single producer, single consumer lock-free queue. It has no dependency on
+ * Android, so it could be built and exercised on any host.
+ *   - the backing storage is rounded up to a power of 2 so slot lookup is a
+ *     mask instead of a modulo; the logical capacity is still the requested
+ *     size (the device shadow queues depend on it to mirror OpenSL queues)
+ *   - each side caches the last seen index of the other side, and only
+ *     re-reads the other core's cache line when the cached value says the
+ *     queue is full (producer) or empty (consumer)
+ *   - push_n()/pop_n() and reserve_write()/commit() move several items with
+ *     one acquire/release pair
+ */
+template <typename T>
+class ProducerConsumerQueue {
+ public:
+  explicit ProducerConsumerQueue(uint32_t size)
+      : size_(CheckedSize(size)),
+        mask_(RoundUpToPowerOf2(size_) - 1),
+        buffer_(new T[mask_ + 1]) {}
+
+  bool push(const T& item) {
+    return push([&](T* ptr) -> bool {
+      *ptr = item;
+      return true;
+    });
+  }
+
+  // get() is idempotent between calls to commit().
+  T* getWriteablePtr() {
+    T* result = nullptr;
+
+    bool check __attribute__((unused));  //= false;
+
+    check = push([&](T* head) -> bool {
+      result = head;
+      return false;  // don't increment
+    });
+
+    // if there's no space, result should not have been set, and vice versa
+    assert(check == (result != nullptr));
+
+    return result;
+  }
+
+  bool commitWriteablePtr(T* ptr) {
+    bool result = push([&](T* head) -> bool {
+      // this writer func does nothing, because we assume that the caller
+      // has already written to *ptr after acquiring it from a call to get().
+      // So just double-check that ptr is actually at the write head, and
+      // return true to indicate that it's safe to advance.
+
+      // if this isn't the same pointer we got from a call to get(), then
+      // something has gone terribly wrong. Either there was an intervening
+      // call to push() or commit(), or the pointer is spurious.
+      assert(ptr == head);
+      return true;
+    });
+    return result;
+  }
+
+  // writer() can return false, which indicates that the caller
+  // of push() changed its mind while writing (e.g. ran out of bytes)
+  template <typename F>
+  bool push(const F& writer) {
+    uint32_t writeptr = write_.load(std::memory_order_relaxed);
+    if (writeSpace(writeptr, 1) < 1) {
+      return false;
+    }
+    if (writer(&buffer_[writeptr & mask_])) {
+      write_.store(writeptr + 1, std::memory_order_release);
+    }
+    return true;
+  }
+
+  /*
+   * reserve_write(): zero-copy reservation of up to count slots.
+   *   The returned span is contiguous, so it may be shorter than count when
+   *   the free space wraps around the end of the storage; call it again
+   *   after commit() for the rest. Nothing is visible to the consumer
+   *   until commit().
+   * @return number of contiguous slots available at *span
+   */
+  uint32_t reserve_write(uint32_t count, T** span) {
+    uint32_t writeptr = write_.load(std::memory_order_relaxed);
+    uint32_t space = writeSpace(writeptr, count);
+    if (count > space) count = space;
+
+    uint32_t idx = writeptr & mask_;
+    uint32_t contiguous = mask_ + 1 - idx;
+    if (count > contiguous) count = contiguous;
+
+    *span = &buffer_[idx];
+    return count;
+  }
+
+  // publish count slots previously handed out by reserve_write()
+  void commit(uint32_t count) {
+    uint32_t writeptr = write_.load(std::memory_order_relaxed);
+    assert(count <= writeSpace(writeptr, count));
+    write_.store(writeptr + count, std::memory_order_release);
+  }
+
+  // push as many of items[0, count) as fit, with a single release store
+  uint32_t push_n(const T* items, uint32_t count) {
+    uint32_t writeptr = write_.load(std::memory_order_relaxed);
+    uint32_t space = writeSpace(writeptr, count);
+    if (count > space) count = space;
+
+    for (uint32_t i = 0; i < count; i++) {
+      buffer_[(writeptr + i) & mask_] = items[i];
+    }
+    if (count) {
+      write_.store(writeptr + count, std::memory_order_release);
+    }
+    return count;
+  }
+
+  // front out the queue, but not pop-out
+  bool front(T* out_item) {
+    return front([&](T* ptr) -> bool {
+      *out_item = *ptr;
+      return true;
+    });
+  }
+
+  void pop(void) {
+    uint32_t readptr = read_.load(std::memory_order_relaxed);
+    ++readptr;
+    read_.store(readptr, std::memory_order_release);
+  }
+
+  template <typename F>
+  bool front(const F& reader) {
+    uint32_t readptr = read_.load(std::memory_order_relaxed);
+    if (readAvailable(readptr, 1) < 1) {
+      return false;
+    }
+    reader(&buffer_[readptr & mask_]);
+    return true;
+  }
+
+  // pop up to count items into out[], with a single release store
+  uint32_t pop_n(T* out, uint32_t count) {
+    uint32_t readptr = read_.load(std::memory_order_relaxed);
+    uint32_t available = readAvailable(readptr, count);
+    if (count > available) count = available;
+
+    for (uint32_t i = 0; i < count; i++) {
+      out[i] = buffer_[(readptr + i) & mask_];
+    }
+    if (count) {
+      read_.store(readptr + count, std::memory_order_release);
+    }
+    return count;
+  }
+
+  uint32_t size(void) {
+    uint32_t writeptr = write_.load(std::memory_order_acquire);
+    uint32_t readptr = read_.load(std::memory_order_relaxed);
+
+    return writeptr - readptr;
+  }
+
+  uint32_t capacity(void) const { return size_; }
+
+ private:
+  // checked before anything is sized from it: the indices depend on
+  // unsigned wraparound, which needs size <= 2^31
+  static uint32_t CheckedSize(uint32_t size) {
+    assert(size && size <= (1u << 31));
+    return size;
+  }
+
+  static uint32_t RoundUpToPowerOf2(uint32_t v) {
+    uint32_t p = 1;
+    while (p < v && p < (1u << 31)) p <<= 1;
+    return p;
+  }
+
+  // producer side: free slots, refreshing the cached read index only
+  // when the stale copy says there is not enough room for wanted slots
+  uint32_t writeSpace(uint32_t writeptr, uint32_t wanted) {
+    uint32_t space = size_ - (writeptr - readCache_);
+    if (space < wanted) {
+      readCache_ = read_.load(std::memory_order_acquire);
+      space = size_ - (writeptr - readCache_);
+    }
+    return space;
+  }
+
+  // consumer side: filled slots, same caching scheme as writeSpace()
+  uint32_t readAvailable(uint32_t readptr, uint32_t wanted) {
+    uint32_t available = writeCache_ - readptr;
+    if (available < wanted) {
+      writeCache_ = write_.load(std::memory_order_acquire);
+      available = writeCache_ - readptr;
+    }
+    return available;
+  }
+
+  const uint32_t size_;
+  const uint32_t mask_;
+  std::unique_ptr<T[]> buffer_;
+
+  // forcing cache line alignment to eliminate false sharing of the
+  // frequently-updated read and write pointers. The object is to never
+  // let these get into the "shared" state where they'd cause a cache miss
+  // for every write. Each index shares its line with the owner's cached
+  // copy of the opposite index.
+  alignas(CACHE_ALIGN) std::atomic<uint32_t> read_{0};
+  uint32_t writeCache_ = 0;  // consumer's view of write_
+  alignas(CACHE_ALIGN) std::atomic<uint32_t> write_{0};
+  uint32_t readCache_ = 0;  // producer's view of read_
+};
+
+#endif  // NATIVE_AUDIO_PRODUCER_CONSUMER_QUEUE_H
@@ -0,0 +1,166 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Changes the AudioDelay parameters from one thread while another one
+ * runs process(), as the UI and the recorder callback do in the app.
+ *
+ *    audio_delay_test [--buffers n]
+ *
+ * For the int16 and the float format in turn, the audio thread processes
+ * --buffers buffers of random length while the control thread keeps
+ * calling setDelayTime() and setDecayWeight() with random values, some of
+ * them out of range. Every buffer is surrounded by guard samples that
+ * have to come back untouched; the float output has to stay finite and
+ * within the input range, as the echo is a weighted average of live and
+ * delayed audio. The exit status is 1 when a check failed.
+ *
+ * Build with -fsanitize=thread to have the parameter handoff checked for
+ * data races, with -fsanitize=address for the delay line accesses.
+ */
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <thread>
+#include <vector>
+#include "audio_effect.h"
+
+static std::atomic<uint32_t> failures(0);
+
+#define CHECK(cond, ...)                                              \
+  do {                                                                \
+    if (!(cond) && failures.fetch_add(1) < 10) {                      \
+      fprintf(stderr, "%s:%d: %s: ", __FILE__, __LINE__, #cond);      \
+      fprintf(stderr, __VA_ARGS__);                                   \
+      fprintf(stderr, "\n");                                          \
+    }                                                                 \
+  } while (0)
+
+static const int32_t kChannels = 2;
+static const int32_t kMaxFrames = 1000;  // spans several kernel chunks
+static const int32_t kGuard = 64;        // samples on each side of a buffer
+static const int16_t kGuardI16 = 0x5a5a;
+static const float kGuardF32 = 1234.5f;
+
+static void FillRandom(int16_t *samples, int32_t count, std::mt19937 *random) {
+  for (int32_t idx = 0; idx < count; idx++) {
+    samples[idx] = static_cast<int16_t>((*random)());
+  }
+}
+
+static void FillRandom(float *samples, int32_t count, std::mt19937 *random) {
+  std::uniform_real_distribution<float> sample(-1.0f, 1.0f);
+  for (int32_t idx = 0; idx < count; idx++) {
+    samples[idx] = sample(*random);
+  }
+}
+
+static bool InRange(int16_t) { return true; }
+static bool InRange(float sample) {
+  return std::isfinite(sample) && std::fabs(sample) <= 1.0f + 1e-5f;
+}
+
+static double AsDouble(int16_t sample) { return sample; }
+static double AsDouble(float sample) { return sample; }
+
+template <typename T>
+static void RunAudio(AudioDelay *delay, uint32_t buffers, T guard,
+                     std::atomic<bool> *done) {
+  std::mt19937 random(buffers);
+  std::vector<T> audio(kGuard + kMaxFrames * kChannels + kGuard);
+  for (uint32_t buffer = 0; buffer < buffers; buffer++) {
+    int32_t frames = 1 + random() % kMaxFrames;
+    int32_t samples = frames * kChannels;
+    std::fill(audio.begin(), audio.end(), guard);
+    T *live = audio.data() + kGuard;
+    FillRandom(live, samples, &random);
+    delay->process(live, frames);
+
+    for (int32_t idx = 0; idx < samples; idx++) {
+      CHECK(InRange(live[idx]), "buffer %u, sample %d of %d is %g", buffer,
+            idx, samples, AsDouble(live[idx]));
+    }
+    for (int32_t idx = 0; idx < kGuard; idx++) {
+      CHECK(audio[idx] == guard && live[samples + idx] == guard,
+            "buffer %u of %d frames: written outside, guard sample %d",
+            buffer, frames, idx);
+    }
+  }
+  done->store(true);
+}
+
+static void RunControl(AudioDelay *delay, std::atomic<bool> *done,
+                       uint32_t *changes) {
+  std::mt19937 random(7);
+  std::uniform_real_distribution<float> weight(-0.1f, 1.1f);
+  while (!done->load()) {
+    // up to 1.2 s: the longest delay the effect takes is 1 s
+    size_t delayTime = random() % 1200;
+    bool accepted = delay->setDelayTime(delayTime);
+    CHECK(accepted == (delayTime <= 1000), "setDelayTime(%zu) returned %d",
+          delayTime, accepted);
+    delay->setDecayWeight(weight(random));
+    CHECK(delay->getDecayWeight() > 0.0f && delay->getDecayWeight() < 1.0f,
+          "decay weight %f", delay->getDecayWeight());
+    (*changes)++;
+    std::this_thread::yield();
+  }
+}
+
+template <typename T>
+static void TestFormat(SLuint32 format, uint32_t buffers, T guard) {
+  AudioDelay delay(SL_SAMPLINGRATE_48, kChannels, format, 100, 0.5f);
+  std::atomic<bool> done(false);
+  uint32_t changes = 0;
+  std::thread control(RunControl, &delay, &done, &changes);
+  std::thread audio(RunAudio<T>, &delay, buffers, guard, &done);
+  audio.join();
+  control.join();
+  printf("%-5s %u buffers, %u parameter changes\n",
+         format == SL_PCMSAMPLEFORMAT_FIXED_16 ? "int16" : "float", buffers,
+         changes);
+}
+
+static void Usage(const char *name) {
+  fprintf(stderr, "usage: %s [--buffers n]\n", name);
+}
+
+int main(int argc, char *argv[]) {
+  int buffers = 20000;
+  for (int idx = 1; idx < argc; idx++) {
+    if (!strcmp(argv[idx], "--buffers") && idx + 1 < argc) {
+      buffers = atoi(argv[++idx]);
+    } else {
+      Usage(argv[0]);
+      return 2;
+    }
+  }
+  if (buffers <= 0) {
+    Usage(argv[0]);
+    return 2;
+  }
+
+  TestFormat<int16_t>(SL_PCMSAMPLEFORMAT_FIXED_16, buffers, kGuardI16);
+  TestFormat<float>(SL_PCMSAMPLEFORMAT_FIXED_32, buffers, kGuardF32);
+  if (failures) {
+    fprintf(stderr, "%u checks failed\n", failures.load());
+    return 1;
+  }
+  return 0;
+}
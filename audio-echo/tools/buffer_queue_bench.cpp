@@ -0,0 +1,172 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Throughput and handoff latency of ProducerConsumerQueue between two
+ * threads.
+ *
+ *    buffer_queue_bench [--seconds 1] [--size 16] [--batch 8]
+ *
+ * The producer stamps every item with the time it is pushed, the consumer
+ * takes the difference when it pops it. Items move one at a time (push(),
+ * front() + pop()) and in batches (push_n(), pop_n()); for each the
+ * items per second and the median and 99th percentile handoff latency
+ * are printed. With fewer cores than threads the latency is the
+ * scheduler's time slice, not the queue's.
+ */
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include "producer_consumer_queue.h"
+
+typedef std::chrono::steady_clock Clock;
+
+static uint64_t NowInNs(void) {
+  return static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          Clock::now().time_since_epoch())
+          .count());
+}
+
+struct BenchResult {
+  uint64_t items;
+  double seconds;
+  std::vector<uint32_t> latencies;  // ns, of every 16th item
+};
+
+static const uint32_t kMaxBatch = 64;
+static const uint32_t kSampleEvery = 16;
+
+static void RunBench(uint32_t size, uint32_t batch, double seconds,
+                     BenchResult *result) {
+  ProducerConsumerQueue<uint64_t> queue(size);
+  std::atomic<bool> stop(false);
+  result->items = 0;
+  result->latencies.clear();
+  result->latencies.reserve(1 << 20);
+
+  std::thread producer([&] {
+    uint64_t stamps[kMaxBatch];
+    while (!stop.load(std::memory_order_relaxed)) {
+      uint64_t now = NowInNs();
+      bool pushed;
+      if (batch == 1) {
+        pushed = queue.push(now);
+      } else {
+        std::fill(stamps, stamps + batch, now);
+        pushed = queue.push_n(stamps, batch) != 0;
+      }
+      if (!pushed) std::this_thread::yield();
+    }
+  });
+
+  uint64_t items = 0;
+  uint64_t stamps[kMaxBatch];
+  Clock::time_point start = Clock::now();
+  Clock::time_point end =
+      start + std::chrono::duration_cast<Clock::duration>(
+                  std::chrono::duration<double>(seconds));
+  while (true) {
+    uint32_t popped;
+    if (batch == 1) {
+      popped = queue.front(&stamps[0]) ? 1 : 0;
+      if (popped) queue.pop();
+    } else {
+      popped = queue.pop_n(stamps, batch);
+    }
+    if (!popped) {
+      if (Clock::now() >= end) break;
+      std::this_thread::yield();
+      continue;
+    }
+    uint64_t now = NowInNs();
+    for (uint32_t idx = 0; idx < popped; idx++) {
+      if ((items + idx) % kSampleEvery == 0 &&
+          result->latencies.size() < result->latencies.capacity()) {
+        result->latencies.push_back(static_cast<uint32_t>(
+            std::min<uint64_t>(now - stamps[idx], UINT32_MAX)));
+      }
+    }
+    items += popped;
+    if ((items & 1023) < popped && Clock::now() >= end) break;
+  }
+  result->seconds =
+      std::chrono::duration<double>(Clock::now() - start).count();
+  stop.store(true, std::memory_order_relaxed);
+  producer.join();
+  result->items = items;
+}
+
+static uint32_t Percentile(std::vector<uint32_t> *values, double fraction) {
+  if (values->empty()) return 0;
+  size_t idx = static_cast<size_t>(fraction * (values->size() - 1));
+  std::nth_element(values->begin(), values->begin() + idx, values->end());
+  return (*values)[idx];
+}
+
+static void Usage(const char *name) {
+  fprintf(stderr, "usage: %s [--seconds s] [--size n] [--batch n]\n", name);
+}
+
+int main(int argc, char *argv[]) {
+  double seconds = 1.0;
+  uint32_t size = 16, batch = 8;
+  for (int idx = 1; idx < argc; idx++) {
+    const char *arg = argv[idx];
+    if (idx + 1 >= argc) {
+      Usage(argv[0]);
+      return 2;
+    }
+    const char *value = argv[++idx];
+    if (!strcmp(arg, "--seconds")) {
+      seconds = atof(value);
+    } else if (!strcmp(arg, "--size")) {
+      size = static_cast<uint32_t>(atoi(value));
+    } else if (!strcmp(arg, "--batch")) {
+      batch = static_cast<uint32_t>(atoi(value));
+    } else {
+      Usage(argv[0]);
+      return 2;
+    }
+  }
+  if (seconds <= 0.0 || !size || !batch || batch > kMaxBatch) {
+    Usage(argv[0]);
+    return 2;
+  }
+
+  printf("queue of %u, batches of %u, %u hardware threads\n", size, batch,
+         std::thread::hardware_concurrency());
+  BenchResult result;
+  for (uint32_t runBatch : {1u, batch}) {
+    RunBench(size, runBatch, seconds, &result);
+    if (!result.items) {
+      fprintf(stderr, "nothing moved through the queue\n");
+      return 1;
+    }
+    uint32_t p50 = Percentile(&result.latencies, 0.5);
+    uint32_t p99 = Percentile(&result.latencies, 0.99);
+    printf("%-16s %12.0f items/s, handoff p50 %8.2f us, p99 %8.2f us\n",
+           runBatch == 1 ? "push/pop" : "push_n/pop_n",
+           result.items / result.seconds, p50 / 1000.0, p99 / 1000.0);
+    if (runBatch == batch) break;
+  }
+  return 0;
+}
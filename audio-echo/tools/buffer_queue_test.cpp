@@ -0,0 +1,261 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Stress tests of the buffer plumbing the audio threads share.
+ *
+ *    buffer_queue_test --queue [--items n]
+ *        one producer and one consumer thread move a counting sequence
+ *        through ProducerConsumerQueues of several sizes, each side
+ *        switching at random between all of its push / pop calls; the
+ *        consumer checks that every item arrives once and in order
+ *    buffer_queue_test --pool [--items n]
+ *        threads hammer SampleBufPool::Acquire()/Release() while another
+ *        one grows the pool; every buffer is filled with its owner's tag
+ *        and checked before it goes back, so a buffer handed out twice
+ *        shows up as a corrupted tag
+ *
+ * The exit status is 1 when a check failed. Build with
+ * -fsanitize=thread to have the memory ordering checked as well.
+ */
+#include <atomic>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <thread>
+#include <vector>
+#include "buf_manager.h"
+#include "producer_consumer_queue.h"
+
+static std::atomic<uint32_t> failures(0);
+
+#define CHECK(cond, ...)                                              \
+  do {                                                                \
+    if (!(cond) && failures.fetch_add(1) < 10) {                      \
+      fprintf(stderr, "%s:%d: %s: ", __FILE__, __LINE__, #cond);      \
+      fprintf(stderr, __VA_ARGS__);                                   \
+      fprintf(stderr, "\n");                                          \
+    }                                                                 \
+  } while (0)
+
+static const uint32_t kMaxBatch = 7;
+
+static void Produce(ProducerConsumerQueue<uint32_t> *queue, uint32_t items,
+                    uint32_t seed) {
+  std::mt19937 random(seed);
+  uint32_t next = 0;
+  while (next < items) {
+    uint32_t batch = 1 + random() % kMaxBatch;
+    if (batch > items - next) batch = items - next;
+    uint32_t pushed = 0;
+    switch (random() % 4) {
+      case 0:
+        pushed = queue->push(next) ? 1 : 0;
+        break;
+      case 1: {
+        uint32_t values[kMaxBatch];
+        for (uint32_t idx = 0; idx < batch; idx++) {
+          values[idx] = next + idx;
+        }
+        pushed = queue->push_n(values, batch);
+        break;
+      }
+      case 2: {
+        uint32_t *span = nullptr;
+        pushed = queue->reserve_write(batch, &span);
+        for (uint32_t idx = 0; idx < pushed; idx++) {
+          span[idx] = next + idx;
+        }
+        if (pushed) queue->commit(pushed);
+        break;
+      }
+      default: {
+        uint32_t *slot = queue->getWriteablePtr();
+        if (slot) {
+          *slot = next;
+          pushed = queue->commitWriteablePtr(slot) ? 1 : 0;
+        }
+        break;
+      }
+    }
+    CHECK(queue->size() <= queue->capacity(), "%u queued, capacity %u",
+          queue->size(), queue->capacity());
+    next += pushed;
+    if (!pushed) std::this_thread::yield();
+  }
+}
+
+static void Consume(ProducerConsumerQueue<uint32_t> *queue, uint32_t items,
+                    uint32_t seed) {
+  std::mt19937 random(seed);
+  uint32_t expected = 0;
+  while (expected < items) {
+    uint32_t values[kMaxBatch];
+    uint32_t popped = 0;
+    if (random() % 2) {
+      if (queue->front(&values[0])) {
+        queue->pop();
+        popped = 1;
+      }
+    } else {
+      popped = queue->pop_n(values, 1 + random() % kMaxBatch);
+    }
+    for (uint32_t idx = 0; idx < popped; idx++, expected++) {
+      CHECK(values[idx] == expected, "got %u, expected %u", values[idx],
+            expected);
+      if (values[idx] != expected) return;
+    }
+    if (!popped) std::this_thread::yield();
+  }
+  CHECK(queue->size() == 0, "%u items left", queue->size());
+}
+
+static void TestQueue(uint32_t items) {
+  // 1 and 3 are not powers of 2: the capacity is not the storage size
+  for (uint32_t size : {1u, 3u, 16u, 1000u}) {
+    ProducerConsumerQueue<uint32_t> queue(size);
+    CHECK(queue.capacity() == size, "capacity %u", queue.capacity());
+    std::thread producer(Produce, &queue, items, size);
+    std::thread consumer(Consume, &queue, items, size + 1);
+    producer.join();
+    consumer.join();
+    printf("queue of %4u: %u items in order\n", size, items);
+  }
+}
+
+static const uint32_t kPoolThreads = 4;
+static const uint32_t kPoolBufSize = 96;
+
+static void UseBuffers(SampleBufPool *pool, uint32_t cycles, uint8_t tag,
+                       uint32_t seed, uint32_t *starved) {
+  std::mt19937 random(seed);
+  std::vector<sample_buf *> held;
+  for (uint32_t cycle = 0; cycle < cycles; cycle++) {
+    uint32_t want = 1 + random() % 4;
+    for (uint32_t idx = 0; idx < want; idx++) {
+      sample_buf *buf = pool->Acquire();
+      if (!buf) {
+        (*starved)++;
+        break;
+      }
+      CHECK(buf->cap_ == kPoolBufSize && buf->size_ == 0,
+            "cap %u size %u", buf->cap_, buf->size_);
+      memset(buf->buf_, tag, buf->cap_);
+      buf->size_ = buf->cap_;
+      held.push_back(buf);
+    }
+    if (random() % 8 == 0) std::this_thread::yield();
+    for (sample_buf *buf : held) {
+      bool intact = true;
+      for (uint32_t idx = 0; idx < buf->cap_; idx++) {
+        intact = intact && buf->buf_[idx] == tag;
+      }
+      CHECK(intact, "buffer %p shared with another thread", buf->buf_);
+      pool->Release(buf);
+    }
+    held.clear();
+  }
+}
+
+static void TestPool(uint32_t cycles) {
+  SampleBufPool pool(kPoolBufSize);
+  CHECK(pool.Grow(8) == 8, "initial buffers");
+
+  uint32_t starved[kPoolThreads] = {0};
+  std::vector<std::thread> threads;
+  for (uint32_t idx = 0; idx < kPoolThreads; idx++) {
+    threads.emplace_back(UseBuffers, &pool, cycles,
+                         static_cast<uint8_t>(idx + 1), idx, &starved[idx]);
+  }
+  // grows while the buffers are in use, as the app's control thread may
+  for (int grow = 0; grow < 3; grow++) {
+    std::this_thread::yield();
+    CHECK(pool.Grow(4) == 4, "grow %d", grow);
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  uint32_t totalStarved = 0;
+  for (uint32_t count : starved) {
+    totalStarved += count;
+  }
+  CHECK(pool.bufCount() == 20, "%u buffers", pool.bufCount());
+  CHECK(pool.freeCount() == pool.bufCount(), "%u of %u buffers free",
+        pool.freeCount(), pool.bufCount());
+  CHECK(pool.highWaterMark() <= pool.bufCount(), "high water mark %u",
+        pool.highWaterMark());
+  CHECK(pool.starvationCount() == totalStarved, "%u starved, counted %u",
+        pool.starvationCount(), totalStarved);
+
+  // all of them come out once, then the pool starves
+  std::vector<sample_buf *> all;
+  while (sample_buf *buf = pool.Acquire()) {
+    all.push_back(buf);
+  }
+  CHECK(all.size() == pool.bufCount(), "%zu buffers acquired", all.size());
+  for (size_t idx = 0; idx < all.size(); idx++) {
+    CHECK(reinterpret_cast<uintptr_t>(all[idx]->buf_) % CACHE_ALIGN == 0,
+          "buffer %zu not cache line aligned", idx);
+    CHECK(pool.GetBuf(pool.GetHandle(all[idx])) == all[idx],
+          "buffer %zu does not come back from its handle", idx);
+    for (size_t other = 0; other < idx; other++) {
+      CHECK(all[idx] != all[other], "buffer %zu handed out twice", idx);
+    }
+    pool.Release(all[idx]);
+  }
+  printf("pool: %u threads x %u cycles, high water mark %u, starved %u\n",
+         kPoolThreads, cycles, pool.highWaterMark(), pool.starvationCount());
+}
+
+static void Usage(const char *name) {
+  fprintf(stderr, "usage: %s --queue | --pool [--items n]\n", name);
+}
+
+int main(int argc, char *argv[]) {
+  bool queue = false, pool = false;
+  uint32_t items = 0;
+  for (int idx = 1; idx < argc; idx++) {
+    const char *arg = argv[idx];
+    if (!strcmp(arg, "--queue")) {
+      queue = true;
+    } else if (!strcmp(arg, "--pool")) {
+      pool = true;
+    } else if (!strcmp(arg, "--items") && idx + 1 < argc) {
+      items = static_cast<uint32_t>(atoi(argv[++idx]));
+    } else {
+      Usage(argv[0]);
+      return 2;
+    }
+  }
+  if (queue == pool) {
+    Usage(argv[0]);
+    return 2;
+  }
+
+  if (queue) {
+    TestQueue(items ? items : 1000000);
+  } else {
+    TestPool(items ? items : 100000);
+  }
+  if (failures) {
+    fprintf(stderr, "%u checks failed\n", failures.load());
+    return 1;
+  }
+  return 0;
+}
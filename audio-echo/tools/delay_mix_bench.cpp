@@ -0,0 +1,131 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Time of every delay mix kernel the CPU runs, per frame.
+ *
+ *    delay_mix_bench [--seconds 1] [--frames 192]
+ *
+ * Mixes blocks of --frames mono frames (the app's buffer size by default)
+ * in place, as AudioDelay does, for --seconds per kernel and sample format,
+ * and prints the best of a few runs in ns per frame with the speed up over
+ * the scalar kernel.
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "audio_effect_kernels.h"
+
+typedef std::chrono::steady_clock Clock;
+
+static const int kRuns = 5;
+
+/*
+ * Calls mix() over a block for seconds / kRuns, kRuns times
+ * @return the fastest run in ns per frame
+ */
+template <typename Mix>
+static double TimeKernel(Mix mix, int32_t frames, double seconds) {
+  double best = 0.0;
+  for (int run = 0; run < kRuns; run++) {
+    Clock::time_point start = Clock::now();
+    Clock::time_point end =
+        start + std::chrono::duration_cast<Clock::duration>(
+                    std::chrono::duration<double>(seconds / kRuns));
+    uint64_t calls = 0;
+    Clock::time_point now;
+    do {
+      for (int batch = 0; batch < 64; batch++) {
+        mix();
+      }
+      calls += 64;
+      now = Clock::now();
+    } while (now < end);
+    double ns = std::chrono::duration<double, std::nano>(now - start).count() /
+                (static_cast<double>(calls) * frames);
+    if (run == 0 || ns < best) best = ns;
+  }
+  return best;
+}
+
+static void Usage(const char *name) {
+  fprintf(stderr, "usage: %s [--seconds s] [--frames n]\n", name);
+}
+
+int main(int argc, char *argv[]) {
+  double seconds = 1.0;
+  int32_t frames = 192;
+  for (int idx = 1; idx < argc; idx++) {
+    const char *arg = argv[idx];
+    if (idx + 1 >= argc) {
+      Usage(argv[0]);
+      return 2;
+    }
+    const char *value = argv[++idx];
+    if (!strcmp(arg, "--seconds")) {
+      seconds = atof(value);
+    } else if (!strcmp(arg, "--frames")) {
+      frames = atoi(value);
+    } else {
+      Usage(argv[0]);
+      return 2;
+    }
+  }
+  if (seconds <= 0.0 || frames <= 0) {
+    Usage(argv[0]);
+    return 2;
+  }
+
+  std::vector<int16_t> liveI16(frames), delayI16(frames);
+  std::vector<float> liveF32(frames), delayF32(frames);
+  for (int32_t idx = 0; idx < frames; idx++) {
+    liveI16[idx] = static_cast<int16_t>(idx * 97);
+    delayI16[idx] = static_cast<int16_t>(idx * -31);
+    liveF32[idx] = liveI16[idx] / 32768.0f;
+    delayF32[idx] = delayI16[idx] / 32768.0f;
+  }
+
+  const DelayMixKernels *kernels[kMaxDelayMixKernels];
+  int32_t count = GetSupportedDelayMixKernels(kernels, kMaxDelayMixKernels);
+  printf("%d frames per block, %s selected\n", frames,
+         GetDelayMixKernels().name_);
+  double scalarI16 = 0.0, scalarF32 = 0.0;
+  for (int32_t set = 0; set < count; set++) {
+    const DelayMixKernels &mix = *kernels[set];
+    // in place, the samples keep moving between the two buffers
+    double nsI16 = TimeKernel(
+        [&] {
+          mix.mixI16_(liveI16.data(), delayI16.data(), delayI16.data(), frames,
+                      kDelayMixScale / 2, kDelayMixScale / 2);
+        },
+        frames, seconds / 2);
+    double nsF32 = TimeKernel(
+        [&] {
+          mix.mixF32_(liveF32.data(), delayF32.data(), delayF32.data(), frames,
+                      0.5f, 0.5f);
+        },
+        frames, seconds / 2);
+    if (set == 0) {
+      scalarI16 = nsI16;
+      scalarF32 = nsF32;
+    }
+    printf("%-8s int16 %7.3f ns/frame (x%5.2f), float %7.3f ns/frame (x%5.2f)\n",
+           mix.name_, nsI16, scalarI16 / nsI16, nsF32, scalarF32 / nsF32);
+  }
+  return 0;
+}
@@ -0,0 +1,194 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Checks every delay mix kernel the CPU runs against the scalar one.
+ *
+ *    delay_mix_test [--blocks n]
+ *
+ * Random blocks of every length up to a few vectors, then random lengths
+ * up to a few thousand samples, so each kernel ends on every tail length;
+ * the blocks start at odd offsets and are mixed both in place (delayIn ==
+ * delayOut, as AudioDelay does when the tap meets the write head) and
+ * into a separate buffer. The weights cover 0..kDelayMixScale on both
+ * inputs, samples include the int16 extremes so the saturation is hit.
+ * The int16 results have to be bit-exact; the float ones within rounding,
+ * as the compiler may fuse the scalar multiply-add. Samples past the end
+ * of a block must not be touched. The exit status is 1 on a mismatch.
+ */
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+#include "audio_effect_kernels.h"
+
+static uint32_t failures = 0;
+
+#define CHECK(cond, ...)                                              \
+  do {                                                                \
+    if (!(cond) && failures++ < 10) {                                 \
+      fprintf(stderr, "%s:%d: %s: ", __FILE__, __LINE__, #cond);      \
+      fprintf(stderr, __VA_ARGS__);                                   \
+      fprintf(stderr, "\n");                                          \
+    }                                                                 \
+  } while (0)
+
+// past the end of every block, must come out unchanged
+static const int32_t kGuard = 16;
+static const int16_t kGuardI16 = 0x5a5a;
+static const float kGuardF32 = 1234.5f;
+
+static int16_t RandomSample(std::mt19937 *random) {
+  switch ((*random)() % 8) {
+    case 0:
+      return INT16_MAX;
+    case 1:
+      return INT16_MIN;
+    default:
+      return static_cast<int16_t>((*random)());
+  }
+}
+
+/*
+ * One block through kernels and the scalar reference, on copies of the
+ * same input at the same offset
+ */
+static void CheckI16(const DelayMixKernels &kernels, int32_t count,
+                     int32_t offset, bool inPlace, std::mt19937 *random) {
+  int32_t size = offset + count + kGuard;
+  std::vector<int16_t> live(size, kGuardI16), delay(size, kGuardI16);
+  std::vector<int16_t> out(size, kGuardI16);
+  for (int32_t idx = offset; idx < offset + count; idx++) {
+    live[idx] = RandomSample(random);
+    delay[idx] = RandomSample(random);
+  }
+  int32_t feedback = (*random)() % (kDelayMixScale + 1);
+  int32_t liveFactor = (*random)() % 2 ? kDelayMixScale - feedback
+                                       : (*random)() % (kDelayMixScale + 1);
+
+  std::vector<int16_t> refLive(live), refDelay(delay), refOut(out);
+  int16_t *refDelayOut = inPlace ? refDelay.data() : refOut.data();
+  GetScalarDelayMixKernels().mixI16_(
+      refLive.data() + offset, refDelay.data() + offset, refDelayOut + offset,
+      count, feedback, liveFactor);
+  int16_t *delayOut = inPlace ? delay.data() : out.data();
+  kernels.mixI16_(live.data() + offset, delay.data() + offset,
+                  delayOut + offset, count, feedback, liveFactor);
+
+  for (int32_t idx = 0; idx < size; idx++) {
+    CHECK(live[idx] == refLive[idx] && delayOut[idx] == refDelayOut[idx],
+          "%s int16, %d samples at %d%s, factors %d/%d: sample %d is "
+          "%d/%d, scalar %d/%d",
+          kernels.name_, count, offset, inPlace ? " in place" : "", feedback,
+          liveFactor, idx - offset, live[idx], delayOut[idx], refLive[idx],
+          refDelayOut[idx]);
+  }
+}
+
+static bool CloseEnough(float value, float reference) {
+  return std::fabs(value - reference) <=
+         1e-6f * (std::fabs(value) + std::fabs(reference));
+}
+
+static void CheckF32(const DelayMixKernels &kernels, int32_t count,
+                     int32_t offset, bool inPlace, std::mt19937 *random) {
+  int32_t size = offset + count + kGuard;
+  std::vector<float> live(size, kGuardF32), delay(size, kGuardF32);
+  std::vector<float> out(size, kGuardF32);
+  std::uniform_real_distribution<float> sample(-1.0f, 1.0f);
+  for (int32_t idx = offset; idx < offset + count; idx++) {
+    live[idx] = sample(*random);
+    delay[idx] = sample(*random);
+  }
+  float feedback =
+      static_cast<float>((*random)() % (kDelayMixScale + 1)) / kDelayMixScale;
+  float liveWeight = (*random)() % 2 ? 1.0f - feedback
+                                     : std::uniform_real_distribution<float>(
+                                           0.0f, 1.0f)(*random);
+
+  std::vector<float> refLive(live), refDelay(delay), refOut(out);
+  float *refDelayOut = inPlace ? refDelay.data() : refOut.data();
+  GetScalarDelayMixKernels().mixF32_(
+      refLive.data() + offset, refDelay.data() + offset, refDelayOut + offset,
+      count, feedback, liveWeight);
+  float *delayOut = inPlace ? delay.data() : out.data();
+  kernels.mixF32_(live.data() + offset, delay.data() + offset,
+                  delayOut + offset, count, feedback, liveWeight);
+
+  for (int32_t idx = 0; idx < size; idx++) {
+    CHECK(live[idx] == refLive[idx] &&
+              CloseEnough(delayOut[idx], refDelayOut[idx]),
+          "%s float, %d samples at %d%s, weights %f/%f: sample %d is "
+          "%f/%f, scalar %f/%f",
+          kernels.name_, count, offset, inPlace ? " in place" : "", feedback,
+          liveWeight, idx - offset, live[idx], delayOut[idx], refLive[idx],
+          refDelayOut[idx]);
+  }
+}
+
+static void Usage(const char *name) {
+  fprintf(stderr, "usage: %s [--blocks n]\n", name);
+}
+
+int main(int argc, char *argv[]) {
+  int32_t blocks = 2000;
+  for (int idx = 1; idx < argc; idx++) {
+    if (!strcmp(argv[idx], "--blocks") && idx + 1 < argc) {
+      blocks = atoi(argv[++idx]);
+    } else {
+      Usage(argv[0]);
+      return 2;
+    }
+  }
+  if (blocks <= 0) {
+    Usage(argv[0]);
+    return 2;
+  }
+
+  const DelayMixKernels *kernels[kMaxDelayMixKernels];
+  int32_t count = GetSupportedDelayMixKernels(kernels, kMaxDelayMixKernels);
+  CHECK(kernels[count - 1] == &GetDelayMixKernels(),
+        "%s is selected, %s is the last supported", GetDelayMixKernels().name_,
+        kernels[count - 1]->name_);
+
+  // 3 * 16: the widest kernel takes 16 int16 samples per iteration
+  static const int32_t kShortest = 3 * 16;
+  static const int32_t kLongest = 4099;
+  for (int32_t set = 1; set < count; set++) {
+    std::mt19937 random(set);
+    for (int32_t block = 0; block < blocks; block++) {
+      int32_t length =
+          block <= kShortest ? block : 1 + random() % kLongest;
+      int32_t offset = random() % 4;
+      bool inPlace = block % 2;
+      CheckI16(*kernels[set], length, offset, inPlace, &random);
+      CheckF32(*kernels[set], length, offset, inPlace, &random);
+    }
+    printf("%-8s %d blocks match the scalar kernels\n", kernels[set]->name_,
+           blocks);
+  }
+  if (count == 1) {
+    printf("only the scalar kernels run on this CPU\n");
+  }
+
+  if (failures) {
+    fprintf(stderr, "%u checks failed\n", failures);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,141 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Host side replay of the echo path on simulated devices
+ * (RunEchoSimulation(), echo_simulation.h): runs the recorder, player and
+ * delay effect of the app for the given time under scheduling noise and
+ * prints latency, queue depth and xrun numbers.
+ *
+ *    echo_sim [--seconds 10] [--rate 48000] [--frames 192] [--channels 1]
+ *             [--delay 100] [--decay 0.1] [--jitter <us>] [--stall <us>]
+ *             [--stall-probability <p>] [--seed <n>] [--fixed]
+ *             [--in <raw pcm>] [--out <raw pcm>] [--max-underruns <n>]
+ *
+ * --fixed keeps the player at PLAY_KICKSTART_BUFFER_COUNT buffers instead
+ * of the adaptive jitter buffer. The exit status is 1 when nothing was
+ * played or the run had more than --max-underruns underruns.
+ */
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "audio_common.h"
+#include "echo_simulation.h"
+
+static void Usage(const char *name) {
+  fprintf(stderr,
+          "usage: %s [--seconds s] [--rate hz] [--frames n] [--channels n]\n"
+          "       [--delay ms] [--decay w] [--jitter us] [--stall us]\n"
+          "       [--stall-probability p] [--seed n] [--fixed]\n"
+          "       [--in pcm] [--out pcm] [--max-underruns n]\n",
+          name);
+}
+
+int main(int argc, char *argv[]) {
+  EchoSimConfig config;
+  memset(&config, 0, sizeof(config));
+  config.sampleRate_ = 48000 * 1000;
+  config.framesPerBuf_ = 192;
+  config.channels_ = AUDIO_SAMPLE_CHANNELS;
+  config.delayInMs_ = 100;
+  config.decay_ = 0.1f;
+  config.seed_ = 1;
+  config.jitterBuffer_ = {true, PLAY_MAX_UNDERRUN_RATE, PLAY_MIN_BUFFER_DEPTH,
+                          PLAY_MAX_BUFFER_DEPTH};
+  double seconds = 10.0;
+  long maxUnderruns = -1;
+
+  for (int idx = 1; idx < argc; idx++) {
+    const char *arg = argv[idx];
+    if (!strcmp(arg, "--fixed")) {
+      config.jitterBuffer_.adaptive_ = false;
+      continue;
+    }
+    if (idx + 1 >= argc) {
+      Usage(argv[0]);
+      return 2;
+    }
+    const char *value = argv[++idx];
+    if (!strcmp(arg, "--seconds")) {
+      seconds = atof(value);
+    } else if (!strcmp(arg, "--rate")) {
+      config.sampleRate_ = static_cast<uint32_t>(atoi(value)) * 1000;
+    } else if (!strcmp(arg, "--frames")) {
+      config.framesPerBuf_ = static_cast<uint32_t>(atoi(value));
+    } else if (!strcmp(arg, "--channels")) {
+      config.channels_ = static_cast<uint16_t>(atoi(value));
+    } else if (!strcmp(arg, "--delay")) {
+      config.delayInMs_ = static_cast<size_t>(atoi(value));
+    } else if (!strcmp(arg, "--decay")) {
+      config.decay_ = static_cast<float>(atof(value));
+    } else if (!strcmp(arg, "--jitter")) {
+      config.maxJitterUs_ = static_cast<uint32_t>(atoi(value));
+    } else if (!strcmp(arg, "--stall")) {
+      config.stallUs_ = static_cast<uint32_t>(atoi(value));
+    } else if (!strcmp(arg, "--stall-probability")) {
+      config.stallProbability_ = static_cast<float>(atof(value));
+    } else if (!strcmp(arg, "--seed")) {
+      config.seed_ = static_cast<uint32_t>(atoi(value));
+    } else if (!strcmp(arg, "--in")) {
+      config.inputFile_ = value;
+    } else if (!strcmp(arg, "--out")) {
+      config.outputFile_ = value;
+    } else if (!strcmp(arg, "--max-underruns")) {
+      maxUnderruns = atol(value);
+    } else {
+      Usage(argv[0]);
+      return 2;
+    }
+  }
+
+  EchoSimStats stats;
+  if (!RunEchoSimulation(config, static_cast<uint64_t>(seconds * 1000000),
+                         &stats)) {
+    fprintf(stderr, "invalid configuration\n");
+    return 2;
+  }
+
+  printf("%.1f s at %u Hz, %u frames per buffer, %s jitter buffer\n", seconds,
+         config.sampleRate_ / 1000, config.framesPerBuf_,
+         config.jitterBuffer_.adaptive_ ? "adaptive" : "fixed");
+  printf("buffers: %u recorded, %u played\n", stats.recordedBufs_,
+         stats.playedBufs_);
+  printf("xruns: %u recorder overruns, %u player underruns\n",
+         stats.recOverruns_, stats.playUnderruns_);
+  printf("latency: %u buffers, min %" PRIu64 " us, avg %" PRIu64
+         " us, max %" PRIu64 " us\n",
+         stats.latencyCount_, stats.minLatencyUs_, stats.avgLatencyUs_,
+         stats.maxLatencyUs_);
+  printf("recBufQueue depth: avg %.2f, max %u\n", stats.avgRecQueueDepth_,
+         stats.maxRecQueueDepth_);
+  printf("jitter buffer: depth %u, target %u, jitter %u us\n",
+         stats.jitterBuffer_.depth_, stats.jitterBuffer_.targetDepth_,
+         stats.jitterBuffer_.jitterUs_);
+  printf("buffer pool: high water mark %u, starved %u times\n",
+         stats.poolHighWaterMark_, stats.poolStarvationCount_);
+
+  if (!stats.playedBufs_ || !stats.latencyCount_) {
+    fprintf(stderr, "no recorded audio reached the player\n");
+    return 1;
+  }
+  if (maxUnderruns >= 0 && stats.playUnderruns_ > maxUnderruns) {
+    fprintf(stderr, "%u underruns, at most %ld expected\n",
+            stats.playUnderruns_, maxUnderruns);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,339 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Host side runner for AudioEffectChain (audio_effect_chain.h).
+ *
+ *    effect_chain_wav [--gain g] [--delay ms] [--decay w] in.wav out.wav
+ *        runs a 16 bit PCM WAV file through highpass -> gain -> echo ->
+ *        limiter, in buffers of the size the app uses
+ *    effect_chain_wav --bench [--seconds s]
+ *        times gain + clamp + echo as one fused chain stage against the
+ *        separate passes it replaces (two loops and AudioDelay::process()),
+ *        checks that both sound the same, and that the chain output comes
+ *        back unchanged through a WAV file
+ */
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include "audio_effect.h"
+#include "audio_effect_chain.h"
+
+static const int32_t kFramesPerBuf = 192;  // a fast path buffer at 48 kHz
+
+struct WavAudio {
+  uint32_t sampleRate;  // Hz
+  uint16_t channels;
+  std::vector<int16_t> samples;  // interleaved
+};
+
+static uint32_t ReadLE(const uint8_t *bytes, int count) {
+  uint32_t value = 0;
+  for (int idx = count - 1; idx >= 0; idx--) {
+    value = (value << 8) | bytes[idx];
+  }
+  return value;
+}
+
+static void WriteLE(std::vector<uint8_t> *out, uint32_t value, int count) {
+  for (int idx = 0; idx < count; idx++) {
+    out->push_back(static_cast<uint8_t>(value >> (8 * idx)));
+  }
+}
+
+/*
+ * 16 bit PCM WAV files only; chunks other than fmt and data are skipped
+ */
+static bool ReadWav(const char *fileName, WavAudio *audio) {
+  FILE *fp = fopen(fileName, "rb");
+  if (!fp) {
+    fprintf(stderr, "can not open %s\n", fileName);
+    return false;
+  }
+  std::vector<uint8_t> file;
+  uint8_t chunk[4096];
+  size_t count;
+  while ((count = fread(chunk, 1, sizeof(chunk), fp)) != 0) {
+    file.insert(file.end(), chunk, chunk + count);
+  }
+  fclose(fp);
+
+  if (file.size() < 12 || memcmp(&file[0], "RIFF", 4) ||
+      memcmp(&file[8], "WAVE", 4)) {
+    fprintf(stderr, "%s is not a WAV file\n", fileName);
+    return false;
+  }
+  bool haveFormat = false;
+  size_t pos = 12;
+  while (pos + 8 <= file.size()) {
+    uint32_t size = ReadLE(&file[pos + 4], 4);
+    const uint8_t *body = &file[pos + 8];
+    size_t available = file.size() - pos - 8;
+    if (size > available) size = static_cast<uint32_t>(available);
+
+    if (!memcmp(&file[pos], "fmt ", 4) && size >= 16) {
+      if (ReadLE(body, 2) != 1 || ReadLE(body + 14, 2) != 16) {
+        fprintf(stderr, "%s: only 16 bit PCM is supported\n", fileName);
+        return false;
+      }
+      audio->channels = static_cast<uint16_t>(ReadLE(body + 2, 2));
+      audio->sampleRate = ReadLE(body + 4, 4);
+      haveFormat = audio->channels != 0 && audio->sampleRate != 0;
+    } else if (!memcmp(&file[pos], "data", 4) && haveFormat) {
+      audio->samples.resize(size / sizeof(int16_t));
+      for (size_t idx = 0; idx < audio->samples.size(); idx++) {
+        audio->samples[idx] =
+            static_cast<int16_t>(ReadLE(body + 2 * idx, 2));
+      }
+      return true;
+    }
+    pos += 8 + size + (size & 1);
+  }
+  fprintf(stderr, "%s has no audio\n", fileName);
+  return false;
+}
+
+static bool WriteWav(const char *fileName, const WavAudio &audio) {
+  uint32_t dataSize =
+      static_cast<uint32_t>(audio.samples.size() * sizeof(int16_t));
+  std::vector<uint8_t> header;
+  header.insert(header.end(), {'R', 'I', 'F', 'F'});
+  WriteLE(&header, 36 + dataSize, 4);
+  header.insert(header.end(), {'W', 'A', 'V', 'E', 'f', 'm', 't', ' '});
+  WriteLE(&header, 16, 4);
+  WriteLE(&header, 1, 2);  // PCM
+  WriteLE(&header, audio.channels, 2);
+  WriteLE(&header, audio.sampleRate, 4);
+  WriteLE(&header, audio.sampleRate * audio.channels * 2, 4);
+  WriteLE(&header, audio.channels * 2, 2);
+  WriteLE(&header, 16, 2);
+  header.insert(header.end(), {'d', 'a', 't', 'a'});
+  WriteLE(&header, dataSize, 4);
+
+  std::vector<uint8_t> data;
+  data.reserve(dataSize);
+  for (int16_t sample : audio.samples) {
+    WriteLE(&data, static_cast<uint16_t>(sample), 2);
+  }
+
+  FILE *fp = fopen(fileName, "wb");
+  if (!fp) {
+    fprintf(stderr, "can not create %s\n", fileName);
+    return false;
+  }
+  bool ok = fwrite(header.data(), 1, header.size(), fp) == header.size() &&
+            fwrite(data.data(), 1, data.size(), fp) == data.size();
+  ok = (fclose(fp) == 0) && ok;
+  return ok;
+}
+
+// run audio through process() the way the player callbacks would
+template <typename P>
+static void ProcessInBuffers(std::vector<int16_t> *samples, int32_t channels,
+                             P process) {
+  int32_t frames = static_cast<int32_t>(samples->size() / channels);
+  for (int32_t frame = 0; frame < frames; frame += kFramesPerBuf) {
+    process(samples->data() + frame * channels,
+            std::min(kFramesPerBuf, frames - frame));
+  }
+}
+
+static int RunFile(const char *inName, const char *outName, float gain,
+                   size_t delayInMs, float decay) {
+  WavAudio audio;
+  if (!ReadWav(inName, &audio)) return 1;
+
+  AudioEffectChain chain(static_cast<int32_t>(audio.sampleRate * 1000),
+                         audio.channels, SL_PCMSAMPLEFORMAT_FIXED_16,
+                         kFramesPerBuf);
+  AudioEffectChain::NodeId node = chain.addBiquad(
+      AudioEffectChain::kChainInput, AudioEffectChain::BIQUAD_HIGHPASS,
+      80.0f, 0.707f, 0.0f);
+  node = chain.addGain(node, gain);
+  node = chain.addDelay(node, delayInMs, decay);
+  node = chain.addLimiter(node, 0.9f, 50.0f);
+  if (!chain.build(node)) {
+    fprintf(stderr, "can not build the effect chain\n");
+    return 1;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  ProcessInBuffers(&audio.samples, audio.channels,
+                   [&chain](int16_t *buf, int32_t frames) {
+                     chain.process(buf, frames);
+                   });
+  double ms = std::chrono::duration<double, std::milli>(
+                  std::chrono::steady_clock::now() - start)
+                  .count();
+  double seconds = static_cast<double>(audio.samples.size()) /
+                   audio.channels / audio.sampleRate;
+  printf("%.1f s of audio processed in %.1f ms\n", seconds, ms);
+  return WriteWav(outName, audio) ? 0 : 1;
+}
+
+static int RunBench(double seconds) {
+  const uint32_t sampleRate = 48000;
+  const int32_t channels = 1;
+  // 0.375 is 48 / 128, the same feedback in the Q7 of AudioDelay as in the
+  // float of the chain
+  const float gain = 1.5f, limit = 0.8f, decay = 0.375f;
+  const size_t delayInMs = 150;
+
+  // a tone with noise, loud enough for the gain to clip
+  WavAudio source = {sampleRate, channels, {}};
+  source.samples.resize(static_cast<size_t>(seconds * sampleRate) * channels);
+  std::mt19937 random(1);
+  std::uniform_real_distribution<float> noise(-0.1f, 0.1f);
+  for (size_t idx = 0; idx < source.samples.size(); idx++) {
+    float value = 0.6f * std::sin(idx * 2.0f * 3.14159265f * 440 / sampleRate) +
+                  noise(random);
+    source.samples[idx] = static_cast<int16_t>(value * 32767);
+  }
+
+  // separate passes: gain, clamp, then the echo of the app
+  std::vector<int16_t> passes = source.samples;
+  AudioDelay delay(static_cast<int32_t>(sampleRate * 1000), channels,
+                   SL_PCMSAMPLEFORMAT_FIXED_16, delayInMs, decay);
+  const int32_t limitSample = static_cast<int32_t>(limit * 32767);
+  auto start = std::chrono::steady_clock::now();
+  ProcessInBuffers(&passes, channels, [&](int16_t *buf, int32_t frames) {
+    int32_t count = frames * channels;
+    for (int32_t idx = 0; idx < count; idx++) {
+      float value = buf[idx] * gain;
+      value = std::min(std::max(value, -32768.0f), 32767.0f);
+      buf[idx] = static_cast<int16_t>(value);
+    }
+    for (int32_t idx = 0; idx < count; idx++) {
+      buf[idx] = static_cast<int16_t>(
+          std::min(std::max<int32_t>(buf[idx], -limitSample), limitSample));
+    }
+    delay.process(buf, frames);
+  });
+  double passesMs = std::chrono::duration<double, std::milli>(
+                        std::chrono::steady_clock::now() - start)
+                        .count();
+
+  // the same as one fused stage
+  std::vector<int16_t> fused = source.samples;
+  AudioEffectChain chain(static_cast<int32_t>(sampleRate * 1000), channels,
+                         SL_PCMSAMPLEFORMAT_FIXED_16, kFramesPerBuf);
+  AudioEffectChain::NodeId node =
+      chain.addGain(AudioEffectChain::kChainInput, gain);
+  node = chain.addClamp(node, limit);
+  node = chain.addDelay(node, delayInMs, decay);
+  if (!chain.build(node)) {
+    fprintf(stderr, "can not build the effect chain\n");
+    return 1;
+  }
+  start = std::chrono::steady_clock::now();
+  ProcessInBuffers(&fused, channels, [&chain](int16_t *buf, int32_t frames) {
+    chain.process(buf, frames);
+  });
+  double fusedMs = std::chrono::duration<double, std::milli>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+
+  double frames = static_cast<double>(source.samples.size()) / channels;
+  printf("%.0f s of %u Hz audio in %d frame buffers\n", seconds, sampleRate,
+         kFramesPerBuf);
+  printf("separate passes: %7.2f ms, %6.2f ns/frame\n", passesMs,
+         passesMs * 1e6 / frames);
+  printf("fused chain:     %7.2f ms, %6.2f ns/frame\n", fusedMs,
+         fusedMs * 1e6 / frames);
+
+  // AudioDelay mixes int16 in Q7 fixed point, the chain in float: they
+  // round differently, by a step or two
+  int32_t maxDiff = 0;
+  for (size_t idx = 0; idx < fused.size(); idx++) {
+    maxDiff = std::max(maxDiff, std::abs(fused[idx] - passes[idx]));
+  }
+  printf("largest difference: %d\n", maxDiff);
+  if (maxDiff > 2) {
+    fprintf(stderr, "the fused chain does not match the separate passes\n");
+    return 1;
+  }
+
+  std::string wavName = "effect_chain_bench.wav";
+  WavAudio written = {sampleRate, channels, fused};
+  WavAudio read;
+  if (!WriteWav(wavName.c_str(), written) || !ReadWav(wavName.c_str(), &read)) {
+    return 1;
+  }
+  remove(wavName.c_str());
+  if (read.sampleRate != sampleRate || read.channels != channels ||
+      read.samples != fused) {
+    fprintf(stderr, "the WAV file did not read back unchanged\n");
+    return 1;
+  }
+  return 0;
+}
+
+static void Usage(const char *name) {
+  fprintf(stderr,
+          "usage: %s [--gain g] [--delay ms] [--decay w] in.wav out.wav\n"
+          "       %s --bench [--seconds s]\n",
+          name, name);
+}
+
+int main(int argc, char *argv[]) {
+  bool bench = false;
+  double seconds = 30.0;
+  float gain = 1.0f, decay = 0.3f;
+  size_t delayInMs = 150;
+  std::vector<const char *> files;
+
+  for (int idx = 1; idx < argc; idx++) {
+    const char *arg = argv[idx];
+    if (!strcmp(arg, "--bench")) {
+      bench = true;
+    } else if (arg[0] == '-' && arg[1] == '-') {
+      if (idx + 1 >= argc) {
+        Usage(argv[0]);
+        return 2;
+      }
+      const char *value = argv[++idx];
+      if (!strcmp(arg, "--seconds")) {
+        seconds = atof(value);
+      } else if (!strcmp(arg, "--gain")) {
+        gain = static_cast<float>(atof(value));
+      } else if (!strcmp(arg, "--delay")) {
+        delayInMs = static_cast<size_t>(atoi(value));
+      } else if (!strcmp(arg, "--decay")) {
+        decay = static_cast<float>(atof(value));
+      } else {
+        Usage(argv[0]);
+        return 2;
+      }
+    } else {
+      files.push_back(arg);
+    }
+  }
+
+  if (bench) {
+    return RunBench(seconds);
+  }
+  if (files.size() != 2) {
+    Usage(argv[0]);
+    return 2;
+  }
+  return RunFile(files[0], files[1], gain, delayInMs, decay);
+}
@@ -0,0 +1,205 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Host side decoder for the binary trace audio-echo writes (debug_utils.h).
+ * It is one of the host tools built by CMakeLists.txt here, or by hand:
+ *    g++ -std=c++14 -I../app/src/main/cpp trace_decode.cpp -o trace_decode
+ *    adb pull /sdcard/data/audio_echo.trace
+ *    adb pull /sdcard/data/audio_echo.trace.1    (when the trace rotated)
+ *    ./trace_decode audio_echo.trace.1 audio_echo.trace
+ * It prints histograms of the player / recorder callback periods, of the
+ * queue depths seen in the callbacks and of the echo effect durations.
+ */
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <map>
+#include <vector>
+#include "debug_utils.h"
+
+static const int kBarWidth = 50;
+
+/*
+ * Histogram of unsigned values: one bucket per value for small ones
+ * (queue depths), power of 2 buckets for durations
+ */
+class Histogram {
+ public:
+  explicit Histogram(bool log2) : log2_(log2), count_(0), sum_(0), max_(0) {}
+
+  void Add(uint64_t value) {
+    buckets_[log2_ ? Bucket(value) : value]++;
+    count_++;
+    sum_ += value;
+    max_ = std::max(max_, value);
+  }
+
+  void Print(const char *title, const char *unit) const {
+    printf("%s: %" PRIu64 " samples", title, count_);
+    if (!count_) {
+      printf("\n\n");
+      return;
+    }
+    printf(", avg %.1f %s, max %" PRIu64 " %s\n",
+           static_cast<double>(sum_) / count_, unit, max_, unit);
+
+    uint64_t peak = 0;
+    for (auto &bucket : buckets_) peak = std::max(peak, bucket.second);
+    for (auto &bucket : buckets_) {
+      if (log2_) {
+        uint64_t high = (static_cast<uint64_t>(1) << bucket.first) - 1;
+        printf("  %8" PRIu64 " - %-8" PRIu64, (high + 1) >> 1, high);
+      } else {
+        printf("  %19" PRIu64, bucket.first);
+      }
+      int bar = static_cast<int>(bucket.second * kBarWidth / peak);
+      printf(" %8" PRIu64 " |%.*s\n", bucket.second, std::max(bar, 1),
+             "##################################################");
+    }
+    printf("\n");
+  }
+
+ private:
+  // bucket n holds [2^(n-1), 2^n)
+  static uint64_t Bucket(uint64_t value) {
+    uint64_t bucket = 0;
+    while (value) {
+      value >>= 1;
+      bucket++;
+    }
+    return bucket;
+  }
+
+  bool log2_;
+  std::map<uint64_t, uint64_t> buckets_;
+  uint64_t count_;
+  uint64_t sum_;
+  uint64_t max_;
+};
+
+struct CallbackStats {
+  CallbackStats() : last_(0), period_(true), devQueue_(false),
+                    appQueue_(false) {}
+  uint64_t last_;
+  Histogram period_;  // micro seconds
+  Histogram devQueue_;
+  Histogram appQueue_;
+};
+
+static void AddCallback(CallbackStats *stats, const TraceRecord &record) {
+  if (stats->last_) {
+    stats->period_.Add((record.time_ - stats->last_) / 1000);
+  }
+  stats->last_ = record.time_;
+  stats->devQueue_.Add(static_cast<uint64_t>(std::max(record.arg0_, 0)));
+  stats->appQueue_.Add(static_cast<uint64_t>(std::max(record.arg1_, 0)));
+}
+
+// append the records of fileName to records
+static bool ReadTraceFile(const char *fileName,
+                          std::vector<TraceRecord> *records) {
+  FILE *fp = fopen(fileName, "rb");
+  if (!fp) {
+    fprintf(stderr, "can not open %s\n", fileName);
+    return false;
+  }
+  TraceFileHeader header;
+  if (fread(&header, sizeof(header), 1, fp) != 1 ||
+      header.magic_ != TRACE_FILE_MAGIC ||
+      header.version_ != TRACE_FILE_VERSION ||
+      header.recordSize_ != sizeof(TraceRecord)) {
+    fprintf(stderr, "%s is not an audio-echo trace\n", fileName);
+    fclose(fp);
+    return false;
+  }
+  TraceRecord record;
+  while (fread(&record, sizeof(record), 1, fp) == 1) {
+    records->push_back(record);
+  }
+  fclose(fp);
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <trace file> [<trace file> ...]\n", argv[0]);
+    return 1;
+  }
+  std::vector<TraceRecord> records;
+  for (int idx = 1; idx < argc; idx++) {
+    if (!ReadTraceFile(argv[idx], &records)) {
+      return 1;
+    }
+  }
+
+  // the drain thread writes one thread ring after the other, and rotated
+  // files may come in any order
+  std::stable_sort(records.begin(), records.end(),
+                   [](const TraceRecord &a, const TraceRecord &b) {
+                     return a.time_ < b.time_;
+                   });
+
+  CallbackStats play, rec;
+  Histogram effect(true);  // micro seconds
+  std::map<uint32_t, uint64_t> effectBegin;  // per thread
+  uint64_t underruns = 0;
+  int32_t dropped = 0;
+  for (auto &r : records) {
+    switch (r.event_) {
+      case TRACE_PLAY_CALLBACK:
+        AddCallback(&play, r);
+        break;
+      case TRACE_PLAY_UNDERRUN:
+        underruns++;
+        break;
+      case TRACE_REC_CALLBACK:
+        AddCallback(&rec, r);
+        break;
+      case TRACE_EFFECT_BEGIN:
+        effectBegin[r.thread_] = r.time_;
+        break;
+      case TRACE_EFFECT_END: {
+        auto begin = effectBegin.find(r.thread_);
+        if (begin != effectBegin.end() && begin->second) {
+          effect.Add((r.time_ - begin->second) / 1000);
+          begin->second = 0;
+        }
+        break;
+      }
+      case TRACE_DROPPED:
+        dropped = std::max(dropped, r.arg0_);
+        break;
+      default:
+        break;
+    }
+  }
+
+  double span = records.empty()
+                    ? 0.0
+                    : (records.back().time_ - records.front().time_) / 1e9;
+  printf("%zu records over %.3f s, %" PRIu64 " player underruns, ",
+         records.size(), span, underruns);
+  printf("%d dropped\n\n", dropped);
+  play.period_.Print("player callback period", "us");
+  play.devQueue_.Print("player device queue depth", "bufs");
+  play.appQueue_.Print("player play queue depth", "bufs");
+  rec.period_.Print("recorder callback period", "us");
+  rec.devQueue_.Print("recorder device queue depth", "bufs");
+  rec.appQueue_.Print("recorded queue depth", "bufs");
+  effect.Print("echo effect duration", "us");
+  return 0;
+}
@@ -34,6 +34,11 @@ CameraEngine::CameraEngine(android_app* app)
       cameraReady_(false),
       yuvReader_(nullptr),
       jpgReader_(nullptr),
+      framePending_(false),
+      analyzer_(nullptr),
+      histogram_(nullptr),
+      preview_(nullptr),
+      cpuPreview_(false),
       camera_(nullptr) {
   memset(&savedNativeWinRes_, 0, sizeof(savedNativeWinRes_));
 }
@@ -89,6 +94,12 @@ void CameraEngine::CreateCamera(void) {
 
   yuvReader_ = new ImageReader(&view, AIMAGE_FORMAT_YUV_420_888);
   yuvReader_->SetPresentRotation(imageRotation);
+
+  // exposure statistics of every 3rd preview frame, luma decimated 4x
+  analyzer_ = new FrameAnalyzer();
+  histogram_ = new LumaHistogram(3, 4);
+  analyzer_->AddProcessor(histogram_);
+  yuvReader_->SetFrameAnalyzer(analyzer_);
   jpgReader_ = new ImageReader(&capture, AIMAGE_FORMAT_JPEG);
   jpgReader_->SetPresentRotation(imageRotation);
   jpgReader_->RegisterCallback(this, [this](void* ctx, const char* str) -> void {
@@ -102,6 +113,17 @@ void CameraEngine::CreateCamera(void) {
 
 void CameraEngine::DeleteCamera(void) {
   cameraReady_ = false;
+  PostFrame();
+  if (preview_) {
+    FrameUploader::Stats stats = preview_->Uploader()->GetStats();
+    LOGI("Frames uploaded: %llu, dropped: %llu, waited for: %llu",
+         static_cast<unsigned long long>(stats.uploaded),
+         static_cast<unsigned long long>(stats.dropped),
+         static_cast<unsigned long long>(stats.fenceWaits));
+    delete preview_;
+    preview_ = nullptr;
+  }
+  cpuPreview_ = false;
   if (camera_) {
     delete camera_;
     camera_ = nullptr;
@@ -110,6 +132,21 @@ void CameraEngine::DeleteCamera(void) {
     delete yuvReader_;
     yuvReader_ = nullptr;
   }
+  if (analyzer_) {
+    FrameAnalyzer::Stats stats = analyzer_->GetStats(histogram_);
+    LumaStatistics luma;
+    if (histogram_->GetStatistics(&luma)) {
+      LOGI("Preview luma mean %.1f, %.1f%% dark, %.1f%% bright",
+           luma.mean, luma.dark * 100.0f, luma.bright * 100.0f);
+    }
+    LOGI("Frames analyzed: %llu, dropped: %llu",
+         static_cast<unsigned long long>(stats.processed),
+         static_cast<unsigned long long>(stats.dropped));
+    delete analyzer_;
+    delete histogram_;
+    analyzer_ = nullptr;
+    histogram_ = nullptr;
+  }
   if (jpgReader_) {
     delete jpgReader_;
     jpgReader_ = nullptr;
@@ -149,12 +186,27 @@ void CameraEngine::OnCameraParameterChanged(int32_t code, int64_t val) {
 }
 
 /**
- * The main function rendering a frame. In our case, it is yuv to RGBA8888
- * converter
+ * The main function rendering a frame. With OpenGL ES the YUV image is
+ * uploaded as it is and the shader converts it while drawing. Otherwise
+ * it is yuv to RGBA8888 converter, with frames pipelined: the next image
+ * is acquired while the previous one is still converted, then the previous
+ * one is posted and the conversion of the next one started. The app thread
+ * returns to its event loop in between, and joins the conversion when it
+ * posts the frame.
  */
 void CameraEngine::DrawFrame(void) {
   if (!cameraReady_ || !yuvReader_) return;
-  AImage* image = yuvReader_->GetNextImage();
+  if (!preview_ && !cpuPreview_) {
+    CreatePreview();
+  }
+  AImage* image = yuvReader_->GetPreviewImage();
+  if (preview_) {
+    if (image && yuvReader_->UploadImage(preview_->Uploader(), image)) {
+      preview_->Draw();
+    }
+    return;
+  }
+  PostFrame();
   if (!image) {
     return;
   }
@@ -162,11 +214,38 @@ void CameraEngine::DrawFrame(void) {
   ANativeWindow_acquire(app_->window);
   ANativeWindow_Buffer buf;
   if (ANativeWindow_lock(app_->window, &buf, nullptr) < 0) {
+    ANativeWindow_release(app_->window);
     yuvReader_->DeleteImage(image);
     return;
   }
 
-  yuvReader_->DisplayImage(&buf, image);
+  yuvReader_->StartDisplayImage(&buf, image);
+  framePending_ = true;
+}
+
+/**
+ * Draw with OpenGL ES when the window takes it. Done here, on the thread
+ * drawing, rather than in CreateCamera(), which the permission callback
+ * calls from its own thread; and before the first ANativeWindow_lock(),
+ * after which EGL cannot use the window any more.
+ */
+void CameraEngine::CreatePreview(void) {
+  preview_ = new GlPreview();
+  if (!preview_->Init(app_->window)) {
+    LOGW("No OpenGL ES 3.0, preview converted on the CPU");
+    delete preview_;
+    preview_ = nullptr;
+    cpuPreview_ = true;
+  }
+}
+
+/**
+ * Wait for the frame being converted, if any, and post it
+ */
+void CameraEngine::PostFrame(void) {
+  if (!framePending_) return;
+  yuvReader_->FinishDisplayImage();
   ANativeWindow_unlockAndPost(app_->window);
   ANativeWindow_release(app_->window);
+  framePending_ = false;
 }
@@ -24,6 +24,8 @@
 #include <thread>
 
 #include "camera_manager.h"
+#include "gl_preview.h"
+#include "utils/frame_processors.h"
 
 /**
  * basic CameraAppEngine
@@ -60,6 +62,8 @@ class CameraEngine {
  private:
   void OnPhotoTaken(const char* fileName);
   int  GetDisplayRotation(void);
+  void PostFrame(void);
+  void CreatePreview(void);
 
   struct android_app* app_;
   ImageFormat savedNativeWinRes_;
@@ -69,6 +73,11 @@ class CameraEngine {
   NDKCamera* camera_;
   ImageReader* yuvReader_;
   ImageReader* jpgReader_;
+  bool framePending_;  // window locked, its image still being converted
+  FrameAnalyzer* analyzer_;
+  LumaHistogram* histogram_;
+  GlPreview* preview_;  // nullptr when converting on the CPU
+  bool cpuPreview_;     // OpenGL ES failed on this window
 };
 
 /**
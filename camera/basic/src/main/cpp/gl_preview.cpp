@@ -0,0 +1,213 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "gl_preview.h"
+#include <EGL/eglext.h>
+#include "utils/native_debug.h"
+
+GlPreview::GlPreview()
+    : display_(EGL_NO_DISPLAY),
+      surface_(EGL_NO_SURFACE),
+      context_(EGL_NO_CONTEXT),
+      backend_(nullptr),
+      uploader_(nullptr),
+      program_(0),
+      quad_(0),
+      texCoordU_(-1),
+      texCoordV_(-1) {}
+
+GlPreview::~GlPreview() { Destroy(); }
+
+bool GlPreview::Init(ANativeWindow* window) {
+  display_ = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+  if (display_ == EGL_NO_DISPLAY ||
+      !eglInitialize(display_, nullptr, nullptr)) {
+    LOGW("No EGL display");
+    display_ = EGL_NO_DISPLAY;
+    return false;
+  }
+
+  // RGBA 8888, the format CameraEngine sets the window buffers to
+  const EGLint configAttribs[] = {
+      EGL_RENDERABLE_TYPE, EGL_OPENGL_ES3_BIT_KHR,
+      EGL_SURFACE_TYPE,    EGL_WINDOW_BIT,
+      EGL_RED_SIZE,        8,
+      EGL_GREEN_SIZE,      8,
+      EGL_BLUE_SIZE,       8,
+      EGL_ALPHA_SIZE,      8,
+      EGL_NONE};
+  const EGLint contextAttribs[] = {EGL_CONTEXT_CLIENT_VERSION, 3, EGL_NONE};
+  EGLConfig config;
+  EGLint count = 0;
+  if (!eglChooseConfig(display_, configAttribs, &config, 1, &count) ||
+      count < 1) {
+    LOGW("No OpenGL ES 3.0 config");
+    Destroy();
+    return false;
+  }
+  context_ = eglCreateContext(display_, config, EGL_NO_CONTEXT,
+                              contextAttribs);
+  if (context_ != EGL_NO_CONTEXT) {
+    surface_ = eglCreateWindowSurface(display_, config, window, nullptr);
+  }
+  if (surface_ == EGL_NO_SURFACE ||
+      !eglMakeCurrent(display_, surface_, surface_, context_)) {
+    LOGW("Cannot draw with OpenGL ES 3.0: EGL error 0x%x", eglGetError());
+    Destroy();
+    return false;
+  }
+
+  backend_ = new GlesFrameBackend(true);
+  uploader_ = new FrameUploader(backend_);
+  if (!CreateProgram()) {
+    Destroy();
+    return false;
+  }
+  return true;
+}
+
+FrameUploader* GlPreview::Uploader(void) { return uploader_; }
+
+/*
+ * Draw()
+ *   One quad over the window: the window buffers have the size of the
+ *   rotated preview, TexCoordMatrix() turns the texture to fit
+ */
+bool GlPreview::Draw(void) {
+  if (!uploader_->Texture(0)) {
+    return false;
+  }
+  EGLint width = 0, height = 0;
+  eglQuerySurface(display_, surface_, EGL_WIDTH, &width);
+  eglQuerySurface(display_, surface_, EGL_HEIGHT, &height);
+  glViewport(0, 0, width, height);
+
+  float matrix[6];
+  uploader_->TexCoordMatrix(matrix);
+  glUseProgram(program_);
+  glUniform3fv(texCoordU_, 1, matrix);
+  glUniform3fv(texCoordV_, 1, matrix + 3);
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D, uploader_->Texture(1));
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, uploader_->Texture(0));
+
+  glBindBuffer(GL_ARRAY_BUFFER, quad_);
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, nullptr);
+  glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  return eglSwapBuffers(display_, surface_) == EGL_TRUE;
+}
+
+static GLuint CompileShader(GLenum type, const char* source) {
+  GLuint shader = glCreateShader(type);
+  glShaderSource(shader, 1, &source, nullptr);
+  glCompileShader(shader);
+  GLint compiled = GL_FALSE;
+  glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+  if (!compiled) {
+    char log[512];
+    glGetShaderInfoLog(shader, sizeof(log), nullptr, log);
+    LOGE("Cannot compile shader: %s", log);
+    glDeleteShader(shader);
+    return 0;
+  }
+  return shader;
+}
+
+/*
+ * CreateProgram()
+ *   The shaders for the layout of the uploader, texture units 0 and 1,
+ *   and the quad covering clip space as a triangle strip
+ */
+bool GlPreview::CreateProgram(void) {
+  GLuint vertex =
+      CompileShader(GL_VERTEX_SHADER, GlesFrameBackend::VertexShader());
+  GLuint fragment =
+      CompileShader(GL_FRAGMENT_SHADER,
+                    GlesFrameBackend::FragmentShader(uploader_->Layout()));
+  if (!vertex || !fragment) {
+    glDeleteShader(vertex);
+    glDeleteShader(fragment);
+    return false;
+  }
+  program_ = glCreateProgram();
+  glAttachShader(program_, vertex);
+  glAttachShader(program_, fragment);
+  glLinkProgram(program_);
+  glDeleteShader(vertex);
+  glDeleteShader(fragment);
+  GLint linked = GL_FALSE;
+  glGetProgramiv(program_, GL_LINK_STATUS, &linked);
+  if (!linked) {
+    char log[512];
+    glGetProgramInfoLog(program_, sizeof(log), nullptr, log);
+    LOGE("Cannot link preview program: %s", log);
+    return false;
+  }
+
+  glUseProgram(program_);
+  glUniform1i(glGetUniformLocation(program_, "frameTexture"), 0);
+  glUniform1i(glGetUniformLocation(program_, "lumaTexture"), 0);
+  glUniform1i(glGetUniformLocation(program_, "chromaTexture"), 1);
+  texCoordU_ = glGetUniformLocation(program_, "texCoordU");
+  texCoordV_ = glGetUniformLocation(program_, "texCoordV");
+
+  static const GLfloat kQuad[] = {-1.0f, -1.0f, 1.0f, -1.0f,
+                                  -1.0f, 1.0f,  1.0f, 1.0f};
+  glGenBuffers(1, &quad_);
+  glBindBuffer(GL_ARRAY_BUFFER, quad_);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(kQuad), kQuad, GL_STATIC_DRAW);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  return glGetError() == GL_NO_ERROR;
+}
+
+/*
+ * Destroy()
+ *   GL objects go with the context still current, then the surface lets
+ *   go of the window
+ */
+void GlPreview::Destroy(void) {
+  if (display_ == EGL_NO_DISPLAY) {
+    return;
+  }
+  delete uploader_;
+  delete backend_;
+  uploader_ = nullptr;
+  backend_ = nullptr;
+  if (program_) {
+    glDeleteProgram(program_);
+    program_ = 0;
+  }
+  if (quad_) {
+    glDeleteBuffers(1, &quad_);
+    quad_ = 0;
+  }
+
+  eglMakeCurrent(display_, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+  if (surface_ != EGL_NO_SURFACE) {
+    eglDestroySurface(display_, surface_);
+    surface_ = EGL_NO_SURFACE;
+  }
+  if (context_ != EGL_NO_CONTEXT) {
+    eglDestroyContext(display_, context_);
+    context_ = EGL_NO_CONTEXT;
+  }
+  eglTerminate(display_);
+  display_ = EGL_NO_DISPLAY;
+}
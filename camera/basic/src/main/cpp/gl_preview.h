@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __CAMERA_GL_PREVIEW_H__
+#define __CAMERA_GL_PREVIEW_H__
+
+#include <EGL/egl.h>
+#include <GLES3/gl3.h>
+#include <android/native_window.h>
+
+#include "utils/frame_uploader.h"
+#include "utils/gles_frame_backend.h"
+
+/**
+ * GlPreview:
+ *     Draws the preview with OpenGL ES 3.0 on the native window: images
+ *     are uploaded as YUV textures by FrameUploader, converted and rotated
+ *     by the shaders of GlesFrameBackend. All calls have to come from the
+ *     thread Init() was called on.
+ */
+class GlPreview {
+ public:
+  GlPreview();
+  ~GlPreview();
+
+  /**
+   * Create the context and surface on window, whose buffers geometry
+   * is set already. Once it failed the window is left untouched, for
+   * ANativeWindow_lock() to draw on instead.
+   */
+  bool Init(ANativeWindow* window);
+
+  FrameUploader* Uploader(void);
+
+  /**
+   * Draw the last frame uploaded over the whole window and post it
+   */
+  bool Draw(void);
+
+ private:
+  EGLDisplay display_;
+  EGLSurface surface_;
+  EGLContext context_;
+  GlesFrameBackend* backend_;
+  FrameUploader* uploader_;
+  GLuint program_;
+  GLuint quad_;
+  GLint texCoordU_, texCoordV_;
+
+  bool CreateProgram(void);
+  void Destroy(void);
+};
+
+#endif  // __CAMERA_GL_PREVIEW_H__
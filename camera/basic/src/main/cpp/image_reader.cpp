@@ -13,20 +13,17 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
-#include <string>
 #include <functional>
 #include <thread>
-#include <cstdlib>
-#include <dirent.h>
-#include <ctime>
 #include "image_reader.h"
 #include "utils/native_debug.h"
+#include "utils/yuv_converter.h"
 
 /*
  * For JPEG capture, captured files are saved under
  *     DirName
- * File names are incrementally appended an index number as
- *     capture0.jpg, capture1.jpg, capture2.jpg
+ * File names are appended the capture time as
+ *     capture<month><day>-<hour><minute><second>-<millisecond>.jpg
  */
 static const char *kDirName = "/sdcard/DCIM/Camera/";
 static const char *kFileName = "capture";
@@ -37,6 +34,16 @@ static const char *kFileName = "capture";
  */
 #define MAX_BUF_COUNT 4
 
+/**
+ * PREVIEW_MAX_BACKLOG:
+ *   Images allowed to wait in the queue before the preview skips to the
+ *   latest one.
+ * PREVIEW_BAND_ROWS:
+ *   Rows of the preview image converted by a thread at a time.
+ */
+#define PREVIEW_MAX_BACKLOG 2
+#define PREVIEW_BAND_ROWS (2 * YUV_BAND_ALIGN)
+
 /**
  * ImageReader listener: called by AImageReader for every frame captured
  * We pass the event to ImageReader class, so it could do some housekeeping
@@ -55,7 +62,9 @@ void OnImageCallback(void *ctx, AImageReader *reader) {
  * Constructor
  */
 ImageReader::ImageReader(ImageFormat *res, enum AIMAGE_FORMATS format)
-    : reader_(nullptr), presentRotation_(0) {
+    : reader_(nullptr), presentRotation_(0), writer_(nullptr),
+      pendingImages_(0), analyzer_(nullptr), jobRotation_(0), nextBand_(0), bandCount_(0),
+      bandsDone_(0), quit_(false) {
   callback_ = nullptr;
   callbackCtx_ = nullptr;
 
@@ -67,11 +76,34 @@ ImageReader::ImageReader(ImageFormat *res, enum AIMAGE_FORMATS format)
       .context = this, .onImageAvailable = OnImageCallback,
   };
   AImageReader_setImageListener(reader_, &listener);
+
+  if (format == AIMAGE_FORMAT_JPEG) {
+    writer_ = new JpegWriter(kDirName, kFileName, [this](const char *name) {
+      if (callback_) {
+        callback_(callbackCtx_, name);
+      }
+    });
+  }
 }
 
 ImageReader::~ImageReader() {
   ASSERT(reader_, "NULL Pointer to %s", __FUNCTION__);
+  // no capture may reach writer_ or the workers from here on
+  AImageReader_setImageListener(reader_, nullptr);
+  FinishDisplayImage();
+  {
+    std::lock_guard<std::mutex> lock(jobLock_);
+    quit_ = true;
+  }
+  jobCond_.notify_all();
+  for (auto &worker : workers_) {
+    worker.join();
+  }
+  if (analyzer_) {
+    analyzer_->Flush();
+  }
   AImageReader_delete(reader_);
+  delete writer_;
 }
 
 void ImageReader::RegisterCallback(void* ctx,
@@ -80,6 +112,10 @@ void ImageReader::RegisterCallback(void* ctx,
   callback_ = func;
 }
 
+void ImageReader::SetFrameAnalyzer(FrameAnalyzer *analyzer) {
+  analyzer_ = analyzer;
+}
+
 void ImageReader::ImageCallback(AImageReader *reader) {
   int32_t format;
   media_status_t status = AImageReader_getFormat(reader, &format);
@@ -89,9 +125,27 @@ void ImageReader::ImageCallback(AImageReader *reader) {
     media_status_t status = AImageReader_acquireNextImage(reader, &image);
     ASSERT(status == AMEDIA_OK && image, "Image is not available");
 
-    // Create a thread and write out the jpeg files
-    std::thread writeFileHandler(&ImageReader::WriteFile, this, image);
-    writeFileHandler.detach();
+    // copy for the writer thread and give the camera its buffer back before
+    // Write() can wait for room
+    int planeCount;
+    status = AImage_getNumberOfPlanes(image, &planeCount);
+    ASSERT(status == AMEDIA_OK && planeCount == 1,
+           "Error: getNumberOfPlanes() planeCount = %d", planeCount);
+    uint8_t *data = nullptr;
+    int len = 0;
+    AImage_getPlaneData(image, 0, &data, &len);
+    std::vector<uint8_t> jpeg;
+    if (data && len > 0) {
+      jpeg.assign(data, data + len);
+    }
+    int64_t timestamp = 0;
+    AImage_getTimestamp(image, &timestamp);
+    AImage_delete(image);
+    if (!jpeg.empty()) {
+      writer_->Write(std::move(jpeg), timestamp);
+    }
+  } else {
+    pendingImages_++;
   }
 }
 
@@ -133,64 +187,35 @@ AImage *ImageReader::GetLatestImage(void) {
 }
 
 /**
- * Delete Image
- * @param image {@link AImage} instance to be deleted
+ * GetPreviewImage()
+ *   pendingImages_ is only a hint: when the queue turns out empty it is
+ * reset, so it cannot keep the preview dropping frames.
  */
-void ImageReader::DeleteImage(AImage *image) {
-  if (image) AImage_delete(image);
+AImage *ImageReader::GetPreviewImage(void) {
+  int32_t pending = pendingImages_;
+  if (pending > PREVIEW_MAX_BACKLOG) {
+    AImage *image = GetLatestImage();
+    if (image) {
+      pendingImages_ -= pending;
+      return image;
+    }
+  } else {
+    AImage *image = GetNextImage();
+    if (image) {
+      pendingImages_--;
+      return image;
+    }
+  }
+  pendingImages_ = 0;
+  return nullptr;
 }
 
 /**
- * Helper function for YUV_420 to RGB conversion. Courtesy of Tensorflow
- * ImageClassifier Sample:
- * https://github.com/tensorflow/tensorflow/blob/master/tensorflow/examples/android/jni/yuv2rgb.cc
- * The difference is that here we have to swap UV plane when calling it.
+ * Delete Image
+ * @param image {@link AImage} instance to be deleted
  */
-#ifndef MAX
-#define MAX(a, b)           \
-  ({                        \
-    __typeof__(a) _a = (a); \
-    __typeof__(b) _b = (b); \
-    _a > _b ? _a : _b;      \
-  })
-#define MIN(a, b)           \
-  ({                        \
-    __typeof__(a) _a = (a); \
-    __typeof__(b) _b = (b); \
-    _a < _b ? _a : _b;      \
-  })
-#endif
-
-// This value is 2 ^ 18 - 1, and is used to clamp the RGB values before their
-// ranges
-// are normalized to eight bits.
-static const int kMaxChannelValue = 262143;
-
-static inline uint32_t YUV2RGB(int nY, int nU, int nV) {
-  nY -= 16;
-  nU -= 128;
-  nV -= 128;
-  if (nY < 0) nY = 0;
-
-  // This is the floating point equivalent. We do the conversion in integer
-  // because some Android devices do not have floating point in hardware.
-  // nR = (int)(1.164 * nY + 1.596 * nV);
-  // nG = (int)(1.164 * nY - 0.813 * nV - 0.391 * nU);
-  // nB = (int)(1.164 * nY + 2.018 * nU);
-
-  int nR = (int)(1192 * nY + 1634 * nV);
-  int nG = (int)(1192 * nY - 833 * nV - 400 * nU);
-  int nB = (int)(1192 * nY + 2066 * nU);
-
-  nR = MIN(kMaxChannelValue, MAX(0, nR));
-  nG = MIN(kMaxChannelValue, MAX(0, nG));
-  nB = MIN(kMaxChannelValue, MAX(0, nB));
-
-  nR = (nR >> 10) & 0xff;
-  nG = (nG >> 10) & 0xff;
-  nB = (nB >> 10) & 0xff;
-
-  return 0xff000000 | (nR << 16) | (nG << 8) | nB;
+void ImageReader::DeleteImage(AImage *image) {
+  if (image) AImage_delete(image);
 }
 
 /**
@@ -204,10 +229,17 @@ static inline uint32_t YUV2RGB(int nY, int nU, int nV) {
  *            it will be deleted via {@link AImage_delete}
  */
 bool ImageReader::DisplayImage(ANativeWindow_Buffer *buf, AImage *image) {
-  ASSERT(buf->format == WINDOW_FORMAT_RGBX_8888 ||
-             buf->format == WINDOW_FORMAT_RGBA_8888,
-         "Not supported buffer format");
+  bool status = StartDisplayImage(buf, image);
+  FinishDisplayImage();
+  return status;
+}
 
+/*
+ * ReadYuvImage()
+ *   Describe the cropped picture of a YUV_420_888 image. Planes are Y, U,
+ *   V in this order; U and V share their strides.
+ */
+static void ReadYuvImage(AImage *image, YuvImage *src) {
   int32_t srcFormat = -1;
   AImage_getFormat(image, &srcFormat);
   ASSERT(AIMAGE_FORMAT_YUV_420_888 == srcFormat, "Failed to get format");
@@ -215,243 +247,153 @@ bool ImageReader::DisplayImage(ANativeWindow_Buffer *buf, AImage *image) {
   AImage_getNumberOfPlanes(image, &srcPlanes);
   ASSERT(srcPlanes == 3, "Is not 3 planes");
 
-  switch (presentRotation_) {
-    case 0:
-      PresentImage(buf, image);
-      break;
-    case 90:
-      PresentImage90(buf, image);
-      break;
-    case 180:
-      PresentImage180(buf, image);
-      break;
-    case 270:
-      PresentImage270(buf, image);
-      break;
-    default:
-      ASSERT(0, "NOT recognized display rotation: %d", presentRotation_);
-  }
-
-  AImage_delete(image);
-
-  return true;
-}
-
-/*
- * PresentImage()
- *   Converting yuv to RGB
- *   No rotation: (x,y) --> (x, y)
- *   Refer to:
- * https://mathbits.com/MathBits/TISection/Geometry/Transformations2.htm
- */
-void ImageReader::PresentImage(ANativeWindow_Buffer *buf, AImage *image) {  
   AImageCropRect srcRect;
   AImage_getCropRect(image, &srcRect);
 
-  int32_t yStride, uvStride;
   uint8_t *yPixel, *uPixel, *vPixel;
   int32_t yLen, uLen, vLen;
-  AImage_getPlaneRowStride(image, 0, &yStride);
-  AImage_getPlaneRowStride(image, 1, &uvStride);
+  AImage_getPlaneRowStride(image, 0, &src->yStride);
+  AImage_getPlaneRowStride(image, 1, &src->uvStride);
+  AImage_getPlanePixelStride(image, 1, &src->uvPixelStride);
   AImage_getPlaneData(image, 0, &yPixel, &yLen);
-  AImage_getPlaneData(image, 1, &vPixel, &vLen);
-  AImage_getPlaneData(image, 2, &uPixel, &uLen);
-  int32_t uvPixelStride;
-  AImage_getPlanePixelStride(image, 1, &uvPixelStride);
-
-  int32_t height = MIN(buf->height, (srcRect.bottom - srcRect.top));
-  int32_t width = MIN(buf->width, (srcRect.right - srcRect.left));
-
-  uint32_t *out = static_cast<uint32_t *>(buf->bits);
-  for (int32_t y = 0; y < height; y++) {
-    const uint8_t *pY = yPixel + yStride * (y + srcRect.top) + srcRect.left;
-
-    int32_t uv_row_start = uvStride * ((y + srcRect.top) >> 1);
-    const uint8_t *pU = uPixel + uv_row_start + (srcRect.left >> 1);
-    const uint8_t *pV = vPixel + uv_row_start + (srcRect.left >> 1);
-
-    for (int32_t x = 0; x < width; x++) {
-      const int32_t uv_offset = (x >> 1) * uvPixelStride;
-      out[x] = YUV2RGB(pY[x], pU[uv_offset], pV[uv_offset]);
-    }
-    out += buf->stride;
-  }
+  AImage_getPlaneData(image, 1, &uPixel, &uLen);
+  AImage_getPlaneData(image, 2, &vPixel, &vLen);
+  src->y = yPixel;
+  src->u = uPixel;
+  src->v = vPixel;
+  src->left = srcRect.left;
+  src->top = srcRect.top;
+  src->width = srcRect.right - srcRect.left;
+  src->height = srcRect.bottom - srcRect.top;
 }
 
 /*
- * PresentImage90()
- *   Converting YUV to RGB
- *   Rotation image anti-clockwise 90 degree -- (x, y) --> (-y, x)
+ * StartDisplayImage()
+ *   Converting yuv to RGB, rotated by presentRotation_ on the way: see
+ *   ConvertYuvToRgbaRows() for the mapping of each angle.
  */
-void ImageReader::PresentImage90(ANativeWindow_Buffer *buf, AImage *image) {
-  AImageCropRect srcRect;
-  AImage_getCropRect(image, &srcRect);
-
-  int32_t yStride, uvStride;
-  uint8_t *yPixel, *uPixel, *vPixel;
-  int32_t yLen, uLen, vLen;
-  AImage_getPlaneRowStride(image, 0, &yStride);
-  AImage_getPlaneRowStride(image, 1, &uvStride);
-  AImage_getPlaneData(image, 0, &yPixel, &yLen);
-  AImage_getPlaneData(image, 1, &vPixel, &vLen);
-  AImage_getPlaneData(image, 2, &uPixel, &uLen);
-  int32_t uvPixelStride;
-  AImage_getPlanePixelStride(image, 1, &uvPixelStride);
-
-  int32_t height = MIN(buf->width, (srcRect.bottom - srcRect.top));
-  int32_t width = MIN(buf->height, (srcRect.right - srcRect.left));
-
-  uint32_t *out = static_cast<uint32_t *>(buf->bits);
-  out += height - 1;
-  for (int32_t y = 0; y < height; y++) {
-    const uint8_t *pY = yPixel + yStride * (y + srcRect.top) + srcRect.left;
-
-    int32_t uv_row_start = uvStride * ((y + srcRect.top) >> 1);
-    const uint8_t *pU = uPixel + uv_row_start + (srcRect.left >> 1);
-    const uint8_t *pV = vPixel + uv_row_start + (srcRect.left >> 1);
-
-    for (int32_t x = 0; x < width; x++) {
-      const int32_t uv_offset = (x >> 1) * uvPixelStride;
-      // [x, y]--> [-y, x]
-      out[x * buf->stride] = YUV2RGB(pY[x], pU[uv_offset], pV[uv_offset]);
+bool ImageReader::StartDisplayImage(ANativeWindow_Buffer *buf,
+                                    AImage *image) {
+  ASSERT(buf->format == WINDOW_FORMAT_RGBX_8888 ||
+             buf->format == WINDOW_FORMAT_RGBA_8888,
+         "Not supported buffer format");
+  ASSERT(presentRotation_ == 0 || presentRotation_ == 90 ||
+             presentRotation_ == 180 || presentRotation_ == 270,
+         "NOT recognized display rotation: %d", presentRotation_);
+
+  YuvImage src;
+  ReadYuvImage(image, &src);
+
+  RgbaImage dst;
+  dst.bits = static_cast<uint32_t *>(buf->bits);
+  dst.stride = buf->stride;
+  dst.width = buf->width;
+  dst.height = buf->height;
+
+  if (src.height <= 0) {
+    AImage_delete(image);
+    return true;
+  }
+  std::shared_ptr<AImage> frame(image, AImage_delete);
+  if (analyzer_) {
+    int64_t timestamp = 0;
+    AImage_getTimestamp(image, &timestamp);
+    analyzer_->Submit(src, timestamp, [frame]() mutable { frame.reset(); });
+  }
+  {
+    std::lock_guard<std::mutex> lock(jobLock_);
+    ASSERT(!jobImage_, "Previous image is still being displayed");
+    // started by the first image converted on the CPU, so a reader feeding
+    // the GL preview has none; the thread finishing the image converts too,
+    // one worker less than cores
+    if (workers_.empty()) {
+      uint32_t cores = std::thread::hardware_concurrency();
+      for (uint32_t idx = 1; idx < cores; idx++) {
+        workers_.push_back(std::thread(&ImageReader::ConversionWorker, this));
+      }
     }
-    out -= 1;  // move to the next column
+    jobImage_ = frame;
+    jobSrc_ = src;
+    jobDst_ = dst;
+    jobRotation_ = presentRotation_;
+    nextBand_ = 0;
+    bandsDone_ = 0;
+    bandCount_ = (src.height + PREVIEW_BAND_ROWS - 1) / PREVIEW_BAND_ROWS;
   }
+  jobCond_.notify_all();
+
+  return true;
 }
 
 /*
- * PresentImage180()
- *   Converting yuv to RGB
- *   Rotate image 180 degree: (x, y) --> (-x, -y)
+ * UploadImage()
+ *   Upload the image to uploader's textures, for presentRotation_; the
+ *   analyzer gets it too, as in StartDisplayImage()
  */
-void ImageReader::PresentImage180(ANativeWindow_Buffer *buf, AImage *image) {
-  AImageCropRect srcRect;
-  AImage_getCropRect(image, &srcRect);
+bool ImageReader::UploadImage(FrameUploader *uploader, AImage *image) {
+  YuvImage src;
+  ReadYuvImage(image, &src);
+  if (src.height <= 0) {
+    AImage_delete(image);
+    return false;
+  }
+  std::shared_ptr<AImage> frame(image, AImage_delete);
+  if (analyzer_) {
+    int64_t timestamp = 0;
+    AImage_getTimestamp(image, &timestamp);
+    analyzer_->Submit(src, timestamp, [frame]() mutable { frame.reset(); });
+  }
+  return uploader->Upload(src, presentRotation_);
+}
 
-  int32_t yStride, uvStride;
-  uint8_t *yPixel, *uPixel, *vPixel;
-  int32_t yLen, uLen, vLen;
-  AImage_getPlaneRowStride(image, 0, &yStride);
-  AImage_getPlaneRowStride(image, 1, &uvStride);
-  AImage_getPlaneData(image, 0, &yPixel, &yLen);
-  AImage_getPlaneData(image, 1, &vPixel, &vLen);
-  AImage_getPlaneData(image, 2, &uPixel, &uLen);
-  int32_t uvPixelStride;
-  AImage_getPlanePixelStride(image, 1, &uvPixelStride);
-
-  int32_t height = MIN(buf->height, (srcRect.bottom - srcRect.top));
-  int32_t width = MIN(buf->width, (srcRect.right - srcRect.left));
-
-  uint32_t *out = static_cast<uint32_t *>(buf->bits);
-  out += (height - 1) * buf->stride;
-  for (int32_t y = 0; y < height; y++) {
-    const uint8_t *pY = yPixel + yStride * (y + srcRect.top) + srcRect.left;
-
-    int32_t uv_row_start = uvStride * ((y + srcRect.top) >> 1);
-    const uint8_t *pU = uPixel + uv_row_start + (srcRect.left >> 1);
-    const uint8_t *pV = vPixel + uv_row_start + (srcRect.left >> 1);
-
-    for (int32_t x = 0; x < width; x++) {
-      const int32_t uv_offset = (x >> 1) * uvPixelStride;
-      // mirror image since we are using front camera
-      out[width - 1 - x] = YUV2RGB(pY[x], pU[uv_offset], pV[uv_offset]);
-      // out[x] = YUV2RGB(pY[x], pU[uv_offset], pV[uv_offset]);
+void ImageReader::FinishDisplayImage(void) {
+  ConvertBands();
+  std::unique_lock<std::mutex> lock(jobLock_);
+  doneCond_.wait(lock, [this] { return jobImage_ == nullptr; });
+}
+
+void ImageReader::ConversionWorker(void) {
+  std::unique_lock<std::mutex> lock(jobLock_);
+  while (true) {
+    jobCond_.wait(lock, [this] { return quit_ || nextBand_ < bandCount_; });
+    if (quit_) {
+      return;
     }
-    out -= buf->stride;
+    lock.unlock();
+    ConvertBands();
+    lock.lock();
   }
 }
 
 /*
- * PresentImage270()
- *   Converting image from YUV to RGB
- *   Rotate Image counter-clockwise 270 degree: (x, y) --> (y, x)
+ * ConvertBands()
+ *   Convert bands of the current image until none is left; whoever
+ *   converts the last one drops the image, deleting it unless the analyzer
+ *   still uses it
  */
-void ImageReader::PresentImage270(ANativeWindow_Buffer *buf, AImage *image) {
-  AImageCropRect srcRect;
-  AImage_getCropRect(image, &srcRect);
-
-  int32_t yStride, uvStride;
-  uint8_t *yPixel, *uPixel, *vPixel;
-  int32_t yLen, uLen, vLen;
-  AImage_getPlaneRowStride(image, 0, &yStride);
-  AImage_getPlaneRowStride(image, 1, &uvStride);
-  AImage_getPlaneData(image, 0, &yPixel, &yLen);
-  AImage_getPlaneData(image, 1, &vPixel, &vLen);
-  AImage_getPlaneData(image, 2, &uPixel, &uLen);
-  int32_t uvPixelStride;
-  AImage_getPlanePixelStride(image, 1, &uvPixelStride);
-
-  int32_t height = MIN(buf->width, (srcRect.bottom - srcRect.top));
-  int32_t width = MIN(buf->height, (srcRect.right - srcRect.left));
-
-  uint32_t *out = static_cast<uint32_t *>(buf->bits);
-  for (int32_t y = 0; y < height; y++) {
-    const uint8_t *pY = yPixel + yStride * (y + srcRect.top) + srcRect.left;
-
-    int32_t uv_row_start = uvStride * ((y + srcRect.top) >> 1);
-    const uint8_t *pU = uPixel + uv_row_start + (srcRect.left >> 1);
-    const uint8_t *pV = vPixel + uv_row_start + (srcRect.left >> 1);
-
-    for (int32_t x = 0; x < width; x++) {
-      const int32_t uv_offset = (x >> 1) * uvPixelStride;
-      out[(width - 1 - x) * buf->stride] =
-          YUV2RGB(pY[x], pU[uv_offset], pV[uv_offset]);
+void ImageReader::ConvertBands(void) {
+  std::unique_lock<std::mutex> lock(jobLock_);
+  while (nextBand_ < bandCount_) {
+    int32_t band = nextBand_++;
+    YuvImage src = jobSrc_;
+    RgbaImage dst = jobDst_;
+    int32_t rotation = jobRotation_;
+    lock.unlock();
+    ConvertYuvToRgbaRows(src, dst, rotation, band * PREVIEW_BAND_ROWS,
+                         PREVIEW_BAND_ROWS);
+    lock.lock();
+
+    if (++bandsDone_ == bandCount_) {
+      std::shared_ptr<AImage> image;
+      image.swap(jobImage_);
+      lock.unlock();
+      image.reset();
+      doneCond_.notify_all();
+      lock.lock();
     }
-    out += 1;  // move to the next column
   }
 }
+
 void ImageReader::SetPresentRotation(int32_t angle) {
   presentRotation_ = angle;
 }
-
-/**
- * Write out jpeg files to kDirName directory
- * @param image point capture jpg image
- */
-void ImageReader::WriteFile(AImage* image) {
-
-  int planeCount;
-  media_status_t status = AImage_getNumberOfPlanes(image, &planeCount);
-  ASSERT(status == AMEDIA_OK && planeCount == 1,
-         "Error: getNumberOfPlanes() planeCount = %d", planeCount);
-  uint8_t *data = nullptr;
-  int len = 0;
-  AImage_getPlaneData(image, 0, &data, &len);
-
-  DIR *dir = opendir(kDirName);
-  if (dir) {
-    closedir(dir);
-  } else {
-    std::string cmd = "mkdir -p ";
-    cmd += kDirName;
-    system(cmd.c_str());
-  }
-
-  struct timespec ts {
-      0, 0
-  };
-  clock_gettime(CLOCK_REALTIME, &ts);
-  struct tm localTime;
-  localtime_r(&ts.tv_sec, &localTime);
-
-  std::string fileName = kDirName;
-  std::string dash("-");
-  fileName += kFileName + std::to_string(localTime.tm_mon) +
-              std::to_string(localTime.tm_mday) + dash +
-              std::to_string(localTime.tm_hour) +
-              std::to_string(localTime.tm_min) +
-              std::to_string(localTime.tm_sec) + ".jpg";
-  FILE *file = fopen(fileName.c_str(), "wb");
-  if (file && data && len) {
-    fwrite(data, 1, len, file);
-    fclose(file);
-
-    if (callback_) {
-      callback_(callbackCtx_, fileName.c_str());
-    }
-  } else {
-    if (file)
-      fclose(file);
-  }
-  AImage_delete(image);
-}
\ No newline at end of file
@@ -17,7 +17,17 @@
 #ifndef CAMERA_IMAGE_READER_H
 #define CAMERA_IMAGE_READER_H
 #include <media/NdkImageReader.h>
+#include <atomic>
+#include <condition_variable>
 #include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "jpeg_writer.h"
+#include "utils/frame_analyzer.h"
+#include "utils/frame_uploader.h"
+#include "utils/yuv_converter.h"
 /*
  * ImageFormat:
  *     A Data Structure to communicate resolution between camera and ImageReader
@@ -55,6 +65,13 @@ class ImageReader {
   */
   AImage* GetLatestImage(void);
 
+  /**
+   * Retrieve the image to preview: the next one while the preview keeps up
+   * with the camera, the latest one when more than PREVIEW_MAX_BACKLOG
+   * images are waiting, dropping the older ones
+   */
+  AImage* GetPreviewImage(void);
+
   /**
    * Delete Image
    * @param image {@link AImage} instance to be deleted
@@ -81,6 +98,33 @@ class ImageReader {
    *   @return true on success, false on failure
    */
   bool DisplayImage(ANativeWindow_Buffer* buf, AImage* image);
+
+  /**
+   * StartDisplayImage()
+   *   Same as DisplayImage(), but only start the conversion on the
+   * conversion threads and return. FinishDisplayImage() must be called
+   * before buf is posted or the next image is started.
+   */
+  bool StartDisplayImage(ANativeWindow_Buffer* buf, AImage* image);
+
+  /**
+   * FinishDisplayImage()
+   *   Help converting the image started last and wait until it is done.
+   * The image is deleted as soon as its last band is converted, or when
+   * the analyzer is done with it. Does nothing when no image was started.
+   */
+  void FinishDisplayImage(void);
+
+  /**
+   * UploadImage()
+   *   Present camera image through the textures of uploader instead of a
+   * display buffer: see FrameUploader for where it is converted.
+   *   @param image a {@link AImage} instance, deleted once uploaded and
+   *            analyzed
+   *   @return true when uploaded, false when the uploader dropped it
+   */
+  bool UploadImage(FrameUploader* uploader, AImage* image);
+
   /**
    * Configure the rotation angle necessary to apply to
    * Camera image when presenting: all rotations should be accumulated:
@@ -96,19 +140,43 @@ class ImageReader {
    * @param callback is the actual callback function
    */
   void RegisterCallback(void* ctx, std::function<void(void* ctx, const char* fileName)>);
+
+  /**
+   * Submit the images displayed to analyzer too: they are deleted once
+   * both the conversion and the analyzer are done with them. The analyzer
+   * must outlive this reader.
+   */
+  void SetFrameAnalyzer(FrameAnalyzer* analyzer);
  private:
   int32_t presentRotation_;
   AImageReader* reader_;
 
   std::function<void(void *ctx, const char* fileName)> callback_;
   void *callbackCtx_;
+  JpegWriter* writer_;
+
+  // images the camera queued and the preview has not acquired yet
+  std::atomic<int32_t> pendingImages_;
+  FrameAnalyzer* analyzer_;
 
-  void PresentImage(ANativeWindow_Buffer* buf, AImage* image);
-  void PresentImage90(ANativeWindow_Buffer* buf, AImage* image);
-  void PresentImage180(ANativeWindow_Buffer* buf, AImage* image);
-  void PresentImage270(ANativeWindow_Buffer* buf, AImage* image);
+  // preview conversion: jobImage_ is split into bands of PREVIEW_BAND_ROWS
+  // rows, converted by the workers and the thread finishing the image;
+  // the workers start with the first image
+  std::vector<std::thread> workers_;
+  std::mutex jobLock_;
+  std::condition_variable jobCond_;
+  std::condition_variable doneCond_;
+  std::shared_ptr<AImage> jobImage_;
+  YuvImage jobSrc_;
+  RgbaImage jobDst_;
+  int32_t jobRotation_;
+  int32_t nextBand_;
+  int32_t bandCount_;
+  int32_t bandsDone_;
+  bool quit_;
 
-  void WriteFile(AImage* image);
+  void ConversionWorker(void);
+  void ConvertBands(void);
 };
 
 #endif  // CAMERA_IMAGE_READER_H
@@ -0,0 +1,285 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <initializer_list>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "jpeg_writer.h"
+#include "utils/native_debug.h"
+
+static double MsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - start).count();
+}
+
+// how long ago an image handed to Write() may have been captured
+static const int64_t kMaxCaptureAgeNs = 1000000000LL;
+
+static int64_t ClockNs(clockid_t clock) {
+  struct timespec ts {
+      0, 0
+  };
+  clock_gettime(clock, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+ * CaptureTime()
+ *   Wall clock time of a sensor timestamp. The camera stamps images with
+ *   CLOCK_BOOTTIME (timestamp source REALTIME) or, on devices with an
+ *   unknown source, with a clock running like CLOCK_MONOTONIC; the image
+ *   was just acquired, so whichever of the two puts it less than
+ *   kMaxCaptureAgeNs in the past is the one. Now if neither does.
+ */
+static struct timespec CaptureTime(int64_t timestampNs) {
+  int64_t wallNs = ClockNs(CLOCK_REALTIME);
+  for (clockid_t clock : {CLOCK_BOOTTIME, CLOCK_MONOTONIC}) {
+    int64_t age = ClockNs(clock) - timestampNs;
+    if (age >= 0 && age < kMaxCaptureAgeNs) {
+      wallNs -= age;
+      break;
+    }
+  }
+  struct timespec ts {
+      static_cast<time_t>(wallNs / 1000000000LL),
+      static_cast<long>(wallNs % 1000000000LL)
+  };
+  return ts;
+}
+
+JpegWriter::JpegWriter(const char* dirName, const char* filePrefix,
+                       std::function<void(const char* fileName)> written)
+    : dirName_(dirName),
+      filePrefix_(filePrefix),
+      written_(written),
+      dirFd_(-1),
+      queuedBytes_(0),
+      quit_(false),
+      totalLatencyMs_(0.0) {
+  memset(&stats_, 0, sizeof(stats_));
+  thread_ = std::thread(&JpegWriter::Run, this);
+}
+
+/**
+ * Write out everything queued before returning
+ */
+JpegWriter::~JpegWriter() {
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    quit_ = true;
+  }
+  jobCond_.notify_all();
+  thread_.join();
+  if (dirFd_ >= 0) {
+    close(dirFd_);
+  }
+}
+
+void JpegWriter::Write(std::vector<uint8_t> data, int64_t timestampNs) {
+  size_t len = data.size();
+  Job job;
+  job.queued = Clock::now();
+  job.captured = CaptureTime(timestampNs);
+  {
+    std::unique_lock<std::mutex> lock(lock_);
+    // an image larger than the whole queue still goes when it is empty
+    auto hasRoom = [this, len] {
+      return !queuedBytes_ || queuedBytes_ + len <= JPEG_QUEUE_BYTES;
+    };
+    if (!hasRoom()) {
+      stats_.stalls++;
+      roomCond_.wait(lock, hasRoom);
+      double waited = MsSince(job.queued);
+      stats_.stallMs += waited;
+      LOGW("JPEG queue full, capture waited %.1f ms", waited);
+    }
+    queuedBytes_ += len;
+    stats_.peakQueueBytes = std::max(stats_.peakQueueBytes, queuedBytes_);
+    job.data = std::move(data);
+    queue_.push_back(std::move(job));
+  }
+  jobCond_.notify_one();
+}
+
+JpegWriter::Stats JpegWriter::GetStats(void) {
+  std::lock_guard<std::mutex> lock(lock_);
+  return stats_;
+}
+
+/*
+ * Run()
+ *   Write the queued images one by one; sync what was written when the
+ *   queue runs empty or JPEG_SYNC_BATCH files are waiting for it
+ */
+void JpegWriter::Run(void) {
+  bool haveDirectories = false;
+  std::unique_lock<std::mutex> lock(lock_);
+  while (true) {
+    jobCond_.wait(lock, [this] { return quit_ || !queue_.empty(); });
+    if (queue_.empty()) {
+      break;
+    }
+    Job job = std::move(queue_.front());
+    queue_.pop_front();
+    lock.unlock();
+
+    if (!haveDirectories) {
+      haveDirectories = CreateDirectories();
+    }
+    std::string fileName = NextFileName(job.captured);
+    int fd = haveDirectories ? WriteFile(fileName, job.data) : -1;
+    size_t len = job.data.size();
+    std::vector<uint8_t>().swap(job.data);
+
+    lock.lock();
+    queuedBytes_ -= len;
+    roomCond_.notify_all();
+    if (fd < 0) {
+      stats_.failures++;
+      continue;
+    }
+    stats_.bytes += len;
+    unsynced_.push_back(Written{fd, fileName, job.queued});
+    if (queue_.empty() || unsynced_.size() >= JPEG_SYNC_BATCH) {
+      lock.unlock();
+      SyncFiles();
+      lock.lock();
+    }
+  }
+  lock.unlock();
+  SyncFiles();
+}
+
+/*
+ * CreateDirectories()
+ *   Create dirName_ and its parents, once; keep it open to sync new
+ *   directory entries
+ */
+bool JpegWriter::CreateDirectories(void) {
+  size_t pos = dirName_.find('/', 1);
+  while (true) {
+    std::string dir = dirName_.substr(0, pos);
+    if (mkdir(dir.c_str(), 0775) && errno != EEXIST) {
+      LOGE("Cannot create %s: %s", dir.c_str(), strerror(errno));
+      return false;
+    }
+    if (pos == std::string::npos) {
+      break;
+    }
+    pos = dirName_.find('/', pos + 1);
+  }
+  dirFd_ = open(dirName_.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  return true;
+}
+
+/*
+ * NextFileName()
+ *   capture<month><day>-<hour><minute><second>-<millisecond>.jpg of the
+ *   capture time, unique for captures in the same second
+ */
+std::string JpegWriter::NextFileName(const struct timespec& captured) {
+  struct tm localTime;
+  localtime_r(&captured.tv_sec, &localTime);
+
+  char name[64];
+  snprintf(name, sizeof(name), "%02d%02d-%02d%02d%02d-%03ld.jpg",
+           localTime.tm_mon + 1, localTime.tm_mday, localTime.tm_hour,
+           localTime.tm_min, localTime.tm_sec, captured.tv_nsec / 1000000);
+  return dirName_ + filePrefix_ + name;
+}
+
+/*
+ * WriteFile()
+ *   Reserve the whole file first, so it is laid out in one piece, then
+ *   write it in JPEG_WRITE_CHUNK pieces. Returns the file still open, to be
+ *   synced later, or -1
+ */
+int JpegWriter::WriteFile(const std::string& fileName,
+                          const std::vector<uint8_t>& data) {
+  int fd = open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                0664);
+  if (fd < 0) {
+    LOGE("Cannot create %s: %s", fileName.c_str(), strerror(errno));
+    return -1;
+  }
+  // not every file system supports it, writing works without
+  fallocate(fd, 0, 0, static_cast<off_t>(data.size()));
+
+  size_t done = 0;
+  while (done < data.size()) {
+    size_t len = std::min(data.size() - done,
+                          static_cast<size_t>(JPEG_WRITE_CHUNK));
+    ssize_t count = write(fd, data.data() + done, len);
+    if (count < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      LOGE("Cannot write %s: %s", fileName.c_str(), strerror(errno));
+      close(fd);
+      unlink(fileName.c_str());
+      return -1;
+    }
+    done += static_cast<size_t>(count);
+  }
+  return fd;
+}
+
+/*
+ * SyncFiles()
+ *   Sync and close the files written since the last call, then their
+ *   directory entries, and report them
+ */
+void JpegWriter::SyncFiles(void) {
+  if (unsynced_.empty()) {
+    return;
+  }
+  for (auto& file : unsynced_) {
+    fsync(file.fd);
+    close(file.fd);
+  }
+  if (dirFd_ >= 0) {
+    fsync(dirFd_);
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    for (auto& file : unsynced_) {
+      double latency = MsSince(file.queued);
+      stats_.files++;
+      totalLatencyMs_ += latency;
+      stats_.maxLatencyMs = std::max(stats_.maxLatencyMs, latency);
+    }
+    stats_.averageLatencyMs = totalLatencyMs_ / stats_.files;
+    LOGI("JPEG files written: %llu, latency %.1f ms (max %.1f), "
+         "queue peak %zu KB, %llu stalls",
+         static_cast<unsigned long long>(stats_.files),
+         stats_.averageLatencyMs, stats_.maxLatencyMs,
+         stats_.peakQueueBytes / 1024,
+         static_cast<unsigned long long>(stats_.stalls));
+  }
+
+  for (auto& file : unsynced_) {
+    if (written_) {
+      written_(file.fileName.c_str());
+    }
+  }
+  unsynced_.clear();
+}
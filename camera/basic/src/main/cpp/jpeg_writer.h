@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CAMERA_JPEG_WRITER_H
+#define CAMERA_JPEG_WRITER_H
+#include <chrono>
+#include <condition_variable>
+#include <ctime>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * JPEG_QUEUE_BYTES:
+ *     JPEG data waiting to be written; a capture finding the queue full
+ *     waits for room, its camera buffer already released
+ * JPEG_WRITE_CHUNK:
+ *     Largest single write() call
+ * JPEG_SYNC_BATCH:
+ *     Files written before they are synced, even if more are queued
+ */
+#define JPEG_QUEUE_BYTES (64 * 1024 * 1024)
+#define JPEG_WRITE_CHUNK (1024 * 1024)
+#define JPEG_SYNC_BATCH  8
+
+/*
+ * JpegWriter:
+ *     Writes captured JPEG images to files on its own thread. Write() takes
+ *     a copy of the image, so the camera gets its buffer back before any
+ *     wait for room in the queue; files are synced in batches, when the
+ *     queue runs empty, and reported to the written callback after that.
+ */
+class JpegWriter {
+ public:
+  struct Stats {
+    uint64_t files;
+    uint64_t failures;
+    uint64_t bytes;
+    double averageLatencyMs;  // from Write() to the file being synced
+    double maxLatencyMs;
+    uint64_t stalls;          // Write() calls that waited for room
+    double stallMs;
+    size_t peakQueueBytes;
+  };
+
+  JpegWriter(const char* dirName, const char* filePrefix,
+             std::function<void(const char* fileName)> written);
+  ~JpegWriter();
+
+  /**
+   * Queue the JPEG image data, copied out of the AImage by the caller, who
+   * releases the AImage first. timestampNs is AImage_getTimestamp() of the
+   * image: the file is named after the time it was captured. Blocks while
+   * JPEG_QUEUE_BYTES are queued already.
+   */
+  void Write(std::vector<uint8_t> data, int64_t timestampNs);
+
+  Stats GetStats(void);
+
+ private:
+  typedef std::chrono::steady_clock Clock;
+  struct Job {
+    std::vector<uint8_t> data;
+    Clock::time_point queued;
+    struct timespec captured;  // wall clock
+  };
+  struct Written {
+    int fd;
+    std::string fileName;
+    Clock::time_point queued;
+  };
+
+  std::string dirName_;
+  std::string filePrefix_;
+  std::function<void(const char* fileName)> written_;
+  int dirFd_;
+
+  std::thread thread_;
+  std::mutex lock_;
+  std::condition_variable jobCond_;
+  std::condition_variable roomCond_;
+  std::deque<Job> queue_;
+  size_t queuedBytes_;
+  bool quit_;
+  Stats stats_;
+  double totalLatencyMs_;
+
+  std::vector<Written> unsynced_;
+
+  void Run(void);
+  bool CreateDirectories(void);
+  std::string NextFileName(const struct timespec& captured);
+  int WriteFile(const std::string& fileName, const std::vector<uint8_t>& data);
+  void SyncFiles(void);
+};
+
+#endif  // CAMERA_JPEG_WRITER_H
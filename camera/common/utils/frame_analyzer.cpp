@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "frame_analyzer.h"
+
+/*
+ * PlaneAt()
+ *   View of a plane whose samples are pixelStride bytes apart, starting
+ *   at sample (left, top), decimated by scale
+ */
+static PlaneView PlaneAt(const uint8_t* data, int32_t rowStride,
+                         int32_t pixelStride, int32_t left, int32_t top,
+                         int32_t width, int32_t height, int32_t scale) {
+  PlaneView plane;
+  plane.data = data + top * rowStride + left * pixelStride;
+  plane.rowStride = rowStride * scale;
+  plane.pixelStride = pixelStride * scale;
+  plane.width = width / scale;
+  plane.height = height / scale;
+  return plane;
+}
+
+static FrameView ViewOf(const YuvImage& image, int64_t timestamp,
+                        uint64_t number, int32_t scale) {
+  FrameView view;
+  view.y = PlaneAt(image.y, image.yStride, 1, image.left, image.top,
+                   image.width, image.height, scale);
+  int32_t uvLeft = image.left >> 1, uvTop = image.top >> 1;
+  int32_t uvWidth = (image.width + 1) >> 1, uvHeight = (image.height + 1) >> 1;
+  view.u = PlaneAt(image.u, image.uvStride, image.uvPixelStride, uvLeft, uvTop,
+                   uvWidth, uvHeight, scale);
+  view.v = PlaneAt(image.v, image.uvStride, image.uvPixelStride, uvLeft, uvTop,
+                   uvWidth, uvHeight, scale);
+  view.scale = scale;
+  view.timestamp = timestamp;
+  view.number = number;
+  return view;
+}
+
+FrameAnalyzer::FrameAnalyzer()
+    : frameCount_(0), framesInFlight_(0), quit_(false) {
+  for (int idx = 0; idx < ANALYZER_THREADS; idx++) {
+    workers_.push_back(std::thread(&FrameAnalyzer::Worker, this));
+  }
+}
+
+FrameAnalyzer::~FrameAnalyzer() {
+  Flush();
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    quit_ = true;
+  }
+  taskCond_.notify_all();
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+}
+
+void FrameAnalyzer::AddProcessor(FrameProcessor* processor) {
+  std::lock_guard<std::mutex> lock(lock_);
+  slots_.push_back(Slot{processor, false, Stats{0, 0}});
+}
+
+FrameAnalyzer::Stats FrameAnalyzer::GetStats(const FrameProcessor* processor) {
+  std::lock_guard<std::mutex> lock(lock_);
+  for (auto& slot : slots_) {
+    if (slot.processor == processor) {
+      return slot.stats;
+    }
+  }
+  return Stats{0, 0};
+}
+
+bool FrameAnalyzer::Submit(const YuvImage& image, int64_t timestamp,
+                           std::function<void(void)> release) {
+  std::unique_lock<std::mutex> lock(lock_);
+  uint64_t number = frameCount_++;
+
+  std::vector<size_t> due;
+  for (size_t idx = 0; idx < slots_.size(); idx++) {
+    Slot& slot = slots_[idx];
+    if (number % slot.processor->Cadence()) {
+      continue;
+    }
+    if (slot.busy || framesInFlight_ >= ANALYZER_MAX_FRAMES) {
+      slot.stats.dropped++;
+    } else {
+      due.push_back(idx);
+    }
+  }
+  if (due.empty()) {
+    return false;
+  }
+
+  Frame* frame = new Frame{image, timestamp, number, release,
+                           static_cast<int32_t>(due.size())};
+  framesInFlight_++;
+  for (size_t idx : due) {
+    slots_[idx].busy = true;
+    tasks_.push_back(Task{frame, idx});
+  }
+  lock.unlock();
+  taskCond_.notify_all();
+  return true;
+}
+
+void FrameAnalyzer::Flush(void) {
+  std::unique_lock<std::mutex> lock(lock_);
+  idleCond_.wait(lock, [this] { return framesInFlight_ == 0; });
+}
+
+void FrameAnalyzer::Worker(void) {
+  std::unique_lock<std::mutex> lock(lock_);
+  while (true) {
+    taskCond_.wait(lock, [this] { return quit_ || !tasks_.empty(); });
+    if (quit_) {
+      return;
+    }
+    Task task = tasks_.front();
+    tasks_.pop_front();
+    FrameProcessor* processor = slots_[task.slot].processor;
+    Frame* frame = task.frame;
+    lock.unlock();
+
+    processor->Process(ViewOf(frame->image, frame->timestamp, frame->number,
+                              processor->Scale()));
+
+    lock.lock();
+    slots_[task.slot].busy = false;
+    slots_[task.slot].stats.processed++;
+    if (--frame->pending) {
+      continue;
+    }
+    lock.unlock();
+    frame->release();
+    delete frame;
+    lock.lock();
+    framesInFlight_--;
+    idleCond_.notify_all();
+  }
+}
@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __CAMERA_FRAME_ANALYZER_H__
+#define __CAMERA_FRAME_ANALYZER_H__
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "yuv_converter.h"
+
+/*
+ * ANALYZER_THREADS:
+ *     Threads running the processors.
+ * ANALYZER_MAX_FRAMES:
+ *     Frames held by the processors at a time. Every frame held is a camera
+ *     buffer the camera cannot fill: a frame arriving when that many are
+ *     in flight is not analyzed at all.
+ */
+#define ANALYZER_THREADS    2
+#define ANALYZER_MAX_FRAMES 1
+
+/*
+ * PlaneView:
+ *     Read-only view of one plane of the crop rectangle, pointing into the
+ *     camera buffer: sample (x, y) is data[y * rowStride + x * pixelStride]
+ */
+struct PlaneView {
+  const uint8_t* data;
+  int32_t rowStride;
+  int32_t pixelStride;
+  int32_t width, height;
+
+  uint8_t At(int32_t x, int32_t y) const {
+    return data[y * rowStride + x * pixelStride];
+  }
+};
+
+/*
+ * FrameView:
+ *     The planes of one frame, decimated by scale: with a scale of 4 every
+ *     4th sample of every 4th row is visible, without a copy.
+ */
+struct FrameView {
+  PlaneView y, u, v;
+  int32_t scale;
+  int64_t timestamp;
+  uint64_t number;  // frames submitted before this one
+};
+
+/*
+ * FrameProcessor:
+ *     Analysis run on every cadence-th frame, at 1/scale of its resolution.
+ *     Process() runs on an analyzer thread, never on two frames at the same
+ *     time; the views are only valid until it returns.
+ */
+class FrameProcessor {
+ public:
+  FrameProcessor(int32_t cadence, int32_t scale)
+      : cadence_(cadence), scale_(scale) {}
+  virtual ~FrameProcessor() {}
+
+  int32_t Cadence(void) const { return cadence_; }
+  int32_t Scale(void) const { return scale_; }
+
+  virtual void Process(const FrameView& frame) = 0;
+
+ private:
+  int32_t cadence_;
+  int32_t scale_;
+};
+
+/*
+ * FrameAnalyzer:
+ *     Runs the processors added to it on the frames submitted, on
+ *     ANALYZER_THREADS threads. A processor still busy with an earlier frame
+ *     when its next one is due skips it: processors falling behind drop
+ *     frames instead of queuing them.
+ */
+class FrameAnalyzer {
+ public:
+  struct Stats {
+    uint64_t processed;
+    uint64_t dropped;
+  };
+
+  FrameAnalyzer();
+  ~FrameAnalyzer();
+
+  void AddProcessor(FrameProcessor* processor);
+  Stats GetStats(const FrameProcessor* processor);
+
+  /**
+   * Submit()
+   *   Hand the frame to the processors it is due for. On true the frame
+   *   is in use until release is called, from an analyzer thread; on false
+   *   nothing needed it and release is not called.
+   */
+  bool Submit(const YuvImage& image, int64_t timestamp,
+              std::function<void(void)> release);
+
+  // wait until every frame submitted is released
+  void Flush(void);
+
+ private:
+  struct Frame {
+    YuvImage image;
+    int64_t timestamp;
+    uint64_t number;
+    std::function<void(void)> release;
+    int32_t pending;  // processors not done with it
+  };
+  struct Slot {
+    FrameProcessor* processor;
+    bool busy;
+    Stats stats;
+  };
+  struct Task {
+    Frame* frame;
+    size_t slot;
+  };
+
+  std::vector<Slot> slots_;
+  std::deque<Task> tasks_;
+  uint64_t frameCount_;
+  int32_t framesInFlight_;
+  bool quit_;
+
+  std::vector<std::thread> workers_;
+  std::mutex lock_;
+  std::condition_variable taskCond_;
+  std::condition_variable idleCond_;
+
+  void Worker(void);
+};
+
+#endif  // __CAMERA_FRAME_ANALYZER_H__
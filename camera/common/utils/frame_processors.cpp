@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <algorithm>
+#include <cstring>
+#include "frame_processors.h"
+
+/*
+ * CountRow()
+ *   Add count samples, step bytes apart, to the histograms. Consecutive
+ *   samples go to different histograms, so the increments do not wait for
+ *   each other; contiguous rows are read 8 samples per load.
+ */
+static void CountRow(const uint8_t* row, int32_t count, int32_t step,
+                     uint32_t (*bins)[256]) {
+  int32_t x = 0;
+  if (step == 1) {
+    for (; x + 8 <= count; x += 8) {
+      uint64_t word;
+      memcpy(&word, row + x, sizeof(word));
+      bins[0][word & 0xff]++;
+      bins[1][(word >> 8) & 0xff]++;
+      bins[2][(word >> 16) & 0xff]++;
+      bins[3][(word >> 24) & 0xff]++;
+      bins[0][(word >> 32) & 0xff]++;
+      bins[1][(word >> 40) & 0xff]++;
+      bins[2][(word >> 48) & 0xff]++;
+      bins[3][word >> 56]++;
+    }
+  }
+  for (; x < count; x++) {
+    bins[x & 3][row[x * step]]++;
+  }
+}
+
+LumaHistogram::LumaHistogram(int32_t cadence, int32_t scale)
+    : FrameProcessor(cadence, scale) {
+  memset(&stats_, 0, sizeof(stats_));
+}
+
+void LumaHistogram::Process(const FrameView& frame) {
+  uint32_t bins[4][256];
+  memset(bins, 0, sizeof(bins));
+  const PlaneView& luma = frame.y;
+  for (int32_t y = 0; y < luma.height; y++) {
+    CountRow(luma.data + y * luma.rowStride, luma.width, luma.pixelStride,
+             bins);
+  }
+
+  LumaStatistics stats;
+  uint64_t sum = 0;
+  uint32_t dark = 0, bright = 0;
+  for (int32_t level = 0; level < 256; level++) {
+    uint32_t count = bins[0][level] + bins[1][level] + bins[2][level] +
+                     bins[3][level];
+    stats.histogram[level] = count;
+    sum += static_cast<uint64_t>(count) * level;
+    if (level <= LUMA_DARK_LEVEL) dark += count;
+    if (level >= LUMA_BRIGHT_LEVEL) bright += count;
+  }
+  stats.count = static_cast<uint32_t>(luma.width) * luma.height;
+  float scale = stats.count ? 1.0f / stats.count : 0.0f;
+  stats.mean = sum * scale;
+  stats.dark = dark * scale;
+  stats.bright = bright * scale;
+  stats.timestamp = frame.timestamp;
+
+  std::lock_guard<std::mutex> lock(lock_);
+  stats_ = stats;
+}
+
+bool LumaHistogram::GetStatistics(LumaStatistics* stats) {
+  std::lock_guard<std::mutex> lock(lock_);
+  *stats = stats_;
+  return stats_.count != 0;
+}
+
+LumaDownscaler::LumaDownscaler(int32_t cadence, int32_t scale, int32_t factor)
+    : FrameProcessor(cadence, scale), factor_(factor), width_(0), height_(0) {}
+
+/*
+ * Process()
+ *   Sum factor_ rows into sums_, one sum per thumbnail pixel, then divide
+ *   with rounding; samples past the last whole block are left out
+ */
+void LumaDownscaler::Process(const FrameView& frame) {
+  const PlaneView& luma = frame.y;
+  int32_t width = luma.width / factor_;
+  int32_t height = luma.height / factor_;
+  uint32_t area = static_cast<uint32_t>(factor_ * factor_);
+  std::vector<uint8_t> thumbnail(static_cast<size_t>(width) * height);
+  sums_.resize(width);
+
+  for (int32_t ty = 0; ty < height; ty++) {
+    std::fill(sums_.begin(), sums_.end(), 0);
+    for (int32_t r = 0; r < factor_; r++) {
+      const uint8_t* row = luma.data + (ty * factor_ + r) * luma.rowStride;
+      if (luma.pixelStride == 1) {
+        for (int32_t tx = 0; tx < width; tx++) {
+          const uint8_t* block = row + tx * factor_;
+          uint32_t sum = 0;
+          for (int32_t c = 0; c < factor_; c++) {
+            sum += block[c];
+          }
+          sums_[tx] += sum;
+        }
+      } else {
+        for (int32_t tx = 0; tx < width; tx++) {
+          for (int32_t c = 0; c < factor_; c++) {
+            sums_[tx] += row[(tx * factor_ + c) * luma.pixelStride];
+          }
+        }
+      }
+    }
+    uint8_t* out = &thumbnail[static_cast<size_t>(ty) * width];
+    for (int32_t tx = 0; tx < width; tx++) {
+      out[tx] = static_cast<uint8_t>((sums_[tx] + area / 2) / area);
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(lock_);
+  thumbnail_.swap(thumbnail);
+  width_ = width;
+  height_ = height;
+}
+
+bool LumaDownscaler::GetThumbnail(std::vector<uint8_t>* pixels,
+                                  int32_t* width, int32_t* height) {
+  std::lock_guard<std::mutex> lock(lock_);
+  *pixels = thumbnail_;
+  *width = width_;
+  *height = height_;
+  return !thumbnail_.empty();
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __CAMERA_FRAME_PROCESSORS_H__
+#define __CAMERA_FRAME_PROCESSORS_H__
+
+#include <mutex>
+#include <vector>
+#include "frame_analyzer.h"
+
+/*
+ * Luma levels counted as crushed shadows and blown highlights: the ends of
+ * the limited range luma the camera produces.
+ */
+#define LUMA_DARK_LEVEL   16
+#define LUMA_BRIGHT_LEVEL 235
+
+/*
+ * LumaStatistics:
+ *     Histogram of the luma of a frame, and the exposure figures from it
+ */
+struct LumaStatistics {
+  uint32_t histogram[256];
+  uint32_t count;
+  float mean;    // average luma
+  float dark;    // share of samples at or under LUMA_DARK_LEVEL
+  float bright;  // share of samples at or over LUMA_BRIGHT_LEVEL
+  int64_t timestamp;
+};
+
+/*
+ * LumaHistogram:
+ *     Keeps the LumaStatistics of the last frame processed
+ */
+class LumaHistogram : public FrameProcessor {
+ public:
+  LumaHistogram(int32_t cadence, int32_t scale);
+
+  void Process(const FrameView& frame) override;
+
+  // false until a frame was processed
+  bool GetStatistics(LumaStatistics* stats);
+
+ private:
+  std::mutex lock_;
+  LumaStatistics stats_;
+};
+
+/*
+ * LumaDownscaler:
+ *     Keeps a grayscale thumbnail of the last frame processed, each pixel
+ *     the average of factor x factor luma samples of the frame view
+ */
+class LumaDownscaler : public FrameProcessor {
+ public:
+  LumaDownscaler(int32_t cadence, int32_t scale, int32_t factor);
+
+  void Process(const FrameView& frame) override;
+
+  // false until a frame was processed
+  bool GetThumbnail(std::vector<uint8_t>* pixels, int32_t* width,
+                    int32_t* height);
+
+ private:
+  int32_t factor_;
+  std::vector<uint32_t> sums_;
+
+  std::mutex lock_;
+  std::vector<uint8_t> thumbnail_;
+  int32_t width_, height_;
+};
+
+#endif  // __CAMERA_FRAME_PROCESSORS_H__
@@ -0,0 +1,259 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <cstring>
+#include <utility>
+#include "frame_uploader.h"
+#include "utils/native_debug.h"
+
+// chroma starts on its own cache line in the YUV layout
+#define FRAME_PLANE_ALIGN 64
+
+FrameUploader::FrameUploader(FrameBackend* backend)
+    : backend_(backend),
+      layout_(backend->ConvertsYuv() ? FrameLayout::YUV : FrameLayout::RGBA),
+      next_(0),
+      current_(-1),
+      texWidth_(0),
+      texHeight_(0),
+      rotation_(0),
+      bufferSize_(0),
+      chromaOffset_(0) {
+  memset(slots_, 0, sizeof(slots_));
+  memset(&stats_, 0, sizeof(stats_));
+}
+
+FrameUploader::~FrameUploader() { Release(); }
+
+/*
+ * Upload()
+ *   Wait for the GPU to be done with the next slot, write the frame into
+ *   its buffer (mapped for good, or mapped for this write only), copy it
+ *   into the slot's textures and fence that
+ */
+bool FrameUploader::Upload(const YuvImage& frame, int32_t rotation) {
+  if (frame.width <= 0 || frame.height <= 0) {
+    return false;
+  }
+  bool sideways = (rotation == 90 || rotation == 270);
+  int32_t width = frame.width, height = frame.height;
+  if (layout_ == FrameLayout::RGBA && sideways) {
+    std::swap(width, height);
+  }
+  if (width != texWidth_ || height != texHeight_) {
+    if (!Allocate(width, height)) {
+      stats_.dropped++;
+      return false;
+    }
+  }
+
+  Slot& slot = slots_[next_];
+  if (slot.fence) {
+    if (!backend_->WaitFence(slot.fence, 0)) {
+      stats_.fenceWaits++;
+      if (!backend_->WaitFence(slot.fence, FRAME_FENCE_TIMEOUT_NS)) {
+        stats_.dropped++;
+        return false;
+      }
+    }
+    backend_->DeleteFence(slot.fence);
+    slot.fence = nullptr;
+  }
+
+  uint8_t* dst = slot.mapped;
+  if (!dst) {
+    dst = backend_->MapBuffer(slot.buffer, bufferSize_);
+    if (!dst) {
+      stats_.dropped++;
+      return false;
+    }
+  }
+  if (layout_ == FrameLayout::YUV) {
+    WriteYuv(frame, dst);
+  } else {
+    RgbaImage image{reinterpret_cast<uint32_t*>(dst), width, width, height};
+    ConvertYuvToRgba(frame, image, rotation);
+  }
+  if (!slot.mapped) {
+    backend_->UnmapBuffer(slot.buffer);
+  }
+
+  if (layout_ == FrameLayout::YUV) {
+    backend_->UploadTexture(slot.textures[0], TextureFormat::R8, width,
+                            height, slot.buffer, 0);
+    backend_->UploadTexture(slot.textures[1], TextureFormat::RG8,
+                            (width + 1) / 2, (height + 1) / 2, slot.buffer,
+                            chromaOffset_);
+  } else {
+    backend_->UploadTexture(slot.textures[0], TextureFormat::RGBA8, width,
+                            height, slot.buffer, 0);
+  }
+  slot.fence = backend_->InsertFence();
+
+  current_ = next_;
+  next_ = (next_ + 1) % FRAME_RING_SIZE;
+  rotation_ = rotation;
+  stats_.uploaded++;
+  return true;
+}
+
+FrameLayout FrameUploader::Layout(void) const { return layout_; }
+
+uint32_t FrameUploader::Texture(int32_t plane) const {
+  if (current_ < 0 || plane < 0 || plane > 1) {
+    return 0;
+  }
+  return slots_[current_].textures[plane];
+}
+
+int32_t FrameUploader::Width(void) const {
+  if (layout_ == FrameLayout::YUV && (rotation_ == 90 || rotation_ == 270)) {
+    return texHeight_;
+  }
+  return texWidth_;
+}
+
+int32_t FrameUploader::Height(void) const {
+  if (layout_ == FrameLayout::YUV && (rotation_ == 90 || rotation_ == 270)) {
+    return texWidth_;
+  }
+  return texHeight_;
+}
+
+void FrameUploader::TexCoordMatrix(float matrix[6]) const {
+  static const float kMatrices[4][6] = {
+      {1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f},    // 0
+      {0.0f, 1.0f, 0.0f, -1.0f, 0.0f, 1.0f},   // 90: top left from bottom left
+      {-1.0f, 0.0f, 1.0f, 0.0f, -1.0f, 1.0f},  // 180
+      {0.0f, -1.0f, 1.0f, 1.0f, 0.0f, 0.0f},   // 270: top left from top right
+  };
+  int32_t index = 0;
+  if (layout_ == FrameLayout::YUV) {
+    index = (rotation_ / 90) & 3;
+  }
+  memcpy(matrix, kMatrices[index], sizeof(kMatrices[index]));
+}
+
+FrameUploader::Stats FrameUploader::GetStats(void) const { return stats_; }
+
+/*
+ * Allocate()
+ *   (Re)create the buffers and textures of all slots for width x height
+ *   (luma) textures; only happens when the frame size changes
+ */
+bool FrameUploader::Allocate(int32_t width, int32_t height) {
+  Release();
+  int32_t uvWidth = (width + 1) / 2, uvHeight = (height + 1) / 2;
+  size_t pixels = static_cast<size_t>(width) * height;
+  if (layout_ == FrameLayout::YUV) {
+    chromaOffset_ = (pixels + FRAME_PLANE_ALIGN - 1) & ~(FRAME_PLANE_ALIGN - 1);
+    bufferSize_ = chromaOffset_ + static_cast<size_t>(uvWidth) * uvHeight * 2;
+  } else {
+    chromaOffset_ = 0;
+    bufferSize_ = pixels * 4;
+  }
+
+  bool persistent = backend_->PersistentMapping();
+  for (auto& slot : slots_) {
+    slot.buffer = backend_->CreateBuffer(bufferSize_);
+    if (slot.buffer && persistent) {
+      slot.mapped = backend_->MapBuffer(slot.buffer, bufferSize_);
+    }
+    if (layout_ == FrameLayout::YUV) {
+      slot.textures[0] = backend_->CreateTexture(TextureFormat::R8, width,
+                                                 height);
+      slot.textures[1] = backend_->CreateTexture(TextureFormat::RG8, uvWidth,
+                                                 uvHeight);
+    } else {
+      slot.textures[0] = backend_->CreateTexture(TextureFormat::RGBA8, width,
+                                                 height);
+    }
+    if (!slot.buffer || (persistent && !slot.mapped) || !slot.textures[0] ||
+        (layout_ == FrameLayout::YUV && !slot.textures[1])) {
+      LOGE("Cannot allocate %dx%d frame buffers", width, height);
+      Release();
+      return false;
+    }
+  }
+  texWidth_ = width;
+  texHeight_ = height;
+  stats_.allocations++;
+  return true;
+}
+
+/*
+ * Release()
+ *   Delete what the slots hold; the GPU may still use it, GL keeps deleted
+ *   objects alive until it is done
+ */
+void FrameUploader::Release(void) {
+  for (auto& slot : slots_) {
+    if (slot.fence) {
+      backend_->DeleteFence(slot.fence);
+    }
+    if (slot.buffer) {
+      if (slot.mapped) {
+        backend_->UnmapBuffer(slot.buffer);
+      }
+      backend_->DeleteBuffer(slot.buffer);
+    }
+    for (auto texture : slot.textures) {
+      if (texture) {
+        backend_->DeleteTexture(texture);
+      }
+    }
+  }
+  memset(slots_, 0, sizeof(slots_));
+  next_ = 0;
+  current_ = -1;
+  texWidth_ = texHeight_ = 0;
+  bufferSize_ = 0;
+}
+
+/*
+ * WriteYuv()
+ *   Luma rows back to back, then chroma as U V pairs, one per 2x2 pixels;
+ *   NV12 chroma is in that order already and copied a row at a time. An
+ *   odd crop origin shifts chroma by half a sample.
+ */
+void FrameUploader::WriteYuv(const YuvImage& frame, uint8_t* dst) {
+  for (int32_t row = 0; row < frame.height; row++) {
+    memcpy(dst + static_cast<size_t>(row) * frame.width,
+           frame.y + static_cast<size_t>(frame.top + row) * frame.yStride +
+               frame.left,
+           frame.width);
+  }
+
+  int32_t uvWidth = (frame.width + 1) / 2, uvHeight = (frame.height + 1) / 2;
+  int32_t ps = frame.uvPixelStride;
+  bool nv12 = (ps == 2 && frame.v == frame.u + 1);
+  uint8_t* uv = dst + chromaOffset_;
+  for (int32_t row = 0; row < uvHeight; row++) {
+    size_t offset =
+        static_cast<size_t>(frame.top / 2 + row) * frame.uvStride +
+        static_cast<size_t>(frame.left / 2) * ps;
+    const uint8_t* u = frame.u + offset;
+    const uint8_t* v = frame.v + offset;
+    uint8_t* out = uv + static_cast<size_t>(row) * uvWidth * 2;
+    if (nv12) {
+      memcpy(out, u, static_cast<size_t>(uvWidth) * 2);
+      continue;
+    }
+    for (int32_t x = 0; x < uvWidth; x++) {
+      out[2 * x] = u[x * ps];
+      out[2 * x + 1] = v[x * ps];
+    }
+  }
+}
@@ -0,0 +1,154 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __CAMERA_FRAME_UPLOADER_H__
+#define __CAMERA_FRAME_UPLOADER_H__
+
+#include <cstddef>
+#include <cstdint>
+#include "yuv_converter.h"
+
+/*
+ * FRAME_RING_SIZE:
+ *     Pixel buffers (and textures) frames are uploaded through in turn: a
+ *     buffer is written again FRAME_RING_SIZE frames after it was uploaded,
+ *     when the GPU is normally long done with it.
+ * FRAME_FENCE_TIMEOUT_NS:
+ *     Longest wait for the GPU to release a buffer; the frame is dropped
+ *     when it takes longer.
+ */
+#define FRAME_RING_SIZE        3
+#define FRAME_FENCE_TIMEOUT_NS 4000000
+
+enum class FrameLayout : int32_t {
+  RGBA,  // one RGBA texture, converted and rotated on the CPU
+  YUV,   // luma R and chroma RG (U, V) textures, converted by the shader
+};
+
+enum class TextureFormat : int32_t {
+  R8,
+  RG8,
+  RGBA8,
+};
+
+typedef void* FrameFence;
+
+/*
+ * FrameBackend:
+ *     The graphics calls FrameUploader makes: GlesFrameBackend on the
+ *     device, anything that keeps the same promises elsewhere. Buffers are
+ *     pixel unpack buffers; with PersistentMapping() MapBuffer() is called
+ *     once per buffer and its pointer kept until DeleteBuffer(), otherwise
+ *     every write is enclosed in MapBuffer() and UnmapBuffer(). The
+ *     uploader never writes a buffer before the fence inserted after its
+ *     last upload is signaled.
+ */
+class FrameBackend {
+ public:
+  virtual ~FrameBackend() {}
+
+  virtual bool ConvertsYuv(void) = 0;
+  virtual bool PersistentMapping(void) = 0;
+
+  virtual uint32_t CreateBuffer(size_t size) = 0;
+  virtual void DeleteBuffer(uint32_t buffer) = 0;
+  virtual uint8_t* MapBuffer(uint32_t buffer, size_t size) = 0;
+  virtual void UnmapBuffer(uint32_t buffer) = 0;
+
+  virtual uint32_t CreateTexture(TextureFormat format, int32_t width,
+                                 int32_t height) = 0;
+  virtual void DeleteTexture(uint32_t texture) = 0;
+  // copy width x height texels, tightly packed at offset in buffer
+  virtual void UploadTexture(uint32_t texture, TextureFormat format,
+                             int32_t width, int32_t height, uint32_t buffer,
+                             size_t offset) = 0;
+
+  virtual FrameFence InsertFence(void) = 0;
+  virtual bool WaitFence(FrameFence fence, uint64_t timeoutNs) = 0;
+  virtual void DeleteFence(FrameFence fence) = 0;
+};
+
+/*
+ * FrameUploader:
+ *     Uploads camera frames as textures through a ring of pixel buffers,
+ *     allocated once for a frame size and reused: as YUV textures for the
+ *     shader when the backend converts YUV, otherwise converted to RGBA on
+ *     the CPU with ConvertYuvToRgba(). All calls on the GL thread.
+ */
+class FrameUploader {
+ public:
+  struct Stats {
+    uint64_t uploaded;
+    uint64_t dropped;      // the GPU still held the buffer
+    uint64_t fenceWaits;   // uploads that had to wait for the GPU
+    uint64_t allocations;  // ring (re)allocations, on frame size changes
+  };
+
+  explicit FrameUploader(FrameBackend* backend);
+  ~FrameUploader();
+
+  /**
+   * Upload the crop rectangle of frame, rotated clockwise by rotation
+   * degrees: on the CPU for FrameLayout::RGBA, through TexCoordMatrix()
+   * for FrameLayout::YUV. Returns false when the frame was dropped; the
+   * textures of the previous frame stay current.
+   */
+  bool Upload(const YuvImage& frame, int32_t rotation);
+
+  FrameLayout Layout(void) const;
+  // textures of the last frame uploaded: RGBA, or luma and chroma
+  uint32_t Texture(int32_t plane) const;
+  // size of the picture on screen, after rotation
+  int32_t Width(void) const;
+  int32_t Height(void) const;
+
+  /**
+   * TexCoordMatrix()
+   *   Texture coordinates (u, v) for screen coordinates (s, t), 0, 0 at
+   *   the top left of the picture: u = m[0] s + m[1] t + m[2],
+   *   v = m[3] s + m[4] t + m[5]. Rotates YUV textures, identity for RGBA
+   *   ones as those are rotated already.
+   */
+  void TexCoordMatrix(float matrix[6]) const;
+
+  Stats GetStats(void) const;
+
+ private:
+  struct Slot {
+    uint32_t buffer;
+    uint8_t* mapped;
+    uint32_t textures[2];
+    FrameFence fence;
+  };
+
+  FrameBackend* backend_;
+  FrameLayout layout_;
+  Slot slots_[FRAME_RING_SIZE];
+  int32_t next_;
+  int32_t current_;
+
+  // size of the (luma) textures the ring is allocated for
+  int32_t texWidth_, texHeight_;
+  int32_t rotation_;
+  size_t bufferSize_;
+  size_t chromaOffset_;
+  Stats stats_;
+
+  bool Allocate(int32_t width, int32_t height);
+  void Release(void);
+  void WriteYuv(const YuvImage& frame, uint8_t* dst);
+};
+
+#endif  // __CAMERA_FRAME_UPLOADER_H__
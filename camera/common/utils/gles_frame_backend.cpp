@@ -0,0 +1,214 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <cstring>
+#include <EGL/egl.h>
+#include "gles_frame_backend.h"
+#include "utils/native_debug.h"
+
+#define PERSISTENT_MAP_ACCESS \
+  (GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT_EXT | GL_MAP_COHERENT_BIT_EXT)
+
+GlesFrameBackend::GlesFrameBackend(bool convertYuv)
+    : convertYuv_(convertYuv), bufferStorage_(nullptr) {
+  GLint count = 0;
+  glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+  for (GLint idx = 0; idx < count; idx++) {
+    const GLubyte* name = glGetStringi(GL_EXTENSIONS, idx);
+    if (name && !strcmp(reinterpret_cast<const char*>(name),
+                        "GL_EXT_buffer_storage")) {
+      bufferStorage_ = reinterpret_cast<PFNGLBUFFERSTORAGEEXTPROC>(
+          eglGetProcAddress("glBufferStorageEXT"));
+      break;
+    }
+  }
+  LOGI("Frames uploaded as %s textures from %s buffers",
+       convertYuv_ ? "YUV" : "RGBA",
+       bufferStorage_ ? "persistently mapped" : "per frame mapped");
+}
+
+bool GlesFrameBackend::ConvertsYuv(void) { return convertYuv_; }
+
+bool GlesFrameBackend::PersistentMapping(void) {
+  return bufferStorage_ != nullptr;
+}
+
+uint32_t GlesFrameBackend::CreateBuffer(size_t size) {
+  GLuint buffer = 0;
+  glGenBuffers(1, &buffer);
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+  if (bufferStorage_) {
+    bufferStorage_(GL_PIXEL_UNPACK_BUFFER, static_cast<GLsizeiptr>(size),
+                   nullptr, PERSISTENT_MAP_ACCESS);
+  } else {
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, static_cast<GLsizeiptr>(size),
+                 nullptr, GL_STREAM_DRAW);
+  }
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  if (glGetError() != GL_NO_ERROR) {
+    glDeleteBuffers(1, &buffer);
+    return 0;
+  }
+  return buffer;
+}
+
+void GlesFrameBackend::DeleteBuffer(uint32_t buffer) {
+  glDeleteBuffers(1, &buffer);
+}
+
+/*
+ * MapBuffer()
+ *   Unsynchronized when mapped per frame: the uploader waited for the
+ *   buffer's fence, there is nothing for the driver to wait for
+ */
+uint8_t* GlesFrameBackend::MapBuffer(uint32_t buffer, size_t size) {
+  GLbitfield access =
+      bufferStorage_ ? PERSISTENT_MAP_ACCESS
+                     : (GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT |
+                        GL_MAP_UNSYNCHRONIZED_BIT);
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+  void* data = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0,
+                                static_cast<GLsizeiptr>(size), access);
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  return static_cast<uint8_t*>(data);
+}
+
+void GlesFrameBackend::UnmapBuffer(uint32_t buffer) {
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+  glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+static void TextureFormats(TextureFormat format, GLenum* internalFormat,
+                           GLenum* pixelFormat) {
+  switch (format) {
+    case TextureFormat::R8:
+      *internalFormat = GL_R8;
+      *pixelFormat = GL_RED;
+      break;
+    case TextureFormat::RG8:
+      *internalFormat = GL_RG8;
+      *pixelFormat = GL_RG;
+      break;
+    default:
+      *internalFormat = GL_RGBA8;
+      *pixelFormat = GL_RGBA;
+      break;
+  }
+}
+
+uint32_t GlesFrameBackend::CreateTexture(TextureFormat format, int32_t width,
+                                         int32_t height) {
+  GLenum internalFormat, pixelFormat;
+  TextureFormats(format, &internalFormat, &pixelFormat);
+
+  GLuint texture = 0;
+  glGenTextures(1, &texture);
+  glBindTexture(GL_TEXTURE_2D, texture);
+  glTexStorage2D(GL_TEXTURE_2D, 1, internalFormat, width, height);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  if (glGetError() != GL_NO_ERROR) {
+    glDeleteTextures(1, &texture);
+    return 0;
+  }
+  return texture;
+}
+
+void GlesFrameBackend::DeleteTexture(uint32_t texture) {
+  glDeleteTextures(1, &texture);
+}
+
+void GlesFrameBackend::UploadTexture(uint32_t texture, TextureFormat format,
+                                     int32_t width, int32_t height,
+                                     uint32_t buffer, size_t offset) {
+  GLenum internalFormat, pixelFormat;
+  TextureFormats(format, &internalFormat, &pixelFormat);
+
+  glBindTexture(GL_TEXTURE_2D, texture);
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+  // rows are packed without padding
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, pixelFormat,
+                  GL_UNSIGNED_BYTE, reinterpret_cast<const void*>(offset));
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+FrameFence GlesFrameBackend::InsertFence(void) {
+  return static_cast<FrameFence>(
+      glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0));
+}
+
+bool GlesFrameBackend::WaitFence(FrameFence fence, uint64_t timeoutNs) {
+  GLenum status = glClientWaitSync(static_cast<GLsync>(fence),
+                                   GL_SYNC_FLUSH_COMMANDS_BIT, timeoutNs);
+  return status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED;
+}
+
+void GlesFrameBackend::DeleteFence(FrameFence fence) {
+  glDeleteSync(static_cast<GLsync>(fence));
+}
+
+const char* GlesFrameBackend::VertexShader(void) {
+  return "#version 300 es\n"
+         "layout(location = 0) in vec2 position;\n"
+         "uniform vec3 texCoordU;\n"
+         "uniform vec3 texCoordV;\n"
+         "out vec2 texCoord;\n"
+         "void main() {\n"
+         "  vec3 st = vec3(position.x * 0.5 + 0.5, 0.5 - position.y * 0.5,"
+         " 1.0);\n"
+         "  texCoord = vec2(dot(texCoordU, st), dot(texCoordV, st));\n"
+         "  gl_Position = vec4(position, 0.0, 1.0);\n"
+         "}\n";
+}
+
+/*
+ * FragmentShader()
+ *   The YUV one has the BT.601 limited range coefficients of
+ *   ConvertYuvToRgba(), on samples scaled back to [0, 255]
+ */
+const char* GlesFrameBackend::FragmentShader(FrameLayout layout) {
+  if (layout == FrameLayout::RGBA) {
+    return "#version 300 es\n"
+           "precision mediump float;\n"
+           "uniform sampler2D frameTexture;\n"
+           "in vec2 texCoord;\n"
+           "out vec4 fragColor;\n"
+           "void main() {\n"
+           "  fragColor = texture(frameTexture, texCoord);\n"
+           "}\n";
+  }
+  return "#version 300 es\n"
+         "precision highp float;\n"
+         "uniform sampler2D lumaTexture;\n"
+         "uniform sampler2D chromaTexture;\n"
+         "in vec2 texCoord;\n"
+         "out vec4 fragColor;\n"
+         "void main() {\n"
+         "  float y = 1.164 * max(texture(lumaTexture, texCoord).r * 255.0"
+         " - 16.0, 0.0);\n"
+         "  vec2 uv = texture(chromaTexture, texCoord).rg * 255.0 - 128.0;\n"
+         "  vec3 rgb = vec3(y + 1.596 * uv.y,\n"
+         "                  y - 0.813 * uv.y - 0.391 * uv.x,\n"
+         "                  y + 2.018 * uv.x);\n"
+         "  fragColor = vec4(clamp(rgb / 255.0, 0.0, 1.0), 1.0);\n"
+         "}\n";
+}
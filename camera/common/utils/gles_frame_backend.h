@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __CAMERA_GLES_FRAME_BACKEND_H__
+#define __CAMERA_GLES_FRAME_BACKEND_H__
+
+#include <GLES3/gl3.h>
+#include <GLES2/gl2ext.h>
+#include "frame_uploader.h"
+
+/*
+ * GlesFrameBackend:
+ *     FrameBackend on OpenGL ES 3.0, for the thread the context is current
+ *     on. Pixel buffers are mapped once and for all where
+ *     GL_EXT_buffer_storage is supported, otherwise unsynchronized for
+ *     every frame: FrameUploader fences them either way.
+ */
+class GlesFrameBackend : public FrameBackend {
+ public:
+  /**
+   * convertYuv: upload YUV textures for the shader from FragmentShader();
+   * false converts to RGBA on the CPU instead
+   */
+  explicit GlesFrameBackend(bool convertYuv);
+
+  bool ConvertsYuv(void) override;
+  bool PersistentMapping(void) override;
+
+  uint32_t CreateBuffer(size_t size) override;
+  void DeleteBuffer(uint32_t buffer) override;
+  uint8_t* MapBuffer(uint32_t buffer, size_t size) override;
+  void UnmapBuffer(uint32_t buffer) override;
+
+  uint32_t CreateTexture(TextureFormat format, int32_t width,
+                         int32_t height) override;
+  void DeleteTexture(uint32_t texture) override;
+  void UploadTexture(uint32_t texture, TextureFormat format, int32_t width,
+                     int32_t height, uint32_t buffer, size_t offset) override;
+
+  FrameFence InsertFence(void) override;
+  bool WaitFence(FrameFence fence, uint64_t timeoutNs) override;
+  void DeleteFence(FrameFence fence) override;
+
+  /**
+   * GLSL ES 3.00 sources to draw FrameUploader textures with. The vertex
+   * shader takes a quad in clip space as attribute 0 and the rows of
+   * FrameUploader::TexCoordMatrix() as uniforms texCoordU and texCoordV;
+   * the fragment shader samples frameTexture (RGBA), or lumaTexture and
+   * chromaTexture (YUV), converting those like ConvertYuvToRgba().
+   */
+  static const char* VertexShader(void);
+  static const char* FragmentShader(FrameLayout layout);
+
+ private:
+  bool convertYuv_;
+  PFNGLBUFFERSTORAGEEXTPROC bufferStorage_;
+};
+
+#endif  // __CAMERA_GLES_FRAME_BACKEND_H__
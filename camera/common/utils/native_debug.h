@@ -1,3 +1,4 @@
+#ifdef __ANDROID__
 #include <android/log.h>
 
 #define LOG_TAG "CAMERA-SAMPLE"
@@ -8,3 +9,24 @@
   if (!(cond)) {                                              \
     __android_log_assert(#cond, LOG_TAG, fmt, ##__VA_ARGS__); \
   }
+#else
+// host builds (camera/tests) log to stderr
+#include <cstdio>
+#include <cstdlib>
+
+#define LOG_TAG "CAMERA-SAMPLE"
+#define HOST_LOG(level, ...)                      \
+  do {                                            \
+    fprintf(stderr, LOG_TAG " " level ": ");      \
+    fprintf(stderr, __VA_ARGS__);                 \
+    fprintf(stderr, "\n");                        \
+  } while (0)
+#define LOGI(...) HOST_LOG("I", __VA_ARGS__)
+#define LOGW(...) HOST_LOG("W", __VA_ARGS__)
+#define LOGE(...) HOST_LOG("E", __VA_ARGS__)
+#define ASSERT(cond, fmt, ...)                         \
+  if (!(cond)) {                                       \
+    HOST_LOG("F", "%s: " fmt, #cond, ##__VA_ARGS__);   \
+    abort();                                           \
+  }
+#endif
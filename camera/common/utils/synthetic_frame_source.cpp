@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "synthetic_frame_source.h"
+
+/*
+ * The chroma of interleaved frames is U V U V ..., V one byte after U; the
+ * last V sample is the last byte of the buffer, as with camera buffers.
+ * Planar frames have the V plane after the U plane.
+ */
+SyntheticFrameSource::SyntheticFrameSource(int32_t width, int32_t height,
+                                           int32_t uvPixelStride,
+                                           int32_t rowPadding)
+    : width_(width),
+      height_(height),
+      uvPixelStride_(uvPixelStride),
+      frameCount_(0),
+      framesDropped_(0) {
+  int32_t uvWidth = (width + 1) / 2, uvHeight = (height + 1) / 2;
+  yStride_ = width + rowPadding;
+  uvStride_ = uvWidth * uvPixelStride + rowPadding;
+  uvOffset_ = static_cast<size_t>(yStride_) * height;
+  size_t uvSize = static_cast<size_t>(uvStride_) * uvHeight;
+  if (uvPixelStride == 1) {
+    uvSize *= 2;
+  }
+  for (auto& buffer : buffers_) {
+    buffer.data.resize(uvOffset_ + uvSize);
+    buffer.inUse = false;
+  }
+}
+
+bool SyntheticFrameSource::Acquire(YuvImage* image, int64_t* timestamp) {
+  Buffer* free = nullptr;
+  uint64_t number;
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    number = frameCount_++;
+    for (auto& buffer : buffers_) {
+      if (!buffer.inUse) {
+        free = &buffer;
+        break;
+      }
+    }
+    if (!free) {
+      framesDropped_++;
+      return false;
+    }
+    free->inUse = true;
+  }
+  Draw(free->data.data(), number);
+
+  const uint8_t* data = free->data.data();
+  image->y = data;
+  image->u = data + uvOffset_;
+  image->v = (uvPixelStride_ == 1)
+                 ? image->u + static_cast<size_t>(uvStride_) * ((height_ + 1) / 2)
+                 : image->u + 1;
+  image->yStride = yStride_;
+  image->uvStride = uvStride_;
+  image->uvPixelStride = uvPixelStride_;
+  image->left = 0;
+  image->top = 0;
+  image->width = width_;
+  image->height = height_;
+  *timestamp = static_cast<int64_t>(number) * SYNTHETIC_FRAME_INTERVAL;
+  return true;
+}
+
+void SyntheticFrameSource::Release(const YuvImage& image) {
+  std::lock_guard<std::mutex> lock(lock_);
+  for (auto& buffer : buffers_) {
+    if (buffer.data.data() == image.y) {
+      buffer.inUse = false;
+    }
+  }
+}
+
+uint64_t SyntheticFrameSource::FramesDropped(void) {
+  std::lock_guard<std::mutex> lock(lock_);
+  return framesDropped_;
+}
+
+void SyntheticFrameSource::Draw(uint8_t* data, uint64_t number) {
+  uint32_t gain = static_cast<uint32_t>(number & 255);
+  for (int32_t y = 0; y < height_; y++) {
+    uint8_t* row = data + static_cast<size_t>(y) * yStride_;
+    for (int32_t x = 0; x < width_; x++) {
+      if (((x + number) / 32) % 4 == 0) {
+        row[x] = 235;
+      } else {
+        uint32_t ramp = static_cast<uint32_t>(x + y) * 255 / (width_ + height_);
+        row[x] = static_cast<uint8_t>(16 + ramp * gain * 219 / (255 * 255));
+      }
+    }
+  }
+
+  int32_t uvWidth = (width_ + 1) / 2, uvHeight = (height_ + 1) / 2;
+  uint8_t* u = data + uvOffset_;
+  uint8_t* v = (uvPixelStride_ == 1)
+                   ? u + static_cast<size_t>(uvStride_) * uvHeight
+                   : u + 1;
+  for (int32_t y = 0; y < uvHeight; y++) {
+    for (int32_t x = 0; x < uvWidth; x++) {
+      size_t offset = static_cast<size_t>(y) * uvStride_ + x * uvPixelStride_;
+      u[offset] = static_cast<uint8_t>(96 + x * 64 / uvWidth);
+      v[offset] = static_cast<uint8_t>(96 + y * 64 / uvHeight);
+    }
+  }
+}
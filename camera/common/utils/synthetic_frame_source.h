@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __CAMERA_SYNTHETIC_FRAME_SOURCE_H__
+#define __CAMERA_SYNTHETIC_FRAME_SOURCE_H__
+
+#include <mutex>
+#include <vector>
+#include "yuv_converter.h"
+
+/*
+ * SYNTHETIC_BUFFER_COUNT:
+ *     Frames the source can have handed out at a time, like the buffers of
+ *     an AImageReader
+ * SYNTHETIC_FRAME_INTERVAL:
+ *     Time between two frames in nanoseconds, 30 fps
+ */
+#define SYNTHETIC_BUFFER_COUNT   4
+#define SYNTHETIC_FRAME_INTERVAL 33333333
+
+/*
+ * SyntheticFrameSource:
+ *     Stands in for the camera where there is none, e.g. to run the frame
+ *     converter and analyzer on Linux: produces YUV_420_888 frames in the
+ *     layout of a real camera (padded rows, planar chroma with a pixel
+ *     stride of 1, interleaved with 2), showing bars moving one pixel per
+ *     frame over a luma ramp that brightens over a 256 frame cycle.
+ *     Frames stay valid until released; with all buffers out Acquire()
+ *     fails, as the camera drops frames when nobody releases them.
+ */
+class SyntheticFrameSource {
+ public:
+  SyntheticFrameSource(int32_t width, int32_t height, int32_t uvPixelStride,
+                       int32_t rowPadding);
+
+  bool Acquire(YuvImage* image, int64_t* timestamp);
+  void Release(const YuvImage& image);
+
+  uint64_t FramesDropped(void);
+
+ private:
+  struct Buffer {
+    std::vector<uint8_t> data;
+    bool inUse;
+  };
+
+  int32_t width_, height_;
+  int32_t uvPixelStride_;
+  int32_t yStride_, uvStride_;
+  size_t uvOffset_;
+
+  std::mutex lock_;
+  Buffer buffers_[SYNTHETIC_BUFFER_COUNT];
+  uint64_t frameCount_;
+  uint64_t framesDropped_;
+
+  void Draw(uint8_t* data, uint64_t number);
+};
+
+#endif  // __CAMERA_SYNTHETIC_FRAME_SOURCE_H__
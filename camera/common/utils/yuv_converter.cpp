@@ -0,0 +1,356 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <algorithm>
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define YUV_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define YUV_SSE2 1
+#endif
+#include "yuv_converter.h"
+
+/*
+ * YUV_TILE_SIZE:
+ *   Rotated images are converted in tiles of YUV_TILE_SIZE^2 pixels, small
+ *   enough to stay in L1 while they are transposed.
+ */
+#define YUV_TILE_SIZE YUV_BAND_ALIGN
+
+/*
+ * BT.601 limited range, coefficients in 10 bit fixed point:
+ *   R = 1.164 * (Y - 16) + 1.596 * (V - 128)
+ *   G = 1.164 * (Y - 16) - 0.813 * (V - 128) - 0.391 * (U - 128)
+ *   B = 1.164 * (Y - 16) + 2.018 * (U - 128)
+ * The vector kernels compute exactly the same values.
+ */
+static const int32_t kYCoef = 1192;
+static const int32_t kVRCoef = 1634;
+static const int32_t kVGCoef = 833;
+static const int32_t kUGCoef = 400;
+static const int32_t kUBCoef = 2066;
+
+static inline uint32_t ClampChannel(int32_t value) {
+  return static_cast<uint32_t>(std::min(std::max(value, 0), 262143) >> 10);
+}
+
+// one pixel, R in the lowest byte
+static inline uint32_t YuvToRgba(int32_t y, int32_t u, int32_t v) {
+  y = std::max(y - 16, 0) * kYCoef;
+  u -= 128;
+  v -= 128;
+  uint32_t r = ClampChannel(y + kVRCoef * v);
+  uint32_t g = ClampChannel(y - kVGCoef * v - kUGCoef * u);
+  uint32_t b = ClampChannel(y + kUBCoef * u);
+  return 0xff000000 | (b << 16) | (g << 8) | r;
+}
+
+#if defined(YUV_NEON)
+static inline uint8x8_t NeonChannel(int32x4_t lo, int32x4_t hi) {
+  return vqmovn_u16(vcombine_u16(vqshrun_n_s32(lo, 10), vqshrun_n_s32(hi, 10)));
+}
+
+// 16 pixels, 8 chroma samples
+static inline void ConvertPixels16(const uint8_t* y, const uint8_t* u,
+                                   const uint8_t* v, int32_t uvPixelStride,
+                                   uint32_t* out) {
+  uint8x16_t luma = vld1q_u8(y);
+  uint8x8_t u8, v8;
+  if (uvPixelStride == 1) {
+    u8 = vld1_u8(u);
+    v8 = vld1_u8(v);
+  } else {
+    u8 = vld2_u8(u).val[0];
+    v8 = vld2_u8(v).val[0];
+  }
+  uint8x8x2_t uu = vzip_u8(u8, u8);
+  uint8x8x2_t vv = vzip_u8(v8, v8);
+
+  uint8x8_t r[2], g[2], b[2];
+  for (int half = 0; half < 2; half++) {
+    uint8x8_t y8 = half ? vget_high_u8(luma) : vget_low_u8(luma);
+    int16x8_t y16 = vmaxq_s16(
+        vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(y8)), vdupq_n_s16(16)),
+        vdupq_n_s16(0));
+    int16x8_t u16 = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(uu.val[half])),
+                              vdupq_n_s16(128));
+    int16x8_t v16 = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vv.val[half])),
+                              vdupq_n_s16(128));
+    int32x4_t yLo = vmull_n_s16(vget_low_s16(y16), kYCoef);
+    int32x4_t yHi = vmull_n_s16(vget_high_s16(y16), kYCoef);
+
+    r[half] = NeonChannel(vmlal_n_s16(yLo, vget_low_s16(v16), kVRCoef),
+                          vmlal_n_s16(yHi, vget_high_s16(v16), kVRCoef));
+    g[half] = NeonChannel(
+        vmlsl_n_s16(vmlsl_n_s16(yLo, vget_low_s16(v16), kVGCoef),
+                    vget_low_s16(u16), kUGCoef),
+        vmlsl_n_s16(vmlsl_n_s16(yHi, vget_high_s16(v16), kVGCoef),
+                    vget_high_s16(u16), kUGCoef));
+    b[half] = NeonChannel(vmlal_n_s16(yLo, vget_low_s16(u16), kUBCoef),
+                          vmlal_n_s16(yHi, vget_high_s16(u16), kUBCoef));
+  }
+
+  uint8x16x4_t rgba;
+  rgba.val[0] = vcombine_u8(r[0], r[1]);
+  rgba.val[1] = vcombine_u8(g[0], g[1]);
+  rgba.val[2] = vcombine_u8(b[0], b[1]);
+  rgba.val[3] = vdupq_n_u8(0xff);
+  vst4q_u8(reinterpret_cast<uint8_t*>(out), rgba);
+}
+#elif defined(YUV_SSE2)
+// (a, b) pairs for _mm_madd_epi16
+static inline __m128i Coefs(int16_t a, int16_t b) {
+  return _mm_set_epi16(b, a, b, a, b, a, b, a);
+}
+
+// 8 pixels of one channel: (first, second) * coefs, plus extra
+static inline __m128i SseChannel(__m128i first, __m128i second, __m128i coefs,
+                                 __m128i extraLo, __m128i extraHi) {
+  __m128i lo = _mm_add_epi32(
+      _mm_madd_epi16(_mm_unpacklo_epi16(first, second), coefs), extraLo);
+  __m128i hi = _mm_add_epi32(
+      _mm_madd_epi16(_mm_unpackhi_epi16(first, second), coefs), extraHi);
+  return _mm_packs_epi32(_mm_srai_epi32(lo, 10), _mm_srai_epi32(hi, 10));
+}
+
+// 16 pixels, 8 chroma samples
+static inline void ConvertPixels16(const uint8_t* y, const uint8_t* u,
+                                   const uint8_t* v, int32_t uvPixelStride,
+                                   uint32_t* out) {
+  const __m128i zero = _mm_setzero_si128();
+  __m128i luma = _mm_loadu_si128(reinterpret_cast<const __m128i*>(y));
+  __m128i u8, v8;
+  if (uvPixelStride == 1) {
+    u8 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(u));
+    v8 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(v));
+  } else {
+    const __m128i even = _mm_set1_epi16(0xff);
+    u8 = _mm_packus_epi16(
+        _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(u)),
+                      even), zero);
+    v8 = _mm_packus_epi16(
+        _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(v)),
+                      even), zero);
+  }
+  __m128i uu = _mm_unpacklo_epi8(u8, u8);
+  __m128i vv = _mm_unpacklo_epi8(v8, v8);
+
+  __m128i r[2], g[2], b[2];
+  for (int half = 0; half < 2; half++) {
+    __m128i y16 = half ? _mm_unpackhi_epi8(luma, zero) :
+                         _mm_unpacklo_epi8(luma, zero);
+    __m128i u16 = half ? _mm_unpackhi_epi8(uu, zero) :
+                         _mm_unpacklo_epi8(uu, zero);
+    __m128i v16 = half ? _mm_unpackhi_epi8(vv, zero) :
+                         _mm_unpacklo_epi8(vv, zero);
+    y16 = _mm_max_epi16(_mm_sub_epi16(y16, _mm_set1_epi16(16)), zero);
+    u16 = _mm_sub_epi16(u16, _mm_set1_epi16(128));
+    v16 = _mm_sub_epi16(v16, _mm_set1_epi16(128));
+
+    // U part of G on its own, as 32 bit values
+    __m128i ugLo = _mm_madd_epi16(_mm_unpacklo_epi16(u16, zero),
+                                  Coefs(-kUGCoef, 0));
+    __m128i ugHi = _mm_madd_epi16(_mm_unpackhi_epi16(u16, zero),
+                                  Coefs(-kUGCoef, 0));
+    r[half] = SseChannel(y16, v16, Coefs(kYCoef, kVRCoef), zero, zero);
+    g[half] = SseChannel(y16, v16, Coefs(kYCoef, -kVGCoef), ugLo, ugHi);
+    b[half] = SseChannel(y16, u16, Coefs(kYCoef, kUBCoef), zero, zero);
+  }
+  __m128i r8 = _mm_packus_epi16(r[0], r[1]);
+  __m128i g8 = _mm_packus_epi16(g[0], g[1]);
+  __m128i b8 = _mm_packus_epi16(b[0], b[1]);
+  __m128i a8 = _mm_set1_epi8(static_cast<char>(0xff));
+
+  __m128i rgLo = _mm_unpacklo_epi8(r8, g8), rgHi = _mm_unpackhi_epi8(r8, g8);
+  __m128i baLo = _mm_unpacklo_epi8(b8, a8), baHi = _mm_unpackhi_epi8(b8, a8);
+  __m128i* dst = reinterpret_cast<__m128i*>(out);
+  _mm_storeu_si128(dst + 0, _mm_unpacklo_epi16(rgLo, baLo));
+  _mm_storeu_si128(dst + 1, _mm_unpackhi_epi16(rgLo, baLo));
+  _mm_storeu_si128(dst + 2, _mm_unpacklo_epi16(rgHi, baHi));
+  _mm_storeu_si128(dst + 3, _mm_unpackhi_epi16(rgHi, baHi));
+}
+#endif
+
+/*
+ * ConvertRow()
+ *   count pixels of row y of src, starting at pixel x (both relative to
+ *   the image, not to the crop rectangle), into out
+ */
+static void ConvertRow(const YuvImage& src, int32_t x, int32_t y,
+                       int32_t count, uint32_t* out) {
+  const int32_t ps = src.uvPixelStride;
+  const uint8_t* pY = src.y + y * src.yStride + x;
+  int32_t uvOffset = (y >> 1) * src.uvStride + (x >> 1) * ps;
+  const uint8_t* pU = src.u + uvOffset;
+  const uint8_t* pV = src.v + uvOffset;
+
+  // second pixel of a chroma pair first, so the rest goes by pairs
+  int32_t idx = 0;
+  if ((x & 1) && count) {
+    out[0] = YuvToRgba(pY[0], pU[0], pV[0]);
+    pU += ps, pV += ps;
+    idx = 1;
+  }
+  int32_t start = idx;
+#if defined(YUV_NEON) || defined(YUV_SSE2)
+  // semi-planar chroma is read 16 bytes at a time: near the right edge
+  // of the crop keep a sample after the last one needed, so nothing past
+  // the plane is touched
+  if (ps == 1 || ps == 2) {
+    int32_t end = src.left + src.width - x - ((ps == 2) ? 2 : 0);
+    for (; idx + 16 <= count && idx + 16 <= end; idx += 16) {
+      int32_t c = ((idx - start) >> 1) * ps;
+      ConvertPixels16(pY + idx, pU + c, pV + c, ps, out + idx);
+    }
+  }
+#endif
+  for (; idx < count; idx++) {
+    int32_t c = ((idx - start) >> 1) * ps;
+    out[idx] = YuvToRgba(pY[idx], pU[c], pV[c]);
+  }
+}
+
+/*
+ * StoreTile()
+ *   Write the tile, tileH rows of tileW pixels, transposed: tile column c
+ *   becomes row dst + c * rowStep; with reverse, tile row r lands in
+ *   column tileH - 1 - r instead of r
+ */
+static void StoreTile(const uint32_t (*tile)[YUV_TILE_SIZE], int32_t tileW,
+                      int32_t tileH, uint32_t* dst, int32_t rowStep,
+                      bool reverse) {
+  int32_t c = 0;
+#if defined(YUV_NEON) || defined(YUV_SSE2)
+  // 4x4 blocks in registers
+  if (!(tileH & 3)) {
+    for (; c + 4 <= tileW; c += 4) {
+      for (int32_t r = 0; r < tileH; r += 4) {
+        int32_t col = reverse ? tileH - 4 - r : r;
+#if defined(YUV_NEON)
+        uint32x4x2_t t01 = vtrnq_u32(vld1q_u32(&tile[r][c]),
+                                     vld1q_u32(&tile[r + 1][c]));
+        uint32x4x2_t t23 = vtrnq_u32(vld1q_u32(&tile[r + 2][c]),
+                                     vld1q_u32(&tile[r + 3][c]));
+        uint32x4_t cols[4] = {
+            vcombine_u32(vget_low_u32(t01.val[0]), vget_low_u32(t23.val[0])),
+            vcombine_u32(vget_low_u32(t01.val[1]), vget_low_u32(t23.val[1])),
+            vcombine_u32(vget_high_u32(t01.val[0]), vget_high_u32(t23.val[0])),
+            vcombine_u32(vget_high_u32(t01.val[1]), vget_high_u32(t23.val[1])),
+        };
+        for (int k = 0; k < 4; k++) {
+          if (reverse) {
+            uint32x4_t rev = vrev64q_u32(cols[k]);
+            cols[k] = vcombine_u32(vget_high_u32(rev), vget_low_u32(rev));
+          }
+          vst1q_u32(dst + (c + k) * rowStep + col, cols[k]);
+        }
+#else
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&tile[r][c]));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&tile[r + 1][c]));
+        __m128i e = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&tile[r + 2][c]));
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&tile[r + 3][c]));
+        __m128i ab0 = _mm_unpacklo_epi32(a, b), ab1 = _mm_unpackhi_epi32(a, b);
+        __m128i ed0 = _mm_unpacklo_epi32(e, d), ed1 = _mm_unpackhi_epi32(e, d);
+        __m128i cols[4] = {
+            _mm_unpacklo_epi64(ab0, ed0), _mm_unpackhi_epi64(ab0, ed0),
+            _mm_unpacklo_epi64(ab1, ed1), _mm_unpackhi_epi64(ab1, ed1),
+        };
+        for (int k = 0; k < 4; k++) {
+          if (reverse) {
+            cols[k] = _mm_shuffle_epi32(cols[k], _MM_SHUFFLE(0, 1, 2, 3));
+          }
+          _mm_storeu_si128(
+              reinterpret_cast<__m128i*>(dst + (c + k) * rowStep + col),
+              cols[k]);
+        }
+#endif
+      }
+    }
+  }
+#endif
+  for (; c < tileW; c++) {
+    uint32_t* row = dst + c * rowStep;
+    for (int32_t r = 0; r < tileH; r++) {
+      row[reverse ? tileH - 1 - r : r] = tile[r][c];
+    }
+  }
+}
+
+/*
+ * ConvertYuvToRgbaRows()
+ *   (x, y) is the pixel in the crop rectangle, w x h what is converted:
+ *     0:   (x, y) --> (x, y)
+ *     90:  (x, y) --> (h - 1 - y, x)
+ *     180: (x, y) --> (w - 1 - x, h - 1 - y)
+ *     270: (x, y) --> (y, w - 1 - x)
+ */
+void ConvertYuvToRgbaRows(const YuvImage& src, const RgbaImage& dst,
+                          int32_t rotation, int32_t firstRow,
+                          int32_t rowCount) {
+  bool sideways = (rotation == 90 || rotation == 270);
+  int32_t height = std::min(sideways ? dst.width : dst.height, src.height);
+  int32_t width = std::min(sideways ? dst.height : dst.width, src.width);
+  int32_t endRow = std::min(height, firstRow + rowCount);
+  if (width <= 0 || firstRow < 0 || firstRow >= endRow) {
+    return;
+  }
+
+  if (rotation == 0) {
+    for (int32_t y = firstRow; y < endRow; y++) {
+      ConvertRow(src, src.left, src.top + y, width, dst.bits + y * dst.stride);
+    }
+    return;
+  }
+
+  alignas(16) uint32_t tile[YUV_TILE_SIZE][YUV_TILE_SIZE];
+  if (rotation == 180) {
+    for (int32_t y = firstRow; y < endRow; y++) {
+      uint32_t* out = dst.bits + (height - 1 - y) * dst.stride + width - 1;
+      for (int32_t x = 0; x < width; x += YUV_TILE_SIZE) {
+        int32_t count = std::min(YUV_TILE_SIZE, width - x);
+        ConvertRow(src, src.left + x, src.top + y, count, tile[0]);
+        for (int32_t idx = 0; idx < count; idx++) {
+          out[-(x + idx)] = tile[0][idx];
+        }
+      }
+    }
+    return;
+  }
+
+  for (int32_t ty = firstRow; ty < endRow; ty += YUV_TILE_SIZE) {
+    int32_t tileH = std::min(YUV_TILE_SIZE, endRow - ty);
+    for (int32_t tx = 0; tx < width; tx += YUV_TILE_SIZE) {
+      int32_t tileW = std::min(YUV_TILE_SIZE, width - tx);
+      for (int32_t r = 0; r < tileH; r++) {
+        ConvertRow(src, src.left + tx, src.top + ty + r, tileW, tile[r]);
+      }
+      if (rotation == 90) {
+        StoreTile(tile, tileW, tileH,
+                  dst.bits + tx * dst.stride + (height - ty - tileH),
+                  dst.stride, true);
+      } else {
+        StoreTile(tile, tileW, tileH,
+                  dst.bits + (width - 1 - tx) * dst.stride + ty,
+                  -dst.stride, false);
+      }
+    }
+  }
+}
+
+void ConvertYuvToRgba(const YuvImage& src, const RgbaImage& dst,
+                      int32_t rotation) {
+  ConvertYuvToRgbaRows(src, dst, rotation, 0, src.height);
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __CAMERA_YUV_CONVERTER_H__
+#define __CAMERA_YUV_CONVERTER_H__
+
+#include <cstdint>
+
+/*
+ * YuvImage:
+ *     The planes of a YUV_420_888 image, as AImage reports them: chroma is
+ *     2x2 subsampled, samples uvPixelStride bytes apart (1: planar, 2:
+ *     semi-planar). Only the crop rectangle left, top, width, height (in
+ *     luma pixels) is converted.
+ */
+struct YuvImage {
+  const uint8_t* y;
+  const uint8_t* u;
+  const uint8_t* v;
+  int32_t yStride;
+  int32_t uvStride;
+  int32_t uvPixelStride;
+
+  int32_t left, top;
+  int32_t width, height;
+};
+
+/*
+ * RgbaImage:
+ *     Destination of the conversion, such as a locked ANativeWindow_Buffer:
+ *     RGBA (or RGBX) 8888 pixels, stride in pixels
+ */
+struct RgbaImage {
+  uint32_t* bits;
+  int32_t stride;
+  int32_t width, height;
+};
+
+/**
+ * ConvertYuvToRgba()
+ *   Convert src into dst, BT.601 limited range, rotating it clockwise by
+ *   rotation degrees (0, 90, 180 or 270) on the way. Rows are converted 16
+ *   pixels at a time with NEON or SSE2; 90 and 270 go through 32x32 tiles
+ *   transposed in cache, so the destination is written a row at a time.
+ *   The part of src that does not fit into dst is dropped.
+ */
+void ConvertYuvToRgba(const YuvImage& src, const RgbaImage& dst,
+                      int32_t rotation);
+
+/**
+ * ConvertYuvToRgbaRows()
+ *   Convert rows [firstRow, firstRow + rowCount) of the crop rectangle of
+ *   src only, to the place ConvertYuvToRgba() would put them: separate
+ *   row ranges write separate pixels of dst, so they can be converted on
+ *   several threads. Ranges starting at a multiple of YUV_BAND_ALIGN keep
+ *   the rotated tiles whole.
+ */
+#define YUV_BAND_ALIGN 32
+void ConvertYuvToRgbaRows(const YuvImage& src, const RgbaImage& dst,
+                          int32_t rotation, int32_t firstRow,
+                          int32_t rowCount);
+
+#endif  // __CAMERA_YUV_CONVERTER_H__
@@ -0,0 +1,293 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include "test_utils.h"
+#include "utils/frame_processors.h"
+#include "utils/synthetic_frame_source.h"
+
+/*
+ * GatedProcessor:
+ *     Holds every frame until Open() is called, to have the analyzer see a
+ *     processor still busy with an earlier frame
+ */
+class GatedProcessor : public FrameProcessor {
+ public:
+  GatedProcessor() : FrameProcessor(1, 1), open_(false), entered_(0) {}
+
+  void Process(const FrameView& frame) override {
+    std::unique_lock<std::mutex> lock(lock_);
+    entered_++;
+    enteredCond_.notify_all();
+    openCond_.wait(lock, [this] { return open_; });
+  }
+
+  void WaitEntered(int count) {
+    std::unique_lock<std::mutex> lock(lock_);
+    enteredCond_.wait(lock, [this, count] { return entered_ >= count; });
+  }
+
+  void Open(void) {
+    std::lock_guard<std::mutex> lock(lock_);
+    open_ = true;
+    openCond_.notify_all();
+  }
+
+ private:
+  std::mutex lock_;
+  std::condition_variable openCond_;
+  std::condition_variable enteredCond_;
+  bool open_;
+  int entered_;
+};
+
+// frames in the layout of a camera, and dropped while all buffers are out
+static void TestSyntheticSource(void) {
+  for (int32_t uvPixelStride = 1; uvPixelStride <= 2; uvPixelStride++) {
+    SyntheticFrameSource source(641, 479, uvPixelStride, 13);
+    YuvImage images[SYNTHETIC_BUFFER_COUNT];
+    int64_t timestamps[SYNTHETIC_BUFFER_COUNT];
+    for (int idx = 0; idx < SYNTHETIC_BUFFER_COUNT; idx++) {
+      EXPECT(source.Acquire(&images[idx], &timestamps[idx]), "buffer %d",
+             idx);
+    }
+    const YuvImage& image = images[0];
+    EXPECT(image.width == 641 && image.height == 479, "%dx%d", image.width,
+           image.height);
+    EXPECT(image.yStride == 641 + 13, "luma stride %d", image.yStride);
+    EXPECT(image.uvPixelStride == uvPixelStride, "pixel stride %d",
+           image.uvPixelStride);
+    EXPECT(image.uvStride == 321 * uvPixelStride + 13, "chroma stride %d",
+           image.uvStride);
+    EXPECT(uvPixelStride == 1 || image.v == image.u + 1,
+           "interleaved chroma is U V U V");
+    EXPECT(timestamps[1] - timestamps[0] == SYNTHETIC_FRAME_INTERVAL,
+           "frame interval %lld",
+           static_cast<long long>(timestamps[1] - timestamps[0]));
+
+    YuvImage extra;
+    int64_t timestamp;
+    EXPECT(!source.Acquire(&extra, &timestamp), "more buffers than exist");
+    EXPECT(source.FramesDropped() == 1, "%llu frames dropped",
+           static_cast<unsigned long long>(source.FramesDropped()));
+    source.Release(images[2]);
+    EXPECT(source.Acquire(&extra, &timestamp), "released buffer reused");
+    EXPECT(extra.y == images[2].y, "the released buffer");
+    EXPECT(timestamp == 5 * SYNTHETIC_FRAME_INTERVAL,
+           "dropped frames keep their place in time");
+    for (auto& held : images) {
+      source.Release(held);
+    }
+  }
+}
+
+static void CountLuma(const YuvImage& image, int32_t scale,
+                      uint32_t histogram[256]) {
+  for (int idx = 0; idx < 256; idx++) {
+    histogram[idx] = 0;
+  }
+  for (int32_t y = 0; y < image.height / scale; y++) {
+    for (int32_t x = 0; x < image.width / scale; x++) {
+      histogram[image.y[(image.top + y * scale) * image.yStride +
+                        image.left + x * scale]]++;
+    }
+  }
+}
+
+// histograms and thumbnails against a straightforward count
+static void TestProcessors(void) {
+  SyntheticFrameSource source(641, 479, 2, 13);
+  for (int32_t scale : {1, 4}) {
+    YuvImage image;
+    int64_t timestamp;
+    for (int skip = 0; skip < 100; skip++) {
+      EXPECT(source.Acquire(&image, &timestamp), "frame");
+      source.Release(image);
+    }
+    EXPECT(source.Acquire(&image, &timestamp), "frame");
+
+    FrameAnalyzer analyzer;
+    LumaHistogram histogram(1, scale);
+    LumaDownscaler downscaler(1, scale, 8);
+    analyzer.AddProcessor(&histogram);
+    analyzer.AddProcessor(&downscaler);
+    std::atomic<int> releases(0);
+    EXPECT(analyzer.Submit(image, timestamp, [&releases] { releases++; }),
+           "frame taken");
+    analyzer.Flush();
+    EXPECT(releases == 1, "released %d times", releases.load());
+
+    LumaStatistics stats;
+    EXPECT(histogram.GetStatistics(&stats), "statistics");
+    uint32_t expected[256];
+    CountLuma(image, scale, expected);
+    uint64_t sum = 0;
+    uint32_t count = 0, dark = 0, bright = 0;
+    for (int level = 0; level < 256; level++) {
+      EXPECT(stats.histogram[level] == expected[level],
+             "scale %d, level %d: %u, expected %u", scale, level,
+             stats.histogram[level], expected[level]);
+      sum += static_cast<uint64_t>(level) * expected[level];
+      count += expected[level];
+      if (level <= LUMA_DARK_LEVEL) dark += expected[level];
+      if (level >= LUMA_BRIGHT_LEVEL) bright += expected[level];
+    }
+    EXPECT(stats.count == count, "count %u, expected %u", stats.count, count);
+    EXPECT(std::fabs(stats.mean - static_cast<float>(sum) / count) < 0.01f,
+           "mean %f", stats.mean);
+    EXPECT(std::fabs(stats.dark - static_cast<float>(dark) / count) < 1e-4f,
+           "dark %f", stats.dark);
+    EXPECT(std::fabs(stats.bright - static_cast<float>(bright) / count) <
+               1e-4f,
+           "bright %f", stats.bright);
+    EXPECT(stats.bright > 0.2f, "the bars are bright: %f", stats.bright);
+    EXPECT(stats.timestamp == timestamp, "timestamp");
+
+    std::vector<uint8_t> thumbnail;
+    int32_t width, height;
+    EXPECT(downscaler.GetThumbnail(&thumbnail, &width, &height), "thumbnail");
+    EXPECT(width == 641 / scale / 8 && height == 479 / scale / 8,
+           "thumbnail %dx%d", width, height);
+    for (int32_t ty = 0; ty < height; ty++) {
+      for (int32_t tx = 0; tx < width; tx++) {
+        uint32_t blockSum = 0;
+        for (int32_t r = 0; r < 8; r++) {
+          for (int32_t c = 0; c < 8; c++) {
+            blockSum += image.y[(ty * 8 + r) * scale * image.yStride +
+                                (tx * 8 + c) * scale];
+          }
+        }
+        uint8_t pixel = thumbnail[ty * width + tx];
+        EXPECT(pixel == (blockSum + 32) / 64, "thumbnail (%d, %d): %d", tx, ty,
+               pixel);
+      }
+    }
+    source.Release(image);
+  }
+}
+
+// a busy processor skips frames instead of queuing them
+static void TestDropPolicy(void) {
+  SyntheticFrameSource source(64, 48, 2, 0);
+  FrameAnalyzer analyzer;
+  GatedProcessor gated;
+  LumaHistogram everyOther(2, 1);
+  analyzer.AddProcessor(&gated);
+  analyzer.AddProcessor(&everyOther);
+
+  YuvImage image;
+  int64_t timestamp;
+  std::atomic<int> releases(0);
+  auto release = [&releases] { releases++; };
+  EXPECT(source.Acquire(&image, &timestamp), "frame");
+  EXPECT(analyzer.Submit(image, timestamp, release), "frame 0 taken");
+  gated.WaitEntered(1);
+  // frame 0 is in flight: frames 1 and 2 are dropped by everyone due
+  EXPECT(!analyzer.Submit(image, timestamp, release), "frame 1 dropped");
+  EXPECT(!analyzer.Submit(image, timestamp, release), "frame 2 dropped");
+  EXPECT(releases == 0, "nothing released while the frame is held");
+  gated.Open();
+  analyzer.Flush();
+  EXPECT(releases == 1, "released %d times", releases.load());
+
+  FrameAnalyzer::Stats gatedStats = analyzer.GetStats(&gated);
+  FrameAnalyzer::Stats histogramStats = analyzer.GetStats(&everyOther);
+  EXPECT(gatedStats.processed == 1 && gatedStats.dropped == 2,
+         "gated processed %llu, dropped %llu",
+         static_cast<unsigned long long>(gatedStats.processed),
+         static_cast<unsigned long long>(gatedStats.dropped));
+  EXPECT(histogramStats.processed == 1 && histogramStats.dropped == 1,
+         "every other frame processed %llu, dropped %llu",
+         static_cast<unsigned long long>(histogramStats.processed),
+         static_cast<unsigned long long>(histogramStats.dropped));
+
+  // nobody due: frame 3 is not taken
+  LumaHistogram never(1000, 1);
+  FrameAnalyzer idle;
+  idle.AddProcessor(&never);
+  EXPECT(idle.Submit(image, timestamp, release), "frame 0 is due");
+  EXPECT(!idle.Submit(image, timestamp, release), "frame 1 is not");
+  idle.Flush();
+  EXPECT(releases == 2, "released %d times", releases.load());
+  source.Release(image);
+}
+
+// a camera-paced run: every frame taken is released once, and only those
+static void TestReleaseOnce(void) {
+  SyntheticFrameSource source(320, 240, 1, 32);
+  FrameAnalyzer analyzer;
+  LumaHistogram histogram(1, 2);
+  LumaDownscaler downscaler(3, 1, 4);
+  analyzer.AddProcessor(&histogram);
+  analyzer.AddProcessor(&downscaler);
+
+  std::mutex lock;
+  std::map<uint64_t, int> releases;
+  uint64_t taken = 0, notTaken = 0;
+  for (uint64_t frame = 0; frame < 300; frame++) {
+    YuvImage image;
+    int64_t timestamp;
+    if (!source.Acquire(&image, &timestamp)) {
+      continue;
+    }
+    bool submitted =
+        analyzer.Submit(image, timestamp, [&source, &lock, &releases, image,
+                                           frame] {
+          {
+            std::lock_guard<std::mutex> guard(lock);
+            releases[frame]++;
+          }
+          source.Release(image);
+        });
+    if (submitted) {
+      taken++;
+    } else {
+      notTaken++;
+      source.Release(image);
+    }
+  }
+  analyzer.Flush();
+
+  EXPECT(taken > 0, "frames analyzed");
+  EXPECT(releases.size() == taken, "%zu frames released, %llu taken",
+         releases.size(), static_cast<unsigned long long>(taken));
+  for (auto& entry : releases) {
+    EXPECT(entry.second == 1, "frame %llu released %d times",
+           static_cast<unsigned long long>(entry.first), entry.second);
+  }
+  FrameAnalyzer::Stats stats = analyzer.GetStats(&histogram);
+  EXPECT(stats.processed + stats.dropped == taken + notTaken,
+         "the histogram is due every frame: %llu + %llu",
+         static_cast<unsigned long long>(stats.processed),
+         static_cast<unsigned long long>(stats.dropped));
+  // every buffer came back
+  YuvImage images[SYNTHETIC_BUFFER_COUNT];
+  int64_t timestamp;
+  for (auto& image : images) {
+    EXPECT(source.Acquire(&image, &timestamp), "buffer back");
+  }
+}
+
+int main(void) {
+  TestSyntheticSource();
+  TestProcessors();
+  TestDropPolicy();
+  TestReleaseOnce();
+  return TestResult();
+}
@@ -0,0 +1,371 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <cstring>
+#include <map>
+#include <utility>
+#include <vector>
+#include "test_utils.h"
+#include "utils/frame_uploader.h"
+#include "utils/synthetic_frame_source.h"
+
+/*
+ * FakeBackend:
+ *     FrameBackend in memory: buffers and textures are byte vectors, a
+ *     texture upload copies from its buffer, fences are signaled when the
+ *     test says so. Checks the promises FrameUploader makes its backend.
+ */
+class FakeBackend : public FrameBackend {
+ public:
+  struct Texture {
+    TextureFormat format;
+    int32_t width, height;
+    std::vector<uint8_t> texels;
+  };
+
+  FakeBackend(bool convertYuv, bool persistent)
+      : convertYuv_(convertYuv),
+        persistent_(persistent),
+        nextId_(1),
+        signalFences_(true),
+        signalOnWait_(false),
+        maps_(0) {}
+
+  bool ConvertsYuv(void) override { return convertYuv_; }
+  bool PersistentMapping(void) override { return persistent_; }
+
+  uint32_t CreateBuffer(size_t size) override {
+    Buffer& buffer = buffers_[nextId_];
+    buffer.data.resize(size);
+    buffer.mapped = false;
+    buffer.fence = 0;
+    return nextId_++;
+  }
+  void DeleteBuffer(uint32_t id) override {
+    EXPECT(buffers_.count(id) && !buffers_[id].mapped, "buffer %u", id);
+    buffers_.erase(id);
+  }
+  uint8_t* MapBuffer(uint32_t id, size_t size) override {
+    Buffer& buffer = buffers_.at(id);
+    EXPECT(!buffer.mapped && size == buffer.data.size(), "buffer %u", id);
+    EXPECT(persistent_ || Idle(buffer), "buffer %u written while in use",
+           id);
+    buffer.mapped = true;
+    maps_++;
+    // garbage, the uploader has to write all it uploads
+    memset(buffer.data.data(), 0xcd, size);
+    return buffer.data.data();
+  }
+  void UnmapBuffer(uint32_t id) override {
+    EXPECT(buffers_.at(id).mapped, "buffer %u", id);
+    buffers_.at(id).mapped = false;
+  }
+
+  uint32_t CreateTexture(TextureFormat format, int32_t width,
+                         int32_t height) override {
+    Texture& texture = textures_[nextId_];
+    texture.format = format;
+    texture.width = width;
+    texture.height = height;
+    texture.texels.assign(static_cast<size_t>(width) * height * Bytes(format),
+                          0);
+    return nextId_++;
+  }
+  void DeleteTexture(uint32_t id) override {
+    EXPECT(textures_.count(id), "texture %u", id);
+    textures_.erase(id);
+  }
+  void UploadTexture(uint32_t id, TextureFormat format, int32_t width,
+                     int32_t height, uint32_t bufferId,
+                     size_t offset) override {
+    Texture& texture = textures_.at(id);
+    Buffer& buffer = buffers_.at(bufferId);
+    size_t size = texture.texels.size();
+    EXPECT(texture.format == format && texture.width == width &&
+               texture.height == height,
+           "texture %u", id);
+    EXPECT(persistent_ || !buffer.mapped, "buffer %u still mapped", bufferId);
+    EXPECT(Idle(buffer), "buffer %u written while in use", bufferId);
+    EXPECT(offset + size <= buffer.data.size(), "buffer %u", bufferId);
+    memcpy(texture.texels.data(), buffer.data.data() + offset, size);
+    uploaded_.push_back(bufferId);
+  }
+
+  FrameFence InsertFence(void) override {
+    uintptr_t fence = nextId_++;
+    fences_[fence] = signalFences_;
+    for (auto id : uploaded_) {
+      buffers_.at(id).fence = fence;
+    }
+    uploaded_.clear();
+    return reinterpret_cast<FrameFence>(fence);
+  }
+  bool WaitFence(FrameFence fence, uint64_t timeoutNs) override {
+    bool& signaled = fences_.at(reinterpret_cast<uintptr_t>(fence));
+    if (timeoutNs && signalOnWait_) {
+      signaled = true;
+    }
+    return signaled;
+  }
+  void DeleteFence(FrameFence fence) override {
+    EXPECT(fences_.erase(reinterpret_cast<uintptr_t>(fence)) == 1,
+           "fence %p", fence);
+  }
+
+  const Texture& GetTexture(uint32_t id) { return textures_.at(id); }
+  // the GPU completes what is queued from now on, or stalls
+  void SignalFences(bool signal) {
+    signalFences_ = signal;
+    for (auto& fence : fences_) {
+      fence.second = fence.second || signal;
+    }
+  }
+  // the GPU completes while the uploader waits
+  void SignalOnWait(bool signal) { signalOnWait_ = signal; }
+  int32_t Maps(void) const { return maps_; }
+  size_t LiveObjects(void) const {
+    return buffers_.size() + textures_.size() + fences_.size();
+  }
+
+ private:
+  struct Buffer {
+    std::vector<uint8_t> data;
+    bool mapped;
+    uintptr_t fence;  // inserted after its last upload
+  };
+
+  static size_t Bytes(TextureFormat format) {
+    return format == TextureFormat::R8 ? 1 : format == TextureFormat::RG8 ? 2
+                                                                          : 4;
+  }
+  bool Idle(const Buffer& buffer) {
+    // a deleted fence was waited for
+    return !buffer.fence || !fences_.count(buffer.fence) ||
+           fences_[buffer.fence];
+  }
+
+  bool convertYuv_, persistent_;
+  uint32_t nextId_;
+  bool signalFences_, signalOnWait_;
+  int32_t maps_;
+  std::map<uint32_t, Buffer> buffers_;
+  std::map<uint32_t, Texture> textures_;
+  std::map<uintptr_t, bool> fences_;
+  std::vector<uint32_t> uploaded_;
+};
+
+static YuvImage Crop(YuvImage image, int32_t left, int32_t top, int32_t width,
+                     int32_t height) {
+  image.left = left;
+  image.top = top;
+  image.width = width;
+  image.height = height;
+  return image;
+}
+
+/*
+ * Sample the YUV textures the way the fragment shader of GlesFrameBackend
+ * does, at the center of every output pixel mapped by TexCoordMatrix(),
+ * nearest texel
+ */
+static void DrawYuv(FakeBackend* backend, const FrameUploader& uploader,
+                    const YuvImage& frame, std::vector<uint32_t>* pixels) {
+  const FakeBackend::Texture& luma = backend->GetTexture(uploader.Texture(0));
+  const FakeBackend::Texture& chroma =
+      backend->GetTexture(uploader.Texture(1));
+  float matrix[6];
+  uploader.TexCoordMatrix(matrix);
+  int32_t width = uploader.Width(), height = uploader.Height();
+  pixels->resize(static_cast<size_t>(width) * height);
+  for (int32_t row = 0; row < height; row++) {
+    for (int32_t col = 0; col < width; col++) {
+      float s = (col + 0.5f) / width, t = (row + 0.5f) / height;
+      float u = matrix[0] * s + matrix[1] * t + matrix[2];
+      float v = matrix[3] * s + matrix[4] * t + matrix[5];
+      int32_t x = static_cast<int32_t>(u * frame.width);
+      int32_t y = static_cast<int32_t>(v * frame.height);
+      size_t c = (static_cast<size_t>(y / 2) * chroma.width + x / 2) * 2;
+      (*pixels)[row * width + col] =
+          ReferencePixel(luma.texels[y * luma.width + x], chroma.texels[c],
+                         chroma.texels[c + 1]);
+    }
+  }
+}
+
+// both layouts, all rotations, crops: the picture ConvertYuvToRgba() makes
+static void TestLayouts(void) {
+  for (int32_t uvPixelStride = 1; uvPixelStride <= 2; uvPixelStride++) {
+    SyntheticFrameSource source(101, 67, uvPixelStride, 13);
+    YuvImage frame;
+    int64_t timestamp;
+    EXPECT(source.Acquire(&frame, &timestamp), "no frame");
+    // crops start on even pixels, as camera crops of subsampled images do
+    YuvImage crops[] = {frame, Crop(frame, 4, 2, 90, 61),
+                        Crop(frame, 0, 0, 64, 32)};
+    for (const YuvImage& crop : crops) {
+      for (int32_t rotation = 0; rotation < 360; rotation += 90) {
+        for (int persistent = 0; persistent < 2; persistent++) {
+          FakeBackend rgba(false, persistent);
+          FrameUploader rgbaUploader(&rgba);
+          EXPECT(rgbaUploader.Layout() == FrameLayout::RGBA, "layout");
+          EXPECT(rgbaUploader.Upload(crop, rotation), "upload");
+          int32_t width = rgbaUploader.Width(),
+                  height = rgbaUploader.Height();
+          bool sideways = (rotation == 90 || rotation == 270);
+          EXPECT(width == (sideways ? crop.height : crop.width) &&
+                     height == (sideways ? crop.width : crop.height),
+                 "%dx%d at %d degrees", width, height, rotation);
+          std::vector<uint32_t> expected(static_cast<size_t>(width) * height);
+          ReferenceYuvToRgba(crop,
+                             RgbaImage{expected.data(), width, width, height},
+                             rotation);
+          const std::vector<uint8_t>& texels =
+              rgba.GetTexture(rgbaUploader.Texture(0)).texels;
+          EXPECT(!memcmp(texels.data(), expected.data(), texels.size()),
+                 "RGBA %dx%d at %d degrees, pixel stride %d", crop.width,
+                 crop.height, rotation, uvPixelStride);
+          float matrix[6], identity[6] = {1.0f, 0.0f, 0.0f,
+                                          0.0f, 1.0f, 0.0f};
+          rgbaUploader.TexCoordMatrix(matrix);
+          EXPECT(!memcmp(matrix, identity, sizeof(matrix)),
+                 "rotated RGBA drawn rotated again");
+
+          FakeBackend yuv(true, persistent);
+          FrameUploader yuvUploader(&yuv);
+          EXPECT(yuvUploader.Layout() == FrameLayout::YUV, "layout");
+          EXPECT(yuvUploader.Upload(crop, rotation), "upload");
+          EXPECT(yuvUploader.Width() == width &&
+                     yuvUploader.Height() == height,
+                 "YUV %dx%d, RGBA %dx%d", yuvUploader.Width(),
+                 yuvUploader.Height(), width, height);
+          std::vector<uint32_t> drawn;
+          DrawYuv(&yuv, yuvUploader, crop, &drawn);
+          EXPECT(drawn == expected, "YUV %dx%d at %d degrees, pixel stride %d",
+                 crop.width, crop.height, rotation, uvPixelStride);
+        }
+      }
+    }
+    source.Release(frame);
+  }
+}
+
+// NV21, V before U, is uploaded in U V order like the planar layouts
+static void TestChromaOrder(void) {
+  SyntheticFrameSource source(64, 32, 2, 0);
+  YuvImage nv12;
+  int64_t timestamp;
+  EXPECT(source.Acquire(&nv12, &timestamp), "no frame");
+  YuvImage nv21 = nv12;
+  std::swap(nv21.u, nv21.v);
+  FakeBackend nv12Backend(true, true), nv21Backend(true, true);
+  FrameUploader nv12Uploader(&nv12Backend), nv21Uploader(&nv21Backend);
+  EXPECT(nv12Uploader.Upload(nv12, 0) && nv21Uploader.Upload(nv21, 0),
+         "upload");
+  const std::vector<uint8_t>& a =
+      nv12Backend.GetTexture(nv12Uploader.Texture(1)).texels;
+  const std::vector<uint8_t>& b =
+      nv21Backend.GetTexture(nv21Uploader.Texture(1)).texels;
+  for (size_t idx = 0; idx < a.size(); idx += 2) {
+    EXPECT(a[idx] == b[idx + 1] && a[idx + 1] == b[idx], "chroma %zu", idx);
+  }
+  source.Release(nv12);
+}
+
+/*
+ * The ring: allocated once per frame size, buffers mapped once when the
+ * mapping persists, a stalled GPU drops frames instead of stalling the
+ * camera, everything released with the uploader
+ */
+static void TestRing(void) {
+  for (int persistent = 0; persistent < 2; persistent++) {
+    SyntheticFrameSource source(640, 480, 2, 64);
+    YuvImage frame;
+    int64_t timestamp;
+    FakeBackend backend(true, persistent);
+    {
+      FrameUploader uploader(&backend);
+      for (int idx = 0; idx < 100; idx++) {
+        EXPECT(source.Acquire(&frame, &timestamp), "no frame");
+        EXPECT(uploader.Upload(frame, 90), "frame %d", idx);
+        source.Release(frame);
+      }
+      FrameUploader::Stats stats = uploader.GetStats();
+      EXPECT(stats.uploaded == 100 && stats.dropped == 0 &&
+                 stats.fenceWaits == 0 && stats.allocations == 1,
+             "%llu uploaded, %llu dropped, %llu waits, %llu allocations",
+             static_cast<unsigned long long>(stats.uploaded),
+             static_cast<unsigned long long>(stats.dropped),
+             static_cast<unsigned long long>(stats.fenceWaits),
+             static_cast<unsigned long long>(stats.allocations));
+      EXPECT(backend.Maps() == (persistent ? FRAME_RING_SIZE : 100),
+             "%d maps", backend.Maps());
+      // a buffer, two textures and a fence per slot
+      EXPECT(backend.LiveObjects() == FRAME_RING_SIZE * 4, "%zu objects",
+             backend.LiveObjects());
+
+      // the GPU stalls: the ring fills, then the oldest slot times out
+      backend.SignalFences(false);
+      for (int idx = 0; idx < FRAME_RING_SIZE; idx++) {
+        EXPECT(source.Acquire(&frame, &timestamp), "no frame");
+        EXPECT(uploader.Upload(frame, 90), "frame %d", idx);
+        source.Release(frame);
+      }
+      uint32_t shown = uploader.Texture(0);
+      EXPECT(source.Acquire(&frame, &timestamp), "no frame");
+      EXPECT(!uploader.Upload(frame, 90), "buffer in use written");
+      EXPECT(uploader.Texture(0) == shown, "dropped frame shown");
+      stats = uploader.GetStats();
+      EXPECT(stats.dropped == 1 && stats.fenceWaits == 1,
+             "%llu dropped, %llu waits",
+             static_cast<unsigned long long>(stats.dropped),
+             static_cast<unsigned long long>(stats.fenceWaits));
+
+      // it completes while the uploader waits
+      backend.SignalOnWait(true);
+      EXPECT(uploader.Upload(frame, 90), "frame after the stall");
+      source.Release(frame);
+      stats = uploader.GetStats();
+      EXPECT(stats.dropped == 1 && stats.fenceWaits == 2,
+             "%llu dropped, %llu waits",
+             static_cast<unsigned long long>(stats.dropped),
+             static_cast<unsigned long long>(stats.fenceWaits));
+      backend.SignalFences(true);
+
+      // a new frame size reallocates the ring, once
+      SyntheticFrameSource small(320, 240, 1, 0);
+      for (int idx = 0; idx < 10; idx++) {
+        EXPECT(small.Acquire(&frame, &timestamp), "no frame");
+        EXPECT(uploader.Upload(frame, 0), "frame %d", idx);
+        small.Release(frame);
+      }
+      EXPECT(uploader.GetStats().allocations == 2 &&
+                 uploader.Width() == 320 && uploader.Height() == 240,
+             "%llu allocations, %dx%d",
+             static_cast<unsigned long long>(uploader.GetStats().allocations),
+             uploader.Width(), uploader.Height());
+      EXPECT(backend.LiveObjects() == FRAME_RING_SIZE * 4, "%zu objects",
+             backend.LiveObjects());
+    }
+    EXPECT(backend.LiveObjects() == 0, "%zu objects left",
+           backend.LiveObjects());
+  }
+}
+
+int main(void) {
+  TestLayouts();
+  TestChromaOrder();
+  TestRing();
+  return TestResult();
+}
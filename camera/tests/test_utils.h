@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __CAMERA_TEST_UTILS_H__
+#define __CAMERA_TEST_UTILS_H__
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include "utils/yuv_converter.h"
+
+/*
+ * EXPECT(cond, fmt, ...):
+ *     Report a failed check and carry on; a test's main() returns
+ *     TestResult(), non zero once any check failed.
+ */
+static int testFailures = 0;
+
+#define EXPECT(cond, fmt, ...)                                          \
+  do {                                                                  \
+    if (!(cond)) {                                                      \
+      if (testFailures++ < 20) {                                        \
+        fprintf(stderr, "%s:%d: %s: " fmt "\n", __FILE__, __LINE__,     \
+                #cond, ##__VA_ARGS__);                                  \
+      }                                                                 \
+    }                                                                   \
+  } while (0)
+
+static inline int TestResult(void) {
+  if (testFailures) {
+    fprintf(stderr, "%d checks failed\n", testFailures);
+  }
+  return testFailures ? 1 : 0;
+}
+
+/*
+ * ReferenceYuvToRgba()
+ *   ConvertYuvToRgba() the slow way, one pixel at a time with the 10 bit
+ *   BT.601 coefficients of yuv_converter.cpp, each pixel stored straight
+ *   to its rotated place: the vector rows and rotated tiles have to give
+ *   exactly the same image
+ */
+static inline uint32_t ReferencePixel(int32_t y, int32_t u, int32_t v) {
+  y = std::max(y - 16, 0) * 1192;
+  u -= 128;
+  v -= 128;
+  int32_t channels[3] = {
+      y + 1634 * v,
+      y - 833 * v - 400 * u,
+      y + 2066 * u,
+  };
+  uint32_t pixel = 0xff000000;
+  for (int idx = 0; idx < 3; idx++) {
+    int32_t value = std::min(std::max(channels[idx], 0), 262143) >> 10;
+    pixel |= static_cast<uint32_t>(value) << (8 * idx);
+  }
+  return pixel;
+}
+
+static inline void ReferenceYuvToRgba(const YuvImage& src,
+                                      const RgbaImage& dst,
+                                      int32_t rotation) {
+  bool sideways = (rotation == 90 || rotation == 270);
+  int32_t height = std::min(sideways ? dst.width : dst.height, src.height);
+  int32_t width = std::min(sideways ? dst.height : dst.width, src.width);
+  for (int32_t y = 0; y < height; y++) {
+    for (int32_t x = 0; x < width; x++) {
+      int32_t sx = src.left + x, sy = src.top + y;
+      int32_t c = (sy / 2) * src.uvStride + (sx / 2) * src.uvPixelStride;
+      uint32_t pixel =
+          ReferencePixel(src.y[sy * src.yStride + sx], src.u[c], src.v[c]);
+      int32_t row, col;
+      switch (rotation) {
+        case 90:
+          row = x, col = height - 1 - y;
+          break;
+        case 180:
+          row = height - 1 - y, col = width - 1 - x;
+          break;
+        case 270:
+          row = width - 1 - x, col = y;
+          break;
+        default:
+          row = y, col = x;
+          break;
+      }
+      dst.bits[row * dst.stride + col] = pixel;
+    }
+  }
+}
+
+#endif  // __CAMERA_TEST_UTILS_H__
@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <random>
+#include <vector>
+#include "test_utils.h"
+#include "utils/synthetic_frame_source.h"
+#include "utils/yuv_converter.h"
+
+/*
+ * Planes of random samples, each allocated to its last byte, so a
+ * sanitizer build catches any read past the plane
+ */
+struct RandomYuv {
+  std::vector<uint8_t> y, u, v;
+  YuvImage image;
+
+  RandomYuv(std::mt19937* random, int32_t width, int32_t height,
+            int32_t uvPixelStride, int32_t padding) {
+    int32_t uvWidth = (width + 1) / 2, uvHeight = (height + 1) / 2;
+    int32_t yStride = width + padding;
+    int32_t uvStride = uvWidth * uvPixelStride + padding;
+    y.resize(yStride * (height - 1) + width);
+    u.resize(uvStride * (uvHeight - 1) + (uvWidth - 1) * uvPixelStride + 1);
+    v.resize(u.size());
+    for (auto* plane : {&y, &u, &v}) {
+      for (auto& sample : *plane) {
+        sample = static_cast<uint8_t>((*random)());
+      }
+    }
+    image = YuvImage{y.data(), u.data(), v.data(), yStride, uvStride,
+                     uvPixelStride, 0, 0, width, height};
+  }
+};
+
+// crops, strides and destination sizes of every kind, all four rotations
+static void TestRandomImages(void) {
+  std::mt19937 random(1);
+  for (int run = 0; run < 600; run++) {
+    int32_t width = 1 + random() % 150, height = 1 + random() % 150;
+    RandomYuv yuv(&random, width, height, 1 + random() % 3, random() % 8);
+    YuvImage& src = yuv.image;
+    src.left = random() % width;
+    src.top = random() % height;
+    src.width = width - src.left;
+    src.height = height - src.top;
+
+    int32_t rotation = static_cast<int32_t>(random() % 4) * 90;
+    int32_t dstWidth = 1 + random() % 160, dstHeight = 1 + random() % 160;
+    int32_t stride = dstWidth + random() % 5;
+    std::vector<uint32_t> expected(stride * dstHeight, 0);
+    std::vector<uint32_t> converted(expected.size(), 0);
+    ReferenceYuvToRgba(src, RgbaImage{expected.data(), stride, dstWidth,
+                                      dstHeight}, rotation);
+    ConvertYuvToRgba(src, RgbaImage{converted.data(), stride, dstWidth,
+                                    dstHeight}, rotation);
+    EXPECT(converted == expected,
+           "%dx%d crop (%d, %d) %dx%d pixel stride %d, %d degrees into %dx%d",
+           width, height, src.left, src.top, src.width, src.height,
+           src.uvPixelStride, rotation, dstWidth, dstHeight);
+  }
+}
+
+// bands converted separately, as the conversion threads do, fill the image
+static void TestBands(void) {
+  std::mt19937 random(2);
+  RandomYuv yuv(&random, 333, 250, 2, 16);
+  const YuvImage& src = yuv.image;
+  for (int32_t rotation = 0; rotation < 360; rotation += 90) {
+    bool sideways = (rotation == 90 || rotation == 270);
+    int32_t width = sideways ? src.height : src.width;
+    int32_t height = sideways ? src.width : src.height;
+    std::vector<uint32_t> whole(width * height, 0), bands(whole.size(), 0);
+    ConvertYuvToRgba(src, RgbaImage{whole.data(), width, width, height},
+                     rotation);
+    for (int32_t row = 0; row < src.height; row += 2 * YUV_BAND_ALIGN) {
+      ConvertYuvToRgbaRows(src, RgbaImage{bands.data(), width, width, height},
+                           rotation, row, 2 * YUV_BAND_ALIGN);
+    }
+    EXPECT(bands == whole, "bands differ at %d degrees", rotation);
+  }
+}
+
+// the layouts the synthetic camera produces convert like the reference
+static void TestSyntheticFrames(void) {
+  for (int32_t uvPixelStride = 1; uvPixelStride <= 2; uvPixelStride++) {
+    SyntheticFrameSource source(640, 480, uvPixelStride, 64);
+    YuvImage image;
+    int64_t timestamp;
+    for (int frame = 0; frame < 3; frame++) {
+      EXPECT(source.Acquire(&image, &timestamp), "frame %d", frame);
+      std::vector<uint32_t> expected(480 * 640), converted(480 * 640);
+      ReferenceYuvToRgba(image, RgbaImage{expected.data(), 480, 480, 640}, 90);
+      ConvertYuvToRgba(image, RgbaImage{converted.data(), 480, 480, 640}, 90);
+      EXPECT(converted == expected, "pixel stride %d, frame %d",
+             uvPixelStride, frame);
+      source.Release(image);
+    }
+  }
+}
+
+// limited range black and white, and a saturated red
+static void TestKnownColors(void) {
+  const uint8_t y[2] = {16, 235}, neutral[1] = {128};
+  YuvImage gray{y, neutral, neutral, 2, 1, 1, 0, 0, 2, 1};
+  uint32_t pixels[2];
+  ConvertYuvToRgba(gray, RgbaImage{pixels, 2, 2, 1}, 0);
+  EXPECT(pixels[0] == 0xff000000, "black is %08x", pixels[0]);
+  EXPECT((pixels[1] & 0xff) >= 254 && (pixels[1] >> 8 & 0xff) >= 254 &&
+             (pixels[1] >> 16 & 0xff) >= 254,
+         "white is %08x", pixels[1]);
+
+  const uint8_t redY[1] = {81}, redU[1] = {90}, redV[1] = {240};
+  YuvImage red{redY, redU, redV, 1, 1, 1, 0, 0, 1, 1};
+  ConvertYuvToRgba(red, RgbaImage{pixels, 1, 1, 1}, 0);
+  EXPECT((pixels[0] & 0xff) >= 250 && (pixels[0] >> 8 & 0xff) <= 5 &&
+             (pixels[0] >> 16 & 0xff) <= 5,
+         "red is %08x", pixels[0]);
+}
+
+int main(void) {
+  TestRandomImages();
+  TestBands();
+  TestSyntheticFrames();
+  TestKnownColors();
+  return TestResult();
+}
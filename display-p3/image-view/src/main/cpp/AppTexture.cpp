@@ -15,6 +15,7 @@
  *
  */
 #include "AssetUtil.h"
+#include "ColorLut.h"
 #include "ImageViewEngine.h"
 
 /*
@@ -22,6 +23,7 @@
  *    Release all textures created in engine
  */
 void ImageViewEngine::DeleteTextures(void) {
+  loader_.Stop();
   for (auto& tex : textures_) {
     delete tex;
   }
@@ -33,6 +35,8 @@ void ImageViewEngine::DeleteTextures(void) {
  *    Create 2 textures in current display_ color space ( P3 or sRGB)
  *    If it is P3 space, image is transformed through sRGB so colors
  *    outside sRGB gamut are removed.
+ *    Images are only listed here; loader_ decodes and uploads them when
+ *    they get close to the one on screen.
  */
 bool ImageViewEngine::CreateTextures(void) {
   std::vector<std::string> files;
@@ -41,15 +45,16 @@ bool ImageViewEngine::CreateTextures(void) {
     return false;
   }
   DeleteTextures();
+  SetColorLutCacheDir(app_->activity->internalDataPath);
 
   for(auto& f : files) {
     AssetTexture* tex = new AssetTexture(f);
     ASSERT(tex, "OUT OF MEMORY");
     tex->ColorSpace(dispColorSpace_);
-    bool status = tex->CreateGLTextures(app_->activity->assetManager);
-    ASSERT(status, "Failed to create Texture for %s", f.c_str());
+    tex->DisplayFormat(dispFormat_);
     textures_.push_back(tex);
   }
+  loader_.Start(app_->activity->assetManager, &textures_);
 
   return true;
 }
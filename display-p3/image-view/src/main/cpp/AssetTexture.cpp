@@ -15,31 +15,36 @@
  *
  */
 
-#define STB_IMAGE_IMPLEMENTATION
-#define STBI_ONLY_PNG
-#include <stb/stb_image.h>
+#include <algorithm>
+#include <cstring>
 #include "simple_png.h"
+#include "ColorLut.h"
 #include "ColorSpaceTransform.h"
 #include "AssetTexture.h"
-#include "AssetUtil.h"
 #include "ImageViewEngine.h"
 
 
 #define INVALID_TEXTURE_ID 0xFFFFFFFF
 AssetTexture::AssetTexture(const std::string& name) :
   name_(name), p3Id_(INVALID_TEXTURE_ID), sRGBId_(INVALID_TEXTURE_ID),
-  valid_(false), dispColorSpace_(DISPLAY_COLORSPACE::INVALID)
+  valid_(false), dispColorSpace_(DISPLAY_COLORSPACE::INVALID),
+  dispFormat_(DISPLAY_FORMAT::R8G8B8A8_REV), state_(TEXTURE_STATE::EMPTY),
+  width_(0), height_(0), uploadTex_(0), uploadRow_(0)
 {
 }
 
 AssetTexture::~AssetTexture() {
-  if (valid_) {
+  DeleteGLTextures();
+}
+
+void AssetTexture::DeleteGLTextures(void) {
+  if (p3Id_ != INVALID_TEXTURE_ID) {
     glDeleteTextures(1, &p3Id_);
     glDeleteTextures(1, &sRGBId_);
-    valid_ = false;
-    p3Id_ = INVALID_TEXTURE_ID;
-    sRGBId_ = INVALID_TEXTURE_ID;
   }
+  valid_ = false;
+  p3Id_ = INVALID_TEXTURE_ID;
+  sRGBId_ = INVALID_TEXTURE_ID;
 }
 
 void AssetTexture::ColorSpace(enum DISPLAY_COLORSPACE space) {
@@ -51,6 +56,22 @@ DISPLAY_COLORSPACE AssetTexture::ColorSpace(void) {
   return dispColorSpace_;
 }
 
+/*
+ * DisplayFormat()
+ *    Surfaces deeper than 8 bits get the converted textures in half float,
+ *    as they come out of the linear intermediate
+ */
+void AssetTexture::DisplayFormat(enum DISPLAY_FORMAT format) {
+  dispFormat_ = format;
+}
+
+void AssetTexture::State(TEXTURE_STATE state) {
+  state_ = state;
+}
+TEXTURE_STATE AssetTexture::State(void) {
+  return state_;
+}
+
 bool AssetTexture::IsValid(void) {
   return valid_;
 }
@@ -66,118 +87,229 @@ GLuint AssetTexture::SRGBATexId() {
 }
 
 /*
- * CreateGLTexture()
- *     Create textures with regard to current display_ color space.
+ * DecodeImage()
+ *     Decode the image and convert it for the current display_ color space,
+ *     ready for UploadGLTextures(); it does not touch GL so it runs on any
+ *     thread.
  *     For P3 image, one texture is created with original image; the second
  *     texture is created from:
  *       original image --> sRGB color Space --> display_ color space
  *     during the process, colors outside sRGB are clamped.
+ *     Converted textures are half float on surfaces deeper than 8 bits.
+ *     Images with an iCCP, sRGB or cHRM chunk are converted from their own
+ *     color space with a 3D LUT; the others are taken as P3.
  */
-bool AssetTexture::CreateGLTextures(AAssetManager *mgr) {
+bool AssetTexture::DecodeImage(AAssetManager *mgr) {
   ASSERT(mgr, "Asset Manager is not valid");
   ASSERT(dispColorSpace_ != DISPLAY_COLORSPACE::INVALID, "eglContext_ color space not set");
-  if (valid_) {
-    glDeleteTextures(1, &p3Id_);
-    glDeleteTextures(1, &sRGBId_);
-    valid_ = false;
-    p3Id_ = INVALID_TEXTURE_ID;
-    sRGBId_ = INVALID_TEXTURE_ID;
+
+  // one streamed read of the file for both the header and the pixels
+  AAsset* asset = AAssetManager_open(mgr, name_.c_str(),
+                                     AASSET_MODE_STREAMING);
+  if (!asset) {
+    LOGE("%s does not exist", name_.c_str());
+    return false;
+  }
+  PNGHeader header(name_, [asset](uint8_t* buf, uint32_t len) {
+    int count = AAsset_read(asset, buf, len);
+    return static_cast<uint32_t>(std::max(count, 0));
+  });
+  uint32_t imgWidth = header.Width(), imgHeight = header.Height();
+  std::vector<uint8_t> image;
+  bool status = header.IsValid();
+  if (status) {
+    image.resize(static_cast<size_t>(imgWidth) * imgHeight * 4);
+    status = header.DecodeImage(image.data());
   }
+  AAsset_close(asset);
+  if (!status) {
+    LOGE("Failed to decode %s", name_.c_str());
+    return false;
+  }
+  width_ = imgWidth;
+  height_ = imgHeight;
+
+  // converted textures keep more than 8 bits of the linear intermediate for
+  // the deeper surfaces
+  bool halfFloat = (dispFormat_ != DISPLAY_FORMAT::R8G8B8A8_REV);
+  GLenum convFormat = halfFloat ? GL_RGBA16F : GL_RGBA8;
+  GLenum convType = halfFloat ? GL_HALF_FLOAT : GL_UNSIGNED_BYTE;
+  uint32_t convSize = imgWidth * imgHeight * 4 * (halfFloat ? 2 : 1);
+  IMAGE_FORMAT src {
+      .buf_ = image.data(),
+      .width_ = imgWidth,
+      .height_ = imgHeight,
+      .gamma_ = DEFAULT_P3_IMAGE_GAMMA,
+      .npm_ = GetTransformNPM(NPM_TYPE::P3_D65),
+  };
+  IMAGE_FORMAT dst {
+      .buf_ = nullptr,
+      .width_ = imgWidth,
+      .height_ = imgHeight,
+      .gamma_ = DEFAULT_DISPLAY_GAMMA,
+      .npm_ = GetTransformNPM(NPM_TYPE::SRGB_D65_INV),
+      .format_ = halfFloat ? PIXEL_FORMAT::PIXEL_RGBA_HALF_FLOAT :
+                             PIXEL_FORMAT::PIXEL_R8G8B8A8,
+  };
 
-  glGenTextures(1, &p3Id_);
-  glBindTexture(GL_TEXTURE_2D, p3Id_);
-
-  std::vector<uint8_t> fileData;
-  AssetReadFile(mgr, name_, fileData);
-
-  uint32_t imgWidth, imgHeight, n;
-  uint8_t* imageData = stbi_load_from_memory(
-      fileData.data(), fileData.size(), reinterpret_cast<int*>(&imgWidth),
-      reinterpret_cast<int*>(&imgHeight), reinterpret_cast<int*>(&n), 4);
-  uint8_t* imgBits = imageData;
-  std::vector<uint8_t> staging;
-  if (dispColorSpace_ == DISPLAY_COLORSPACE::SRGB) {
-    staging.resize(imgWidth * imgHeight * 4 * sizeof(uint8_t));
-    IMAGE_FORMAT src {
-        .buf_ = imageData,
-        .width_ = imgWidth,
-        .height_ = imgHeight,
-        .gamma_ = DEFAULT_P3_IMAGE_GAMMA,
-        .npm_ = GetTransformNPM(NPM_TYPE::P3_D65),
-    };
-
-    IMAGE_FORMAT dst {
-        .buf_ = staging.data(),
-        .width_ = imgWidth,
-        .height_ = imgHeight,
-        .gamma_ = DEFAULT_DISPLAY_GAMMA,
-        .npm_ = GetTransformNPM(NPM_TYPE::SRGB_D65_INV),
-    };
-    TransformColorSpace(dst, src);
-    imgBits = staging.data();
+  // images that tell their color space go through their profile, the others
+  // are taken as P3
+  const COLOR_PROFILE* profile = header.Profile();
+  if (profile || dispColorSpace_ == DISPLAY_COLORSPACE::SRGB) {
+    pixels_[0].resize(convSize);
+    dst.buf_ = pixels_[0].data();
+    bool converted;
+    if (profile) {
+      dst.npm_ = GetTransformNPM(dispColorSpace_ == DISPLAY_COLORSPACE::P3 ?
+                                 NPM_TYPE::P3_D65_INV : NPM_TYPE::SRGB_D65_INV);
+      converted = TransformColorProfile(dst, src, *profile);
+    } else {
+      converted = TransformColorSpace(dst, src);
+    }
+    if (!converted) {
+      LOGE("Failed to convert %s to the display color space", name_.c_str());
+      pixels_[0].clear();
+      return false;
+    }
+    texFormat_[0] = convFormat;
+    texType_[0] = convType;
+  } else {
+    pixels_[0].swap(image);
+    src.buf_ = pixels_[0].data();
+    texFormat_[0] = GL_RGBA8;
+    texType_[0] = GL_UNSIGNED_BYTE;
   }
-  glTexImage2D(GL_TEXTURE_2D, 0,  // mip level
-               GL_RGBA,
-               imgWidth, imgHeight,
-               0,                // border color
-               GL_RGBA, GL_UNSIGNED_BYTE, imgBits);
-
-  glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-  glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
-
-  // Generate sRGB view texture
-  glGenTextures(1, &sRGBId_);
-  glBindTexture(GL_TEXTURE_2D, sRGBId_);
+
+  // sRGB view texture
+  pixels_[1].clear();
+  texFormat_[1] = texFormat_[0];
+  texType_[1] = texType_[0];
   if(dispColorSpace_ == DISPLAY_COLORSPACE::P3) {
-    IMAGE_FORMAT src {
-        .buf_ = imageData,
-        .width_ = imgWidth,
-        .height_ = imgHeight,
-        .gamma_ = DEFAULT_P3_IMAGE_GAMMA,
-        .npm_ = GetTransformNPM(NPM_TYPE::P3_D65),
-    };
-    std::vector<uint8_t> srgbImg(imgWidth * imgHeight * 4 * sizeof(uint8_t));
-    IMAGE_FORMAT dst{
-        .buf_ = srgbImg.data(),
-        .width_ = imgWidth,
-        .height_ = imgHeight,
-        .gamma_ = 0.0f,     // intermediate image stays in linear space
-        .npm_ = GetTransformNPM(NPM_TYPE::SRGB_D65_INV),
-    };
-    TransformColorSpace(dst, src);
-
-    // sRGB back to P3 so we could display_ it correctly on P3 device mode
-    staging.resize(imgWidth * imgHeight * 4 * sizeof(uint8_t));
-    IMAGE_FORMAT tmp  = src;
-    src = dst;   // intermediate gamma is 0.0f
-    dst = tmp;   // original src's gamma is preserved
-    src.npm_ = GetTransformNPM(NPM_TYPE::SRGB_D65);
-    dst.buf_ = staging.data();
+    // P3 --> sRGB, clamped, --> P3 in a single pass, so we could display_ it
+    // correctly on P3 device mode
+    pixels_[1].resize(convSize);
+    dst.buf_ = pixels_[1].data();
     dst.npm_ = GetTransformNPM(NPM_TYPE::P3_D65_INV);
-    dst.gamma_ = DEFAULT_DISPLAY_GAMMA,
+    bool converted;
+    if (profile) {
+      converted = TransformColorProfile(dst, src, *profile,
+                                        GetTransformNPM(NPM_TYPE::SRGB_D65));
+    } else {
+      converted = TransformColorSpace(dst, src,
+                                      GetTransformNPM(NPM_TYPE::SRGB_D65));
+    }
+    if (!converted) {
+      LOGE("Failed to convert %s to the sRGB view", name_.c_str());
+      pixels_[0].clear();
+      pixels_[1].clear();
+      return false;
+    }
+    texFormat_[1] = convFormat;
+    texType_[1] = convType;
+  }
+
+  return true;
+}
 
-    TransformColorSpace(dst, src);
-    imgBits = staging.data();
+/*
+ * UploadGLTextures()
+ *     Upload the next band of up to maxBytes of the decoded image, through
+ *     the pixel unpack buffer pbo so the copy to the texture can be done
+ *     by the GPU after the call returns. The textures are created on the
+ *     first call; returns true once both are complete and the decoded
+ *     pixels are released.
+ */
+bool AssetTexture::UploadGLTextures(GLuint pbo, uint32_t maxBytes) {
+  ASSERT(state_ == TEXTURE_STATE::DECODED ||
+         state_ == TEXTURE_STATE::UPLOADING, "Texture is not decoded");
+  if (state_ == TEXTURE_STATE::DECODED) {
+    DeleteGLTextures();
+    glGenTextures(1, &p3Id_);
+    glGenTextures(1, &sRGBId_);
+    GLuint ids[] = { p3Id_, sRGBId_ };
+    for (int idx = 0; idx < 2; idx++) {
+      glBindTexture(GL_TEXTURE_2D, ids[idx]);
+      glTexStorage2D(GL_TEXTURE_2D, 1, texFormat_[idx], width_, height_);
+      glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+      glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+    }
+    uploadTex_ = 0;
+    uploadRow_ = 0;
+    state_ = TEXTURE_STATE::UPLOADING;
   }
-  glTexImage2D(GL_TEXTURE_2D, 0,  // mip level
-               GL_RGBA,
-               imgWidth, imgHeight,
-               0,                // border color
-               GL_RGBA, GL_UNSIGNED_BYTE, imgBits);
-  glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-  glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-  glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
-  glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
 
+  const std::vector<uint8_t>& pixels =
+      pixels_[uploadTex_].empty() ? pixels_[0] : pixels_[uploadTex_];
+  uint32_t rowBytes = static_cast<uint32_t>(pixels.size() / height_);
+  uint32_t rows = std::max(1u, maxBytes / rowBytes);
+  rows = std::min(rows, height_ - uploadRow_);
+  uint32_t bandBytes = rows * rowBytes;
+
+  // orphan the buffer so a band still being copied by the GPU does not stall
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+  glBufferData(GL_PIXEL_UNPACK_BUFFER, bandBytes, nullptr, GL_STREAM_DRAW);
+  void* band = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bandBytes,
+                                GL_MAP_WRITE_BIT |
+                                GL_MAP_INVALIDATE_BUFFER_BIT);
+  if (band) {
+    memcpy(band, pixels.data() + uploadRow_ * rowBytes, bandBytes);
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    glBindTexture(GL_TEXTURE_2D, uploadTex_ ? sRGBId_ : p3Id_);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, uploadRow_, width_, rows,
+                    GL_RGBA, texType_[uploadTex_], nullptr);
+  } else {
+    LOGE("Failed to map the upload buffer for %s", name_.c_str());
+  }
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
   glBindTexture(GL_TEXTURE_2D, 0);
-  stbi_image_free(imageData);
-  valid_ = true;
 
+  uploadRow_ += rows;
+  if (uploadRow_ < height_) {
+    return false;
+  }
+  uploadRow_ = 0;
+  if (++uploadTex_ < 2) {
+    return false;
+  }
+
+  for (auto& pixels : pixels_) {
+    std::vector<uint8_t>().swap(pixels);
+  }
+  valid_ = true;
+  state_ = TEXTURE_STATE::RESIDENT;
   return true;
 }
 
+/*
+ * ReleaseImage()
+ *     Drop the textures and the decoded pixels, back to EMPTY
+ */
+void AssetTexture::ReleaseImage(void) {
+  ASSERT(state_ != TEXTURE_STATE::DECODING, "Texture is being decoded");
+  DeleteGLTextures();
+  for (auto& pixels : pixels_) {
+    std::vector<uint8_t>().swap(pixels);
+  }
+  state_ = TEXTURE_STATE::EMPTY;
+}
+
+/*
+ * MemorySize()
+ *     Bytes held by the decoded pixels and the textures
+ */
+uint64_t AssetTexture::MemorySize(void) {
+  uint64_t size = pixels_[0].size() + pixels_[1].size();
+  if (p3Id_ != INVALID_TEXTURE_ID) {
+    for (int idx = 0; idx < 2; idx++) {
+      size += static_cast<uint64_t>(width_) * height_ * 4 *
+              (texType_[idx] == GL_HALF_FLOAT ? 2 : 1);
+    }
+  }
+  return size;
+}
+
 std::string& AssetTexture::Name(void) {
   return name_;
 }
@@ -18,10 +18,27 @@
 #ifndef  __ASSET_TEXTURE_H__
 #define  __ASSET_TEXTURE_H__
 #include "common.h"
+#include <atomic>
 #include <string>
+#include <vector>
 #include <GLES3/gl32.h>
 #include <android/asset_manager.h>
 
+/*
+ * Texture life cycle: EMPTY --> QUEUED --> DECODING --> DECODED -->
+ * UPLOADING --> RESIDENT, back to EMPTY when released. DECODING is done on
+ * a worker thread, every other change on the GL thread.
+ */
+enum TEXTURE_STATE {
+  EMPTY,
+  QUEUED,
+  DECODING,
+  DECODED,
+  UPLOADING,
+  RESIDENT,
+  FAILED,
+};
+
 class AssetTexture {
 private:
   std::string name_;
@@ -29,13 +46,31 @@ private:
   GLuint sRGBId_;
   bool  valid_;
   enum DISPLAY_COLORSPACE dispColorSpace_;
+  enum DISPLAY_FORMAT dispFormat_;
+  std::atomic<TEXTURE_STATE> state_;
+
+  // decoded pixels of the 2 textures, waiting for upload; an empty second
+  // image is the same as the first one
+  uint32_t width_, height_;
+  std::vector<uint8_t> pixels_[2];
+  GLenum texFormat_[2];
+  GLenum texType_[2];
+  uint32_t uploadTex_, uploadRow_;
+
+  void DeleteGLTextures(void);
 
 public:
   explicit AssetTexture(const std::string& name);
   ~AssetTexture();
   void ColorSpace(enum DISPLAY_COLORSPACE  clrSpace);
   DISPLAY_COLORSPACE ColorSpace(void);
-  bool CreateGLTextures(AAssetManager* mgr);
+  void DisplayFormat(enum DISPLAY_FORMAT format);
+  void State(TEXTURE_STATE state);
+  TEXTURE_STATE State(void);
+  bool DecodeImage(AAssetManager* mgr);
+  bool UploadGLTextures(GLuint pbo, uint32_t maxBytes);
+  void ReleaseImage(void);
+  uint64_t MemorySize(void);
   bool IsValid(void);
   GLuint P3TexId(void);
   GLuint SRGBATexId(void);
@@ -0,0 +1,441 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#include <cinttypes>
+#include <cstdio>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <vector>
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "android_debug.h"
+#include "ColorLut.h"
+
+#define CLIP_COLOR(color, max) ((color > max) ? max : ((color > 0) ? color : 0))
+
+// grid values are encoded display colors, 12 bit fixed point
+#define LUT_BITS        12
+#define LUT_MAX         ((1 << LUT_BITS) - 1)
+#define LUT_NODES       (COLOR_LUT_GRID_SIZE * COLOR_LUT_GRID_SIZE * \
+                         COLOR_LUT_GRID_SIZE)
+// fractions of a grid cell
+#define LUT_FRAC_BITS   8
+#define LUT_FRAC_ONE    (1 << LUT_FRAC_BITS)
+// LUTs kept in memory
+#define LUT_MEMORY_COUNT 8
+
+#define LUT_FILE_MAGIC   0x54554C43   // "CLUT"
+#define LUT_FILE_VERSION 1
+
+/*
+ * LUT_DATA:
+ *     R G B and a padding value per node, so a node is one 64 bit load;
+ *     nodes indexed by ((r * GRID) + g) * GRID + b
+ */
+typedef std::vector<int16_t> LUT_DATA;
+
+struct LUT_FILE_HEADER {
+  uint32_t magic_;
+  uint32_t version_;
+  uint64_t hash_;
+  uint32_t gridSize_;
+  uint32_t nodeSize_;
+};
+
+static std::mutex lutLock;
+static std::string lutCacheDir;
+static std::list<std::pair<uint64_t, std::shared_ptr<const LUT_DATA>>> luts;
+
+void SetColorLutCacheDir(const std::string& dir) {
+  std::lock_guard<std::mutex> lock(lutLock);
+  lutCacheDir = dir;
+}
+
+/*
+ * LutHash: 64 bit FNV-1a of everything a LUT is built from
+ */
+class LutHash {
+public:
+  LutHash() : hash_(14695981039346656037ULL) {}
+
+  void Add(const void* data, size_t len) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    for (size_t idx = 0; idx < len; idx++) {
+      hash_ = (hash_ ^ bytes[idx]) * 1099511628211ULL;
+    }
+  }
+  void Add(float value) {
+    Add(&value, sizeof(value));
+  }
+  void Add(const mathfu::mat3& matrix) {
+    for (int row = 0; row < 3; row++) {
+      for (int col = 0; col < 3; col++) {
+        Add(matrix(row, col));
+      }
+    }
+  }
+  uint64_t Value(void) const { return hash_; }
+
+private:
+  uint64_t hash_;
+};
+
+static uint64_t HashLut(const COLOR_PROFILE& profile, const mathfu::mat3& dstNpm,
+                        float dstGamma, const mathfu::mat3* clipNpm) {
+  LutHash hash;
+  uint32_t layout[] = { LUT_FILE_VERSION, COLOR_LUT_GRID_SIZE, LUT_BITS };
+  hash.Add(layout, sizeof(layout));
+  for (auto& trc : profile.trc_) {
+    uint32_t tableSize = static_cast<uint32_t>(trc.table_.size());
+    hash.Add(&trc.type_, sizeof(trc.type_));
+    hash.Add(trc.params_, sizeof(trc.params_));
+    hash.Add(&tableSize, sizeof(tableSize));
+    hash.Add(trc.table_.data(), tableSize * sizeof(float));
+  }
+  hash.Add(profile.npm_);
+  for (int idx = 0; idx < 3; idx++) {
+    hash.Add(profile.white_[idx]);
+  }
+  hash.Add(dstNpm);
+  hash.Add(dstGamma);
+  if (clipNpm) {
+    hash.Add(*clipNpm);
+  }
+  return hash.Value();
+}
+
+/*
+ * BuildLut()
+ *    Sample the conversion at every grid node: curves, source white to D65,
+ *    optional clamp in the clip gamut, display gamut clamp and gamma
+ */
+static void BuildLut(const COLOR_PROFILE& profile, const mathfu::mat3& dstNpm,
+                     float dstGamma, const mathfu::mat3* clipNpm,
+                     LUT_DATA* lut) {
+  mathfu::mat3 toXYZ = AdaptWhitePoint(profile.white_, D65_WHITE_XYZ) *
+                       profile.npm_;
+  mathfu::mat3 toClip, toDst;
+  if (clipNpm) {
+    toClip = clipNpm->Inverse() * toXYZ;
+    toDst = dstNpm * (*clipNpm);
+  } else {
+    toDst = dstNpm * toXYZ;
+  }
+
+  float linear[3][COLOR_LUT_GRID_SIZE];
+  for (int c = 0; c < 3; c++) {
+    for (int idx = 0; idx < COLOR_LUT_GRID_SIZE; idx++) {
+      linear[c][idx] = profile.trc_[c].Evaluate(
+          static_cast<float>(idx) / (COLOR_LUT_GRID_SIZE - 1));
+    }
+  }
+
+  lut->resize(LUT_NODES * 4);
+  int16_t* node = lut->data();
+  for (int r = 0; r < COLOR_LUT_GRID_SIZE; r++) {
+    for (int g = 0; g < COLOR_LUT_GRID_SIZE; g++) {
+      for (int b = 0; b < COLOR_LUT_GRID_SIZE; b++, node += 4) {
+        mathfu::vec3 rgb(linear[0][r], linear[1][g], linear[2][b]);
+        if (clipNpm) {
+          rgb = toClip * rgb;
+          for (int c = 0; c < 3; c++) {
+            rgb[c] = CLIP_COLOR(rgb[c], 1.0f);
+          }
+        }
+        rgb = toDst * rgb;
+        for (int c = 0; c < 3; c++) {
+          node[c] = static_cast<int16_t>(
+              EncodeGamma(rgb[c], dstGamma) * LUT_MAX + 0.5);
+        }
+        node[3] = 0;
+      }
+    }
+  }
+}
+
+static std::string LutFileName(const std::string& dir, uint64_t hash) {
+  char name[64];
+  snprintf(name, sizeof(name), "/colorlut-%016" PRIx64 ".bin", hash);
+  return dir + name;
+}
+
+static bool ReadLutFile(const std::string& dir, uint64_t hash, LUT_DATA* lut) {
+  FILE* file = fopen(LutFileName(dir, hash).c_str(), "rb");
+  if (!file) {
+    return false;
+  }
+  LUT_FILE_HEADER header;
+  lut->resize(LUT_NODES * 4);
+  bool valid = fread(&header, sizeof(header), 1, file) == 1 &&
+               header.magic_ == LUT_FILE_MAGIC &&
+               header.version_ == LUT_FILE_VERSION &&
+               header.hash_ == hash &&
+               header.gridSize_ == COLOR_LUT_GRID_SIZE &&
+               header.nodeSize_ == 4 * sizeof(int16_t) &&
+               fread(lut->data(), sizeof(int16_t), lut->size(), file) ==
+               lut->size();
+  fclose(file);
+  // the nodes index the output tables: a damaged file must not reach them
+  for (size_t idx = 0; valid && idx < lut->size(); idx++) {
+    valid = (*lut)[idx] >= 0 && (*lut)[idx] <= LUT_MAX;
+  }
+  if (!valid) {
+    LOGW("====Ignoring invalid LUT file %s", LutFileName(dir, hash).c_str());
+  }
+  return valid;
+}
+
+// written aside then renamed, so a LUT file is either complete or missing
+static void WriteLutFile(const std::string& dir, uint64_t hash,
+                         const LUT_DATA& lut) {
+  std::string name = LutFileName(dir, hash);
+  std::string tmpName = name + ".tmp";
+  FILE* file = fopen(tmpName.c_str(), "wb");
+  if (!file) {
+    LOGW("====Cannot create LUT file %s", tmpName.c_str());
+    return;
+  }
+  LUT_FILE_HEADER header = {
+      LUT_FILE_MAGIC, LUT_FILE_VERSION, hash, COLOR_LUT_GRID_SIZE,
+      4 * sizeof(int16_t),
+  };
+  bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                 fwrite(lut.data(), sizeof(int16_t), lut.size(), file) ==
+                 lut.size();
+  if (fclose(file) || !written || rename(tmpName.c_str(), name.c_str())) {
+    remove(tmpName.c_str());
+  }
+}
+
+/*
+ * GetLut()
+ *    The LUT of hash from memory, from its file or built
+ */
+static std::shared_ptr<const LUT_DATA> GetLut(
+    uint64_t hash, const std::function<void(LUT_DATA*)>& build) {
+  std::string dir;
+  {
+    std::lock_guard<std::mutex> lock(lutLock);
+    for (auto it = luts.begin(); it != luts.end(); it++) {
+      if (it->first == hash) {
+        luts.splice(luts.begin(), luts, it);
+        return it->second;
+      }
+    }
+    dir = lutCacheDir;
+  }
+
+  std::shared_ptr<LUT_DATA> lut(new LUT_DATA);
+  if (dir.empty() || !ReadLutFile(dir, hash, lut.get())) {
+    build(lut.get());
+    if (!dir.empty()) {
+      WriteLutFile(dir, hash, *lut);
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(lutLock);
+  luts.emplace_front(hash, lut);
+  if (luts.size() > LUT_MEMORY_COUNT) {
+    luts.pop_back();
+  }
+  return lut;
+}
+
+/*
+ * GRID_TABLES:
+ *    8 bit input --> grid index and fraction of the cell, and the outputs of
+ *    the 12 bit grid values
+ */
+struct GRID_TABLES {
+  uint8_t  index_[256];
+  uint16_t frac_[256];
+  uint8_t  toByte_[LUT_MAX + 1];
+  uint16_t toHalf_[LUT_MAX + 1];
+  uint16_t alphaHalf_[256];
+};
+
+static const GRID_TABLES& GetGridTables(void) {
+  static GRID_TABLES tables;
+  static std::once_flag tablesInit;
+  std::call_once(tablesInit, [] {
+    for (uint32_t idx = 0; idx < 256; idx++) {
+      uint32_t pos = idx * (COLOR_LUT_GRID_SIZE - 1) * LUT_FRAC_ONE / 255;
+      uint32_t node = pos >> LUT_FRAC_BITS;
+      uint32_t frac = pos & (LUT_FRAC_ONE - 1);
+      if (node == COLOR_LUT_GRID_SIZE - 1) {
+        node--, frac = LUT_FRAC_ONE;   // the last node, from the last cell
+      }
+      tables.index_[idx] = static_cast<uint8_t>(node);
+      tables.frac_[idx] = static_cast<uint16_t>(frac);
+      tables.alphaHalf_[idx] = FloatToHalf(idx / 255.0f);
+    }
+    for (uint32_t idx = 0; idx <= LUT_MAX; idx++) {
+      tables.toByte_[idx] = static_cast<uint8_t>((idx * 255 + LUT_MAX / 2) /
+                                                 LUT_MAX);
+      tables.toHalf_[idx] = FloatToHalf(static_cast<float>(idx) / LUT_MAX);
+    }
+  });
+  return tables;
+}
+
+/*
+ * BlendNodes()
+ *    out = (w0 * n0 + w1 * n1 + w2 * n2 + w3 * n3) >> LUT_FRAC_BITS, rounded;
+ *    the 3 channels of a node at once
+ */
+#if defined(__ARM_NEON)
+static inline void BlendNodes(const int16_t* n0, const int16_t* n1,
+                              const int16_t* n2, const int16_t* n3,
+                              int16_t w0, int16_t w1, int16_t w2, int16_t w3,
+                              int16_t* out) {
+  int32x4_t acc = vmull_n_s16(vld1_s16(n0), w0);
+  acc = vmlal_n_s16(acc, vld1_s16(n1), w1);
+  acc = vmlal_n_s16(acc, vld1_s16(n2), w2);
+  acc = vmlal_n_s16(acc, vld1_s16(n3), w3);
+  vst1_s16(out, vrshrn_n_s32(acc, LUT_FRAC_BITS));
+}
+#elif defined(__SSE2__)
+static inline void BlendNodes(const int16_t* n0, const int16_t* n1,
+                              const int16_t* n2, const int16_t* n3,
+                              int16_t w0, int16_t w1, int16_t w2, int16_t w3,
+                              int16_t* out) {
+  // interleave two nodes per _mm_madd_epi16(), with their weight pair
+  __m128i n01 = _mm_unpacklo_epi16(
+      _mm_loadl_epi64(reinterpret_cast<const __m128i*>(n0)),
+      _mm_loadl_epi64(reinterpret_cast<const __m128i*>(n1)));
+  __m128i n23 = _mm_unpacklo_epi16(
+      _mm_loadl_epi64(reinterpret_cast<const __m128i*>(n2)),
+      _mm_loadl_epi64(reinterpret_cast<const __m128i*>(n3)));
+  __m128i acc = _mm_add_epi32(
+      _mm_madd_epi16(n01, _mm_set1_epi32((w1 << 16) | w0)),
+      _mm_madd_epi16(n23, _mm_set1_epi32((w3 << 16) | w2)));
+  acc = _mm_srai_epi32(_mm_add_epi32(acc, _mm_set1_epi32(LUT_FRAC_ONE / 2)),
+                       LUT_FRAC_BITS);
+  _mm_storel_epi64(reinterpret_cast<__m128i*>(out), _mm_packs_epi32(acc, acc));
+}
+#else
+static inline void BlendNodes(const int16_t* n0, const int16_t* n1,
+                              const int16_t* n2, const int16_t* n3,
+                              int16_t w0, int16_t w1, int16_t w2, int16_t w3,
+                              int16_t* out) {
+  for (int c = 0; c < 3; c++) {
+    out[c] = static_cast<int16_t>((w0 * n0[c] + w1 * n1[c] + w2 * n2[c] +
+                                   w3 * n3[c] + LUT_FRAC_ONE / 2) >>
+                                  LUT_FRAC_BITS);
+  }
+}
+#endif
+
+/*
+ * Interpolate()
+ *    Tetrahedral interpolation: the cell is cut in 6 tetrahedra along its
+ *    diagonal, the one holding the pixel is found by sorting the fractions;
+ *    the pixel blends its 4 corners
+ */
+static inline void Interpolate(const int16_t* lut, const GRID_TABLES& grid,
+                               const uint8_t* pixel, int16_t* out) {
+  const uint32_t sb = 4;
+  const uint32_t sg = sb * COLOR_LUT_GRID_SIZE;
+  const uint32_t sr = sg * COLOR_LUT_GRID_SIZE;
+  int32_t fr = grid.frac_[pixel[0]];
+  int32_t fg = grid.frac_[pixel[1]];
+  int32_t fb = grid.frac_[pixel[2]];
+  const int16_t* n0 = lut + grid.index_[pixel[0]] * sr +
+                      grid.index_[pixel[1]] * sg + grid.index_[pixel[2]] * sb;
+
+  uint32_t o1, o2;
+  int32_t f1, f2, f3;
+  if (fr >= fg) {
+    if (fg >= fb) {
+      o1 = sr, o2 = sr + sg, f1 = fr, f2 = fg, f3 = fb;
+    } else if (fr >= fb) {
+      o1 = sr, o2 = sr + sb, f1 = fr, f2 = fb, f3 = fg;
+    } else {
+      o1 = sb, o2 = sb + sr, f1 = fb, f2 = fr, f3 = fg;
+    }
+  } else {
+    if (fr >= fb) {
+      o1 = sg, o2 = sg + sr, f1 = fg, f2 = fr, f3 = fb;
+    } else if (fg >= fb) {
+      o1 = sg, o2 = sg + sb, f1 = fg, f2 = fb, f3 = fr;
+    } else {
+      o1 = sb, o2 = sb + sg, f1 = fb, f2 = fg, f3 = fr;
+    }
+  }
+  BlendNodes(n0, n0 + o1, n0 + o2, n0 + sr + sg + sb,
+             static_cast<int16_t>(LUT_FRAC_ONE - f1),
+             static_cast<int16_t>(f1 - f2), static_cast<int16_t>(f2 - f3),
+             static_cast<int16_t>(f3), out);
+}
+
+static void LutRows(const int16_t* lut, void* dst, PIXEL_FORMAT format,
+                    const uint8_t* src, uint32_t width,
+                    uint32_t firstRow, uint32_t endRow) {
+  const GRID_TABLES& grid = GetGridTables();
+  int16_t rgb[4];
+  const uint8_t* s = src + firstRow * width * 4;
+  uint32_t count = (endRow - firstRow) * width;
+  if (format == PIXEL_FORMAT::PIXEL_R8G8B8A8) {
+    uint8_t* d = static_cast<uint8_t*>(dst) + firstRow * width * 4;
+    for (uint32_t idx = 0; idx < count; idx++, s += 4, d += 4) {
+      Interpolate(lut, grid, s, rgb);
+      d[3] = s[3];
+      d[0] = grid.toByte_[rgb[0]];
+      d[1] = grid.toByte_[rgb[1]];
+      d[2] = grid.toByte_[rgb[2]];
+    }
+  } else {
+    uint16_t* d = static_cast<uint16_t*>(dst) + firstRow * width * 4;
+    for (uint32_t idx = 0; idx < count; idx++, s += 4, d += 4) {
+      Interpolate(lut, grid, s, rgb);
+      d[0] = grid.toHalf_[rgb[0]];
+      d[1] = grid.toHalf_[rgb[1]];
+      d[2] = grid.toHalf_[rgb[2]];
+      d[3] = grid.alphaHalf_[s[3]];
+    }
+  }
+}
+
+/*
+ * Interface Function:
+ *     Convert a profiled image to a display space
+ */
+bool TransformColorProfile(IMAGE_FORMAT& dst, IMAGE_FORMAT& src,
+                           const COLOR_PROFILE& profile,
+                           const mathfu::mat3* clipNpm) {
+  if (!dst.npm_ || !dst.buf_ || !src.buf_ ||
+      src.format_ != PIXEL_FORMAT::PIXEL_R8G8B8A8 ||
+      (dst.format_ != PIXEL_FORMAT::PIXEL_R8G8B8A8 && dst.buf_ == src.buf_)) {
+    LOGE("=====Error: Invalid Parameters to TransformColorProfile()");
+    return false;
+  }
+
+  uint64_t hash = HashLut(profile, *dst.npm_, dst.gamma_, clipNpm);
+  std::shared_ptr<const LUT_DATA> lut = GetLut(hash, [&](LUT_DATA* data) {
+    BuildLut(profile, *dst.npm_, dst.gamma_, clipNpm, data);
+  });
+
+  const uint8_t* srcBits = static_cast<const uint8_t*>(src.buf_);
+  TransformRowBands(src.width_, src.height_, [&](uint32_t firstRow, uint32_t endRow) {
+    LutRows(lut->data(), dst.buf_, dst.format_, srcBits, src.width_,
+            firstRow, endRow);
+  });
+  return true;
+}
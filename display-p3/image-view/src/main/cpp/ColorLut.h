@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef __COLOR_LUT_H__
+#define __COLOR_LUT_H__
+
+#include <string>
+#include "ColorProfile.h"
+#include "ColorSpaceTransform.h"
+
+/*
+ * Color management through 3D LUTs:
+ *     the whole conversion from an image profile to a display space (curves,
+ *     white point adaptation, gamut clamping, display gamma) is sampled once
+ *     on a COLOR_LUT_GRID_SIZE^3 grid; every pixel then costs one tetrahedral
+ *     interpolation in it, whatever the profile.
+ *     LUTs are kept in memory for the last few profiles, and in files under
+ *     the cache directory named after the hash of everything they are built
+ *     from, so a profile is only sampled once per install.
+ */
+#define COLOR_LUT_GRID_SIZE 33
+
+// where LUT files are kept; without it LUTs are cached in memory only
+void SetColorLutCacheDir(const std::string& dir);
+
+/*
+ * TransformColorProfile(IMAGE_FORMAT& dst, IMAGE_FORMAT& src, profile, clipNpm)
+ *     Like TransformColorSpace(), but src.buf_ pixels are described by profile
+ *     instead of src.npm_ and src.gamma_. The display space npm_ is relative
+ *     to D65.
+ */
+bool TransformColorProfile(IMAGE_FORMAT& dst, IMAGE_FORMAT& src,
+                           const COLOR_PROFILE& profile,
+                           const mathfu::mat3* clipNpm = nullptr);
+
+#endif // __COLOR_LUT_H__
@@ -0,0 +1,226 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#include <cmath>
+#include <cstring>
+#include "android_debug.h"
+#include "ColorProfile.h"
+
+#define CLIP_COLOR(color, max) ((color > max) ? max : ((color > 0) ? color : 0))
+
+// ICC signatures, big endian
+#define ICC_SIG(c1, c2, c3, c4)  (((c1)<<24) | ((c2)<<16) | ((c3)<<8) | (c4))
+#define ICC_HEADER_SIZE 128
+
+float TRANSFER_CURVE::Evaluate(float value) const {
+  float x = CLIP_COLOR(value, 1.0f);
+  if (!table_.empty()) {
+    float pos = x * (table_.size() - 1);
+    uint32_t idx = static_cast<uint32_t>(pos);
+    if (idx + 1 >= table_.size()) {
+      return table_.back();
+    }
+    float frac = pos - idx;
+    return table_[idx] + (table_[idx + 1] - table_[idx]) * frac;
+  }
+
+  const float g = params_[0], a = params_[1], b = params_[2], c = params_[3];
+  const float d = params_[4], e = params_[5], f = params_[6];
+  float y;
+  switch (type_) {
+    case 0:
+      y = std::pow(x, g);
+      break;
+    case 1:
+      y = (x >= -b / a) ? std::pow(a * x + b, g) : 0.0f;
+      break;
+    case 2:
+      y = (x >= -b / a) ? std::pow(a * x + b, g) + c : c;
+      break;
+    case 3:
+      y = (x >= d) ? std::pow(a * x + b, g) : c * x;
+      break;
+    case 4:
+      y = (x >= d) ? std::pow(a * x + b, g) + e : c * x + f;
+      break;
+    default:
+      y = x;
+      break;
+  }
+  return CLIP_COLOR(y, 1.0f);
+}
+
+void SetGammaCurve(float gamma, TRANSFER_CURVE* curve) {
+  curve->type_ = 0;
+  curve->params_[0] = gamma;
+  curve->table_.clear();
+}
+
+void SetSRGBCurve(TRANSFER_CURVE* curve) {
+  const float params[] = { 2.4f, 1.0f / 1.055f, 0.055f / 1.055f,
+                           1.0f / 12.92f, 0.04045f, 0.0f, 0.0f };
+  curve->type_ = 3;
+  memcpy(curve->params_, params, sizeof(params));
+  curve->table_.clear();
+}
+
+mathfu::mat3 AdaptWhitePoint(const mathfu::vec3& srcWhite,
+                             const mathfu::vec3& dstWhite) {
+  // XYZ --> cone response
+  const mathfu::mat3 bradford(0.8951f, -0.7502f, 0.0389f,
+                              0.2664f, 1.7135f, -0.0685f,
+                              -0.1614f, 0.0367f, 1.0296f);
+  mathfu::vec3 srcCone = bradford * srcWhite;
+  mathfu::vec3 dstCone = bradford * dstWhite;
+  mathfu::mat3 scale = mathfu::mat3::Identity();
+  for (int idx = 0; idx < 3; idx++) {
+    scale(idx, idx) = dstCone[idx] / srcCone[idx];
+  }
+  return bradford.Inverse() * scale * bradford;
+}
+
+/*
+ * IccReader: big endian reads, out of bounds reads fail
+ */
+class IccReader {
+public:
+  IccReader(const uint8_t* data, uint32_t size) : data_(data), size_(size) {}
+
+  bool Has(uint32_t offset, uint32_t len) const {
+    return offset <= size_ && len <= size_ - offset;
+  }
+  uint32_t Uint32(uint32_t offset) const {
+    const uint8_t* p = data_ + offset;
+    return (static_cast<uint32_t>(p[0]) << 24) | (p[1] << 16) |
+           (p[2] << 8) | p[3];
+  }
+  uint16_t Uint16(uint32_t offset) const {
+    return static_cast<uint16_t>((data_[offset] << 8) | data_[offset + 1]);
+  }
+  float S15Fixed16(uint32_t offset) const {
+    return static_cast<int32_t>(Uint32(offset)) / 65536.0f;
+  }
+
+  // offset and size of a tag, false if it is missing or out of the profile
+  bool FindTag(uint32_t sig, uint32_t* offset, uint32_t* len) const {
+    uint32_t count = Uint32(ICC_HEADER_SIZE);
+    if (count > (size_ - ICC_HEADER_SIZE - 4) / 12) {
+      return false;
+    }
+    for (uint32_t idx = 0; idx < count; idx++) {
+      uint32_t entry = ICC_HEADER_SIZE + 4 + idx * 12;
+      if (Uint32(entry) == sig) {
+        *offset = Uint32(entry + 4);
+        *len = Uint32(entry + 8);
+        return Has(*offset, *len) && *len >= 8;
+      }
+    }
+    return false;
+  }
+
+private:
+  const uint8_t* data_;
+  uint32_t size_;
+};
+
+static bool ReadXYZTag(const IccReader& icc, uint32_t sig, mathfu::vec3* xyz) {
+  uint32_t offset, len;
+  if (!icc.FindTag(sig, &offset, &len) || len < 20 ||
+      icc.Uint32(offset) != ICC_SIG('X', 'Y', 'Z', ' ')) {
+    return false;
+  }
+  *xyz = mathfu::vec3(icc.S15Fixed16(offset + 8), icc.S15Fixed16(offset + 12),
+                      icc.S15Fixed16(offset + 16));
+  return true;
+}
+
+static bool ReadCurveTag(const IccReader& icc, uint32_t sig,
+                         TRANSFER_CURVE* curve) {
+  uint32_t offset, len;
+  if (!icc.FindTag(sig, &offset, &len) || len < 12) {
+    return false;
+  }
+  uint32_t type = icc.Uint32(offset);
+  if (type == ICC_SIG('c', 'u', 'r', 'v')) {
+    uint32_t count = icc.Uint32(offset + 8);
+    if (count > (len - 12) / 2) {
+      return false;
+    }
+    if (count == 0) {
+      SetGammaCurve(1.0f, curve);
+    } else if (count == 1) {
+      // u8Fixed8Number
+      SetGammaCurve(icc.Uint16(offset + 12) / 256.0f, curve);
+    } else {
+      curve->table_.resize(count);
+      for (uint32_t idx = 0; idx < count; idx++) {
+        curve->table_[idx] = icc.Uint16(offset + 12 + idx * 2) / 65535.0f;
+      }
+    }
+    return true;
+  }
+  if (type == ICC_SIG('p', 'a', 'r', 'a')) {
+    const uint32_t paramCounts[] = { 1, 3, 4, 5, 7 };
+    uint32_t function = icc.Uint16(offset + 8);
+    if (function > 4 || len < 12 + paramCounts[function] * 4) {
+      return false;
+    }
+    curve->type_ = function;
+    curve->table_.clear();
+    memset(curve->params_, 0, sizeof(curve->params_));
+    for (uint32_t idx = 0; idx < paramCounts[function]; idx++) {
+      curve->params_[idx] = icc.S15Fixed16(offset + 12 + idx * 4);
+    }
+    return function < 1 || curve->params_[1] != 0.0f;
+  }
+  return false;
+}
+
+bool ParseIccProfile(const uint8_t* data, uint32_t size,
+                     COLOR_PROFILE* profile) {
+  IccReader icc(data, size);
+  if (!data || !icc.Has(0, ICC_HEADER_SIZE + 4) ||
+      icc.Uint32(36) != ICC_SIG('a', 'c', 's', 'p')) {
+    LOGW("====Not an ICC profile");
+    return false;
+  }
+  if (icc.Uint32(16) != ICC_SIG('R', 'G', 'B', ' ') ||
+      icc.Uint32(20) != ICC_SIG('X', 'Y', 'Z', ' ')) {
+    LOGW("====ICC profile is not RGB to XYZ");
+    return false;
+  }
+
+  mathfu::vec3 red, green, blue;
+  if (!ReadXYZTag(icc, ICC_SIG('r', 'X', 'Y', 'Z'), &red) ||
+      !ReadXYZTag(icc, ICC_SIG('g', 'X', 'Y', 'Z'), &green) ||
+      !ReadXYZTag(icc, ICC_SIG('b', 'X', 'Y', 'Z'), &blue) ||
+      !ReadCurveTag(icc, ICC_SIG('r', 'T', 'R', 'C'), &profile->trc_[0]) ||
+      !ReadCurveTag(icc, ICC_SIG('g', 'T', 'R', 'C'), &profile->trc_[1]) ||
+      !ReadCurveTag(icc, ICC_SIG('b', 'T', 'R', 'C'), &profile->trc_[2])) {
+    LOGW("====ICC profile is not a matrix/TRC profile");
+    return false;
+  }
+  profile->npm_ = mathfu::mat3(red[0], red[1], red[2],
+                               green[0], green[1], green[2],
+                               blue[0], blue[1], blue[2]);
+  // the colorants are adapted to the PCS illuminant, D50 in practice
+  profile->white_ = mathfu::vec3(icc.S15Fixed16(68), icc.S15Fixed16(72),
+                                 icc.S15Fixed16(76));
+  if (profile->white_[1] <= 0.0f) {
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef __COLOR_PROFILE_H__
+#define __COLOR_PROFILE_H__
+
+#include <cstdint>
+#include <vector>
+#include <mathfu/glsl_mappings.h>
+
+/*
+ * TRANSFER_CURVE
+ *     encoded value --> linear value, both in 0 -- 1:
+ *     an ICC parametric curve, function type 0 -- 4 with params_ g, a, b, c,
+ *     d, e, f; or, when table_ is not empty, a table sampled evenly over
+ *     0 -- 1 and interpolated linearly
+ */
+struct TRANSFER_CURVE {
+  uint32_t type_;
+  float    params_[7];
+  std::vector<float> table_;
+
+  float Evaluate(float value) const;
+};
+
+// linear = encoded ^ gamma
+void SetGammaCurve(float gamma, TRANSFER_CURVE* curve);
+// IEC 61966-2.1
+void SetSRGBCurve(TRANSFER_CURVE* curve);
+
+/*
+ * COLOR_PROFILE
+ *     How the pixels of an image map to CIE XYZ:
+ *     XYZ = npm_ * (trc_[0](R), trc_[1](G), trc_[2](B)), XYZ relative to the
+ *     white point white_ (Y = 1)
+ */
+struct COLOR_PROFILE {
+  TRANSFER_CURVE trc_[3];
+  mathfu::mat3   npm_;
+  mathfu::vec3   white_;
+};
+
+#define D65_WHITE_XYZ mathfu::vec3(0.95047f, 1.0f, 1.08883f)
+
+/*
+ * ParseIccProfile()
+ *     Read an ICC RGB matrix/TRC profile (v2 or v4, display or input class):
+ *     colorants rXYZ gXYZ bXYZ and curves rTRC gTRC bTRC. Profiles made of
+ *     LUTs only are not supported. Every offset is checked against size.
+ */
+bool ParseIccProfile(const uint8_t* data, uint32_t size, COLOR_PROFILE* profile);
+
+/*
+ * AdaptWhitePoint()
+ *     Bradford chromatic adaptation matrix, XYZ under srcWhite --> XYZ under
+ *     dstWhite
+ */
+mathfu::mat3 AdaptWhitePoint(const mathfu::vec3& srcWhite,
+                             const mathfu::vec3& dstWhite);
+
+#endif // __COLOR_PROFILE_H__
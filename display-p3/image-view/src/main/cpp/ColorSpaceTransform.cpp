@@ -14,9 +14,22 @@
  * limitations under the License.
  *
  */
+#include <algorithm>
 #include <cmath>
+#include <condition_variable>
 #include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
 #include <vector>
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 #include "android_debug.h"
 #include "ColorSpaceTransform.h"
 
@@ -24,193 +37,458 @@
 #define HAS_GAMMA(x) (std::abs(x) > EPSILON && std::abs((x) - 1.0f) > EPSILON)
 #define CLIP_COLOR(color, max) ((color > max) ? max : ((color > 0) ? color : 0))
 
+// linear colors are 12 bit fixed point, so are the matrices
+#define LINEAR_BITS   12
+#define LINEAR_MAX    ((1 << LINEAR_BITS) - 1)
+// pixels staged at a time between the lookups and the matrices
+#define PIXEL_CHUNK   256
+// fewest pixels worth a thread of their own
+#define MIN_BAND_PIXELS (64 * 1024)
+
+enum TABLE_TYPE {
+  DECODE_TABLE,        // 8 bit encoded --> linear
+  ENCODE_TABLE_8,      // linear --> 8 bit encoded
+  ENCODE_TABLE_HALF,   // linear --> encoded half float
+};
+
 /*
- * CreateGammaEncodeTable():
- *     sRGB =
- *        12.92 * LinearRGB            0 < LinearRGB < 0.0031308
- *        1.055 * power(LinearRGB, gamma)-0.055 0.0031308 <= LinarRGB <= 1.0f
+ * FloatToHalf()
+ *    IEEE half float of a value in 0 -- 1, rounded to nearest
  */
-static void CreateGammaEncodeTable(float gamma, std::vector<uint8_t>& table) {
-  ASSERT(gamma < 1.0f, "Wrong Gamma (%f) for encoding", gamma);
-  uint32_t maxPixeli = ( 1<<8 ) - 1;
-  float maxPixelf = static_cast<float>(maxPixeli);
+uint16_t FloatToHalf(float value) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  int32_t exp = static_cast<int32_t>(bits >> 23) - 127 + 15;
+  uint32_t mantissa = bits & 0x7FFFFF;
+  if (exp <= 0) {
+    // subnormal half
+    if (exp < -10) {
+      return 0;
+    }
+    mantissa |= 0x800000;
+    uint32_t shift = 14 - exp;
+    return static_cast<uint16_t>((mantissa + (1 << (shift - 1))) >> shift);
+  }
+  // a carry out of the mantissa rounds up into the exponent
+  return static_cast<uint16_t>(((exp << 10) | (mantissa >> 13)) +
+                               ((mantissa >> 12) & 1));
+}
 
-  uint32_t maxLinearVal = static_cast<uint32_t>(0.0031308f * maxPixeli);
+double EncodeGamma(double linear, float gamma) {
+  linear = CLIP_COLOR(linear, 1.0);
+  if (!HAS_GAMMA(gamma)) {
+    return linear;
+  }
+  // unless gamma is 1/2.4 the two segments leave a gap, filled so that
+  // encoding stays the inverse of decoding, without a step in the darks
+  double val = (linear < 0.0031308) ? linear * 12.92 :
+               std::max(0.04045, 1.055 * pow(linear, gamma) - 0.055);
+  return CLIP_COLOR(val, 1.0);
+}
 
-  table.resize(0);
-  for(uint32_t idx = 0; idx < maxLinearVal; idx++) {
-    double val = idx * 12.92 + .5f;
-    table.push_back(static_cast<uint8_t>(val));
+double DecodeGamma(double value, float gamma) {
+  value = CLIP_COLOR(value, 1.0);
+  if (!HAS_GAMMA(gamma)) {
+    return value;
   }
+  double val = (value < 0.04045) ? value / 12.92 :
+               pow((value + 0.055) / 1.055, gamma);
+  return CLIP_COLOR(val, 1.0);
+}
 
-  for (uint32_t idx = maxLinearVal; idx <= maxPixeli; idx++) {
-    double val = (1.055f * pow(idx / maxPixelf, gamma) - 0.055f);
-    val = val * maxPixeli + 0.5f;
-    table.push_back(static_cast<uint8_t>(CLIP_COLOR(val, maxPixelf)));
+/*
+ * CreateGammaEncodeTable():
+ *     sRGB =
+ *        12.92 * LinearRGB            0 < LinearRGB < 0.0031308
+ *        1.055 * power(LinearRGB, gamma)-0.055 0.0031308 <= LinarRGB <= 1.0f
+ *     indexed by the linear value, gamma 0 to leave it linear
+ */
+static void CreateGammaEncodeTable(float gamma, bool halfFloat,
+                                   std::vector<uint16_t>& table) {
+  ASSERT(!HAS_GAMMA(gamma) || gamma < 1.0f,
+         "Wrong Gamma (%f) for encoding", gamma);
+  table.resize(LINEAR_MAX + 1);
+  for (uint32_t idx = 0; idx <= LINEAR_MAX; idx++) {
+    double val = EncodeGamma(static_cast<double>(idx) / LINEAR_MAX, gamma);
+    table[idx] = halfFloat ? FloatToHalf(static_cast<float>(val)) :
+                             static_cast<uint16_t>(val * 255 + 0.5);
   }
 }
+
 /*
- * CreateGammaEncodeTable()
+ * CreateGammaDecodeTable()
  *    Retrieve linear RGB data
  *    Linear =  sRGB / 12.92    0 <= sRGB < 0.04045
  *              pow((sRGB + 0.055)/1.055, gamma)
+ *    indexed by the 8 bit encoded value, gamma 0 for linear images
  */
-static void CreateGammaDecodeTable(float gamma, std::vector<uint8_t>&table) {
-  ASSERT(gamma > 1.0, "Wrong Gamma(%f) for decoding", gamma);
-  uint32_t maxPixeli = ( 1<<8 ) - 1;
-  float maxPixelf = static_cast<float>(maxPixeli);
-
-  uint32_t maxLinearVal = static_cast<uint32_t>(0.04045 * maxPixeli);
-  for(uint32_t idx = 0; idx < maxLinearVal; idx++) {
-    double val = idx / 12.92 + .5f;
-    table.push_back(static_cast<uint8_t>(val));
+static void CreateGammaDecodeTable(float gamma, std::vector<uint16_t>& table) {
+  ASSERT(!HAS_GAMMA(gamma) || gamma > 1.0f,
+         "Wrong Gamma(%f) for decoding", gamma);
+  table.resize(256);
+  for (uint32_t idx = 0; idx < 256; idx++) {
+    double val = DecodeGamma(idx / 255.0, gamma);
+    table[idx] = static_cast<uint16_t>(val * LINEAR_MAX + 0.5);
   }
+}
+
+/*
+ * GetGammaTable()
+ *    Gamma tables are built once per gamma value and type, then shared by
+ *    all of the transforms for the life of the process
+ */
+static const uint16_t* GetGammaTable(float gamma, TABLE_TYPE type) {
+  static std::mutex tableLock;
+  static std::map<std::pair<float, TABLE_TYPE>, std::vector<uint16_t>> tables;
 
-  for (uint32_t idx = maxLinearVal; idx <= maxPixeli; idx++) {
-    double val;
-    val = (idx / maxPixelf + 0.055f) / 1.055f;
-    val = pow(val, gamma) * maxPixeli + 0.5f;
-    table.push_back(static_cast<uint8_t>(CLIP_COLOR(val, maxPixelf)));
+  if (!HAS_GAMMA(gamma)) {
+    gamma = 0.0f;   // one linear table of each type
+  }
+  std::lock_guard<std::mutex> lock(tableLock);
+  std::pair<float, TABLE_TYPE> key(gamma, type);
+  auto it = tables.find(key);
+  if (it == tables.end()) {
+    it = tables.emplace(key, std::vector<uint16_t>()).first;
+    if (type == DECODE_TABLE) {
+      CreateGammaDecodeTable(gamma, it->second);
+    } else {
+      CreateGammaEncodeTable(gamma, type == ENCODE_TABLE_HALF, it->second);
+    }
   }
+  return it->second.data();
+}
+
+// 8 bit alpha to half float
+static const uint16_t* GetHalfAlphaTable(void) {
+  static uint16_t table[256];
+  static std::once_flag tableInit;
+  std::call_once(tableInit, [] {
+    for (uint32_t idx = 0; idx < 256; idx++) {
+      table[idx] = FloatToHalf(idx / 255.0f);
+    }
+  });
+  return table;
 }
 
 /*
- * ApplyGamma()
- *    Perform gamma lookup for RGBA8888 format
+ * TransformPlan:
+ *    everything applied to a pixel: decode_ lookup, one matrix or two with
+ *    a clamp in between, encode_ lookup. Chained conversions are folded into
+ *    these at plan time, the linear colors never leave the registers.
  */
-static bool ApplyGamma(void* dst, void* src, uint32_t w, uint32_t h,
-                std::vector<uint8_t>& gammaTable) {
-  if(!src || !dst || gammaTable.empty()) {
-    LOGE("Invalid Input to %s, dst(%p),src(%p)",
-         __FUNCTION__, dst, src);
+struct TransformPlan {
+  const uint16_t* decode_;
+  int32_t  matrices_[2][9];   // row major
+  uint32_t matrixCount_;
+  bool     fitsInt16_;        // the vector kernels multiply 16 bit values
+  const uint16_t* encode_;
+  PIXEL_FORMAT    format_;
+};
+
+static bool CreateTransformPlan(const IMAGE_FORMAT& dst,
+                                const IMAGE_FORMAT& src,
+                                const mathfu::mat3* clipNpm,
+                                TransformPlan* plan) {
+  if (src.format_ != PIXEL_FORMAT::PIXEL_R8G8B8A8 ||
+      (dst.format_ != PIXEL_FORMAT::PIXEL_R8G8B8A8 && dst.buf_ == src.buf_)) {
     return false;
   }
-  uint8_t* imgSrc = static_cast<uint8_t*>(src);
-  uint8_t* imgDst = static_cast<uint8_t*>(dst);
-  for (uint32_t r = 0; r < w; r++) {
-    for(uint32_t c = 0; c < h; c++) {
-      *imgDst++ = gammaTable[*imgSrc++];
-      *imgDst++ = gammaTable[*imgSrc++];
-      *imgDst++ = gammaTable[*imgSrc++];
-      *imgDst++ = *imgSrc++;
+  plan->decode_ = GetGammaTable(HAS_GAMMA(src.gamma_) ? 1.0f / src.gamma_ : 0.0f,
+                                DECODE_TABLE);
+  plan->encode_ = GetGammaTable(dst.gamma_,
+                                dst.format_ == PIXEL_FORMAT::PIXEL_R8G8B8A8 ?
+                                ENCODE_TABLE_8 : ENCODE_TABLE_HALF);
+  plan->format_ = dst.format_;
+
+  mathfu::mat3 matrices[2];
+  if (clipNpm) {
+    matrices[0] = clipNpm->Inverse() * (*src.npm_);
+    matrices[1] = *dst.npm_ * (*clipNpm);
+    plan->matrixCount_ = 2;
+  } else {
+    matrices[0] = *dst.npm_ * (*src.npm_);
+    plan->matrixCount_ = 1;
+  }
+  plan->fitsInt16_ = true;
+  for (uint32_t idx = 0; idx < plan->matrixCount_; idx++) {
+    for (int row = 0; row < 3; row++) {
+      for (int col = 0; col < 3; col++) {
+        int32_t m = static_cast<int32_t>(
+            std::lround(matrices[idx](row, col) * (1 << LINEAR_BITS)));
+        plan->matrices_[idx][row * 3 + col] = m;
+        plan->fitsInt16_ &= (m >= INT16_MIN && m <= INT16_MAX);
+      }
     }
   }
   return true;
 }
 
 /*
- * GammaDecode(IMAGE_FORMAT& src):
- *    Decode gamma for src image
- *    src.gamma: the gamma used encoding the src image
- * Ouput:
- *     src.buf_: gamma decoded image with gamma value of 1.0f/src.gamma
+ * TransformChunk()
+ *    rgb = matrix * rgb, rounded and clamped to 0 -- LINEAR_MAX, in place.
+ *    Returns the number of pixels done: the vector kernels leave the tail
+ *    of the chunk, if any, to the scalar code
  */
-static bool GammaDecode(IMAGE_FORMAT &src) {
-  if (!HAS_GAMMA(src.gamma_)) {
-    LOGE("No gamma value to source gamma");
-    return true;
+#if defined(__ARM_NEON)
+static uint32_t TransformChunkSimd(const int32_t* matrix,
+                                   int16_t rgb[3][PIXEL_CHUNK], uint32_t count) {
+  const int16x8_t maxVal = vdupq_n_s16(LINEAR_MAX);
+  const int16x8_t zero = vdupq_n_s16(0);
+  uint32_t idx = 0;
+  for (; idx + 8 <= count; idx += 8) {
+    int16x8_t r = vld1q_s16(&rgb[0][idx]);
+    int16x8_t g = vld1q_s16(&rgb[1][idx]);
+    int16x8_t b = vld1q_s16(&rgb[2][idx]);
+    for (int c = 0; c < 3; c++) {
+      const int32_t* m = &matrix[c * 3];
+      int32x4_t lo = vmull_n_s16(vget_low_s16(r), static_cast<int16_t>(m[0]));
+      lo = vmlal_n_s16(lo, vget_low_s16(g), static_cast<int16_t>(m[1]));
+      lo = vmlal_n_s16(lo, vget_low_s16(b), static_cast<int16_t>(m[2]));
+      int32x4_t hi = vmull_n_s16(vget_high_s16(r), static_cast<int16_t>(m[0]));
+      hi = vmlal_n_s16(hi, vget_high_s16(g), static_cast<int16_t>(m[1]));
+      hi = vmlal_n_s16(hi, vget_high_s16(b), static_cast<int16_t>(m[2]));
+      // rounding shift, then clamp to 0 -- LINEAR_MAX
+      int16x8_t val = vcombine_s16(vqmovn_s32(vrshrq_n_s32(lo, LINEAR_BITS)),
+                                   vqmovn_s32(vrshrq_n_s32(hi, LINEAR_BITS)));
+      vst1q_s16(&rgb[c][idx], vminq_s16(vmaxq_s16(val, zero), maxVal));
+    }
   }
-  std::vector<uint8_t> gammaTable;
-  CreateGammaDecodeTable(1.0f/src.gamma_, gammaTable);
-
-  return ApplyGamma(src.buf_, src.buf_, src.width_, src.height_,
-                    gammaTable);
+  return idx;
+}
+#elif defined(__SSE2__)
+// two 16 bit factors for _mm_madd_epi16(): low multiplies the even lanes
+static inline __m128i FactorPair(int32_t low, int32_t high) {
+  return _mm_set1_epi32(static_cast<int32_t>(
+      (static_cast<uint32_t>(high) << 16) | static_cast<uint16_t>(low)));
 }
 
-static bool GammaDecode(IMAGE_FORMAT &dst, IMAGE_FORMAT &src) {
-  if (!HAS_GAMMA(src.gamma_)) {
-    LOGE("No gamma value to source gamma");
-    return true;
+static uint32_t TransformChunkSimd(const int32_t* matrix,
+                                   int16_t rgb[3][PIXEL_CHUNK], uint32_t count) {
+  __m128i rg[3], b1[3];   // r, g factors; b factor and the rounding term
+  for (int c = 0; c < 3; c++) {
+    rg[c] = FactorPair(matrix[c * 3], matrix[c * 3 + 1]);
+    b1[c] = FactorPair(matrix[c * 3 + 2], 1 << (LINEAR_BITS - 1));
+  }
+  const __m128i one = _mm_set1_epi16(1);
+  const __m128i maxVal = _mm_set1_epi16(LINEAR_MAX);
+  const __m128i zero = _mm_setzero_si128();
+  uint32_t idx = 0;
+  for (; idx + 8 <= count; idx += 8) {
+    __m128i r = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&rgb[0][idx]));
+    __m128i g = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&rgb[1][idx]));
+    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&rgb[2][idx]));
+    __m128i rgLo = _mm_unpacklo_epi16(r, g), rgHi = _mm_unpackhi_epi16(r, g);
+    __m128i b1Lo = _mm_unpacklo_epi16(b, one), b1Hi = _mm_unpackhi_epi16(b, one);
+    for (int c = 0; c < 3; c++) {
+      __m128i lo = _mm_add_epi32(_mm_madd_epi16(rgLo, rg[c]),
+                                 _mm_madd_epi16(b1Lo, b1[c]));
+      __m128i hi = _mm_add_epi32(_mm_madd_epi16(rgHi, rg[c]),
+                                 _mm_madd_epi16(b1Hi, b1[c]));
+      __m128i val = _mm_packs_epi32(_mm_srai_epi32(lo, LINEAR_BITS),
+                                    _mm_srai_epi32(hi, LINEAR_BITS));
+      val = _mm_min_epi16(_mm_max_epi16(val, zero), maxVal);
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(&rgb[c][idx]), val);
+    }
   }
-  std::vector<uint8_t> gammaTable;
-  CreateGammaDecodeTable(1.0f/src.gamma_, gammaTable);
+  return idx;
+}
+#else
+static uint32_t TransformChunkSimd(const int32_t*, int16_t[3][PIXEL_CHUNK],
+                                   uint32_t) {
+  return 0;
+}
+#endif
 
-  return ApplyGamma(dst.buf_, src.buf_, src.width_, src.height_,
-                    gammaTable);
+static void TransformChunk(const int32_t* m, bool simd,
+                           int16_t rgb[3][PIXEL_CHUNK], uint32_t count) {
+  uint32_t idx = simd ? TransformChunkSimd(m, rgb, count) : 0;
+  for (; idx < count; idx++) {
+    int32_t r = rgb[0][idx], g = rgb[1][idx], b = rgb[2][idx];
+    for (int c = 0; c < 3; c++) {
+      int32_t val = (m[c * 3] * r + m[c * 3 + 1] * g + m[c * 3 + 2] * b +
+                     (1 << (LINEAR_BITS - 1))) >> LINEAR_BITS;
+      rgb[c][idx] = static_cast<int16_t>(CLIP_COLOR(val, LINEAR_MAX));
+    }
+  }
 }
 
 /*
- * GammaEncode(IMAGE_FORMAT& format dst)
- *    Gamma encode image with the gamma value of dst.gamma_
+ * TransformRows()
+ *    The whole transform of rows [firstRow, endRow), PIXEL_CHUNK pixels at a
+ *    time: each chunk is read once, staged on the stack and written once, so
+ *    src and dst may be the same R8G8B8A8 buffer
  */
-static bool GammaEncode(IMAGE_FORMAT &dst) {
-  if (!HAS_GAMMA(dst.gamma_)) {
-    LOGE("No gamma value to dst gamma");
-    return true;
-  }
-  std::vector<uint8_t> gammaTable;
-  CreateGammaEncodeTable(dst.gamma_, gammaTable);
+static void TransformRows(const TransformPlan& plan, void* dst,
+                          const uint8_t* src, uint32_t width,
+                          uint32_t firstRow, uint32_t endRow) {
+  int16_t linear[3][PIXEL_CHUNK];
+  const uint16_t* decode = plan.decode_;
+  const uint16_t* encode = plan.encode_;
+  const uint16_t* alpha = GetHalfAlphaTable();
+
+  for (uint32_t row = firstRow; row < endRow; row++) {
+    for (uint32_t col = 0; col < width; col += PIXEL_CHUNK) {
+      uint32_t count = std::min<uint32_t>(PIXEL_CHUNK, width - col);
+      uint32_t offset = (row * width + col) * 4;
+      const uint8_t* s = src + offset;
+      for (uint32_t idx = 0; idx < count; idx++, s += 4) {
+        linear[0][idx] = decode[s[0]];
+        linear[1][idx] = decode[s[1]];
+        linear[2][idx] = decode[s[2]];
+      }
+      for (uint32_t idx = 0; idx < plan.matrixCount_; idx++) {
+        TransformChunk(plan.matrices_[idx], plan.fitsInt16_, linear, count);
+      }
 
-  return ApplyGamma(dst.buf_, dst.buf_, dst.width_, dst.height_,
-                    gammaTable);
+      s = src + offset;
+      if (plan.format_ == PIXEL_FORMAT::PIXEL_R8G8B8A8) {
+        uint8_t* d = static_cast<uint8_t*>(dst) + offset;
+        for (uint32_t idx = 0; idx < count; idx++, s += 4, d += 4) {
+          d[0] = static_cast<uint8_t>(encode[linear[0][idx]]);
+          d[1] = static_cast<uint8_t>(encode[linear[1][idx]]);
+          d[2] = static_cast<uint8_t>(encode[linear[2][idx]]);
+          d[3] = s[3];
+        }
+      } else {
+        uint16_t* d = static_cast<uint16_t*>(dst) + offset;
+        for (uint32_t idx = 0; idx < count; idx++, s += 4, d += 4) {
+          d[0] = encode[linear[0][idx]];
+          d[1] = encode[linear[1][idx]];
+          d[2] = encode[linear[2][idx]];
+          d[3] = alpha[s[3]];
+        }
+      }
+    }
+  }
 }
 
 /*
- * ApplyTransform8888()
- *    dst = matrix * src
- *    and clamp the result to 0 -- 255
+ * BandWorkers
+ *    Threads transforming the bands of TransformRowBands() calls, one less
+ *    than there are cores: started at the first image big enough to split
+ *    and kept for the life of the process, so an image load does not create
+ *    and join threads
  */
-static bool TransformR8G8B8A8(uint8_t* dst, uint8_t *src,
-                           uint32_t width, uint32_t height,
-                           mathfu::mat3& transMatrix) {
-  ASSERT(src && dst, "Wrong image store to %s", __FUNCTION__);
-
-  int32_t m00, m01, m02, m10, m11, m12, m20, m21, m22;
-  m00 = static_cast<int32_t>(transMatrix(0, 0) * 1024 + 0.5f),
-  m01 = static_cast<int32_t>(transMatrix(0, 1) * 1024 + 0.5f);
-  m02 = static_cast<int32_t>(transMatrix(0, 2) * 1024 + 0.5f);
-  m10 = static_cast<int32_t>(transMatrix(1, 0) * 1024 + 0.5f);
-  m11 = static_cast<int32_t>(transMatrix(1, 1) * 1024 + 0.5f);
-  m12 = static_cast<int32_t>(transMatrix(1, 2) * 1024 + 0.5f);
-  m20 = static_cast<int32_t>(transMatrix(2, 0) * 1024 + 0.5f);
-  m21 = static_cast<int32_t>(transMatrix(2, 1) * 1024 + 0.5f);
-  m22 = static_cast<int32_t>(transMatrix(2, 2) * 1024 + 0.5f);
-    for (uint32_t row = 0; row < height; row++) {
-      for (uint32_t col = 0; col < width; col++) {
-        int32_t r, g, b;
-        r = (m00 * src[0] + m01 * src[1] + m02 * src[2] + 512) >> 10;
-        g = (m10 * src[0] + m11 * src[1] + m12 * src[2] + 512) >> 10;
-        b = (m20 * src[0] + m21 * src[1] + m22 * src[2] + 512) >> 10;
-        *dst++ = static_cast<uint8_t>(CLIP_COLOR(r, 255));
-        *dst++ = static_cast<uint8_t>(CLIP_COLOR(g, 255));
-        *dst++ = static_cast<uint8_t>(CLIP_COLOR(b, 255));
-
-        src += 3;          // update src pointer
-        *dst++ = *src++;   // copy alpha
+class BandWorkers {
+ public:
+  static BandWorkers& Get(void) {
+    static BandWorkers workers;
+    return workers;
+  }
+
+  static uint32_t MaxBands(void) {
+    return std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  // bands [1, bands) on the workers, band 0 on the calling thread
+  void Run(uint32_t height, uint32_t bandRows,
+           const std::function<void(uint32_t, uint32_t)>& transform) {
+    uint32_t pending = 0;
+    {
+      std::lock_guard<std::mutex> lock(jobLock_);
+      while (workers_.size() + 1 < MaxBands()) {
+        workers_.emplace_back(&BandWorkers::WorkLoop, this);
+      }
+      for (uint32_t first = bandRows; first < height; first += bandRows) {
+        jobs_.push_back({&transform, first, std::min(first + bandRows, height),
+                         &pending});
+        pending++;
       }
     }
-  return true;
+    jobCond_.notify_all();
+
+    transform(0, std::min(bandRows, height));
+    std::unique_lock<std::mutex> lock(jobLock_);
+    doneCond_.wait(lock, [&pending] { return pending == 0; });
+  }
+
+ private:
+  struct BandJob {
+    const std::function<void(uint32_t, uint32_t)>* transform_;
+    uint32_t firstRow_, endRow_;
+    uint32_t* pending_;   // bands of the call not done yet
+  };
+
+  BandWorkers() : stopping_(false) {}
+
+  ~BandWorkers() {
+    {
+      std::lock_guard<std::mutex> lock(jobLock_);
+      stopping_ = true;
+    }
+    jobCond_.notify_all();
+    for (auto& worker : workers_) {
+      worker.join();
+    }
+  }
+
+  void WorkLoop(void) {
+    std::unique_lock<std::mutex> lock(jobLock_);
+    while (true) {
+      jobCond_.wait(lock, [this] { return stopping_ || !jobs_.empty(); });
+      if (stopping_) {
+        return;
+      }
+      BandJob job = jobs_.front();
+      jobs_.pop_front();
+      lock.unlock();
+      (*job.transform_)(job.firstRow_, job.endRow_);
+      lock.lock();
+      if (--*job.pending_ == 0) {
+        doneCond_.notify_all();
+      }
+    }
+  }
+
+  std::mutex jobLock_;
+  std::condition_variable jobCond_;
+  std::condition_variable doneCond_;
+  std::deque<BandJob> jobs_;
+  bool stopping_;
+  std::vector<std::thread> workers_;
+};
+
+/*
+ * TransformRowBands()
+ *    The rows are split in bands of at least MIN_BAND_PIXELS, transformed on
+ *    the BandWorkers and the calling thread; an image too small for two bands
+ *    is transformed inline
+ */
+void TransformRowBands(uint32_t width, uint32_t height,
+                       const std::function<void(uint32_t, uint32_t)>& transform) {
+  uint64_t pixels = static_cast<uint64_t>(width) * height;
+  uint32_t bands = static_cast<uint32_t>(std::min<uint64_t>(
+      BandWorkers::MaxBands(), pixels / MIN_BAND_PIXELS));
+  uint32_t bandRows = bands ? (height + bands - 1) / bands : height;
+  if (bandRows >= height) {
+    transform(0, height);
+    return;
+  }
+  BandWorkers::Get().Run(height, bandRows, transform);
 }
 
 /*
  * Interface Function:
  *     Convert Color Spaces
  */
-bool TransformColorSpace(IMAGE_FORMAT &dst, IMAGE_FORMAT& src) {
+bool TransformColorSpace(IMAGE_FORMAT &dst, IMAGE_FORMAT& src,
+                         const mathfu::mat3* clipNpm) {
   if (!src.npm_  || !dst.npm_ || !dst.buf_ || !src.buf_) {
     LOGE("=====Error: Invalid Parameters to TransformColorSpace()");
     return false;
   }
-
-  uint8_t* dstBits = static_cast<uint8_t*>(dst.buf_);
-  uint8_t* srcBits = static_cast<uint8_t*>(src.buf_);
-
-  if (HAS_GAMMA(src.gamma_)) {
-    GammaDecode(dst, src);
-    srcBits = dstBits;
-  }
-
-  mathfu::mat3 matrix = *dst.npm_ * (*src.npm_);
-  TransformR8G8B8A8(dstBits, srcBits, src.width_, src.height_, matrix);
-
-  if (HAS_GAMMA(dst.gamma_)) {
-    GammaEncode(dst);
+  TransformPlan plan;
+  if (!CreateTransformPlan(dst, src, clipNpm, &plan)) {
+    LOGE("=====Error: Unsupported formats to TransformColorSpace()");
+    return false;
   }
-
+  const uint8_t* srcBits = static_cast<const uint8_t*>(src.buf_);
+  TransformRowBands(src.width_, src.height_, [&](uint32_t firstRow, uint32_t endRow) {
+    TransformRows(plan, dst.buf_, srcBits, src.width_, firstRow, endRow);
+  });
   return true;
 }
 
-
 /*
  * Default NPMs with white reference points as D65
  * The array sequence should match enum NPM_TYPE definition
@@ -19,31 +19,65 @@
 #define __COLOR_TRANSFORM_H__
 
 #include <cstdint>
+#include <functional>
 #include <mathfu/glsl_mappings.h>
 
+enum PIXEL_FORMAT {
+  PIXEL_R8G8B8A8,        // the default
+  PIXEL_RGBA_HALF_FLOAT, // GL_RGBA16F, destination only
+};
+
 struct IMAGE_FORMAT {
   void*       buf_;  // packed image pointer
   uint32_t    width_, height_;
   float       gamma_;
   const mathfu::mat3* npm_;
+  PIXEL_FORMAT format_;
 };
 
 #define DEFAULT_DISPLAY_GAMMA (1.0f/2.2f)
 #define DEFAULT_P3_IMAGE_GAMMA (1.0f/2.2f)
 
 /*
- * TransformColorSpace(IMAGE_FORMAT& dst, IMAGE_FORMAT& src)
+ * TransformColorSpace(IMAGE_FORMAT& dst, IMAGE_FORMAT& src, clipNpm)
  *     Transforms image between DCI-P3 and sRGB space
  *     Dst.buf_ = dst.npm * src.npm * de-gamma(src.buf_)
  *     dst.buf_ = en-gamma(dst.buf_)
+ * clipNpm:
+ *     if not null, the NPM of a narrower gamut the colors are clamped to on
+ *     the way, like src --> sRGB --> dst
+ *     Dst.buf_ = dst.npm * clipNpm * clamp(clipNpm^-1 * src.npm * ...)
  * dst.buf_:
  *     transformed image buf pointer; user must allocate enough space for the image
  * src.buf_:
  *     source of the image bits to transform.
- * Both src and dst must be in:
- *     R8G8B8A8 4 channels packed format
+ * src must be in R8G8B8A8 4 channels packed format, dst in R8G8B8A8 or
+ * RGBA half float; alpha is copied.
+ * dst.buf_ may be src.buf_ when both are R8G8B8A8. Each pixel goes through
+ * the whole transform in a single pass, linear colors in 12 bits; the rows
+ * are split over a few threads.
+ */
+bool TransformColorSpace(IMAGE_FORMAT &dst, IMAGE_FORMAT& src,
+                         const mathfu::mat3* clipNpm = nullptr);
+
+/*
+ * EncodeGamma(), DecodeGamma()
+ *     The transfer curve of TransformColorSpace() for one value in 0 -- 1;
+ *     gamma as in IMAGE_FORMAT: 1/gamma_ to decode, 0 for linear
+ */
+double EncodeGamma(double linear, float gamma);
+double DecodeGamma(double value, float gamma);
+
+// IEEE half float of a value in 0 -- 1
+uint16_t FloatToHalf(float value);
+
+/*
+ * TransformRowBands()
+ *     Run transform(firstRow, endRow) over [0, height) split in bands, on as
+ *     many threads as there are cores; small images on the calling thread
  */
-bool TransformColorSpace(IMAGE_FORMAT &dst, IMAGE_FORMAT& src);
+void TransformRowBands(uint32_t width, uint32_t height,
+                       const std::function<void(uint32_t, uint32_t)>& transform);
 
 /*
  * GetTransformNPM
@@ -85,9 +85,10 @@ void ImageViewEngine::DrawFrame(void) {
                         2, GL_FLOAT, GL_FALSE, sizeof(GLfloat) * 4, leftQuadVertices + 2);
   glEnableVertexAttribArray(program_.getAttribLocationTex());
   int32_t texIdx = textureIdx_;
+  loader_.Update(texIdx);
   if(renderModeBits_ & RENDERING_P3) {
     glActiveTexture(GL_TEXTURE0 + 0);
-    glBindTexture(GL_TEXTURE_2D, textures_[texIdx]->P3TexId());
+    glBindTexture(GL_TEXTURE_2D, loader_.P3TexId(texIdx));
     glUniform1i(program_.getSamplerLoc(), 0);
     glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
   }
@@ -99,7 +100,7 @@ void ImageViewEngine::DrawFrame(void) {
                           2, GL_FLOAT, GL_FALSE, sizeof(GLfloat) * 4,
                           rightQuadVertices + 2);
     glActiveTexture(GL_TEXTURE0 + 1);
-    glBindTexture(GL_TEXTURE_2D, textures_[texIdx]->SRGBATexId());
+    glBindTexture(GL_TEXTURE_2D, loader_.SRGBATexId(texIdx));
     glUniform1i(program_.getSamplerLoc(), 1);
     glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
   }
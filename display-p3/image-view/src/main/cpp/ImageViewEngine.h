@@ -36,6 +36,7 @@
 #include "gldebug.h"
 #include "ShaderProgram.h"
 #include "AssetTexture.h"
+#include "TextureLoader.h"
 
 class ImageViewEngine {
 public:
@@ -70,9 +71,10 @@ private:
 
   ShaderProgram program_;
 
-  // Image file texture store
+  // Image file texture store, loaded around textureIdx_ by loader_
   std::vector<AssetTexture*> textures_;
   std::atomic<uint32_t>  textureIdx_;
+  TextureLoader loader_;
 
   enum WIDECOLOR_MODE {
     P3_R8G8B8A8_REV,
@@ -0,0 +1,236 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#include <algorithm>
+#include <chrono>
+#include "android_debug.h"
+#include "TextureLoader.h"
+
+TextureLoader::TextureLoader() :
+    mgr_(nullptr), textures_(nullptr), frame_(0), placeholderId_(0),
+    pbo_(0), quit_(false) {
+}
+
+TextureLoader::~TextureLoader() {
+  Stop();
+}
+
+/*
+ * Start()
+ *    Create the placeholder texture and the upload buffer, start the
+ *    workers. Nothing is loaded before the first Update()
+ */
+void TextureLoader::Start(AAssetManager* mgr,
+                          std::vector<AssetTexture*>* textures) {
+  Stop();
+  mgr_ = mgr;
+  textures_ = textures;
+  lastShown_.assign(textures_->size(), 0);
+  frame_ = 0;
+
+  const uint8_t gray[] = { 64, 64, 64, 255 };
+  glGenTextures(1, &placeholderId_);
+  glBindTexture(GL_TEXTURE_2D, placeholderId_);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0,
+               GL_RGBA, GL_UNSIGNED_BYTE, gray);
+  glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glGenBuffers(1, &pbo_);
+
+  quit_ = false;
+  for (int idx = 0; idx < TEXTURE_LOADER_THREADS; idx++) {
+    workers_.push_back(std::thread(&TextureLoader::Worker, this));
+  }
+}
+
+/*
+ * Stop()
+ *    Wait for the images being decoded, then release every texture
+ */
+void TextureLoader::Stop(void) {
+  if (!textures_) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(queueLock_);
+    quit_ = true;
+    queue_.clear();
+  }
+  queueCond_.notify_all();
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+  workers_.clear();
+
+  for (auto tex : *textures_) {
+    tex->ReleaseImage();
+  }
+  glDeleteTextures(1, &placeholderId_);
+  glDeleteBuffers(1, &pbo_);
+  placeholderId_ = 0;
+  pbo_ = 0;
+  textures_ = nullptr;
+}
+
+void TextureLoader::Worker(void) {
+  while (true) {
+    AssetTexture* tex;
+    {
+      std::unique_lock<std::mutex> lock(queueLock_);
+      queueCond_.wait(lock, [this] { return quit_ || !queue_.empty(); });
+      if (quit_) {
+        return;
+      }
+      tex = (*textures_)[queue_.front()];
+      queue_.pop_front();
+      tex->State(TEXTURE_STATE::DECODING);
+    }
+    bool status = tex->DecodeImage(mgr_);
+    tex->State(status ? TEXTURE_STATE::DECODED : TEXTURE_STATE::FAILED);
+  }
+}
+
+/*
+ * Update()
+ *    The window is the current texture and its neighbors within
+ *    TEXTURE_RESIDENT_RANGE, nearest first
+ */
+void TextureLoader::Update(uint32_t current) {
+  if (!textures_ || textures_->empty()) {
+    return;
+  }
+  uint32_t count = static_cast<uint32_t>(textures_->size());
+  std::vector<uint32_t> window(1, current % count);
+  for (uint32_t dist = 1; dist <= TEXTURE_RESIDENT_RANGE; dist++) {
+    uint32_t next = (current + dist) % count;
+    uint32_t prev = (current + count - dist % count) % count;
+    for (uint32_t idx : { next, prev }) {
+      if (std::find(window.begin(), window.end(), idx) == window.end()) {
+        window.push_back(idx);
+      }
+    }
+  }
+
+  frame_++;
+  for (uint32_t idx : window) {
+    lastShown_[idx] = frame_;
+  }
+  Schedule(window);
+  ReleaseOld(window);
+  Upload(window);
+}
+
+/*
+ * Schedule()
+ *    Queue the images of the window not loaded yet, nearest first; images
+ *    still queued for a previous window are dropped
+ */
+void TextureLoader::Schedule(const std::vector<uint32_t>& window) {
+  bool queued = false;
+  {
+    std::lock_guard<std::mutex> lock(queueLock_);
+    for (uint32_t idx : queue_) {
+      (*textures_)[idx]->State(TEXTURE_STATE::EMPTY);
+    }
+    queue_.clear();
+    for (uint32_t idx : window) {
+      AssetTexture* tex = (*textures_)[idx];
+      if (tex->State() == TEXTURE_STATE::EMPTY) {
+        tex->State(TEXTURE_STATE::QUEUED);
+        queue_.push_back(idx);
+        queued = true;
+      }
+    }
+  }
+  if (queued) {
+    queueCond_.notify_all();
+  }
+}
+
+/*
+ * ReleaseOld()
+ *    Images out of the window are dropped unless they are already
+ *    textures; those are released, least recently shown first, while all
+ *    images take more than TEXTURE_MEMORY_BUDGET
+ */
+void TextureLoader::ReleaseOld(const std::vector<uint32_t>& window) {
+  uint64_t total = 0;
+  for (uint32_t idx = 0; idx < textures_->size(); idx++) {
+    AssetTexture* tex = (*textures_)[idx];
+    TEXTURE_STATE state = tex->State();
+    bool inWindow = std::find(window.begin(), window.end(), idx) != window.end();
+    if (!inWindow && (state == TEXTURE_STATE::DECODED ||
+                      state == TEXTURE_STATE::UPLOADING)) {
+      tex->ReleaseImage();
+    } else if (state == TEXTURE_STATE::DECODED ||
+               state == TEXTURE_STATE::UPLOADING ||
+               state == TEXTURE_STATE::RESIDENT) {
+      // a queued image may start decoding at any time, it holds nothing yet
+      total += tex->MemorySize();
+    }
+  }
+
+  while (total > TEXTURE_MEMORY_BUDGET) {
+    AssetTexture* oldest = nullptr;
+    uint64_t oldestFrame = frame_;
+    for (uint32_t idx = 0; idx < textures_->size(); idx++) {
+      AssetTexture* tex = (*textures_)[idx];
+      if (tex->State() == TEXTURE_STATE::RESIDENT &&
+          lastShown_[idx] < oldestFrame) {
+        oldest = tex;
+        oldestFrame = lastShown_[idx];
+      }
+    }
+    if (!oldest) {
+      break;
+    }
+    total -= oldest->MemorySize();
+    oldest->ReleaseImage();
+  }
+}
+
+/*
+ * Upload()
+ *    Upload decoded images of the window, nearest first, one band at a
+ *    time until the frame budget is spent
+ */
+void TextureLoader::Upload(const std::vector<uint32_t>& window) {
+  auto deadline = std::chrono::steady_clock::now() +
+                  std::chrono::microseconds(TEXTURE_UPLOAD_BUDGET_US);
+  for (uint32_t idx : window) {
+    AssetTexture* tex = (*textures_)[idx];
+    while (tex->State() == TEXTURE_STATE::DECODED ||
+           tex->State() == TEXTURE_STATE::UPLOADING) {
+      if (std::chrono::steady_clock::now() >= deadline) {
+        return;
+      }
+      tex->UploadGLTextures(pbo_, TEXTURE_UPLOAD_BAND_SIZE);
+    }
+  }
+}
+
+GLuint TextureLoader::P3TexId(uint32_t idx) {
+  AssetTexture* tex = (*textures_)[idx];
+  return tex->State() == TEXTURE_STATE::RESIDENT ? tex->P3TexId() :
+                                                   placeholderId_;
+}
+
+GLuint TextureLoader::SRGBATexId(uint32_t idx) {
+  AssetTexture* tex = (*textures_)[idx];
+  return tex->State() == TEXTURE_STATE::RESIDENT ? tex->SRGBATexId() :
+                                                   placeholderId_;
+}
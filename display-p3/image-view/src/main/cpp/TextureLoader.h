@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef __TEXTURE_LOADER_H__
+#define __TEXTURE_LOADER_H__
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "AssetTexture.h"
+
+/*
+ * TextureLoader
+ *     Loads the textures around the one on screen, on demand:
+ *     - images within TEXTURE_RESIDENT_RANGE of the current one are decoded
+ *       and converted by TEXTURE_LOADER_THREADS worker threads, nearest
+ *       first
+ *     - decoded images are uploaded on the GL thread through a pixel
+ *       unpack buffer, in bands, for at most TEXTURE_UPLOAD_BUDGET_US per
+ *       frame
+ *     - textures out of the range stay until the memory of all of them
+ *       passes TEXTURE_MEMORY_BUDGET, least recently shown released first
+ *     Images not uploaded yet are drawn with a placeholder texture.
+ *     Every function but the workers' runs on the GL thread.
+ */
+#define TEXTURE_LOADER_THREADS   2
+#define TEXTURE_RESIDENT_RANGE   1
+#define TEXTURE_MEMORY_BUDGET    (96 * 1024 * 1024)
+#define TEXTURE_UPLOAD_BUDGET_US 4000
+#define TEXTURE_UPLOAD_BAND_SIZE (1024 * 1024)
+
+class TextureLoader {
+public:
+  TextureLoader();
+  ~TextureLoader();
+
+  void Start(AAssetManager* mgr, std::vector<AssetTexture*>* textures);
+  void Stop(void);
+
+  // schedule, release and upload for the frame showing texture current
+  void Update(uint32_t current);
+
+  GLuint P3TexId(uint32_t idx);
+  GLuint SRGBATexId(uint32_t idx);
+
+private:
+  AAssetManager* mgr_;
+  std::vector<AssetTexture*>* textures_;
+  std::vector<uint64_t> lastShown_;
+  uint64_t frame_;
+  GLuint placeholderId_;
+  GLuint pbo_;
+
+  std::vector<std::thread> workers_;
+  std::mutex queueLock_;
+  std::condition_variable queueCond_;
+  std::deque<uint32_t> queue_;
+  bool quit_;
+
+  void Worker(void);
+  void Schedule(const std::vector<uint32_t>& window);
+  void ReleaseOld(const std::vector<uint32_t>& window);
+  void Upload(const std::vector<uint32_t>& window);
+};
+
+#endif // __TEXTURE_LOADER_H__
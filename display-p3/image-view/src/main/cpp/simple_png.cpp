@@ -14,132 +14,253 @@
  * limitations under the License.
  *
  */
+#include <algorithm>
 #include <cmath>
+#include <cstring>
+#include <vector>
+#if defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
 #include "common.h"
 #include "simple_png.h"
 
-union littleEndianUint32 {
-  uint8_t bytes[4];
-  uint32_t value;
-};
-// value, store, offset
-#define READ_INT_SWAP(v, s, o)  do {   \
-  v.bytes[3] = s[o + 0];   \
-  v.bytes[2] = s[o + 1];   \
-  v.bytes[1] = s[o + 2];   \
-  v.bytes[0] = s[o + 3];   \
-} while (0)
-
+// inflated ICC profiles larger than this are not read
+#define MAX_ICC_PROFILE_SIZE (4 * 1024 * 1024)
+// IDAT and skipped chunks are read in pieces of this size
+#define PNG_READ_SIZE (64 * 1024)
+#define PNG_MAX_CHUNK_SIZE 0x7FFFFFFFu
 
 // Little endian chunk name
 #define  PNG_CHUNCK(c1, c2, c3, c4)  (((c1)<<24) | ((c2)<<16) | ((c3)<<8) | (c4))
 
+static inline uint32_t ReadBigEndian32(const uint8_t* p) {
+  return (static_cast<uint32_t>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) |
+         p[3];
+}
+
+/*
+ * PNG CRC: the CRC-32 of zlib, which the ARMv8 CRC32 instructions compute
+ * directly when they are available
+ */
+static uint32_t UpdateCrc(uint32_t crc, const uint8_t* data, uint32_t len) {
+#if defined(__ARM_FEATURE_CRC32)
+  crc = ~crc;
+  for (; len >= 8; data += 8, len -= 8) {
+    uint64_t value;
+    memcpy(&value, data, sizeof(value));
+    crc = __crc32d(crc, value);
+  }
+  for (; len; data++, len--) {
+    crc = __crc32b(crc, *data);
+  }
+  return ~crc;
+#else
+  return static_cast<uint32_t>(crc32(crc, data, len));
+#endif
+}
+
 /*
  * Parse PNG file header, refer to:
  *    https://www.w3.org/TR/PNG/#11Chunks
  */
-PNGHeader::PNGHeader(std::string& name, uint8_t *buf, uint64_t len) :
-    name_(name), buf_( buf), length_(len), offset_(0),
-    hasChrm_(false), valid_(false) {
+PNGHeader::PNGHeader(std::string& name, uint8_t *buf, uint64_t len,
+                     bool checkCrc) :
+    name_(name), buf_( buf), length_(buf ? len : 0), offset_(0),
+    checkCrc_(checkCrc), crc_(0), hasChrm_(false), valid_(false),
+    hasTransKey_(false), inflating_(false), idatLeft_(0),
+    hasProfile_(false) {
+  ParseHeader();
+}
 
-  ASSERT(buf_, "PNG header is not initialized");
+PNGHeader::PNGHeader(std::string& name, PNG_READ_FUNC read, bool checkCrc) :
+    name_(name), buf_(nullptr), length_(0), offset_(0), read_(read),
+    checkCrc_(checkCrc), crc_(0), hasChrm_(false), valid_(false),
+    hasTransKey_(false), inflating_(false), idatLeft_(0),
+    hasProfile_(false) {
+  ParseHeader();
+}
+
+PNGHeader::~PNGHeader() {
+  if (inflating_) {
+    inflateEnd(&zstream_);
+  }
+  buf_ = nullptr, offset_= 0;
+}
+
+/*
+ * ParseHeader()
+ *    Read the chunks up to the first IDAT. A truncated file, a bad CRC or
+ *    a broken critical chunk leaves the header invalid; broken ancillary
+ *    chunks are skipped
+ */
+void PNGHeader::ParseHeader(void) {
   NPM_ = mathfu::mat3::Identity();
+  width_ = height_ = bpp_ = colorType_ = 0;
+  compressType_ = filterType_ = interlaceType_ = 0;
+  for (auto& entry : palette_) {
+    entry[0] = entry[1] = entry[2] = 0;
+    entry[3] = 255;
+  }
+  memset(transKey_, 0, sizeof(transKey_));
 
   // always have a gamma, either from PNG file or our default value
   gamma_ = DEFAULT_IMAGE_GAMMA;
   uint8_t sig[] = {137, 80, 78, 71, 13, 10, 26, 10};
 
-  if (memcmp(buf_, sig, sizeof(sig))) {
+  const uint8_t* data;
+  if (!ReadBytes(sizeof(sig), &data) || memcmp(data, sig, sizeof(sig))) {
     LOGE("==== PNG file %s corrupted", name_.c_str());
     return;
   }
-  offset_ += static_cast<uint64_t>(sizeof(sig));
 
   bool has_sRGB = false;
   bool has_iCCP = false;
+  bool hasIHDR = false;
+  uint32_t paletteSize = 0;
   LOGV("=== Parsing File: %s", name_.c_str());
-  while (offset_ < length_) {
-    littleEndianUint32 len, type;
-
-    /*
-     * Read the len word ( 4 bytes ), it is only for data field - no self, not for type
-     * not for CRC
-     */
-    READ_INT_SWAP(len, buf_, offset_);
-    offset_ += 4;
-
-    READ_INT_SWAP(type, buf_, offset_);
-    offset_ += 4;
+  while (true) {
+    uint32_t type, len;
+    if (!ReadChunkHeader(&type, &len)) {
+      LOGE("==== PNG file %s is truncated", name_.c_str());
+      return;
+    }
+    if (type == PNG_CHUNCK('I', 'D', 'A', 'T')) {
+      idatLeft_ = len;
+      break;
+    }
+    if (type == PNG_CHUNCK('I', 'E', 'N', 'D') ||
+        (!hasIHDR && type != PNG_CHUNCK('I', 'H', 'D', 'R'))) {
+      LOGE("==== PNG file %s has no IHDR or IDAT", name_.c_str());
+      return;
+    }
 
-    switch (type.value) {
+    bool status = true;
+    switch (type) {
       case PNG_CHUNCK('I', 'H', 'D', 'R'):
       {
-        uint32_t idx = 0;
-        littleEndianUint32 val;
-        READ_INT_SWAP(val, buf_, (offset_ + idx));
-        width_ = val.value, idx += 4;
-        READ_INT_SWAP(val, buf_, (offset_ + idx));
-        height_ = val.value, idx += 4;
-
-        bpp_ = static_cast<uint32_t> (buf_[offset_ + idx++]);
-        colorType_ = static_cast<uint32_t>(buf_[offset_ + idx++]);
-        compressType_ = static_cast<uint32_t>(buf_[offset_ + idx++]);
-        filterType_ = static_cast<uint32_t>(buf_[offset_ + idx++]);
-        interlaceType_ = static_cast<uint32_t>(buf_[offset_ + idx++]);
-
-        offset_ += sizeof(uint32_t) + len.value; // passing CRC 4 bytes too
+        if (hasIHDR || len != 13 || !ReadChunkData(len, &data)) {
+          LOGE("==== IHDR of %s is invalid", name_.c_str());
+          return;
+        }
+        width_ = ReadBigEndian32(data);
+        height_ = ReadBigEndian32(data + 4);
+        bpp_ = data[8];
+        colorType_ = data[9];
+        compressType_ = data[10];
+        filterType_ = data[11];
+        interlaceType_ = data[12];
+
+        // allowed bit depths of each color type
+        const uint32_t depths[] = { 0x1F, 0, 0x18, 0x0F, 0x18, 0, 0x18 };
+        bool depthOk = colorType_ < 7 && bpp_ && bpp_ <= 16 &&
+                       !(bpp_ & (bpp_ - 1)) &&
+                       (depths[colorType_] & bpp_);
+        if (!width_ || !height_ ||
+            static_cast<uint64_t>(width_) * height_ > PNG_MAX_PIXELS ||
+            !depthOk || compressType_ || filterType_ || interlaceType_ > 1) {
+          LOGE("==== IHDR of %s is not supported", name_.c_str());
+          return;
+        }
+        hasIHDR = true;
+        break;
+      }
+      case PNG_CHUNCK('P', 'L', 'T', 'E'):
+      {
+        if (len % 3 || len > 256 * 3 || !ReadChunkData(len, &data)) {
+          LOGE("==== PLTE of %s is invalid", name_.c_str());
+          return;
+        }
+        paletteSize = len / 3;
+        for (uint32_t idx = 0; idx < paletteSize; idx++) {
+          memcpy(palette_[idx], data + idx * 3, 3);
+        }
+        break;
+      }
+      case PNG_CHUNCK('t', 'R', 'N', 'S'):
+      {
+        uint32_t keySize = (colorType_ == 0) ? 2 : 6;
+        if (colorType_ == 3 && len <= 256) {
+          status = ReadChunkData(len, &data);
+          for (uint32_t idx = 0; status && idx < len; idx++) {
+            palette_[idx][3] = data[idx];
+          }
+        } else if ((colorType_ == 0 || colorType_ == 2) && len == keySize) {
+          status = ReadChunkData(len, &data);
+          for (uint32_t idx = 0; status && idx < keySize / 2; idx++) {
+            transKey_[idx] = static_cast<uint16_t>((data[idx * 2] << 8) |
+                                                   data[idx * 2 + 1]);
+          }
+          hasTransKey_ = status;
+        } else {
+          LOGW("====tRNS chunk of %s is ignored", name_.c_str());
+          status = SkipChunkData(len);
+        }
         break;
       }
       case PNG_CHUNCK('g', 'A', 'M', 'A'):
       {
-        littleEndianUint32 encodedGamma;
-        READ_INT_SWAP(encodedGamma, buf_, offset_);
-        gamma_ = encodedGamma.value / PNG_INTEGER_ENCODING_FACTOR;
-        offset_ += sizeof(uint32_t) + len.value;
+        if (len != 4) {
+          status = SkipChunkData(len);
+          break;
+        }
+        if (!(status = ReadChunkData(len, &data))) {
+          break;
+        }
+        uint32_t encodedGamma = ReadBigEndian32(data);
+        if (encodedGamma) {
+          gamma_ = encodedGamma / PNG_INTEGER_ENCODING_FACTOR;
+        }
         break;
       }
       case PNG_CHUNCK('c', 'H', 'R', 'M'):
       {
-        littleEndianUint32 val;
-        ASSERT(len.value == (2 * 4 * 4), "cHRM Chunk length is not 16(%d)", len.value);
+        if (len != (2 * 4 * 4)) {
+          LOGW("cHRM Chunk length is not 32(%d)", len);
+          status = SkipChunkData(len);
+          break;
+        }
+        if (!(status = ReadChunkData(len, &data))) {
+          break;
+        }
         for(int idx = 0; idx < 4; idx++) {
-          READ_INT_SWAP(val, buf_, (offset_ + idx * 8));
-          chrm_[idx].x = val.value / PNG_INTEGER_ENCODING_FACTOR;
-          READ_INT_SWAP(val, buf_, (offset_ + idx * 8 + 4));
-          chrm_[idx].y = val.value / PNG_INTEGER_ENCODING_FACTOR;
+          chrm_[idx].x = ReadBigEndian32(data + idx * 8) /
+                         PNG_INTEGER_ENCODING_FACTOR;
+          chrm_[idx].y = ReadBigEndian32(data + idx * 8 + 4) /
+                         PNG_INTEGER_ENCODING_FACTOR;
         }
-        hasChrm_ = true;
-        offset_ += sizeof(uint32_t) + len.value;
+        hasChrm_ = chrm_[0].y > 0.0f;
         break;
       }
       case PNG_CHUNCK('s', 'R', 'G', 'B'):
       {
-        has_sRGB = true;
-        ASSERT(len.value == 1, "sRGB length error");
-        offset_ += sizeof(uint32_t) + len.value;
+        has_sRGB = (len == 1);
+        status = SkipChunkData(len);
         break;
       }
       case PNG_CHUNCK('i', 'C', 'C', 'P'):
-        LOGI("====iCCP: %s, compression Method %d",
-             &buf_[offset_],
-             buf_[offset_ +
-                 strlen(reinterpret_cast<const char*>(&buf_[offset_])) + 1]);
         has_iCCP = true;
-        offset_ += sizeof(uint32_t) + len.value;
+        if (len > MAX_ICC_PROFILE_SIZE) {
+          status = SkipChunkData(len);
+          break;
+        }
+        status = ReadChunkData(len, &data);
+        hasProfile_ = status && ParseIccChunk(data, len);
         break;
       default:
-        LOGV("====Unprocessed CHUNK %c%c%c%c",
-             type.bytes[3], type.bytes[2], type.bytes[1], type.bytes[0]);
-        // on purpose: pass through
-      case PNG_CHUNCK('I', 'D', 'A', 'T'):
-      case PNG_CHUNCK('i', 'T', 'X','t'):
-      case PNG_CHUNCK('t', 'T', 'X', 't'):
-      case PNG_CHUNCK('z', 'T', 'X', 't'):
-      case PNG_CHUNCK('t', 'I', 'M', 'E'):
-      case PNG_CHUNCK('I', 'E', 'N', 'D'):
-        offset_ += sizeof(uint32_t) + len.value;  // CRC + data_size
+        LOGV("====Unprocessed CHUNK %c%c%c%c", static_cast<char>(type >> 24),
+             static_cast<char>(type >> 16), static_cast<char>(type >> 8),
+             static_cast<char>(type));
+        status = SkipChunkData(len);
         break;
     }
+    if (!status || !ReadChunkCrc()) {
+      LOGE("==== PNG file %s is truncated or corrupted", name_.c_str());
+      return;
+    }
+  }
+  if (colorType_ == 3 && !paletteSize) {
+    LOGE("==== PNG file %s has no palette", name_.c_str());
+    return;
   }
 
   if(has_sRGB) {
@@ -158,6 +279,23 @@ PNGHeader::PNGHeader(std::string& name, uint8_t *buf, uint64_t len) :
     UpdateNPM();
   }
 
+  // iCCP or sRGB, when present, override cHRM and gAMA
+  if (has_sRGB && !hasProfile_) {
+    for (auto& trc : profile_.trc_) {
+      SetSRGBCurve(&trc);
+    }
+  } else if (hasChrm_ && !hasProfile_) {
+    for (auto& trc : profile_.trc_) {
+      SetGammaCurve(1.0f / gamma_, &trc);
+    }
+  }
+  if (hasChrm_ && !hasProfile_) {
+    profile_.npm_ = NPM_;
+    profile_.white_ = mathfu::vec3(chrm_[0].x / chrm_[0].y, 1.0f,
+                                   (1.0f - chrm_[0].x - chrm_[0].y) / chrm_[0].y);
+    hasProfile_ = true;
+  }
+
   /*
    * shortcut: if SRGB / iCCP present, assume to be P3 iamge
    */
@@ -167,6 +305,18 @@ PNGHeader::PNGHeader(std::string& name, uint8_t *buf, uint64_t len) :
   valid_ = true;
 }
 
+bool PNGHeader::IsValid(void) const {
+  return valid_;
+}
+
+uint32_t PNGHeader::Width(void) const {
+  return width_;
+}
+
+uint32_t PNGHeader::Height(void) const {
+  return height_;
+}
+
 float PNGHeader::GetGamma() const{
     return gamma_;
 }
@@ -241,3 +391,349 @@ const mathfu::mat3* PNGHeader::NPM(void) {
   ASSERT(hasChrm_, "File does not have NPM info");
   return &NPM_;
 }
+
+const COLOR_PROFILE* PNGHeader::Profile(void) const {
+  return hasProfile_ ? &profile_ : nullptr;
+}
+
+/*
+ * ParseIccChunk()
+ *    iCCP: profile name, 0, compression method (0: zlib), compressed profile
+ */
+bool PNGHeader::ParseIccChunk(const uint8_t* chunk, uint32_t len) {
+  const uint8_t* nameEnd = static_cast<const uint8_t*>(memchr(chunk, 0, len));
+  if (!nameEnd || nameEnd + 2 > chunk + len || nameEnd[1] != 0) {
+    LOGE("====iCCP chunk of %s is invalid", name_.c_str());
+    return false;
+  }
+  LOGI("====iCCP: %s, compression Method %d", chunk, nameEnd[1]);
+
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  if (inflateInit(&stream) != Z_OK) {
+    return false;
+  }
+  stream.next_in = const_cast<uint8_t*>(nameEnd + 2);
+  stream.avail_in = static_cast<uInt>(chunk + len - (nameEnd + 2));
+  std::vector<uint8_t> profile;
+  int status = Z_OK;
+  while (status == Z_OK && profile.size() < MAX_ICC_PROFILE_SIZE) {
+    size_t done = profile.size();
+    profile.resize(done + 4096);
+    stream.next_out = profile.data() + done;
+    stream.avail_out = 4096;
+    status = inflate(&stream, Z_NO_FLUSH);
+    profile.resize(profile.size() - stream.avail_out);
+  }
+  inflateEnd(&stream);
+  if (status != Z_STREAM_END) {
+    LOGE("====iCCP profile of %s does not inflate", name_.c_str());
+    return false;
+  }
+  return ParseIccProfile(profile.data(), static_cast<uint32_t>(profile.size()),
+                         &profile_);
+}
+
+/*
+ * ReadBytes()
+ *    The next len bytes of the file: in place for files in memory, copied
+ *    into chunk_ for streamed ones. False past the end of the file
+ */
+bool PNGHeader::ReadBytes(uint32_t len, const uint8_t** data) {
+  if (!read_) {
+    if (len > length_ - offset_) {
+      return false;
+    }
+    *data = buf_ + offset_;
+    offset_ += len;
+    return true;
+  }
+
+  chunk_.resize(len);
+  uint32_t done = 0;
+  while (done < len) {
+    uint32_t count = read_(chunk_.data() + done, len - done);
+    if (!count) {
+      return false;
+    }
+    done += std::min(count, len - done);
+  }
+  *data = chunk_.data();
+  return true;
+}
+
+/*
+ * Chunk layout: length, type, data, CRC of type and data
+ */
+bool PNGHeader::ReadChunkHeader(uint32_t* type, uint32_t* len) {
+  const uint8_t* data;
+  if (!ReadBytes(8, &data)) {
+    return false;
+  }
+  *len = ReadBigEndian32(data);
+  *type = ReadBigEndian32(data + 4);
+  if (checkCrc_) {
+    crc_ = UpdateCrc(0, data + 4, 4);
+  }
+  return *len <= PNG_MAX_CHUNK_SIZE;
+}
+
+bool PNGHeader::ReadChunkData(uint32_t len, const uint8_t** data) {
+  if (!ReadBytes(len, data)) {
+    return false;
+  }
+  if (checkCrc_) {
+    crc_ = UpdateCrc(crc_, *data, len);
+  }
+  return true;
+}
+
+bool PNGHeader::SkipChunkData(uint32_t len) {
+  while (len) {
+    const uint8_t* data;
+    uint32_t size = std::min<uint32_t>(len, PNG_READ_SIZE);
+    if (!ReadChunkData(size, &data)) {
+      return false;
+    }
+    len -= size;
+  }
+  return true;
+}
+
+bool PNGHeader::ReadChunkCrc(void) {
+  const uint8_t* data;
+  if (!ReadBytes(4, &data)) {
+    return false;
+  }
+  if (checkCrc_ && ReadBigEndian32(data) != crc_) {
+    LOGE("==== Chunk CRC error in %s", name_.c_str());
+    return false;
+  }
+  return true;
+}
+
+/*
+ * InflateBytes()
+ *    Fill dst from the IDAT stream, reading the IDAT chunks as needed
+ */
+bool PNGHeader::InflateBytes(uint8_t* dst, uint32_t len) {
+  zstream_.next_out = dst;
+  zstream_.avail_out = len;
+  while (zstream_.avail_out) {
+    if (!zstream_.avail_in) {
+      while (!idatLeft_) {
+        uint32_t type;
+        if (!ReadChunkCrc() || !ReadChunkHeader(&type, &idatLeft_) ||
+            type != PNG_CHUNCK('I', 'D', 'A', 'T')) {
+          LOGE("==== Image data of %s is truncated", name_.c_str());
+          return false;
+        }
+      }
+      const uint8_t* data;
+      uint32_t size = std::min<uint32_t>(idatLeft_, PNG_READ_SIZE);
+      if (!ReadChunkData(size, &data)) {
+        LOGE("==== Image data of %s is truncated", name_.c_str());
+        return false;
+      }
+      idatLeft_ -= size;
+      zstream_.next_in = const_cast<uint8_t*>(data);
+      zstream_.avail_in = size;
+    }
+    int status = inflate(&zstream_, Z_NO_FLUSH);
+    if ((status != Z_OK && status != Z_STREAM_END) ||
+        (status == Z_STREAM_END && zstream_.avail_out)) {
+      LOGE("==== Image data of %s does not inflate", name_.c_str());
+      return false;
+    }
+  }
+  return true;
+}
+
+/*
+ * UnfilterRow()
+ *    Undo the filter of one row, refer to:
+ *      https://www.w3.org/TR/PNG/#9Filters
+ *    bpp: bytes per complete pixel, at least 1
+ */
+static bool UnfilterRow(uint32_t filter, uint8_t* row, const uint8_t* prev,
+                        uint32_t len, uint32_t bpp) {
+  switch (filter) {
+    case 0:
+      break;
+    case 1:
+      for (uint32_t idx = bpp; idx < len; idx++) {
+        row[idx] += row[idx - bpp];
+      }
+      break;
+    case 2:
+      for (uint32_t idx = 0; idx < len; idx++) {
+        row[idx] += prev[idx];
+      }
+      break;
+    case 3:
+      for (uint32_t idx = 0; idx < len; idx++) {
+        uint32_t left = (idx >= bpp) ? row[idx - bpp] : 0;
+        row[idx] += static_cast<uint8_t>((left + prev[idx]) >> 1);
+      }
+      break;
+    case 4:
+      for (uint32_t idx = 0; idx < len; idx++) {
+        int32_t a = (idx >= bpp) ? row[idx - bpp] : 0;
+        int32_t b = prev[idx];
+        int32_t c = (idx >= bpp) ? prev[idx - bpp] : 0;
+        int32_t pa = std::abs(b - c), pb = std::abs(a - c);
+        int32_t pc = std::abs(a + b - 2 * c);
+        row[idx] += static_cast<uint8_t>((pa <= pb && pa <= pc) ? a :
+                                         (pb <= pc) ? b : c);
+      }
+      break;
+    default:
+      return false;
+  }
+  return true;
+}
+
+// sample idx of a row of depth bits samples
+static inline uint32_t Sample(const uint8_t* row, uint32_t idx,
+                              uint32_t depth) {
+  switch (depth) {
+    case 8:
+      return row[idx];
+    case 16:
+      return (row[idx * 2] << 8) | row[idx * 2 + 1];
+    default:
+      uint32_t bit = idx * depth;
+      return (row[bit >> 3] >> (8 - depth - (bit & 7))) & ((1 << depth) - 1);
+  }
+}
+
+/*
+ * ExpandRow()
+ *    count pixels of an unfiltered row to RGBA 8, step bytes apart in dst
+ */
+void PNGHeader::ExpandRow(const uint8_t* row, uint32_t count, uint8_t* dst,
+                          uint32_t step) const {
+  // 8 bit samples from any depth, 16 bit ones keep their high byte
+  const uint32_t depth = bpp_;
+  const uint32_t shift = (depth == 16) ? 8 : 0;
+  const uint32_t scale = (depth < 8) ? 255 / ((1 << depth) - 1) : 1;
+
+  switch (colorType_) {
+    case 0:
+      for (uint32_t idx = 0; idx < count; idx++, dst += step) {
+        uint32_t gray = Sample(row, idx, depth);
+        dst[0] = dst[1] = dst[2] = static_cast<uint8_t>((gray >> shift) * scale);
+        dst[3] = (hasTransKey_ && gray == transKey_[0]) ? 0 : 255;
+      }
+      break;
+    case 2:
+      if (depth == 8 && !hasTransKey_) {
+        for (uint32_t idx = 0; idx < count; idx++, dst += step, row += 3) {
+          dst[0] = row[0], dst[1] = row[1], dst[2] = row[2], dst[3] = 255;
+        }
+        break;
+      }
+      for (uint32_t idx = 0; idx < count; idx++, dst += step) {
+        uint32_t rgb[3];
+        for (int c = 0; c < 3; c++) {
+          rgb[c] = Sample(row, idx * 3 + c, depth);
+          dst[c] = static_cast<uint8_t>(rgb[c] >> shift);
+        }
+        dst[3] = (hasTransKey_ && rgb[0] == transKey_[0] &&
+                  rgb[1] == transKey_[1] && rgb[2] == transKey_[2]) ? 0 : 255;
+      }
+      break;
+    case 3:
+      for (uint32_t idx = 0; idx < count; idx++, dst += step) {
+        memcpy(dst, palette_[Sample(row, idx, depth)], 4);
+      }
+      break;
+    case 4:
+      for (uint32_t idx = 0; idx < count; idx++, dst += step) {
+        dst[0] = dst[1] = dst[2] =
+            static_cast<uint8_t>(Sample(row, idx * 2, depth) >> shift);
+        dst[3] = static_cast<uint8_t>(Sample(row, idx * 2 + 1, depth) >> shift);
+      }
+      break;
+    case 6:
+      if (depth == 8 && step == 4) {
+        memcpy(dst, row, count * 4);
+        break;
+      }
+      for (uint32_t idx = 0; idx < count; idx++, dst += step) {
+        for (int c = 0; c < 4; c++) {
+          dst[c] = static_cast<uint8_t>(Sample(row, idx * 4 + c, depth) >> shift);
+        }
+      }
+      break;
+  }
+}
+
+/*
+ * DecodeImage()
+ *    Rows are inflated one at a time straight out of the IDAT chunks, then
+ *    unfiltered and expanded; interlaced images go through the 7 Adam7
+ *    passes, each pixel written to its place in rgba
+ */
+bool PNGHeader::DecodeImage(uint8_t* rgba) {
+  if (!valid_ || inflating_ || !rgba) {
+    LOGE("==== PNG file %s can not be decoded", name_.c_str());
+    return false;
+  }
+  memset(&zstream_, 0, sizeof(zstream_));
+  if (inflateInit(&zstream_) != Z_OK) {
+    return false;
+  }
+  inflating_ = true;
+
+  const uint32_t channels[] = { 1, 0, 3, 1, 2, 0, 4 };
+  const uint32_t pixelBits = channels[colorType_] * bpp_;
+  const uint32_t filterBpp = std::max(1u, pixelBits / 8);
+
+  // Adam7 pass origins and steps; pass 7 alone for non interlaced images
+  const uint32_t x0[] = { 0, 4, 0, 2, 0, 1, 0 };
+  const uint32_t y0[] = { 0, 0, 4, 0, 2, 0, 1 };
+  const uint32_t dx[] = { 8, 8, 4, 4, 2, 2, 1 };
+  const uint32_t dy[] = { 8, 8, 8, 4, 4, 2, 2 };
+  uint32_t firstPass = interlaceType_ ? 0 : 6;
+
+  std::vector<uint8_t> rows[2];
+  for (uint32_t pass = firstPass; pass < 7; pass++) {
+    uint32_t stepX = interlaceType_ ? dx[pass] : 1;
+    uint32_t stepY = interlaceType_ ? dy[pass] : 1;
+    uint32_t startX = interlaceType_ ? x0[pass] : 0;
+    uint32_t startY = interlaceType_ ? y0[pass] : 0;
+    if (startX >= width_ || startY >= height_) {
+      continue;
+    }
+    uint32_t passWidth = (width_ - startX + stepX - 1) / stepX;
+    uint32_t passHeight = (height_ - startY + stepY - 1) / stepY;
+    uint32_t rowBytes = static_cast<uint32_t>(
+        (static_cast<uint64_t>(passWidth) * pixelBits + 7) / 8);
+
+    // the row above the first one is all 0
+    rows[0].assign(rowBytes + 1, 0);
+    rows[1].resize(rowBytes + 1);
+    for (uint32_t y = 0; y < passHeight; y++) {
+      uint8_t* row = rows[1].data();
+      if (!InflateBytes(row, rowBytes + 1) ||
+          !UnfilterRow(row[0], row + 1, rows[0].data() + 1, rowBytes,
+                       filterBpp)) {
+        LOGE("==== Image data of %s is corrupted", name_.c_str());
+        return false;
+      }
+      uint8_t* dst = rgba + (static_cast<uint64_t>(startY + y * stepY) *
+                             width_ + startX) * 4;
+      ExpandRow(row + 1, passWidth, dst, stepX * 4);
+      rows[0].swap(rows[1]);
+    }
+  }
+
+  // the CRC of the last IDAT chunk covers the end of the zlib stream
+  if (!SkipChunkData(idatLeft_) || !ReadChunkCrc()) {
+    LOGE("==== Image data of %s is corrupted", name_.c_str());
+    return false;
+  }
+  idatLeft_ = 0;
+  return true;
+}
@@ -19,8 +19,12 @@
 #define  __SIMPLE_PNG_H__
 
 #include <cstdint>
+#include <functional>
 #include <string>
+#include <vector>
+#include <zlib.h>
 #include "android_debug.h"
+#include "ColorProfile.h"
 #include <mathfu/glsl_mappings.h>
 
 #pragma pack(push, 1 )
@@ -29,6 +33,8 @@ struct CIE_POINT {
   float x, y;
 };
 
+#pragma pack(pop)
+
 #define REF_WHITE_IDX 0
 #define REF_RED_IDX   1
 #define REF_GREEN_IDX 2
@@ -40,25 +46,78 @@ struct CIE_POINT {
  */
 #define DEFAULT_IMAGE_GAMMA  (1.0f/2.2f)
 
+// larger images are not decoded
+#define PNG_MAX_PIXELS (1 << 26)
+
+/*
+ * PNG_READ_FUNC
+ *     Copy up to len next bytes of the file into buf; returns how many were
+ *     copied, 0 at the end of the file
+ */
+typedef std::function<uint32_t(uint8_t* buf, uint32_t len)> PNG_READ_FUNC;
+
+/*
+ * PNGHeader
+ *     Reads the chunks up to the first IDAT in one pass, every read bounds
+ *     checked and, with checkCrc, every chunk CRC verified: IHDR, PLTE,
+ *     tRNS, gAMA, cHRM, sRGB and iCCP. DecodeImage() then carries on with
+ *     the IDAT chunks through one inflate stream, so metadata and pixels
+ *     come out of a single read of the file.
+ *     Files in memory are parsed in place; streamed files only need one
+ *     chunk (one IDAT piece) in memory at a time.
+ */
 class PNGHeader {
 public:
-  explicit PNGHeader(std::string& name, uint8_t* buf, uint64_t len);
-  ~PNGHeader() {
-    buf_ = nullptr, offset_= 0;
-  }
+  explicit PNGHeader(std::string& name, uint8_t* buf, uint64_t len,
+                     bool checkCrc = true);
+  explicit PNGHeader(std::string& name, PNG_READ_FUNC read,
+                     bool checkCrc = true);
+  ~PNGHeader();
+
+  bool IsValid(void) const;
+  uint32_t Width(void) const;
+  uint32_t Height(void) const;
 
   float GetGamma(void) const;
   bool  IsP3Image(void) const;
   bool  HasNPM(void) const;
   const mathfu::mat3* NPM(void);
 
+  // How the image colors are coded, from iCCP, sRGB or cHRM + gAMA;
+  // nullptr if the file does not say
+  const COLOR_PROFILE* Profile(void) const;
+
+  /*
+   * DecodeImage()
+   *     Decode the pixels into rgba, Width() * Height() 8 bit RGBA pixels:
+   *     any bit depth, color type and interlace; 16 bit samples keep their
+   *     high byte. Only once per PNGHeader.
+   */
+  bool DecodeImage(uint8_t* rgba);
+
 private:
+  void ParseHeader(void);
   void UpdateNPM(void);
+  bool ParseIccChunk(const uint8_t* chunk, uint32_t len);
+
+  // chunk reader
+  bool ReadBytes(uint32_t len, const uint8_t** data);
+  bool ReadChunkHeader(uint32_t* type, uint32_t* len);
+  bool ReadChunkData(uint32_t len, const uint8_t** data);
+  bool SkipChunkData(uint32_t len);
+  bool ReadChunkCrc(void);
+  bool InflateBytes(uint8_t* dst, uint32_t len);
+  void ExpandRow(const uint8_t* row, uint32_t count, uint8_t* dst,
+                 uint32_t step) const;
 
   std::string name_;
   uint8_t* buf_;
   uint64_t length_;
   uint64_t offset_;
+  PNG_READ_FUNC read_;
+  std::vector<uint8_t> chunk_;
+  bool checkCrc_;
+  uint32_t crc_;
   float  gamma_;
 
   // header info:
@@ -68,9 +127,20 @@ private:
   bool hasChrm_;
   mathfu::mat3 NPM_;
   bool  valid_;
-};
 
-#pragma pack(pop)
+  // PLTE + tRNS as RGBA, tRNS key color of gray and RGB images
+  uint8_t palette_[256][4];
+  uint16_t transKey_[3];
+  bool hasTransKey_;
+
+  // IDAT stream, positioned in the first IDAT chunk after the header
+  z_stream zstream_;
+  bool inflating_;
+  uint32_t idatLeft_;
+
+  COLOR_PROFILE profile_;
+  bool  hasProfile_;
+};
 
 #endif //  __SIMPLE_PNG_H__
 
@@ -0,0 +1,407 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "audio_stream.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Single producer / single consumer ring of frames. The indices run freely
+ * and wrap at 2^32; the storage is a power of 2 so a mask picks the slot.
+ * Each side publishes its index with a release store and reads the other one
+ * with an acquire load, no lock on either side.
+ */
+typedef struct FrameRing {
+    short *frames;
+    uint32_t mask;
+    uint32_t write;
+    uint32_t read;
+} FrameRing;
+
+static int initRing(FrameRing *ring, unsigned frames)
+{
+    uint32_t size = 1;
+    while (size < frames) {
+        size <<= 1;
+    }
+    ring->frames = (short *)calloc(size, sizeof(short));
+    ring->mask = size - 1;
+    ring->write = 0;
+    ring->read = 0;
+    return NULL != ring->frames;
+}
+
+static uint32_t ringReadable(FrameRing *ring)
+{
+    return __atomic_load_n(&ring->write, __ATOMIC_ACQUIRE) - ring->read;
+}
+
+static uint32_t ringWritable(FrameRing *ring)
+{
+    return ring->mask + 1 - (ring->write - __atomic_load_n(&ring->read, __ATOMIC_ACQUIRE));
+}
+
+// producer: contiguous free frames at *span, to publish with ringCommit()
+static unsigned ringWriteSpan(FrameRing *ring, short **span)
+{
+    uint32_t idx = ring->write & ring->mask;
+    uint32_t frames = ringWritable(ring);
+    if (frames > ring->mask + 1 - idx) {
+        frames = ring->mask + 1 - idx;
+    }
+    *span = ring->frames + idx;
+    return frames;
+}
+
+static void ringCommit(FrameRing *ring, unsigned frames)
+{
+    __atomic_store_n(&ring->write, ring->write + frames, __ATOMIC_RELEASE);
+}
+
+static unsigned ringWrite(FrameRing *ring, const short *src, unsigned frames)
+{
+    unsigned written = 0;
+    while (written < frames) {
+        short *span;
+        unsigned count = ringWriteSpan(ring, &span);
+        if (0 == count) {
+            break;
+        }
+        if (count > frames - written) {
+            count = frames - written;
+        }
+        memcpy(span, src + written, count * sizeof(short));
+        ringCommit(ring, count);
+        written += count;
+    }
+    return written;
+}
+
+// consumer: contiguous queued frames at *span, to release with ringConsume()
+static unsigned ringReadSpan(FrameRing *ring, const short **span)
+{
+    uint32_t idx = ring->read & ring->mask;
+    uint32_t frames = ringReadable(ring);
+    if (frames > ring->mask + 1 - idx) {
+        frames = ring->mask + 1 - idx;
+    }
+    *span = ring->frames + idx;
+    return frames;
+}
+
+static void ringConsume(FrameRing *ring, unsigned frames)
+{
+    __atomic_store_n(&ring->read, ring->read + frames, __ATOMIC_RELEASE);
+}
+
+static unsigned ringRead(FrameRing *ring, short *dst, unsigned frames)
+{
+    unsigned read = 0;
+    while (read < frames) {
+        const short *span;
+        unsigned count = ringReadSpan(ring, &span);
+        if (0 == count) {
+            break;
+        }
+        if (count > frames - read) {
+            count = frames - read;
+        }
+        memcpy(dst + read, span, count * sizeof(short));
+        ringConsume(ring, count);
+        read += count;
+    }
+    return read;
+}
+
+enum {
+    STREAM_PLAY,
+    STREAM_RECORD,
+};
+
+struct AudioStream {
+    int direction;
+    StreamConfig config;
+    StreamSourceFn source;
+    StreamSinkFn sink;
+    void *ctx;
+    StreamEnqueueFn enqueue;
+    void *deviceCtx;
+
+    // device side, only touched from startStream() and the device callback
+    short *blocks;
+    unsigned *blockFrames;  // frames queued with each block
+    unsigned nextBlock;     // next block to queue
+    unsigned doneBlock;     // oldest block on the device
+    unsigned queuedBlocks;
+
+    FrameRing ring;
+    sem_t wake;             // posted by the device side when the ring moved
+    pthread_t worker;
+    int workerRunning;
+    int stopping;
+    int ended;              // the source or the sink ended the stream
+
+    StreamStats stats;
+};
+
+static short *getBlock(AudioStream *stream, unsigned idx)
+{
+    return stream->blocks + idx * stream->config.blockFrames;
+}
+
+static void waitForDevice(AudioStream *stream)
+{
+    while (sem_wait(&stream->wake) && EINTR == errno) {
+    }
+}
+
+static int isEnded(AudioStream *stream)
+{
+    return __atomic_load_n(&stream->ended, __ATOMIC_ACQUIRE);
+}
+
+static void addXrun(AudioStream *stream, unsigned frames)
+{
+    __atomic_store_n(&stream->stats.xrunCount, stream->stats.xrunCount + 1,
+                     __ATOMIC_RELAXED);
+    __atomic_store_n(&stream->stats.xrunFrames, stream->stats.xrunFrames + frames,
+                     __ATOMIC_RELAXED);
+}
+
+// play worker: fill the ring as far as it goes; returns 0 at the end of the source
+static int fillPlayRing(AudioStream *stream)
+{
+    short *span;
+    unsigned space;
+    while ((space = ringWriteSpan(&stream->ring, &span)) != 0) {
+        unsigned frames = stream->source(stream->ctx, span, space);
+        if (0 == frames) {
+            __atomic_store_n(&stream->ended, 1, __ATOMIC_RELEASE);
+            return 0;
+        }
+        ringCommit(&stream->ring, frames);
+    }
+    return 1;
+}
+
+static void *playWorker(void *arg)
+{
+    AudioStream *stream = (AudioStream *)arg;
+    while (!__atomic_load_n(&stream->stopping, __ATOMIC_ACQUIRE)) {
+        if (!fillPlayRing(stream)) {
+            break;
+        }
+        waitForDevice(stream);
+    }
+    return NULL;
+}
+
+static void *recordWorker(void *arg)
+{
+    AudioStream *stream = (AudioStream *)arg;
+    while (!__atomic_load_n(&stream->stopping, __ATOMIC_ACQUIRE)) {
+        const short *span;
+        unsigned frames;
+        while ((frames = ringReadSpan(&stream->ring, &span)) != 0) {
+            int more = stream->sink(stream->ctx, span, frames);
+            ringConsume(&stream->ring, frames);
+            if (!more) {
+                __atomic_store_n(&stream->ended, 1, __ATOMIC_RELEASE);
+                return NULL;
+            }
+        }
+        waitForDevice(stream);
+    }
+    return NULL;
+}
+
+// device side: queue the next block; returns 0 if nothing was queued
+static int queueBlock(AudioStream *stream)
+{
+    unsigned blockFrames = stream->config.blockFrames;
+    short *block = getBlock(stream, stream->nextBlock);
+    unsigned frames = blockFrames;
+
+    if (STREAM_PLAY == stream->direction) {
+        // ended first: whatever it produced is in the ring by then
+        int ended = isEnded(stream);
+        frames = ringRead(&stream->ring, block, blockFrames);
+        sem_post(&stream->wake);
+        if (frames < blockFrames && !ended) {
+            memset(block + frames, 0, (blockFrames - frames) * sizeof(short));
+            addXrun(stream, blockFrames - frames);
+            frames = blockFrames;
+        }
+        if (0 == frames) {
+            return 0;
+        }
+    }
+    if (!stream->enqueue(stream->deviceCtx, block, frames)) {
+        return 0;
+    }
+    stream->blockFrames[stream->nextBlock] = frames;
+    stream->nextBlock = (stream->nextBlock + 1) % stream->config.blockCount;
+    stream->queuedBlocks++;
+    return 1;
+}
+
+int onStreamBlockDone(AudioStream *stream)
+{
+    if (0 == stream->queuedBlocks) {
+        return 0;
+    }
+    unsigned frames = stream->blockFrames[stream->doneBlock];
+    short *block = getBlock(stream, stream->doneBlock);
+    stream->doneBlock = (stream->doneBlock + 1) % stream->config.blockCount;
+    stream->queuedBlocks--;
+    __atomic_store_n(&stream->stats.frames, stream->stats.frames + frames,
+                     __ATOMIC_RELAXED);
+
+    if (STREAM_RECORD == stream->direction) {
+        if (isEnded(stream)) {
+            // let the blocks still on the device drain
+            return stream->queuedBlocks > 0;
+        }
+        unsigned written = ringWrite(&stream->ring, block, frames);
+        if (written < frames) {
+            addXrun(stream, frames - written);
+        }
+        sem_post(&stream->wake);
+    }
+    queueBlock(stream);
+    return stream->queuedBlocks > 0;
+}
+
+static AudioStream *createStream(int direction, const StreamConfig *config,
+                                 StreamEnqueueFn enqueue, void *deviceCtx)
+{
+    if (!config->blockFrames || !config->blockCount || !enqueue) {
+        return NULL;
+    }
+    AudioStream *stream = (AudioStream *)calloc(1, sizeof(AudioStream));
+    if (NULL == stream) {
+        return NULL;
+    }
+    stream->direction = direction;
+    stream->config = *config;
+    stream->enqueue = enqueue;
+    stream->deviceCtx = deviceCtx;
+
+    // the ring holds at least twice what the device has in flight
+    unsigned ringFrames = 2 * config->blockCount * config->blockFrames;
+    if (ringFrames < config->ringFrames) {
+        ringFrames = config->ringFrames;
+    }
+    stream->blocks = (short *)calloc(config->blockCount * config->blockFrames,
+                                     sizeof(short));
+    stream->blockFrames = (unsigned *)calloc(config->blockCount, sizeof(unsigned));
+    if (!stream->blocks || !stream->blockFrames || !initRing(&stream->ring, ringFrames) ||
+        sem_init(&stream->wake, 0, 0)) {
+        free(stream->ring.frames);
+        free(stream->blockFrames);
+        free(stream->blocks);
+        free(stream);
+        return NULL;
+    }
+    return stream;
+}
+
+AudioStream *createPlayStream(const StreamConfig *config, StreamSourceFn source,
+                              void *sourceCtx, StreamEnqueueFn enqueue,
+                              void *deviceCtx)
+{
+    if (NULL == source) {
+        return NULL;
+    }
+    AudioStream *stream = createStream(STREAM_PLAY, config, enqueue, deviceCtx);
+    if (stream) {
+        stream->source = source;
+        stream->ctx = sourceCtx;
+    }
+    return stream;
+}
+
+AudioStream *createRecordStream(const StreamConfig *config, StreamSinkFn sink,
+                                void *sinkCtx, StreamEnqueueFn enqueue,
+                                void *deviceCtx)
+{
+    if (NULL == sink) {
+        return NULL;
+    }
+    AudioStream *stream = createStream(STREAM_RECORD, config, enqueue, deviceCtx);
+    if (stream) {
+        stream->sink = sink;
+        stream->ctx = sinkCtx;
+    }
+    return stream;
+}
+
+int startStream(AudioStream *stream)
+{
+    void *(*worker)(void *) = recordWorker;
+    if (STREAM_PLAY == stream->direction) {
+        // the worker does not run yet: pre-fill from this thread
+        worker = fillPlayRing(stream) ? playWorker : NULL;
+    }
+    if (worker) {
+        if (pthread_create(&stream->worker, NULL, worker, stream)) {
+            return 0;
+        }
+        stream->workerRunning = 1;
+    }
+    while (stream->queuedBlocks < stream->config.blockCount) {
+        if (!queueBlock(stream)) {
+            break;
+        }
+    }
+    return stream->queuedBlocks > 0;
+}
+
+void stopStream(AudioStream *stream)
+{
+    if (!stream->workerRunning) {
+        return;
+    }
+    __atomic_store_n(&stream->stopping, 1, __ATOMIC_RELEASE);
+    sem_post(&stream->wake);
+    pthread_join(stream->worker, NULL);
+    stream->workerRunning = 0;
+}
+
+void destroyStream(AudioStream *stream)
+{
+    if (NULL == stream) {
+        return;
+    }
+    stopStream(stream);
+    sem_destroy(&stream->wake);
+    free(stream->ring.frames);
+    free(stream->blockFrames);
+    free(stream->blocks);
+    free(stream);
+}
+
+void getStreamStats(AudioStream *stream, StreamStats *stats)
+{
+    stats->frames = __atomic_load_n(&stream->stats.frames, __ATOMIC_RELAXED);
+    stats->xrunCount = __atomic_load_n(&stream->stats.xrunCount, __ATOMIC_RELAXED);
+    stats->xrunFrames = __atomic_load_n(&stream->stats.xrunFrames, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef NATIVE_AUDIO_AUDIO_STREAM_H
+#define NATIVE_AUDIO_AUDIO_STREAM_H
+
+#include <stdint.h>
+
+/*
+ * Streaming playback and capture over a buffer queue device, mono 16-bit.
+ *
+ *     play:   source() -> worker thread -> ring -> device blocks
+ *     record: device blocks -> ring -> worker thread -> sink()
+ *
+ * The device side rotates blockCount blocks of blockFrames frames and only
+ * copies between a block and a lock-free single producer / single consumer
+ * ring from its buffer queue callback. Producing (reading, decoding,
+ * converting, synthesizing) or consuming the audio happens ahead of time on a
+ * worker thread, so the stream length is unbounded while memory stays
+ * constant.
+ *   - play: when the ring runs dry the block is padded with silence and the
+ *     underrun counted
+ *   - record: the ring never overwrites audio the worker did not consume yet;
+ *     when it is full the captured frames that do not fit are dropped and
+ *     counted, and the worker is woken to catch up
+ */
+typedef struct AudioStream AudioStream;
+
+// queue one block on the device: returns non-zero on success
+typedef int (*StreamEnqueueFn)(void *ctx, short *block, unsigned frames);
+
+// play: write up to frames frames to dst; returns the count, 0 at the end
+typedef unsigned (*StreamSourceFn)(void *ctx, short *dst, unsigned frames);
+
+// record: take frames frames from src; returns 0 to end the stream
+typedef int (*StreamSinkFn)(void *ctx, const short *src, unsigned frames);
+
+typedef struct StreamConfig {
+    unsigned blockFrames;  // frames per device buffer
+    unsigned blockCount;   // device buffers in rotation
+    unsigned ringFrames;   // audio buffered between the device and the worker
+} StreamConfig;
+
+typedef struct StreamStats {
+    uint64_t frames;       // frames played or captured by the device
+    uint32_t xrunCount;    // play underruns / record overruns
+    uint64_t xrunFrames;   // silence played / captured frames dropped
+} StreamStats;
+
+AudioStream *createPlayStream(const StreamConfig *config, StreamSourceFn source,
+                              void *sourceCtx, StreamEnqueueFn enqueue,
+                              void *deviceCtx);
+AudioStream *createRecordStream(const StreamConfig *config, StreamSinkFn sink,
+                                void *sinkCtx, StreamEnqueueFn enqueue,
+                                void *deviceCtx);
+
+/*
+ * Start the worker and queue the first blocks on the device; a play stream
+ * pre-fills its ring first. The device must not call back before this
+ * returns: start (or un-pause) it right after. Returns 0 if nothing could be
+ * queued.
+ */
+int startStream(AudioStream *stream);
+
+/*
+ * To call from the device buffer queue callback, once per completed block.
+ * Returns 0 when the last block of an ended stream completed: the device can
+ * be stopped.
+ */
+int onStreamBlockDone(AudioStream *stream);
+
+// stop the worker; stop the device first so no callback runs any more
+void stopStream(AudioStream *stream);
+void destroyStream(AudioStream *stream);
+
+void getStreamStats(AudioStream *stream, StreamStats *stats);
+
+#endif  // NATIVE_AUDIO_AUDIO_STREAM_H
@@ -40,6 +40,9 @@
 #include <android/asset_manager.h>
 #include <android/asset_manager_jni.h>
 
+#include "audio_stream.h"
+#include "resampler.h"
+
 // pre-recorded sound clips, both are 8 kHz mono 16-bit signed little endian
 static const char hello[] =
 #include "hello_clip.h"
@@ -66,7 +69,6 @@ static SLMuteSoloItf bqPlayerMuteSolo;
 static SLVolumeItf bqPlayerVolume;
 static SLmilliHertz bqPlayerSampleRate = 0;
 static jint   bqPlayerBufSize = 0;
-static short *resampleBuf = NULL;
 // a mutext to guard against re-entrance to record & playback
 // as well as make recording and playing back to be mutually exclusive
 // this is to avoid crash at situations like:
@@ -107,10 +109,26 @@ static short sawtoothBuffer[SAWTOOTH_FRAMES];
 static short recorderBuffer[RECORDER_FRAMES];
 static unsigned recorderSize = 0;
 
-// pointer and size of the next player buffer to enqueue, and number of remaining buffers
-static short *nextBuffer;
-static unsigned nextSize;
-static int nextCount;
+// clip being played, looped clipCount times; read ahead by the player stream's worker
+static const short *clipData;
+static unsigned clipFrames;
+static unsigned clipPos;
+static int clipCount;
+// converts the clip to the player rate when they differ
+static Resampler *clipResampler = NULL;
+
+// the buffer queue player rotates PLAYER_BLOCK_COUNT blocks fed from a ring
+#define PLAYER_BLOCK_COUNT 4
+#define PLAYER_BLOCK_FRAMES_DEFAULT 1024
+#define PLAYER_RING_FRAMES 16384
+static AudioStream *playStream = NULL;
+
+// the recorder streams 20 ms blocks; the first RECORDER_FRAMES are kept for playback
+#define RECORDER_BLOCK_COUNT 4
+#define RECORDER_BLOCK_FRAMES 320
+#define RECORDER_RING_FRAMES 16000
+static AudioStream *recordStream = NULL;
+static unsigned recordedFrames;
 
 
 // synthesize a mono sawtooth wave and place it into a buffer (called automatically on load)
@@ -122,75 +140,74 @@ __attribute__((constructor)) static void onDlOpen(void)
     }
 }
 
-void releaseResampleBuf(void) {
-    if( 0 == bqPlayerSampleRate) {
-        /*
-         * we are not using fast path, so we were not creating buffers, nothing to do
-         */
-        return;
+/*
+ * Player stream source, on its worker thread: the next frames of the clip at the player
+ * rate; returns 0 once the clip (and the converter delay) is completely read
+ */
+static unsigned readClip(void *context, short *dst, unsigned frames)
+{
+    unsigned filled = 0;
+    while (filled < frames) {
+        const short *src = clipData + clipPos;
+        unsigned srcFrames = clipFrames - clipPos;
+        if (0 == srcFrames) {
+            if (--clipCount > 0) {
+                // gapless: the next loop follows in the same block
+                clipPos = 0;
+                continue;
+            }
+            if (NULL == clipResampler) {
+                break;
+            }
+            src = NULL;
+        }
+        unsigned count;
+        if (NULL == clipResampler) {
+            count = frames - filled < srcFrames ? frames - filled : srcFrames;
+            memcpy(dst + filled, src, count * sizeof(short));
+            srcFrames = count;
+        } else {
+            count = resample(clipResampler, src, &srcFrames, dst + filled, frames - filled);
+        }
+        filled += count;
+        if (NULL == src) {
+            if (0 == count) {
+                break;
+            }
+        } else {
+            clipPos += srcFrames;
+        }
     }
+    return filled;
+}
 
-    free(resampleBuf);
-    resampleBuf = NULL;
+static int enqueuePlayerBlock(void *context, short *block, unsigned frames)
+{
+    SLresult result;
+    result = (*bqPlayerBufferQueue)->Enqueue(bqPlayerBufferQueue, block,
+                                             frames * sizeof(short));
+    // the most likely other result is SL_RESULT_BUFFER_INSUFFICIENT,
+    // which would mean more blocks than the queue was created with
+    return SL_RESULT_SUCCESS == result;
 }
 
-/*
- * Only support up-sampling
- */
-short* createResampledBuf(uint32_t idx, uint32_t srcRate, unsigned *size) {
-    short  *src = NULL;
-    short  *workBuf;
-    int    upSampleRate;
-    int32_t srcSampleCount = 0;
+static int enqueueRecorderBlock(void *context, short *block, unsigned frames)
+{
+    SLresult result;
+    result = (*recorderBufferQueue)->Enqueue(recorderBufferQueue, block,
+                                             frames * sizeof(short));
+    return SL_RESULT_SUCCESS == result;
+}
 
-    if(0 == bqPlayerSampleRate) {
-        return NULL;
-    }
-    if(bqPlayerSampleRate % srcRate) {
-        /*
-         * simple up-sampling, must be divisible
-         */
-        return NULL;
-    }
-    upSampleRate = bqPlayerSampleRate / srcRate;
-
-    switch (idx) {
-        case 0:
-            return NULL;
-        case 1: // HELLO_CLIP
-            srcSampleCount = sizeof(hello) >> 1;
-            src = (short*)hello;
-            break;
-        case 2: // ANDROID_CLIP
-            srcSampleCount = sizeof(android) >> 1;
-            src = (short*) android;
-            break;
-        case 3: // SAWTOOTH_CLIP
-            srcSampleCount = SAWTOOTH_FRAMES;
-            src = sawtoothBuffer;
-            break;
-        case 4: // captured frames
-            srcSampleCount = recorderSize / sizeof(short);
-            src =  recorderBuffer;
-            break;
-        default:
-            assert(0);
-            return NULL;
-    }
-
-    resampleBuf = (short*) malloc((srcSampleCount * upSampleRate) << 1);
-    if(resampleBuf == NULL) {
-        return resampleBuf;
-    }
-    workBuf = resampleBuf;
-    for(int sample=0; sample < srcSampleCount; sample++) {
-        for(int dup = 0; dup  < upSampleRate; dup++) {
-            *workBuf++ = src[sample];
-        }
+// recorder stream sink, on its worker thread: keep the first RECORDER_FRAMES
+static int storeRecording(void *context, const short *src, unsigned frames)
+{
+    if (frames > RECORDER_FRAMES - recordedFrames) {
+        frames = RECORDER_FRAMES - recordedFrames;
     }
-
-    *size = (srcSampleCount * upSampleRate) << 1;     // sample format is 16 bit
-    return resampleBuf;
+    memcpy(recorderBuffer + recordedFrames, src, frames * sizeof(short));
+    recordedFrames += frames;
+    return recordedFrames < RECORDER_FRAMES;
 }
 
 // this callback handler is called every time a buffer finishes playing
@@ -198,19 +215,8 @@ void bqPlayerCallback(SLAndroidSimpleBufferQueueItf bq, void *context)
 {
     assert(bq == bqPlayerBufferQueue);
     assert(NULL == context);
-    // for streaming playback, replace this test by logic to find and fill the next buffer
-    if (--nextCount > 0 && NULL != nextBuffer && 0 != nextSize) {
-        SLresult result;
-        // enqueue another buffer
-        result = (*bqPlayerBufferQueue)->Enqueue(bqPlayerBufferQueue, nextBuffer, nextSize);
-        // the most likely other result is SL_RESULT_BUFFER_INSUFFICIENT,
-        // which for this code example would indicate a programming error
-        if (SL_RESULT_SUCCESS != result) {
-            pthread_mutex_unlock(&audioEngineLock);
-        }
-        (void)result;
-    } else {
-        releaseResampleBuf();
+    // refill the block that just finished from the stream; done once the last one played
+    if (!onStreamBlockDone(playStream)) {
         pthread_mutex_unlock(&audioEngineLock);
     }
 }
@@ -221,12 +227,14 @@ void bqRecorderCallback(SLAndroidSimpleBufferQueueItf bq, void *context)
 {
     assert(bq == recorderBufferQueue);
     assert(NULL == context);
-    // for streaming recording, here we would call Enqueue to give recorder the next buffer to fill
-    // but instead, this is a one-time buffer so we stop recording
+    // hand the block to the stream, which queues it again until the take is complete
+    if (onStreamBlockDone(recordStream)) {
+        return;
+    }
     SLresult result;
     result = (*recorderRecord)->SetRecordState(recorderRecord, SL_RECORDSTATE_STOPPED);
     if (SL_RESULT_SUCCESS == result) {
-        recorderSize = RECORDER_FRAMES * sizeof(short);
+        recorderSize = recordedFrames * sizeof(short);
     }
     pthread_mutex_unlock(&audioEngineLock);
 }
@@ -288,14 +296,15 @@ void Java_com_example_nativeaudio_NativeAudio_createBufferQueueAudioPlayer(JNIEn
     if (sampleRate >= 0 && bufSize >= 0 ) {
         bqPlayerSampleRate = sampleRate * 1000;
         /*
-         * device native buffer size is another factor to minimize audio latency, not used in this
-         * sample: we only play one giant buffer here
+         * device native buffer size is another factor to minimize audio latency: clips are
+         * streamed in blocks of this size
          */
         bqPlayerBufSize = bufSize;
     }
 
     // configure audio source
-    SLDataLocator_AndroidSimpleBufferQueue loc_bufq = {SL_DATALOCATOR_ANDROIDSIMPLEBUFFERQUEUE, 2};
+    SLDataLocator_AndroidSimpleBufferQueue loc_bufq = {SL_DATALOCATOR_ANDROIDSIMPLEBUFFERQUEUE,
+                                                       PLAYER_BLOCK_COUNT};
     SLDataFormat_PCM format_pcm = {SL_DATAFORMAT_PCM, 1, SL_SAMPLINGRATE_8,
         SL_PCMSAMPLEFORMAT_FIXED_16, SL_PCMSAMPLEFORMAT_FIXED_16,
         SL_SPEAKER_FRONT_CENTER, SL_BYTEORDER_LITTLEENDIAN};
@@ -631,62 +640,80 @@ jboolean Java_com_example_nativeaudio_NativeAudio_selectClip(JNIEnv* env, jclass
         // If we could not acquire audio engine lock, reject this request and client should re-try
         return JNI_FALSE;
     }
+    SLmilliHertz clipRate = SL_SAMPLINGRATE_8;
     switch (which) {
     case 0:     // CLIP_NONE
-        nextBuffer = (short *) NULL;
-        nextSize = 0;
+        clipData = NULL;
+        clipFrames = 0;
         break;
     case 1:     // CLIP_HELLO
-        nextBuffer = createResampledBuf(1, SL_SAMPLINGRATE_8, &nextSize);
-        if(!nextBuffer) {
-            nextBuffer = (short*)hello;
-            nextSize  = sizeof(hello);
-        }
+        clipData = (const short*)hello;
+        clipFrames = sizeof(hello) / sizeof(short);
         break;
     case 2:     // CLIP_ANDROID
-        nextBuffer = createResampledBuf(2, SL_SAMPLINGRATE_8, &nextSize);
-        if(!nextBuffer) {
-            nextBuffer = (short*)android;
-            nextSize  = sizeof(android);
-        }
+        clipData = (const short*)android;
+        clipFrames = sizeof(android) / sizeof(short);
         break;
     case 3:     // CLIP_SAWTOOTH
-        nextBuffer = createResampledBuf(3, SL_SAMPLINGRATE_8, &nextSize);
-        if(!nextBuffer) {
-            nextBuffer = (short*)sawtoothBuffer;
-            nextSize  = sizeof(sawtoothBuffer);
-        }
+        clipData = sawtoothBuffer;
+        clipFrames = SAWTOOTH_FRAMES;
         break;
     case 4:     // CLIP_PLAYBACK
-        nextBuffer = createResampledBuf(4, SL_SAMPLINGRATE_16, &nextSize);
-        // we recorded at 16 kHz, but are playing buffers at 8 Khz, so do a primitive down-sample
-        if(!nextBuffer) {
-            unsigned i;
-            for (i = 0; i < recorderSize; i += 2 * sizeof(short)) {
-                recorderBuffer[i >> 2] = recorderBuffer[i >> 1];
-            }
-            recorderSize >>= 1;
-            nextBuffer = recorderBuffer;
-            nextSize = recorderSize;
-        }
+        // we recorded at 16 kHz
+        clipData = recorderBuffer;
+        clipFrames = recorderSize / sizeof(short);
+        clipRate = SL_SAMPLINGRATE_16;
         break;
     default:
-        nextBuffer = NULL;
-        nextSize = 0;
+        clipData = NULL;
+        clipFrames = 0;
         break;
     }
-    nextCount = count;
-    if (nextSize > 0) {
-        // here we only enqueue one buffer because it is a long clip,
-        // but for streaming playback we would typically enqueue at least 2 buffers to start
-        SLresult result;
-        result = (*bqPlayerBufferQueue)->Enqueue(bqPlayerBufferQueue, nextBuffer, nextSize);
-        if (SL_RESULT_SUCCESS != result) {
+    clipPos = 0;
+    clipCount = count;
+
+    // the previous clip is over, its worker has ended
+    destroyStream(playStream);
+    playStream = NULL;
+    destroyResampler(clipResampler);
+    clipResampler = NULL;
+    if (0 == clipFrames) {
+        pthread_mutex_unlock(&audioEngineLock);
+        return JNI_TRUE;
+    }
+
+    // the player runs at the device rate on the fast path, at 8 kHz otherwise
+    SLmilliHertz playerRate = bqPlayerSampleRate ? bqPlayerSampleRate : SL_SAMPLINGRATE_8;
+    if (clipRate != playerRate) {
+        clipResampler = createResampler(clipRate, playerRate);
+        if (NULL == clipResampler) {
+            // played as is, the clip would come out at the wrong pitch
+            clipData = NULL;
+            clipFrames = 0;
             pthread_mutex_unlock(&audioEngineLock);
             return JNI_FALSE;
         }
-    } else {
+    }
+
+    StreamConfig config = {PLAYER_BLOCK_FRAMES_DEFAULT, PLAYER_BLOCK_COUNT,
+                           PLAYER_RING_FRAMES};
+    if (bqPlayerBufSize > 0) {
+        // one device buffer per block
+        config.blockFrames = (unsigned) bqPlayerBufSize;
+    }
+    playStream = createPlayStream(&config, readClip, NULL, enqueuePlayerBlock, NULL);
+
+    // no callback may come before the first blocks are all queued
+    SLresult result;
+    result = (*bqPlayerPlay)->SetPlayState(bqPlayerPlay, SL_PLAYSTATE_PAUSED);
+    assert(SL_RESULT_SUCCESS == result);
+    int started = NULL != playStream && startStream(playStream);
+    result = (*bqPlayerPlay)->SetPlayState(bqPlayerPlay, SL_PLAYSTATE_PLAYING);
+    assert(SL_RESULT_SUCCESS == result);
+    (void)result;
+    if (!started) {
         pthread_mutex_unlock(&audioEngineLock);
+        return JNI_FALSE;
     }
 
     return JNI_TRUE;
@@ -802,7 +829,8 @@ jboolean Java_com_example_nativeaudio_NativeAudio_createAudioRecorder(JNIEnv* en
     SLDataSource audioSrc = {&loc_dev, NULL};
 
     // configure audio sink
-    SLDataLocator_AndroidSimpleBufferQueue loc_bq = {SL_DATALOCATOR_ANDROIDSIMPLEBUFFERQUEUE, 2};
+    SLDataLocator_AndroidSimpleBufferQueue loc_bq = {SL_DATALOCATOR_ANDROIDSIMPLEBUFFERQUEUE,
+                                                     RECORDER_BLOCK_COUNT};
     SLDataFormat_PCM format_pcm = {SL_DATAFORMAT_PCM, 1, SL_SAMPLINGRATE_16,
         SL_PCMSAMPLEFORMAT_FIXED_16, SL_PCMSAMPLEFORMAT_FIXED_16,
         SL_SPEAKER_FRONT_CENTER, SL_BYTEORDER_LITTLEENDIAN};
@@ -863,15 +891,17 @@ void Java_com_example_nativeaudio_NativeAudio_startRecording(JNIEnv* env, jclass
 
     // the buffer is not valid for playback yet
     recorderSize = 0;
-
-    // enqueue an empty buffer to be filled by the recorder
-    // (for streaming recording, we would enqueue at least 2 empty buffers to start things off)
-    result = (*recorderBufferQueue)->Enqueue(recorderBufferQueue, recorderBuffer,
-            RECORDER_FRAMES * sizeof(short));
-    // the most likely other result is SL_RESULT_BUFFER_INSUFFICIENT,
-    // which for this code example would indicate a programming error
-    assert(SL_RESULT_SUCCESS == result);
-    (void)result;
+    recordedFrames = 0;
+
+    // queue empty blocks to be filled by the recorder, the stream keeps them rotating
+    destroyStream(recordStream);
+    StreamConfig config = {RECORDER_BLOCK_FRAMES, RECORDER_BLOCK_COUNT, RECORDER_RING_FRAMES};
+    recordStream = createRecordStream(&config, storeRecording, NULL, enqueueRecorderBlock,
+                                      NULL);
+    if (NULL == recordStream || !startStream(recordStream)) {
+        pthread_mutex_unlock(&audioEngineLock);
+        return;
+    }
 
     // start recording
     result = (*recorderRecord)->SetRecordState(recorderRecord, SL_RECORDSTATE_RECORDING);
@@ -894,6 +924,10 @@ void Java_com_example_nativeaudio_NativeAudio_shutdown(JNIEnv* env, jclass clazz
         bqPlayerMuteSolo = NULL;
         bqPlayerVolume = NULL;
     }
+    destroyStream(playStream);
+    playStream = NULL;
+    destroyResampler(clipResampler);
+    clipResampler = NULL;
 
     // destroy file descriptor audio player object, and invalidate all associated interfaces
     if (fdPlayerObject != NULL) {
@@ -922,6 +956,8 @@ void Java_com_example_nativeaudio_NativeAudio_shutdown(JNIEnv* env, jclass clazz
         recorderRecord = NULL;
         recorderBufferQueue = NULL;
     }
+    destroyStream(recordStream);
+    recordStream = NULL;
 
     // destroy output mix object, and invalidate all associated interfaces
     if (outputMixObject != NULL) {
@@ -0,0 +1,158 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+// nanosleep() with -std=c99 on glibc
+#define _POSIX_C_SOURCE 200112L
+
+#include "null_audio_device.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+struct NullAudioDevice {
+    NullDeviceCallback callback;
+    void *ctx;
+    unsigned periodInUs;
+
+    pthread_mutex_t lock;
+    pthread_cond_t queued;
+    unsigned *blockFrames;  // FIFO of the queued block sizes
+    unsigned maxBlocks;
+    unsigned head;
+    unsigned count;
+    int running;
+    pthread_t thread;
+    uint64_t frames;
+};
+
+static void *nullDeviceThread(void *arg)
+{
+    NullAudioDevice *device = (NullAudioDevice *)arg;
+    pthread_mutex_lock(&device->lock);
+    for (;;) {
+        while (device->running && 0 == device->count) {
+            pthread_cond_wait(&device->queued, &device->lock);
+        }
+        if (!device->running) {
+            break;
+        }
+        unsigned frames = device->blockFrames[device->head];
+        device->head = (device->head + 1) % device->maxBlocks;
+        device->count--;
+        pthread_mutex_unlock(&device->lock);
+
+        if (device->periodInUs) {
+            struct timespec period = {device->periodInUs / 1000000,
+                                      (device->periodInUs % 1000000) * 1000};
+            nanosleep(&period, NULL);
+        }
+        __atomic_store_n(&device->frames, device->frames + frames, __ATOMIC_RELAXED);
+        // the callback queues the next block, it must not run under the lock
+        device->callback(device->ctx);
+
+        pthread_mutex_lock(&device->lock);
+    }
+    pthread_mutex_unlock(&device->lock);
+    return NULL;
+}
+
+NullAudioDevice *createNullAudioDevice(unsigned maxBlocks, unsigned periodInUs,
+                                       NullDeviceCallback callback, void *ctx)
+{
+    if (!maxBlocks || !callback) {
+        return NULL;
+    }
+    NullAudioDevice *device = (NullAudioDevice *)calloc(1, sizeof(NullAudioDevice));
+    if (NULL == device) {
+        return NULL;
+    }
+    device->blockFrames = (unsigned *)calloc(maxBlocks, sizeof(unsigned));
+    if (NULL == device->blockFrames) {
+        free(device);
+        return NULL;
+    }
+    device->callback = callback;
+    device->ctx = ctx;
+    device->periodInUs = periodInUs;
+    device->maxBlocks = maxBlocks;
+    pthread_mutex_init(&device->lock, NULL);
+    pthread_cond_init(&device->queued, NULL);
+    return device;
+}
+
+void destroyNullAudioDevice(NullAudioDevice *device)
+{
+    if (NULL == device) {
+        return;
+    }
+    stopNullAudioDevice(device);
+    pthread_cond_destroy(&device->queued);
+    pthread_mutex_destroy(&device->lock);
+    free(device->blockFrames);
+    free(device);
+}
+
+int nullDeviceEnqueue(void *ctx, short *block, unsigned frames)
+{
+    NullAudioDevice *device = (NullAudioDevice *)ctx;
+    int queued = 0;
+    (void)block;
+    pthread_mutex_lock(&device->lock);
+    if (device->count < device->maxBlocks) {
+        device->blockFrames[(device->head + device->count) % device->maxBlocks] = frames;
+        device->count++;
+        queued = 1;
+        pthread_cond_signal(&device->queued);
+    }
+    pthread_mutex_unlock(&device->lock);
+    return queued;
+}
+
+int startNullAudioDevice(NullAudioDevice *device)
+{
+    pthread_mutex_lock(&device->lock);
+    int running = device->running;
+    device->running = 1;
+    pthread_mutex_unlock(&device->lock);
+    if (running) {
+        return 1;
+    }
+    if (pthread_create(&device->thread, NULL, nullDeviceThread, device)) {
+        device->running = 0;
+        return 0;
+    }
+    return 1;
+}
+
+void stopNullAudioDevice(NullAudioDevice *device)
+{
+    pthread_mutex_lock(&device->lock);
+    int running = device->running;
+    device->running = 0;
+    device->count = 0;
+    pthread_cond_signal(&device->queued);
+    pthread_mutex_unlock(&device->lock);
+    if (running) {
+        pthread_join(device->thread, NULL);
+    }
+}
+
+uint64_t getNullDeviceFrames(NullAudioDevice *device)
+{
+    return __atomic_load_n(&device->frames, __ATOMIC_RELAXED);
+}
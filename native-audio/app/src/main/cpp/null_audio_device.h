@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef NATIVE_AUDIO_NULL_AUDIO_DEVICE_H
+#define NATIVE_AUDIO_NULL_AUDIO_DEVICE_H
+
+#include <stdint.h>
+
+/*
+ * Buffer queue device without audio hardware, for running audio_stream.h on
+ * any POSIX system (e.g. a Linux host) to measure throughput or check
+ * continuity. Its thread completes the queued blocks in order and calls back
+ * like the OpenSL ES buffer queue callback does:
+ *   - periodInUs == 0: every block completes as soon as it is queued; a play
+ *     stream then mostly underruns, and (frames - xrunFrames) over the run
+ *     time is the throughput of its source
+ *   - otherwise one block completes every periodInUs, like a real device
+ * Played blocks are discarded; record blocks are handed back as they were.
+ */
+typedef struct NullAudioDevice NullAudioDevice;
+
+typedef void (*NullDeviceCallback)(void *ctx);
+
+NullAudioDevice *createNullAudioDevice(unsigned maxBlocks, unsigned periodInUs,
+                                       NullDeviceCallback callback, void *ctx);
+void destroyNullAudioDevice(NullAudioDevice *device);
+
+// a StreamEnqueueFn: device is the NullAudioDevice
+int nullDeviceEnqueue(void *device, short *block, unsigned frames);
+
+int startNullAudioDevice(NullAudioDevice *device);
+// not from the callback
+void stopNullAudioDevice(NullAudioDevice *device);
+
+uint64_t getNullDeviceFrames(NullAudioDevice *device);
+
+#endif  // NATIVE_AUDIO_NULL_AUDIO_DEVICE_H
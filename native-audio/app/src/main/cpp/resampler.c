@@ -0,0 +1,376 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "resampler.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define RESAMPLER_NEON 1
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#define RESAMPLER_SSE 1
+#endif
+
+/*
+ * Filter design: Kaiser windowed sinc with RESAMPLER_HALF_TAPS zero
+ * crossings on each side, cut off at RESAMPLER_CUTOFF of the lower of the two
+ * Nyquist rates. When down-sampling the filter is stretched by the decimation
+ * factor so the transition band stays as narrow: its cost per output frame
+ * grows with the factor, RESAMPLER_MAX_DECIMATION bounds it (16 covers
+ * 192 kHz -> 12 kHz, 48 kHz -> 3 kHz).
+ */
+#define RESAMPLER_HALF_TAPS 32
+#define RESAMPLER_CUTOFF 0.9
+#define RESAMPLER_KAISER_BETA 8.0
+#define RESAMPLER_MAX_PHASES 1024
+#define RESAMPLER_MAX_DECIMATION 16
+
+// input frames converted per refill of the history
+#define RESAMPLER_CHUNK_FRAMES 256
+
+#define RESAMPLER_PI 3.14159265358979323846
+
+typedef struct CoefTable {
+    uint32_t phases;  // L
+    uint32_t step;    // M
+    unsigned taps;    // per phase, a multiple of 4
+    float *coefs;     // [phases][taps]
+    int refs;
+} CoefTable;
+
+/*
+ * Phase tables of the ratios in use, so switching between clips of the same
+ * rate does not redesign the filter
+ */
+#define COEF_CACHE_SIZE 4
+static CoefTable coefCache[COEF_CACHE_SIZE];
+static pthread_mutex_t coefCacheLock = PTHREAD_MUTEX_INITIALIZER;
+
+struct Resampler {
+    CoefTable *table;
+    uint32_t phase;  // position of the next output between 2 inputs, in 1/L
+    unsigned pos;    // first history frame under the filter
+    unsigned count;  // history frames held
+    unsigned capacity;
+    unsigned flushFrames;  // zeros still to feed after the end of the stream
+    int draining;
+    float *history;
+};
+
+static uint32_t gcd(uint32_t a, uint32_t b)
+{
+    while (b) {
+        uint32_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+// zeroth order modified Bessel function of the first kind
+static double besselI0(double x)
+{
+    double sum = 1.0, term = 1.0;
+    for (int k = 1; k < 32; k++) {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+        if (term < sum * 1e-12) {
+            break;
+        }
+    }
+    return sum;
+}
+
+static int buildCoefTable(CoefTable *table, uint32_t phases, uint32_t step)
+{
+    unsigned halfTaps = RESAMPLER_HALF_TAPS;
+    double cutoff = 0.5 * RESAMPLER_CUTOFF;  // in cycles per input frame
+    if (step > phases) {
+        halfTaps *= (step + phases - 1) / phases;
+        cutoff = cutoff * phases / step;
+    }
+    unsigned taps = 2 * halfTaps;
+    float *coefs = (float *)malloc(sizeof(float) * phases * taps);
+    if (!coefs) {
+        return 0;
+    }
+
+    double norm = 1.0 / besselI0(RESAMPLER_KAISER_BETA);
+    for (uint32_t p = 0; p < phases; p++) {
+        float *h = coefs + p * taps;
+        double sum = 0.0;
+        for (unsigned j = 0; j < taps; j++) {
+            // distance from tap j to the output position, in input frames
+            double t = (double)p / phases + (double)halfTaps - 1.0 - j;
+            double x = t / halfTaps;
+            double window = 0.0;
+            if (x > -1.0 && x < 1.0) {
+                window = besselI0(RESAMPLER_KAISER_BETA * sqrt(1.0 - x * x)) *
+                         norm;
+            }
+            double arg = 2.0 * RESAMPLER_PI * cutoff * t;
+            double sinc = (t == 0.0) ? 1.0 : sin(arg) / arg;
+            h[j] = (float)(2.0 * cutoff * sinc * window);
+            sum += h[j];
+        }
+        // unity gain at DC for every phase
+        for (unsigned j = 0; j < taps; j++) {
+            h[j] = (float)(h[j] / sum);
+        }
+    }
+
+    table->phases = phases;
+    table->step = step;
+    table->taps = taps;
+    table->coefs = coefs;
+    table->refs = 1;
+    return 1;
+}
+
+static CoefTable *acquireCoefTable(uint32_t phases, uint32_t step)
+{
+    CoefTable *table = NULL;
+    pthread_mutex_lock(&coefCacheLock);
+    for (int i = 0; i < COEF_CACHE_SIZE; i++) {
+        if (coefCache[i].coefs && coefCache[i].phases == phases &&
+            coefCache[i].step == step) {
+            coefCache[i].refs++;
+            table = &coefCache[i];
+            break;
+        }
+    }
+    if (!table) {
+        // an empty slot, or else one nobody uses any more
+        for (int i = 0; i < COEF_CACHE_SIZE && !table; i++) {
+            if (!coefCache[i].coefs) {
+                table = &coefCache[i];
+            }
+        }
+        for (int i = 0; i < COEF_CACHE_SIZE && !table; i++) {
+            if (!coefCache[i].refs) {
+                free(coefCache[i].coefs);
+                coefCache[i].coefs = NULL;
+                table = &coefCache[i];
+            }
+        }
+        if (!table) {
+            // all slots busy: a private table, freed with its resampler
+            table = (CoefTable *)calloc(1, sizeof(CoefTable));
+        }
+        if (table && !buildCoefTable(table, phases, step)) {
+            if (table < coefCache || table >= coefCache + COEF_CACHE_SIZE) {
+                free(table);
+            }
+            table = NULL;
+        }
+    }
+    pthread_mutex_unlock(&coefCacheLock);
+    return table;
+}
+
+static void releaseCoefTable(CoefTable *table)
+{
+    pthread_mutex_lock(&coefCacheLock);
+    table->refs--;
+    if (table < coefCache || table >= coefCache + COEF_CACHE_SIZE) {
+        free(table->coefs);
+        free(table);
+    }
+    pthread_mutex_unlock(&coefCacheLock);
+}
+
+/*
+ * Inner loop: taps is a multiple of 4; loads are unaligned since the
+ * history window slides one frame at a time
+ */
+static float dotProduct(const float *x, const float *h, unsigned taps)
+{
+#if defined(RESAMPLER_NEON)
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+    unsigned i = 0;
+    for (; i + 8 <= taps; i += 8) {
+        acc0 = vmlaq_f32(acc0, vld1q_f32(x + i), vld1q_f32(h + i));
+        acc1 = vmlaq_f32(acc1, vld1q_f32(x + i + 4), vld1q_f32(h + i + 4));
+    }
+    for (; i < taps; i += 4) {
+        acc0 = vmlaq_f32(acc0, vld1q_f32(x + i), vld1q_f32(h + i));
+    }
+    acc0 = vaddq_f32(acc0, acc1);
+    float32x2_t sum = vadd_f32(vget_low_f32(acc0), vget_high_f32(acc0));
+    return vget_lane_f32(vpadd_f32(sum, sum), 0);
+#elif defined(RESAMPLER_SSE)
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+    unsigned i = 0;
+    for (; i + 8 <= taps; i += 8) {
+        acc0 = _mm_add_ps(acc0,
+                          _mm_mul_ps(_mm_loadu_ps(x + i), _mm_loadu_ps(h + i)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(x + i + 4),
+                                           _mm_loadu_ps(h + i + 4)));
+    }
+    for (; i < taps; i += 4) {
+        acc0 = _mm_add_ps(acc0,
+                          _mm_mul_ps(_mm_loadu_ps(x + i), _mm_loadu_ps(h + i)));
+    }
+    acc0 = _mm_add_ps(acc0, acc1);
+    acc0 = _mm_add_ps(acc0, _mm_movehl_ps(acc0, acc0));
+    acc0 = _mm_add_ss(acc0, _mm_shuffle_ps(acc0, acc0, 1));
+    return _mm_cvtss_f32(acc0);
+#else
+    float acc[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+    for (unsigned i = 0; i < taps; i += 4) {
+        acc[0] += x[i] * h[i];
+        acc[1] += x[i + 1] * h[i + 1];
+        acc[2] += x[i + 2] * h[i + 2];
+        acc[3] += x[i + 3] * h[i + 3];
+    }
+    return (acc[0] + acc[1]) + (acc[2] + acc[3]);
+#endif
+}
+
+static short toSample(float value)
+{
+    if (value >= 32767.0f) {
+        return 32767;
+    }
+    if (value <= -32768.0f) {
+        return -32768;
+    }
+    return (short)lrintf(value);
+}
+
+Resampler *createResampler(uint32_t srcRate, uint32_t dstRate)
+{
+    if (!srcRate || !dstRate) {
+        return NULL;
+    }
+    uint32_t div = gcd(srcRate, dstRate);
+    uint32_t phases = dstRate / div;
+    uint32_t step = srcRate / div;
+    if (phases > RESAMPLER_MAX_PHASES ||
+        step > phases * RESAMPLER_MAX_DECIMATION) {
+        return NULL;
+    }
+
+    Resampler *resampler = (Resampler *)calloc(1, sizeof(Resampler));
+    if (!resampler) {
+        return NULL;
+    }
+    resampler->table = acquireCoefTable(phases, step);
+    if (!resampler->table) {
+        free(resampler);
+        return NULL;
+    }
+    resampler->capacity = resampler->table->taps + RESAMPLER_CHUNK_FRAMES;
+    resampler->history = (float *)malloc(sizeof(float) * resampler->capacity);
+    if (!resampler->history) {
+        destroyResampler(resampler);
+        return NULL;
+    }
+    resetResampler(resampler);
+    return resampler;
+}
+
+void destroyResampler(Resampler *resampler)
+{
+    if (!resampler) {
+        return;
+    }
+    releaseCoefTable(resampler->table);
+    free(resampler->history);
+    free(resampler);
+}
+
+void resetResampler(Resampler *resampler)
+{
+    // half a filter of silence, so output frame 0 lines up with input frame 0
+    unsigned halfTaps = resampler->table->taps / 2;
+    memset(resampler->history, 0, sizeof(float) * (halfTaps - 1));
+    resampler->count = halfTaps - 1;
+    resampler->pos = 0;
+    resampler->phase = 0;
+    resampler->flushFrames = 0;
+    resampler->draining = 0;
+}
+
+unsigned resample(Resampler *resampler, const short *src, unsigned *srcFrames,
+                  short *dst, unsigned dstFrames)
+{
+    const CoefTable *table = resampler->table;
+    unsigned taps = table->taps;
+    unsigned avail = src ? *srcFrames : 0;
+    unsigned consumed = 0;
+    unsigned produced = 0;
+
+    if (!src && !resampler->draining) {
+        // the last input frames need half a filter of what follows them
+        resampler->draining = 1;
+        resampler->flushFrames = taps / 2;
+    }
+
+    while (produced < dstFrames) {
+        if (resampler->pos + taps > resampler->count) {
+            unsigned frames = src ? avail - consumed : resampler->flushFrames;
+            if (!frames) {
+                break;
+            }
+            if (resampler->count == resampler->capacity) {
+                resampler->count -= resampler->pos;
+                memmove(resampler->history,
+                        resampler->history + resampler->pos,
+                        sizeof(float) * resampler->count);
+                resampler->pos = 0;
+            }
+            if (frames > resampler->capacity - resampler->count) {
+                frames = resampler->capacity - resampler->count;
+            }
+            float *history = resampler->history + resampler->count;
+            if (src) {
+                for (unsigned i = 0; i < frames; i++) {
+                    history[i] = src[consumed + i];
+                }
+                consumed += frames;
+            } else {
+                memset(history, 0, sizeof(float) * frames);
+                resampler->flushFrames -= frames;
+            }
+            resampler->count += frames;
+            continue;
+        }
+
+        const float *h = table->coefs + resampler->phase * taps;
+        dst[produced++] =
+            toSample(dotProduct(resampler->history + resampler->pos, h, taps));
+
+        resampler->phase += table->step;
+        while (resampler->phase >= table->phases) {
+            resampler->phase -= table->phases;
+            resampler->pos++;
+        }
+    }
+
+    if (srcFrames) {
+        *srcFrames = consumed;
+    }
+    return produced;
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef NATIVE_AUDIO_RESAMPLER_H
+#define NATIVE_AUDIO_RESAMPLER_H
+
+#include <stdint.h>
+
+/*
+ * Streaming polyphase sample rate converter, mono 16-bit.
+ *
+ * The rate ratio is reduced to L/M (44.1 kHz -> 48 kHz is 160/147) and the
+ * output is computed with a windowed-sinc filter split into L phases, so each
+ * output sample costs one short dot product. Phase tables are built once per
+ * ratio and shared by every resampler using that ratio.
+ *
+ * resample() is pull driven: it produces at most the requested number of
+ * frames and consumes only the input it needs, so a buffer queue callback can
+ * fill exactly one device buffer at a time.
+ */
+typedef struct Resampler Resampler;
+
+/*
+ * rates share their unit: Hz or milliHz (SLmilliHertz) both work
+ * returns NULL if a rate is 0 or the ratio is out of the supported range:
+ * dstRate / srcRate reduced to at most 1024 in its numerator, and srcRate at
+ * most 16 times dstRate
+ */
+Resampler *createResampler(uint32_t srcRate, uint32_t dstRate);
+void destroyResampler(Resampler *resampler);
+
+// forget the input history, to start an unrelated stream
+void resetResampler(Resampler *resampler);
+
+/*
+ * Produce up to dstFrames frames into dst.
+ *   src/srcFrames: input available; *srcFrames is updated to the number of
+ *                  frames consumed. Pass src == NULL at the end of the stream
+ *                  to drain the filter delay.
+ *   returns the number of frames written to dst; 0 with src == NULL means the
+ *   stream is completely drained
+ */
+unsigned resample(Resampler *resampler, const short *src, unsigned *srcFrames,
+                  short *dst, unsigned dstFrames);
+
+#endif  // NATIVE_AUDIO_RESAMPLER_H
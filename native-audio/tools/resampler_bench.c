@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * Throughput of resampler.h at the ratios the app and devices use.
+ *
+ *    resampler_bench [--seconds 1] [--block 240]
+ *
+ * Converts a second of noise over and over, --block output frames per
+ * resample() call as a buffer queue callback asks, for --seconds per ratio,
+ * and prints the best of a few runs: ns per output frame, output frames per
+ * second, and how many times faster than real time.
+ */
+
+// clock_gettime() with -std=c99 on glibc
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "resampler.h"
+
+#define BENCH_RUNS 5
+
+static const unsigned kRatios[][2] = {
+    {8000, 44100},  {8000, 48000},  {16000, 44100}, {16000, 48000},
+    {44100, 48000}, {48000, 44100}, {48000, 16000}, {192000, 12000},
+};
+
+static double nowInSeconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/*
+ * Output frames of srcRate -> dstRate per second, best of BENCH_RUNS runs
+ * of seconds / BENCH_RUNS each; 0 if the ratio is not supported
+ */
+static double measure(unsigned srcRate, unsigned dstRate, unsigned block, double seconds)
+{
+    Resampler *resampler = createResampler(srcRate, dstRate);
+    if (NULL == resampler) {
+        return 0.0;
+    }
+    unsigned srcFrames = srcRate;
+    short *src = (short *)malloc(sizeof(short) * srcFrames);
+    short *dst = (short *)malloc(sizeof(short) * block);
+    unsigned seed = 1;
+    for (unsigned i = 0; i < srcFrames; i++) {
+        seed = seed * 1103515245 + 12345;
+        src[i] = (short)(seed >> 16);
+    }
+
+    double best = 0.0;
+    for (int run = 0; run < BENCH_RUNS; run++) {
+        uint64_t frames = 0;
+        unsigned pos = 0;
+        double start = nowInSeconds(), now;
+        do {
+            for (int call = 0; call < 64; call++) {
+                unsigned avail = srcFrames - pos;
+                frames += resample(resampler, src + pos, &avail, dst, block);
+                pos += avail;
+                if (pos == srcFrames) {
+                    pos = 0;
+                }
+            }
+            now = nowInSeconds();
+        } while (now - start < seconds / BENCH_RUNS);
+        double rate = frames / (now - start);
+        if (rate > best) {
+            best = rate;
+        }
+    }
+    free(src);
+    free(dst);
+    destroyResampler(resampler);
+    return best;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [--seconds s] [--block frames]\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+    double seconds = 1.0;
+    unsigned block = 240;
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+            return 2;
+        }
+        const char *value = argv[++i];
+        if (!strcmp(arg, "--seconds")) {
+            seconds = atof(value);
+        } else if (!strcmp(arg, "--block")) {
+            block = (unsigned)atoi(value);
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (seconds <= 0.0 || !block) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    printf("%u output frames per call\n", block);
+    for (unsigned r = 0; r < sizeof(kRatios) / sizeof(kRatios[0]); r++) {
+        unsigned srcRate = kRatios[r][0], dstRate = kRatios[r][1];
+        double framesPerSecond = measure(srcRate, dstRate, block, seconds);
+        if (framesPerSecond <= 0.0) {
+            fprintf(stderr, "%u -> %u Hz is not supported\n", srcRate, dstRate);
+            return 1;
+        }
+        printf("%6u -> %6u Hz: %7.1f ns/frame, %6.2f M frames/s, %7.0fx real time\n",
+               srcRate, dstRate, 1e9 / framesPerSecond, framesPerSecond / 1e6,
+               framesPerSecond / dstRate);
+    }
+    return 0;
+}
@@ -0,0 +1,314 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * Quality of resampler.h at every ratio between the rates Android devices
+ * and the clips of the app run at.
+ *
+ *    resampler_test [--min-snr 80] [--min-rejection 80]
+ *
+ * For every pair of rates createResampler() takes:
+ *   - SNR: an exponential sine sweep over the passband (up to 0.8 of the
+ *     lower Nyquist rate) is converted in output blocks of varying size,
+ *     and compared with the same sweep computed at the output rate; the
+ *     output has to line up with the input, so a delay shows up as noise.
+ *   - stopband rejection: when up-sampling, the power of the images above
+ *     the input Nyquist rate next to a passband tone, from an FFT of the
+ *     output; when down-sampling, the output power of tones between the
+ *     output and the input Nyquist rate, which must not alias back.
+ * Pairs out of the supported range have to be refused, the ones the app
+ * converts (its 8 and 16 kHz clips to any device rate) have to be taken.
+ * The exit status is 1 when a pair is below --min-snr or --min-rejection
+ * dB, or a conversion the app needs is refused.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "resampler.h"
+
+#define TEST_PI 3.14159265358979323846
+#define TEST_AMPLITUDE 16384.0       // -6 dBFS
+#define TEST_SWEEP_SECONDS 0.5
+#define TEST_MARGIN_SECONDS 0.02     // longer than the longest filter
+#define TEST_FFT_SIZE 8192
+#define TEST_TONE_COUNT 3
+
+static const unsigned kRates[] = {8000,  11025, 16000, 22050, 24000, 32000,
+                                  44100, 48000, 88200, 96000, 192000};
+#define RATE_COUNT (sizeof(kRates) / sizeof(kRates[0]))
+
+static int neededByApp(unsigned srcRate)
+{
+    return srcRate == 8000 || srcRate == 16000;
+}
+
+/*
+ * Convert srcFrames of src into at most dstCapacity frames of dst, in
+ * output blocks of changing sizes the way buffer queue callbacks ask, and
+ * drain the filter at the end
+ */
+static unsigned convert(Resampler *resampler, const short *src, unsigned srcFrames,
+                        short *dst, unsigned dstCapacity)
+{
+    static const unsigned kBlocks[] = {1, 7, 240, 441, 1024};
+    unsigned consumed = 0, produced = 0, block = 0;
+    resetResampler(resampler);
+    while (produced < dstCapacity) {
+        unsigned want = kBlocks[block++ % (sizeof(kBlocks) / sizeof(kBlocks[0]))];
+        if (want > dstCapacity - produced) {
+            want = dstCapacity - produced;
+        }
+        const short *input = consumed < srcFrames ? src + consumed : NULL;
+        unsigned frames = srcFrames - consumed;
+        unsigned got = resample(resampler, input, &frames, dst + produced, want);
+        if (input) {
+            consumed += frames;
+        } else if (!got) {
+            break;
+        }
+        produced += got;
+    }
+    return produced;
+}
+
+// phase of an exponential sweep from f0 to f1 Hz over seconds, at time t
+static double sweepPhase(double f0, double f1, double seconds, double t)
+{
+    double rate = log(f1 / f0) / seconds;
+    return 2.0 * TEST_PI * f0 * (exp(rate * t) - 1.0) / rate;
+}
+
+static double measureSnr(Resampler *resampler, unsigned srcRate, unsigned dstRate)
+{
+    double lowerNyquist = 0.5 * (srcRate < dstRate ? srcRate : dstRate);
+    double f0 = 20.0, f1 = 0.8 * lowerNyquist;
+    unsigned srcFrames = (unsigned)(TEST_SWEEP_SECONDS * srcRate);
+    unsigned dstFrames = (unsigned)((double)srcFrames * dstRate / srcRate);
+    short *src = (short *)malloc(sizeof(short) * srcFrames);
+    short *dst = (short *)malloc(sizeof(short) * dstFrames);
+    for (unsigned i = 0; i < srcFrames; i++) {
+        double t = (double)i / srcRate;
+        src[i] = (short)lrint(TEST_AMPLITUDE *
+                              sin(sweepPhase(f0, f1, TEST_SWEEP_SECONDS, t)));
+    }
+    unsigned produced = convert(resampler, src, srcFrames, dst, dstFrames);
+
+    // away from both ends, where the filter runs over the edge of the sweep
+    unsigned margin = (unsigned)(TEST_MARGIN_SECONDS * dstRate);
+    double signal = 0.0, noise = 0.0;
+    for (unsigned i = margin; i + margin < produced; i++) {
+        double t = (double)i / dstRate;
+        double expected = TEST_AMPLITUDE * sin(sweepPhase(f0, f1, TEST_SWEEP_SECONDS, t));
+        signal += expected * expected;
+        noise += (dst[i] - expected) * (dst[i] - expected);
+    }
+    free(src);
+    free(dst);
+    if (produced < dstFrames) {
+        fprintf(stderr, "%u -> %u Hz: %u of %u frames\n", srcRate, dstRate,
+                produced, dstFrames);
+        return 0.0;
+    }
+    return 10.0 * log10(signal / (noise > 0.0 ? noise : 1e-9));
+}
+
+// in place radix 2 FFT of TEST_FFT_SIZE points
+static void fft(double *re, double *im)
+{
+    unsigned n = TEST_FFT_SIZE;
+    for (unsigned i = 1, j = 0; i < n; i++) {
+        unsigned bit = n >> 1;
+        for (; j & bit; bit >>= 1) {
+            j ^= bit;
+        }
+        j |= bit;
+        if (i < j) {
+            double t = re[i]; re[i] = re[j]; re[j] = t;
+            t = im[i]; im[i] = im[j]; im[j] = t;
+        }
+    }
+    for (unsigned len = 2; len <= n; len <<= 1) {
+        double angle = -2.0 * TEST_PI / len;
+        for (unsigned i = 0; i < n; i += len) {
+            for (unsigned k = 0; k < len / 2; k++) {
+                double wr = cos(angle * k), wi = sin(angle * k);
+                double *ar = re + i + k, *ai = im + i + k;
+                double *br = ar + len / 2, *bi = ai + len / 2;
+                double tr = *br * wr - *bi * wi, ti = *br * wi + *bi * wr;
+                *br = *ar - tr;
+                *bi = *ai - ti;
+                *ar += tr;
+                *ai += ti;
+            }
+        }
+    }
+}
+
+/*
+ * A tone of hz at srcRate converted; fills spectrum[] with the power of
+ * TEST_FFT_SIZE / 2 bins of the output (Blackman-Harris window, its side
+ * lobes are below the noise floor of 16 bit samples), or returns the mean
+ * output power over the steady part if spectrum is NULL
+ */
+static double convertTone(Resampler *resampler, unsigned srcRate, unsigned dstRate,
+                          double hz, double *spectrum)
+{
+    unsigned margin = (unsigned)(TEST_MARGIN_SECONDS * dstRate);
+    unsigned dstFrames = TEST_FFT_SIZE + 2 * margin;
+    unsigned srcFrames = (unsigned)((double)dstFrames * srcRate / dstRate) + 1;
+    short *src = (short *)malloc(sizeof(short) * srcFrames);
+    short *dst = (short *)malloc(sizeof(short) * dstFrames);
+    for (unsigned i = 0; i < srcFrames; i++) {
+        src[i] = (short)lrint(TEST_AMPLITUDE * sin(2.0 * TEST_PI * hz * i / srcRate));
+    }
+    unsigned produced = convert(resampler, src, srcFrames, dst, dstFrames);
+    double power = 0.0;
+    if (!spectrum) {
+        for (unsigned i = margin; i < margin + TEST_FFT_SIZE && i < produced; i++) {
+            power += (double)dst[i] * dst[i];
+        }
+        power /= TEST_FFT_SIZE;
+    } else {
+        double *re = (double *)calloc(TEST_FFT_SIZE, sizeof(double));
+        double *im = (double *)calloc(TEST_FFT_SIZE, sizeof(double));
+        for (unsigned i = 0; i < TEST_FFT_SIZE && margin + i < produced; i++) {
+            double x = 2.0 * TEST_PI * i / TEST_FFT_SIZE;
+            double window = 0.35875 - 0.48829 * cos(x) + 0.14128 * cos(2 * x) -
+                            0.01168 * cos(3 * x);
+            re[i] = dst[margin + i] * window;
+        }
+        fft(re, im);
+        for (unsigned k = 0; k < TEST_FFT_SIZE / 2; k++) {
+            spectrum[k] = re[k] * re[k] + im[k] * im[k];
+        }
+        free(re);
+        free(im);
+    }
+    free(src);
+    free(dst);
+    return power;
+}
+
+/*
+ * Worst rejection in dB over TEST_TONE_COUNT tones: of the images against
+ * the tone when up-sampling, of the output against the input power of a
+ * stopband tone when down-sampling
+ */
+static double measureRejection(Resampler *resampler, unsigned srcRate, unsigned dstRate)
+{
+    double worst = 1e9;
+    double srcNyquist = 0.5 * srcRate, dstNyquist = 0.5 * dstRate;
+    for (int tone = 0; tone < TEST_TONE_COUNT; tone++) {
+        double rejection;
+        if (dstRate > srcRate) {
+            static double spectrum[TEST_FFT_SIZE / 2];
+            double hz = srcNyquist * (0.1 + 0.35 * tone);
+            convertTone(resampler, srcRate, dstRate, hz, spectrum);
+            unsigned toneBin = (unsigned)(hz * TEST_FFT_SIZE / dstRate + 0.5);
+            unsigned imageBin = (unsigned)(srcNyquist * TEST_FFT_SIZE / dstRate) + 1;
+            double signal = 0.0, images = 0.0;
+            for (unsigned k = 0; k < TEST_FFT_SIZE / 2; k++) {
+                if (k + 8 >= toneBin && k <= toneBin + 8) {
+                    signal += spectrum[k];
+                } else if (k >= imageBin) {
+                    images += spectrum[k];
+                }
+            }
+            rejection = 10.0 * log10(signal / (images > 0.0 ? images : 1e-9));
+        } else {
+            // from just past the transition band up to the input Nyquist rate
+            double low = 1.05 * dstNyquist, high = 0.98 * srcNyquist;
+            double hz = low + (high - low) * tone / (TEST_TONE_COUNT - 1);
+            double power = convertTone(resampler, srcRate, dstRate, hz, NULL);
+            double input = TEST_AMPLITUDE * TEST_AMPLITUDE / 2.0;
+            rejection = 10.0 * log10(input / (power > 0.0 ? power : 1e-9));
+        }
+        if (rejection < worst) {
+            worst = rejection;
+        }
+    }
+    return worst;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [--min-snr db] [--min-rejection db]\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+    double minSnr = 80.0, minRejection = 80.0;
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+            return 2;
+        }
+        const char *value = argv[++i];
+        if (!strcmp(arg, "--min-snr")) {
+            minSnr = atof(value);
+        } else if (!strcmp(arg, "--min-rejection")) {
+            minRejection = atof(value);
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    int failures = 0, pairs = 0, refused = 0;
+    double worstSnr = 1e9, worstRejection = 1e9;
+    for (unsigned s = 0; s < RATE_COUNT; s++) {
+        for (unsigned d = 0; d < RATE_COUNT; d++) {
+            unsigned srcRate = kRates[s], dstRate = kRates[d];
+            if (srcRate == dstRate) {
+                continue;
+            }
+            Resampler *resampler = createResampler(srcRate, dstRate);
+            if (NULL == resampler) {
+                if (neededByApp(srcRate)) {
+                    fprintf(stderr, "%u -> %u Hz refused, the app needs it\n",
+                            srcRate, dstRate);
+                    failures++;
+                }
+                refused++;
+                continue;
+            }
+            double snr = measureSnr(resampler, srcRate, dstRate);
+            double rejection = measureRejection(resampler, srcRate, dstRate);
+            destroyResampler(resampler);
+            pairs++;
+
+            int pass = snr >= minSnr && rejection >= minRejection;
+            printf("%6u -> %6u Hz: SNR %5.1f dB, %s rejection %5.1f dB%s\n",
+                   srcRate, dstRate, snr, dstRate > srcRate ? "image" : "alias",
+                   rejection, pass ? "" : "  FAILED");
+            failures += !pass;
+            worstSnr = snr < worstSnr ? snr : worstSnr;
+            worstRejection = rejection < worstRejection ? rejection : worstRejection;
+        }
+    }
+    printf("%d ratios, %d out of range; worst SNR %.1f dB, worst rejection %.1f dB\n",
+           pairs, refused, worstSnr, worstRejection);
+    if (failures) {
+        fprintf(stderr, "%d ratios failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,261 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * Host side run of audio_stream.h on a NullAudioDevice (null_audio_device.h),
+ * wired the way native-audio-jni.c wires it to the OpenSL ES buffer queues.
+ *
+ *    stream_sim [--record] [--seconds 2] [--rate 48000] [--clip-rate 8000]
+ *               [--block 1024] [--fast] [--max-xruns <n>]
+ *
+ * Play (default): a sawtooth clip at --clip-rate, converted to the device
+ * rate by resampler.h like selectClip() does, for --seconds of device time.
+ * Record: the stream captures --seconds into a sink that only counts.
+ * The device completes one block per block duration, or as fast as it can
+ * with --fast to measure throughput. The exit status is 1 when the stream
+ * did not play or capture the whole length, or had more than --max-xruns
+ * underruns / overruns.
+ */
+
+// nanosleep(), clock_gettime() with -std=c99 on glibc
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "audio_stream.h"
+#include "null_audio_device.h"
+#include "resampler.h"
+
+#define SIM_BLOCK_COUNT 4
+#define SIM_RING_FRAMES 16384
+#define SIM_SAWTOOTH_PERIOD 40  // frames of the clip per tooth
+
+typedef struct SimSource {
+    Resampler *resampler;  // NULL when the clip is at the device rate
+    short clip[256];
+    unsigned clipFrames;
+    unsigned clipPos;
+    uint64_t framesLeft;   // at the clip rate
+} SimSource;
+
+typedef struct SimSink {
+    uint64_t framesLeft;
+} SimSink;
+
+typedef struct SimDevice {
+    AudioStream *stream;
+    int done;
+} SimDevice;
+
+// the stream source: the clip, looped for the length of the run
+static unsigned readSawtooth(void *context, short *dst, unsigned frames)
+{
+    SimSource *source = (SimSource *)context;
+    unsigned filled = 0;
+    while (filled < frames) {
+        const short *src = source->clip + source->clipPos;
+        unsigned srcFrames = source->clipFrames - source->clipPos;
+        if (srcFrames > source->framesLeft) {
+            srcFrames = (unsigned)source->framesLeft;
+        }
+        if (0 == srcFrames) {
+            if (source->framesLeft > 0) {
+                source->clipPos = 0;
+                continue;
+            }
+            if (NULL == source->resampler) {
+                break;
+            }
+            src = NULL;
+        }
+        unsigned count;
+        if (NULL == source->resampler) {
+            count = frames - filled < srcFrames ? frames - filled : srcFrames;
+            memcpy(dst + filled, src, count * sizeof(short));
+            srcFrames = count;
+        } else {
+            count = resample(source->resampler, src, &srcFrames, dst + filled,
+                             frames - filled);
+        }
+        filled += count;
+        if (NULL == src) {
+            if (0 == count) {
+                break;
+            }
+        } else {
+            source->clipPos += srcFrames;
+            source->framesLeft -= srcFrames;
+        }
+    }
+    return filled;
+}
+
+static int countFrames(void *context, const short *src, unsigned frames)
+{
+    SimSink *sink = (SimSink *)context;
+    (void)src;
+    sink->framesLeft = frames < sink->framesLeft ? sink->framesLeft - frames : 0;
+    return sink->framesLeft > 0;
+}
+
+// the buffer queue callback, on the device thread
+static void onBlockDone(void *context)
+{
+    SimDevice *device = (SimDevice *)context;
+    if (!onStreamBlockDone(device->stream)) {
+        __atomic_store_n(&device->done, 1, __ATOMIC_RELEASE);
+    }
+}
+
+static double nowInMs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [--record] [--seconds s] [--rate hz] [--clip-rate hz]\n"
+            "       [--block frames] [--fast] [--max-xruns n]\n",
+            name);
+}
+
+int main(int argc, char *argv[])
+{
+    int record = 0, fast = 0;
+    double seconds = 2.0;
+    unsigned rate = 48000, clipRate = 8000, blockFrames = 1024;
+    long maxXruns = -1;
+
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        if (!strcmp(arg, "--record")) {
+            record = 1;
+            continue;
+        }
+        if (!strcmp(arg, "--fast")) {
+            fast = 1;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+            return 2;
+        }
+        const char *value = argv[++i];
+        if (!strcmp(arg, "--seconds")) {
+            seconds = atof(value);
+        } else if (!strcmp(arg, "--rate")) {
+            rate = (unsigned)atoi(value);
+        } else if (!strcmp(arg, "--clip-rate")) {
+            clipRate = (unsigned)atoi(value);
+        } else if (!strcmp(arg, "--block")) {
+            blockFrames = (unsigned)atoi(value);
+        } else if (!strcmp(arg, "--max-xruns")) {
+            maxXruns = atol(value);
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (!rate || !clipRate || !blockFrames || seconds <= 0.0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    SimDevice simDevice = {NULL, 0};
+    unsigned periodInUs = fast ? 0 : (unsigned)(blockFrames * 1000000ULL / rate);
+    NullAudioDevice *device =
+        createNullAudioDevice(SIM_BLOCK_COUNT, periodInUs, onBlockDone, &simDevice);
+    StreamConfig config = {blockFrames, SIM_BLOCK_COUNT, SIM_RING_FRAMES};
+    uint64_t expected = (uint64_t)(seconds * rate);
+
+    SimSource source;
+    SimSink sink = {expected};
+    memset(&source, 0, sizeof(source));
+    if (record) {
+        simDevice.stream = createRecordStream(&config, countFrames, &sink,
+                                              nullDeviceEnqueue, device);
+    } else {
+        source.clipFrames = sizeof(source.clip) / sizeof(source.clip[0]);
+        for (unsigned i = 0; i < source.clipFrames; i++) {
+            source.clip[i] = (short)((i % SIM_SAWTOOTH_PERIOD) * 65535 /
+                                     (SIM_SAWTOOTH_PERIOD - 1) - 32768);
+        }
+        source.framesLeft = (uint64_t)(seconds * clipRate);
+        if (clipRate != rate) {
+            source.resampler = createResampler(clipRate, rate);
+            if (NULL == source.resampler) {
+                fprintf(stderr, "%u Hz -> %u Hz is not supported\n", clipRate, rate);
+                return 2;
+            }
+        }
+        simDevice.stream = createPlayStream(&config, readSawtooth, &source,
+                                            nullDeviceEnqueue, device);
+    }
+    if (NULL == device || NULL == simDevice.stream) {
+        fprintf(stderr, "can not create the stream\n");
+        return 2;
+    }
+
+    double start = nowInMs();
+    if (!startStream(simDevice.stream) || !startNullAudioDevice(device)) {
+        fprintf(stderr, "can not start the stream\n");
+        return 1;
+    }
+    struct timespec poll = {0, 1000000};
+    while (!__atomic_load_n(&simDevice.done, __ATOMIC_ACQUIRE)) {
+        nanosleep(&poll, NULL);
+    }
+    double elapsedMs = nowInMs() - start;
+    stopNullAudioDevice(device);
+    stopStream(simDevice.stream);
+
+    StreamStats stats;
+    getStreamStats(simDevice.stream, &stats);
+    destroyStream(simDevice.stream);
+    destroyNullAudioDevice(device);
+    destroyResampler(source.resampler);
+
+    uint64_t audioFrames = stats.frames - (record ? 0 : stats.xrunFrames);
+    printf("%s %.1f s at %u Hz in %u frame blocks, %s device\n",
+           record ? "record" : "play", seconds, rate, blockFrames,
+           fast ? "fast" : "real time");
+    printf("frames: %llu on the device, %llu of audio, %.0f ms\n",
+           (unsigned long long)stats.frames, (unsigned long long)audioFrames, elapsedMs);
+    printf("xruns: %u, %llu frames\n", stats.xrunCount,
+           (unsigned long long)stats.xrunFrames);
+    if (elapsedMs > 0.0) {
+        printf("throughput: %.1fx real time\n", audioFrames * 1000.0 / rate / elapsedMs);
+    }
+
+    // the converter adds its delay to the end of a played stream
+    if (audioFrames < expected) {
+        fprintf(stderr, "%llu frames short\n",
+                (unsigned long long)(expected - audioFrames));
+        return 1;
+    }
+    if (maxXruns >= 0 && stats.xrunCount > maxXruns) {
+        fprintf(stderr, "%u xruns, at most %ld expected\n", stats.xrunCount, maxXruns);
+        return 1;
+    }
+    return 0;
+}
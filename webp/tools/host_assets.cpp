@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "host_assets.h"
+
+struct AAssetManager {
+    std::string dir_;
+};
+
+struct AAsset {
+    std::vector<uint8_t> data_;
+    size_t pos_;
+};
+
+AAssetManager* CreateHostAssetManager(const char* dir) {
+    AAssetManager* mgr = new AAssetManager;
+    mgr->dir_ = dir;
+    return mgr;
+}
+
+void DestroyHostAssetManager(AAssetManager* mgr) {
+    delete mgr;
+}
+
+AAsset* AAssetManager_open(AAssetManager* mgr, const char* filename, int) {
+    std::string path = mgr->dir_ + "/" + filename;
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) {
+        return nullptr;
+    }
+    AAsset* asset = new AAsset;
+    asset->pos_ = 0;
+    uint8_t chunk[16 * 1024];
+    size_t size;
+    while ((size = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+        asset->data_.insert(asset->data_.end(), chunk, chunk + size);
+    }
+    fclose(file);
+    return asset;
+}
+
+void AAsset_close(AAsset* asset) {
+    delete asset;
+}
+
+off_t AAsset_getLength(AAsset* asset) {
+    return static_cast<off_t>(asset->data_.size());
+}
+
+const void* AAsset_getBuffer(AAsset* asset) {
+    return asset->data_.data();
+}
+
+int AAsset_read(AAsset* asset, void* buf, size_t count) {
+    count = std::min(count, asset->data_.size() - asset->pos_);
+    memcpy(buf, asset->data_.data() + asset->pos_, count);
+    asset->pos_ += count;
+    return static_cast<int>(count);
+}
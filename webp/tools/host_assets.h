@@ -0,0 +1,29 @@
+/*
+ * Copyright (C) The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __HOST_ASSETS_H__
+#define __HOST_ASSETS_H__
+
+#include <android/asset_manager.h>
+
+/*
+ * The part of the NDK asset manager WebpInputCache uses, over a directory
+ * of the host: assets are files below dir, read whole into memory when
+ * they are opened, so AAsset_getBuffer() always has a buffer to give.
+ */
+AAssetManager* CreateHostAssetManager(const char* dir);
+void DestroyHostAssetManager(AAssetManager* mgr);
+
+#endif // __HOST_ASSETS_H__
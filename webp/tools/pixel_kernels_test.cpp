@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Checks the row kernels GetPixelKernels() picks against the scalar ones.
+ *
+ *    pixel_kernels_test [--rows n]
+ *
+ * Every width up to a few vectors, so each kernel ends on every tail
+ * length, then --rows random widths up to a 4K row. Swizzle and
+ * premultiply run both into a separate row and in place, RGB565 packing
+ * with and without a dither table, YUV conversion with planar (uvStep 1)
+ * and semi-planar (uvStep 2) chroma. Pixels include 0, 255 and the
+ * limited range YUV ends so every clamp is hit. The results have to be
+ * bit-exact, and nothing past the end of a row may be written. The exit
+ * status is 1 on a mismatch.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+#include "pixel_convert_kernels.h"
+
+static uint32_t failures = 0;
+
+#define CHECK(cond, ...)                                              \
+    do {                                                              \
+        if (!(cond) && failures++ < 10) {                             \
+            fprintf(stderr, "%s:%d: %s: ", __FILE__, __LINE__, #cond); \
+            fprintf(stderr, __VA_ARGS__);                             \
+            fprintf(stderr, "\n");                                    \
+        }                                                             \
+    } while (0)
+
+// past the end of every row, must come out unchanged
+static const int32_t kGuard = 64;
+static const uint8_t kGuardByte = 0xA5;
+static const uint16_t kGuardPixel = 0xA5A5;
+static const int32_t kMaxWidth = 3840;
+
+static uint8_t RandomByte(std::mt19937* random) {
+    static const uint8_t kEdges[] = { 0, 1, 15, 16, 128, 235, 240, 254, 255 };
+    uint32_t pick = (*random)();
+    if (pick % 4 == 0) {
+        return kEdges[(pick >> 8) % sizeof(kEdges)];
+    }
+    return static_cast<uint8_t>(pick >> 8);
+}
+
+static std::vector<uint8_t> RandomRow(int32_t bytes, std::mt19937* random) {
+    std::vector<uint8_t> row(bytes + kGuard, kGuardByte);
+    for (int32_t idx = 0; idx < bytes; idx++) {
+        row[idx] = RandomByte(random);
+    }
+    return row;
+}
+
+typedef void (*RgbaRowFunc)(const uint8_t* src, uint8_t* dst, int32_t width);
+
+static void CheckRgbaRow(const char* kernel, const char* name,
+                         RgbaRowFunc func, RgbaRowFunc reference,
+                         int32_t width, std::mt19937* random) {
+    std::vector<uint8_t> src = RandomRow(width * 4, random);
+    std::vector<uint8_t> expected(src.size(), kGuardByte);
+    reference(src.data(), expected.data(), width);
+
+    std::vector<uint8_t> dst(src.size(), kGuardByte);
+    func(src.data(), dst.data(), width);
+    std::vector<uint8_t> inPlace(src);
+    func(inPlace.data(), inPlace.data(), width);
+
+    for (size_t idx = 0; idx < dst.size(); idx++) {
+        CHECK(dst[idx] == expected[idx],
+              "%s %s, width %d: byte %zu is %u, scalar %u", kernel, name,
+              width, idx, dst[idx], expected[idx]);
+        CHECK(inPlace[idx] == expected[idx],
+              "%s %s in place, width %d: byte %zu is %u, scalar %u", kernel,
+              name, width, idx, inPlace[idx], expected[idx]);
+    }
+}
+
+static void CheckPackRgb565(const PixelKernels& kernels, int32_t width,
+                            bool dithered, std::mt19937* random) {
+    std::vector<uint8_t> src = RandomRow(width * 4, random);
+    uint8_t dither[16];
+    for (uint8_t& value : dither) {
+        value = static_cast<uint8_t>((*random)() % 8);
+    }
+    const uint8_t* table = dithered ? dither : nullptr;
+    std::vector<uint16_t> expected(width + kGuard, kGuardPixel);
+    GetScalarPixelKernels().packRgb565_(src.data(), expected.data(), width,
+                                        table);
+    std::vector<uint16_t> dst(width + kGuard, kGuardPixel);
+    kernels.packRgb565_(src.data(), dst.data(), width, table);
+
+    for (size_t idx = 0; idx < dst.size(); idx++) {
+        CHECK(dst[idx] == expected[idx],
+              "%s packRgb565%s, width %d: pixel %zu is 0x%04x, "
+              "scalar 0x%04x", kernels.name_, dithered ? " dithered" : "",
+              width, idx, dst[idx], expected[idx]);
+    }
+}
+
+static void CheckYuvToRgba(const PixelKernels& kernels, int32_t width,
+                           int32_t uvStep, std::mt19937* random) {
+    std::vector<uint8_t> y = RandomRow(width, random);
+    int32_t chroma = ((width + 1) / 2) * uvStep;
+    std::vector<uint8_t> u = RandomRow(chroma, random);
+    std::vector<uint8_t> v = RandomRow(chroma, random);
+    std::vector<uint8_t> expected(width * 4 + kGuard, kGuardByte);
+    GetScalarPixelKernels().yuvToRgba_(y.data(), u.data(), v.data(), uvStep,
+                                       expected.data(), width);
+    std::vector<uint8_t> dst(width * 4 + kGuard, kGuardByte);
+    kernels.yuvToRgba_(y.data(), u.data(), v.data(), uvStep, dst.data(),
+                       width);
+
+    for (size_t idx = 0; idx < dst.size(); idx++) {
+        CHECK(dst[idx] == expected[idx],
+              "%s yuvToRgba uvStep %d, width %d: byte %zu is %u, scalar %u",
+              kernels.name_, uvStep, width, idx, dst[idx], expected[idx]);
+    }
+}
+
+static void CheckWidth(const PixelKernels& kernels, int32_t width,
+                       std::mt19937* random) {
+    const PixelKernels& scalar = GetScalarPixelKernels();
+    CheckRgbaRow(kernels.name_, "swizzle", kernels.swizzle_, scalar.swizzle_,
+                 width, random);
+    CheckRgbaRow(kernels.name_, "premultiply", kernels.premultiply_,
+                 scalar.premultiply_, width, random);
+    CheckPackRgb565(kernels, width, false, random);
+    CheckPackRgb565(kernels, width, true, random);
+    CheckYuvToRgba(kernels, width, 1, random);
+    CheckYuvToRgba(kernels, width, 2, random);
+}
+
+static void Usage(const char* name) {
+    fprintf(stderr, "usage: %s [--rows n]\n", name);
+}
+
+int main(int argc, char* argv[]) {
+    int32_t rows = 200;
+    for (int idx = 1; idx < argc; idx++) {
+        const char* arg = argv[idx];
+        if (idx + 1 >= argc || strcmp(arg, "--rows")) {
+            Usage(argv[0]);
+            return 2;
+        }
+        rows = atoi(argv[++idx]);
+    }
+    if (rows < 0) {
+        Usage(argv[0]);
+        return 2;
+    }
+
+    const PixelKernels& kernels = GetPixelKernels();
+    if (&kernels == &GetScalarPixelKernels()) {
+        printf("no vectorized kernels on this CPU, nothing to check\n");
+        return 0;
+    }
+    std::mt19937 random(1);
+    for (int32_t width = 0; width <= 70; width++) {
+        CheckWidth(kernels, width, &random);
+    }
+    for (int32_t row = 0; row < rows; row++) {
+        CheckWidth(kernels, 1 + random() % kMaxWidth, &random);
+    }
+    if (failures) {
+        fprintf(stderr, "%s: %u mismatches\n", kernels.name_, failures);
+        return 1;
+    }
+    printf("%s: bit-exact with scalar, widths 0..70 and %d random rows\n",
+           kernels.name_, rows);
+    return 0;
+}
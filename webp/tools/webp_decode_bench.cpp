@@ -0,0 +1,182 @@
+/*
+ * Copyright (C) The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Decode throughput and frame latency of the WebpDecoder worker pool.
+ *
+ *    webp_decode_bench --assets <dir> [--frames 300] [--max-threads n]
+ *                      [--width 1080] [--height 1920] [--rgb565]
+ *
+ * Plays the slideshow of the app (clips/frame1..3.webp under --assets) as
+ * fast as the decoder goes, with pools of 1 up to --max-threads workers
+ * (the number of cores by default): a frame is released as soon as it is
+ * ready, like a display that never waits for vsync. Each worker has a
+ * frame buffer of its own to decode into, plus one ready for display.
+ * For every pool size it prints the frames per second and the median and
+ * 99th percentile frame latency, the time from releasing a frame until
+ * the next one is ready. The exit status is 1 when a frame never comes.
+ */
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include "host_assets.h"
+#include "webp_decode.h"
+#include "webp_input_cache.h"
+
+typedef std::chrono::steady_clock Clock;
+
+static const char* kFrames[] = {
+    "clips/frame1.webp",
+    "clips/frame2.webp",
+    "clips/frame3.webp",
+};
+static const uint32_t kFrameCount = sizeof(kFrames) / sizeof(kFrames[0]);
+static const std::chrono::seconds kFrameTimeout(5);
+
+struct BenchResult {
+    double fps_;
+    std::vector<uint32_t> latencies_;  // us
+};
+
+/*
+ * Next decoded frame, skipping animations as the app hands them to
+ * WebpAnimation; false if none is ready within kFrameTimeout
+ */
+static bool WaitForFrame(WebpDecoder* decoder) {
+    Clock::time_point deadline = Clock::now() + kFrameTimeout;
+    while (!decoder->GetDecodedFrame()) {
+        if (decoder->TakeAnimation()) {
+            continue;
+        }
+        if (Clock::now() >= deadline) {
+            return false;
+        }
+        std::this_thread::yield();
+    }
+    return true;
+}
+
+static bool RunBench(WebpInputCache* cache, DecodeSurfaceDescriptor* surface,
+                     uint32_t threads, uint32_t frames, BenchResult* result) {
+    WebpDecoder* decoder = new WebpDecoder(kFrames, kFrameCount, surface, cache,
+                                           threads, threads + 1);
+    result->latencies_.clear();
+    // the pool starts with every buffer queued: not part of the steady state
+    bool ok = WaitForFrame(decoder);
+    Clock::time_point start = Clock::now();
+    for (uint32_t frame = 0; ok && frame < frames; frame++) {
+        decoder->ReleaseFrame();
+        Clock::time_point released = Clock::now();
+        ok = WaitForFrame(decoder);
+        result->latencies_.push_back(static_cast<uint32_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                Clock::now() - released).count()));
+    }
+    double seconds =
+        std::chrono::duration<double>(Clock::now() - start).count();
+    result->fps_ = seconds > 0.0 ? frames / seconds : 0.0;
+    decoder->DestroyDecoder();
+    return ok;
+}
+
+static uint32_t Percentile(std::vector<uint32_t>* values, double fraction) {
+    if (values->empty()) return 0;
+    size_t idx = static_cast<size_t>(fraction * (values->size() - 1));
+    std::nth_element(values->begin(), values->begin() + idx, values->end());
+    return (*values)[idx];
+}
+
+static void Usage(const char* name) {
+    fprintf(stderr,
+            "usage: %s --assets dir [--frames n] [--max-threads n]\n"
+            "       [--width w] [--height h] [--rgb565]\n",
+            name);
+}
+
+int main(int argc, char* argv[]) {
+    const char* assets = nullptr;
+    uint32_t frames = 300;
+    uint32_t maxThreads = std::max(std::thread::hardware_concurrency(), 1u);
+    DecodeSurfaceDescriptor surface = {1080, 1920, 1080,
+                                       SurfaceFormat::SURFACE_FORMAT_RGBA_8888};
+    for (int idx = 1; idx < argc; idx++) {
+        const char* arg = argv[idx];
+        if (!strcmp(arg, "--rgb565")) {
+            surface.format_ = SurfaceFormat::SURFACE_FORMAT_RGB_565;
+            continue;
+        }
+        if (idx + 1 >= argc) {
+            Usage(argv[0]);
+            return 2;
+        }
+        const char* value = argv[++idx];
+        if (!strcmp(arg, "--assets")) {
+            assets = value;
+        } else if (!strcmp(arg, "--frames")) {
+            frames = static_cast<uint32_t>(atoi(value));
+        } else if (!strcmp(arg, "--max-threads")) {
+            maxThreads = static_cast<uint32_t>(atoi(value));
+        } else if (!strcmp(arg, "--width")) {
+            surface.width_ = surface.stride_ = atoi(value);
+        } else if (!strcmp(arg, "--height")) {
+            surface.height_ = atoi(value);
+        } else {
+            Usage(argv[0]);
+            return 2;
+        }
+    }
+    if (!assets || !frames || !maxThreads || surface.width_ <= 0 ||
+        surface.height_ <= 0) {
+        Usage(argv[0]);
+        return 2;
+    }
+
+    AAssetManager* assetMgr = CreateHostAssetManager(assets);
+    WebpInputCache cache(assetMgr);
+    for (const char* file : kFrames) {
+        if (!cache.Get(file)) {
+            fprintf(stderr, "can not load %s/%s\n", assets, file);
+            return 2;
+        }
+    }
+
+    printf("%u frames of %dx%d %s, %u hardware threads\n", frames,
+           surface.width_, surface.height_,
+           surface.format_ == SurfaceFormat::SURFACE_FORMAT_RGB_565 ? "RGB565"
+                                                                    : "RGBA",
+           std::thread::hardware_concurrency());
+    int status = 0;
+    BenchResult result;
+    for (uint32_t threads = 1; threads <= maxThreads; threads++) {
+        if (!RunBench(&cache, &surface, threads, frames, &result)) {
+            fprintf(stderr, "%u threads: no frame within %lld s\n", threads,
+                    static_cast<long long>(kFrameTimeout.count()));
+            status = 1;
+            break;
+        }
+        uint32_t p50 = Percentile(&result.latencies_, 0.5);
+        uint32_t p99 = Percentile(&result.latencies_, 0.99);
+        printf("%2u threads: %7.1f fps, frame latency p50 %6.2f ms, "
+               "p99 %6.2f ms\n",
+               threads, result.fps_, p50 / 1000.0, p99 / 1000.0);
+    }
+    DestroyHostAssetManager(assetMgr);
+    return status;
+}
@@ -0,0 +1,410 @@
+/*
+ * Copyright (C) The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "pixel_convert.h"
+#include "pixel_convert_kernels.h"
+
+// bands smaller than this are not worth a thread
+static const int32_t kMinBandRows = 16;
+
+/*
+ * 4x4 Bayer matrix scaled to the bits RGB565 drops: 3 for red and blue, 2 for
+ * green; one 16 byte pattern of 4 RGBA pixels per row phase
+ */
+static const uint8_t kBayer4x4[4][4] = {
+    {  0,  8,  2, 10 },
+    { 12,  4, 14,  6 },
+    {  3, 11,  1,  9 },
+    { 15,  7, 13,  5 },
+};
+
+static const uint8_t* DitherPattern(int32_t y) {
+    static uint8_t patterns[4][16];
+    static bool ready = [] {
+        for (int row = 0; row < 4; row++) {
+            for (int x = 0; x < 4; x++) {
+                uint8_t t = kBayer4x4[row][x];
+                patterns[row][x * 4 + 0] = t >> 1;
+                patterns[row][x * 4 + 1] = t >> 2;
+                patterns[row][x * 4 + 2] = t >> 1;
+                patterns[row][x * 4 + 3] = 0;
+            }
+        }
+        return true;
+    }();
+    (void)ready;
+    return patterns[y & 3];
+}
+
+static bool IsYuv(PixelFormat format) {
+    return format == PixelFormat::PIXEL_FORMAT_I420 ||
+           format == PixelFormat::PIXEL_FORMAT_NV12 ||
+           format == PixelFormat::PIXEL_FORMAT_NV21;
+}
+
+static int32_t BytesPerPixel(PixelFormat format) {
+    switch (format) {
+        case PixelFormat::PIXEL_FORMAT_RGBA_8888:
+        case PixelFormat::PIXEL_FORMAT_BGRA_8888:
+            return 4;
+        case PixelFormat::PIXEL_FORMAT_RGB_565:
+            return 2;
+        default:
+            return 1;
+    }
+}
+
+PixelImage MakePixelImage(PixelFormat format, int32_t width, int32_t height,
+                          uint8_t* data, int32_t stride) {
+    PixelImage image;
+    memset(&image, 0, sizeof(image));
+    image.format_ = format;
+    image.width_ = width;
+    image.height_ = height;
+    image.planes_[0] = data;
+    image.strides_[0] = stride;
+    if (IsYuv(format)) {
+        image.planes_[1] = data + stride * height;
+        image.strides_[1] = stride;
+        if (format == PixelFormat::PIXEL_FORMAT_I420) {
+            image.strides_[1] = image.strides_[2] = (stride + 1) / 2;
+            image.planes_[2] = image.planes_[1] +
+                               image.strides_[1] * ((height + 1) / 2);
+        }
+    }
+    return image;
+}
+
+PixelImage CropPixelImage(const PixelImage& image, int32_t x, int32_t y,
+                          int32_t width, int32_t height) {
+    PixelImage crop = image;
+    if (IsYuv(image.format_)) {
+        x &= ~1;
+        y &= ~1;
+        crop.planes_[1] += (y / 2) * image.strides_[1] +
+                           (image.format_ == PixelFormat::PIXEL_FORMAT_I420 ?
+                            x / 2 : x);
+        if (image.planes_[2]) {
+            crop.planes_[2] += (y / 2) * image.strides_[2] + x / 2;
+        }
+    }
+    crop.planes_[0] += y * image.strides_[0] + x * BytesPerPixel(image.format_);
+    crop.width_ = width;
+    crop.height_ = height;
+    return crop;
+}
+
+/*
+ * One band of rows: every source row becomes an RGBA row, in the destination
+ * itself when it is RGBA, then goes through the alpha step and is stored
+ */
+class BandConverter {
+  public:
+    BandConverter(const PixelImage& src, const PixelImage& dst,
+                  uint32_t flags)
+        : kernels_(GetPixelKernels()), src_(src), dst_(dst), flags_(flags),
+          rows_(new uint8_t[src.width_ * 4 * 2]) {}
+
+    void Convert(int32_t firstRow, int32_t endRow) {
+        if (!IsYuv(dst_.format_)) {
+            for (int32_t y = firstRow; y < endRow; y++) {
+                StoreRgbRow(y, ReadRgbaRow(y, rows_.get()));
+            }
+            return;
+        }
+        // chroma is shared by row pairs
+        for (int32_t y = firstRow; y < endRow; y += 2) {
+            const uint8_t* top = ReadRgbaRow(y, rows_.get());
+            const uint8_t* bottom = y + 1 < endRow ?
+                ReadRgbaRow(y + 1, rows_.get() + src_.width_ * 4) : top;
+            StoreYuvRows(y, top, bottom);
+        }
+    }
+
+  private:
+    uint8_t* Row(const PixelImage& image, int32_t plane, int32_t y) const {
+        return image.planes_[plane] + y * image.strides_[plane];
+    }
+
+    const uint8_t* ReadRgbaRow(int32_t y, uint8_t* tmp) {
+        int32_t width = src_.width_;
+        uint8_t* rgba = dst_.format_ == PixelFormat::PIXEL_FORMAT_RGBA_8888 ?
+                        Row(dst_, 0, y) : tmp;
+        const uint8_t* row = rgba;
+        switch (src_.format_) {
+            case PixelFormat::PIXEL_FORMAT_RGBA_8888:
+                row = Row(src_, 0, y);
+                break;
+            case PixelFormat::PIXEL_FORMAT_BGRA_8888:
+                kernels_.swizzle_(Row(src_, 0, y), rgba, width);
+                break;
+            case PixelFormat::PIXEL_FORMAT_RGB_565:
+                UnpackRgb565Row(reinterpret_cast<const uint16_t*>(
+                    Row(src_, 0, y)), rgba, width);
+                break;
+            case PixelFormat::PIXEL_FORMAT_I420:
+                kernels_.yuvToRgba_(Row(src_, 0, y), Row(src_, 1, y / 2),
+                                    Row(src_, 2, y / 2), 1, rgba, width);
+                break;
+            case PixelFormat::PIXEL_FORMAT_NV12:
+            case PixelFormat::PIXEL_FORMAT_NV21: {
+                const uint8_t* uv = Row(src_, 1, y / 2);
+                bool nv12 = src_.format_ == PixelFormat::PIXEL_FORMAT_NV12;
+                kernels_.yuvToRgba_(Row(src_, 0, y), nv12 ? uv : uv + 1,
+                                    nv12 ? uv + 1 : uv, 2, rgba, width);
+                break;
+            }
+        }
+
+        if (flags_ & PIXEL_CONVERT_PREMULTIPLY) {
+            kernels_.premultiply_(row, rgba, width);
+            row = rgba;
+        } else if (flags_ & PIXEL_CONVERT_UNPREMULTIPLY) {
+            UnpremultiplyRow(row, rgba, width);
+            row = rgba;
+        }
+        return row;
+    }
+
+    void StoreRgbRow(int32_t y, const uint8_t* rgba) {
+        uint8_t* dst = Row(dst_, 0, y);
+        switch (dst_.format_) {
+            case PixelFormat::PIXEL_FORMAT_RGBA_8888:
+                if (rgba != dst) {
+                    memcpy(dst, rgba, dst_.width_ * 4);
+                }
+                break;
+            case PixelFormat::PIXEL_FORMAT_BGRA_8888:
+                kernels_.swizzle_(rgba, dst, dst_.width_);
+                break;
+            case PixelFormat::PIXEL_FORMAT_RGB_565:
+                kernels_.packRgb565_(rgba, reinterpret_cast<uint16_t*>(dst),
+                                     dst_.width_,
+                                     (flags_ & PIXEL_CONVERT_DITHER) ?
+                                     DitherPattern(y) : nullptr);
+                break;
+            default:
+                break;
+        }
+    }
+
+    // BT.601 limited range, chroma from the average of each 2x2 block
+    void StoreYuvRows(int32_t y, const uint8_t* top, const uint8_t* bottom) {
+        int32_t width = dst_.width_;
+        uint8_t* luma[2] = { Row(dst_, 0, y), nullptr };
+        if (y + 1 < dst_.height_) {
+            luma[1] = Row(dst_, 0, y + 1);
+        }
+        const uint8_t* rgba[2] = { top, bottom };
+        for (int i = 0; i < 2 && luma[i]; i++) {
+            const uint8_t* p = rgba[i];
+            for (int32_t x = 0; x < width; x++, p += 4) {
+                luma[i][x] = static_cast<uint8_t>(
+                    ((66 * p[0] + 129 * p[1] + 25 * p[2] + 128) >> 8) + 16);
+            }
+        }
+
+        uint8_t* u;
+        uint8_t* v;
+        int32_t step = 2;
+        switch (dst_.format_) {
+            case PixelFormat::PIXEL_FORMAT_I420:
+                u = Row(dst_, 1, y / 2);
+                v = Row(dst_, 2, y / 2);
+                step = 1;
+                break;
+            case PixelFormat::PIXEL_FORMAT_NV12:
+                u = Row(dst_, 1, y / 2);
+                v = u + 1;
+                break;
+            default:
+                v = Row(dst_, 1, y / 2);
+                u = v + 1;
+                break;
+        }
+        for (int32_t x = 0; x < width; x += 2) {
+            int32_t next = x + 1 < width ? 4 : 0;
+            int32_t sum[3];
+            for (int c = 0; c < 3; c++) {
+                const uint8_t* t = top + x * 4 + c;
+                const uint8_t* b = bottom + x * 4 + c;
+                sum[c] = (t[0] + t[next] + b[0] + b[next] + 2) >> 2;
+            }
+            u[(x / 2) * step] = static_cast<uint8_t>(
+                ((-38 * sum[0] - 74 * sum[1] + 112 * sum[2] + 128) >> 8) + 128);
+            v[(x / 2) * step] = static_cast<uint8_t>(
+                ((112 * sum[0] - 94 * sum[1] - 18 * sum[2] + 128) >> 8) + 128);
+        }
+    }
+
+    static void UnpackRgb565Row(const uint16_t* src, uint8_t* dst,
+                                int32_t width) {
+        for (int32_t x = 0; x < width; x++, dst += 4) {
+            uint32_t r = src[x] >> 11, g = (src[x] >> 5) & 0x3F;
+            uint32_t b = src[x] & 0x1F;
+            dst[0] = static_cast<uint8_t>((r << 3) | (r >> 2));
+            dst[1] = static_cast<uint8_t>((g << 2) | (g >> 4));
+            dst[2] = static_cast<uint8_t>((b << 3) | (b >> 2));
+            dst[3] = 0xFF;
+        }
+    }
+
+    static void UnpremultiplyRow(const uint8_t* src, uint8_t* dst,
+                                 int32_t width) {
+        for (int32_t x = 0; x < width; x++, src += 4, dst += 4) {
+            uint32_t a = src[3];
+            for (int c = 0; c < 3; c++) {
+                uint32_t value = a ? (src[c] * 255 + a / 2) / a : 0;
+                dst[c] = static_cast<uint8_t>(value > 255 ? 255 : value);
+            }
+            dst[3] = static_cast<uint8_t>(a);
+        }
+    }
+
+    const PixelKernels& kernels_;
+    const PixelImage& src_;
+    const PixelImage& dst_;
+    uint32_t flags_;
+    std::unique_ptr<uint8_t[]> rows_;
+};
+
+static bool IsValid(const PixelImage& image) {
+    if (image.width_ <= 0 || image.height_ <= 0 || !image.planes_[0]) {
+        return false;
+    }
+    switch (image.format_) {
+        case PixelFormat::PIXEL_FORMAT_I420:
+            return image.planes_[1] && image.planes_[2];
+        case PixelFormat::PIXEL_FORMAT_NV12:
+        case PixelFormat::PIXEL_FORMAT_NV21:
+            return image.planes_[1] != nullptr;
+        default:
+            return true;
+    }
+}
+
+/*
+ * Long-lived threads converting the bands of ConvertPixels() calls, so a
+ * frame conversion does not create and join threads. The pool grows to the
+ * largest threadCount asked for and lives as long as the process.
+ */
+class BandWorkers {
+  public:
+    static BandWorkers& Get(void) {
+        static BandWorkers workers;
+        return workers;
+    }
+
+    // converts bands [1, bands) on the workers and band 0 on the caller
+    void Convert(const PixelImage& src, const PixelImage& dst, uint32_t flags,
+                 int32_t bands, int32_t bandRows) {
+        int32_t pending = 0;
+        {
+            std::lock_guard<std::mutex> lock(jobLock_);
+            while (static_cast<int32_t>(workers_.size()) < bands - 1) {
+                workers_.emplace_back(&BandWorkers::WorkLoop, this);
+            }
+            for (int32_t first = bandRows; first < src.height_;
+                 first += bandRows) {
+                int32_t end = std::min(first + bandRows, src.height_);
+                jobs_.push_back({&src, &dst, flags, first, end, &pending});
+                pending++;
+            }
+        }
+        jobCond_.notify_all();
+
+        BandConverter(src, dst, flags).Convert(0, std::min(bandRows,
+                                                           src.height_));
+        std::unique_lock<std::mutex> lock(jobLock_);
+        doneCond_.wait(lock, [&pending] { return pending == 0; });
+    }
+
+  private:
+    struct BandJob {
+        const PixelImage* src_;
+        const PixelImage* dst_;
+        uint32_t flags_;
+        int32_t  first_, end_;
+        int32_t* pending_;  // bands of the call still converting
+    };
+
+    BandWorkers() : stopping_(false) {}
+
+    ~BandWorkers() {
+        {
+            std::lock_guard<std::mutex> lock(jobLock_);
+            stopping_ = true;
+        }
+        jobCond_.notify_all();
+        for (auto& worker : workers_) {
+            worker.join();
+        }
+    }
+
+    void WorkLoop(void) {
+        std::unique_lock<std::mutex> lock(jobLock_);
+        while (true) {
+            jobCond_.wait(lock, [this] { return stopping_ || !jobs_.empty(); });
+            if (stopping_) {
+                return;
+            }
+            BandJob job = jobs_.front();
+            jobs_.pop_front();
+            lock.unlock();
+            BandConverter(*job.src_, *job.dst_, job.flags_)
+                .Convert(job.first_, job.end_);
+            lock.lock();
+            if (--*job.pending_ == 0) {
+                doneCond_.notify_all();
+            }
+        }
+    }
+
+    std::mutex               jobLock_;
+    std::condition_variable  jobCond_;
+    std::condition_variable  doneCond_;
+    std::deque<BandJob>      jobs_;
+    bool                     stopping_;
+    std::vector<std::thread> workers_;
+};
+
+bool ConvertPixels(const PixelImage& src, const PixelImage& dst,
+                   uint32_t flags, uint32_t threadCount) {
+    if (!IsValid(src) || !IsValid(dst) || src.width_ != dst.width_ ||
+        src.height_ != dst.height_ ||
+        (flags & PIXEL_CONVERT_PREMULTIPLY &&
+         flags & PIXEL_CONVERT_UNPREMULTIPLY)) {
+        return false;
+    }
+
+    // bands of an even number of rows: YUV chroma rows are not shared
+    int32_t bands = static_cast<int32_t>(threadCount ? threadCount : 1);
+    bands = std::min(bands, std::max(1, src.height_ / kMinBandRows));
+    int32_t bandRows = ((src.height_ + bands - 1) / bands + 1) & ~1;
+    if (bandRows >= src.height_) {
+        BandConverter(src, dst, flags).Convert(0, src.height_);
+        return true;
+    }
+    BandWorkers::Get().Convert(src, dst, flags, bands, bandRows);
+    return true;
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __PIXEL_CONVERT_H__
+#define __PIXEL_CONVERT_H__
+
+#include <cstdint>
+
+/*
+ * Pixel format conversion between decoder outputs, camera images and window
+ * buffers. The work is split in horizontal bands converted in parallel, each
+ * row through the vectorized kernels of pixel_convert_kernels.h.
+ * Every conversion goes through 8 bit RGBA rows, written straight to the
+ * destination when it is RGBA.
+ */
+enum class PixelFormat : uint32_t {
+    PIXEL_FORMAT_RGBA_8888,
+    PIXEL_FORMAT_BGRA_8888,
+    PIXEL_FORMAT_RGB_565,      // native uint16_t, red in the high bits
+    PIXEL_FORMAT_I420,         // Y, U, V planes, chroma 2x2 subsampled
+    PIXEL_FORMAT_NV12,         // Y plane, U V interleaved plane
+    PIXEL_FORMAT_NV21,         // Y plane, V U interleaved plane
+};
+
+/*
+ * Image in memory: planes_[0] only for RGB formats; Y, U, V for I420;
+ * Y and the interleaved chroma for NV12 / NV21. Strides are in bytes.
+ */
+struct PixelImage {
+    PixelFormat format_;
+    int32_t     width_, height_;
+    uint8_t*    planes_[3];
+    int32_t     strides_[3];
+};
+
+enum PixelConvertFlags : uint32_t {
+    PIXEL_CONVERT_DITHER        = 1,  // 4x4 ordered dither into RGB565
+    PIXEL_CONVERT_PREMULTIPLY   = 2,  // color * alpha: the image over black
+    PIXEL_CONVERT_UNPREMULTIPLY = 4,
+};
+
+/*
+ * Describe an image stored in one buffer: planes follow each other, the
+ * chroma rows of I420 are half the stride, rounded up
+ */
+PixelImage MakePixelImage(PixelFormat format, int32_t width, int32_t height,
+                          uint8_t* data, int32_t stride);
+
+// Sub-rectangle of an image; YUV images crop at even coordinates
+PixelImage CropPixelImage(const PixelImage& image, int32_t x, int32_t y,
+                          int32_t width, int32_t height);
+
+/*
+ * Convert src into dst, of the same size. YUV is BT.601 limited range.
+ * Up to threadCount bands are converted at the same time, the calling
+ * thread converting one of them and a pool of long-lived threads the others.
+ * Returns false for invalid images or flags.
+ */
+bool ConvertPixels(const PixelImage& src, const PixelImage& dst,
+                   uint32_t flags = 0, uint32_t threadCount = 1);
+
+#endif // __PIXEL_CONVERT_H__
@@ -0,0 +1,398 @@
+/*
+ * Copyright (C) The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <cstring>
+#include "pixel_convert_kernels.h"
+
+#ifdef __ANDROID__
+#include <cpu-features.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define PIXEL_KERNELS_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define PIXEL_KERNELS_SSE2 1
+#endif
+
+// YUV -> RGB in 10 bit fixed point, as the camera samples do
+static const int32_t kYuvY  = 1192;   // 1.164
+static const int32_t kYuvRV = 1634;   // 1.596
+static const int32_t kYuvGV = 833;    // 0.813
+static const int32_t kYuvGU = 400;    // 0.391
+static const int32_t kYuvBU = 2066;   // 2.018
+
+static inline uint8_t Div255(uint32_t value) {
+    value += 128;
+    return static_cast<uint8_t>((value + (value >> 8)) >> 8);
+}
+
+static inline uint8_t ClampYuv(int32_t value) {
+    value >>= 10;
+    return static_cast<uint8_t>(value < 0 ? 0 : (value > 255 ? 255 : value));
+}
+
+/*
+ * Scalar kernels: the reference implementation, and the tail handler
+ * for the vectorized ones
+ */
+static void SwizzleRowScalar(const uint8_t* src, uint8_t* dst,
+                             int32_t width) {
+    for (int32_t x = 0; x < width; x++, src += 4, dst += 4) {
+        uint8_t r = src[0], g = src[1], b = src[2], a = src[3];
+        dst[0] = b;
+        dst[1] = g;
+        dst[2] = r;
+        dst[3] = a;
+    }
+}
+
+static void PremultiplyRowScalar(const uint8_t* src, uint8_t* dst,
+                                 int32_t width) {
+    for (int32_t x = 0; x < width; x++, src += 4, dst += 4) {
+        uint32_t a = src[3];
+        dst[0] = Div255(src[0] * a);
+        dst[1] = Div255(src[1] * a);
+        dst[2] = Div255(src[2] * a);
+        dst[3] = static_cast<uint8_t>(a);
+    }
+}
+
+static void PackRgb565RowScalar(const uint8_t* src, uint16_t* dst,
+                                int32_t width, const uint8_t* dither) {
+    static const uint8_t kNoDither[16] = { 0 };
+    const uint8_t* d = dither ? dither : kNoDither;
+    for (int32_t x = 0; x < width; x++, src += 4) {
+        const uint8_t* add = d + (x & 3) * 4;
+        uint32_t r = src[0] + add[0], g = src[1] + add[1], b = src[2] + add[2];
+        r = r > 255 ? 255 : r;
+        g = g > 255 ? 255 : g;
+        b = b > 255 ? 255 : b;
+        dst[x] = static_cast<uint16_t>(((r >> 3) << 11) | ((g >> 2) << 5) |
+                                       (b >> 3));
+    }
+}
+
+static void YuvToRgbaRowScalar(const uint8_t* y, const uint8_t* u,
+                               const uint8_t* v, int32_t uvStep,
+                               uint8_t* dst, int32_t width) {
+    for (int32_t x = 0; x < width; x++, dst += 4) {
+        int32_t ny = y[x] - 16;
+        int32_t nu = u[(x >> 1) * uvStep] - 128;
+        int32_t nv = v[(x >> 1) * uvStep] - 128;
+        ny = ny < 0 ? 0 : ny;
+        dst[0] = ClampYuv(kYuvY * ny + kYuvRV * nv);
+        dst[1] = ClampYuv(kYuvY * ny - kYuvGV * nv - kYuvGU * nu);
+        dst[2] = ClampYuv(kYuvY * ny + kYuvBU * nu);
+        dst[3] = 0xFF;
+    }
+}
+
+// 4 chroma samples for 8 pixels, packed in one word
+static inline uint32_t LoadChroma4(const uint8_t* c, int32_t step) {
+    uint32_t word;
+    if (step == 1) {
+        memcpy(&word, c, sizeof(word));
+    } else {
+        word = c[0] | (c[step] << 8) | (c[2 * step] << 16) |
+               (static_cast<uint32_t>(c[3 * step]) << 24);
+    }
+    return word;
+}
+
+#ifdef PIXEL_KERNELS_NEON
+/*
+ * NEON: vld4/vst4 de-interleave the channels, 8 or 16 pixels per iteration
+ */
+static void SwizzleRowNeon(const uint8_t* src, uint8_t* dst, int32_t width) {
+    int32_t x = 0;
+    for (; x + 16 <= width; x += 16) {
+        uint8x16x4_t px = vld4q_u8(src + x * 4);
+        uint8x16_t r = px.val[0];
+        px.val[0] = px.val[2];
+        px.val[2] = r;
+        vst4q_u8(dst + x * 4, px);
+    }
+    SwizzleRowScalar(src + x * 4, dst + x * 4, width - x);
+}
+
+// (t + 128 + ((t + 128) >> 8)) >> 8, as Div255()
+static inline uint8x8_t Div255Neon(uint16x8_t t) {
+    return vraddhn_u16(t, vrshrq_n_u16(t, 8));
+}
+
+static void PremultiplyRowNeon(const uint8_t* src, uint8_t* dst,
+                               int32_t width) {
+    int32_t x = 0;
+    for (; x + 8 <= width; x += 8) {
+        uint8x8x4_t px = vld4_u8(src + x * 4);
+        px.val[0] = Div255Neon(vmull_u8(px.val[0], px.val[3]));
+        px.val[1] = Div255Neon(vmull_u8(px.val[1], px.val[3]));
+        px.val[2] = Div255Neon(vmull_u8(px.val[2], px.val[3]));
+        vst4_u8(dst + x * 4, px);
+    }
+    PremultiplyRowScalar(src + x * 4, dst + x * 4, width - x);
+}
+
+static void PackRgb565RowNeon(const uint8_t* src, uint16_t* dst,
+                              int32_t width, const uint8_t* dither) {
+    uint8_t pattern[3][8] = { { 0 } };
+    if (dither) {
+        for (int i = 0; i < 8; i++) {
+            for (int c = 0; c < 3; c++) {
+                pattern[c][i] = dither[(i & 3) * 4 + c];
+            }
+        }
+    }
+    uint8x8_t addR = vld1_u8(pattern[0]);
+    uint8x8_t addG = vld1_u8(pattern[1]);
+    uint8x8_t addB = vld1_u8(pattern[2]);
+    int32_t x = 0;
+    for (; x + 8 <= width; x += 8) {
+        uint8x8x4_t px = vld4_u8(src + x * 4);
+        uint16x8_t r = vshll_n_u8(vqadd_u8(px.val[0], addR), 8);
+        uint16x8_t g = vshll_n_u8(vqadd_u8(px.val[1], addG), 8);
+        uint16x8_t b = vshll_n_u8(vqadd_u8(px.val[2], addB), 8);
+        uint16x8_t rgb = vsriq_n_u16(vsriq_n_u16(r, g, 5), b, 11);
+        vst1q_u16(dst + x, rgb);
+    }
+    // the dither phase restarts at x, a multiple of 4
+    PackRgb565RowScalar(src + x * 4, dst + x, width - x, dither);
+}
+
+static inline uint8x8_t YuvChannelNeon(int32x4_t lo, int32x4_t hi) {
+    return vqmovun_s16(vcombine_s16(vqshrn_n_s32(lo, 10),
+                                    vqshrn_n_s32(hi, 10)));
+}
+
+static void YuvToRgbaRowNeon(const uint8_t* y, const uint8_t* u,
+                             const uint8_t* v, int32_t uvStep,
+                             uint8_t* dst, int32_t width) {
+    const int16x8_t bias = vdupq_n_s16(128);
+    int32_t x = 0;
+    for (; x + 8 <= width; x += 8) {
+        int16x8_t ny = vreinterpretq_s16_u16(
+            vmovl_u8(vqsub_u8(vld1_u8(y + x), vdup_n_u8(16))));
+        uint8x8_t u4 = vreinterpret_u8_u32(
+            vdup_n_u32(LoadChroma4(u + (x >> 1) * uvStep, uvStep)));
+        uint8x8_t v4 = vreinterpret_u8_u32(
+            vdup_n_u32(LoadChroma4(v + (x >> 1) * uvStep, uvStep)));
+        int16x8_t nu = vsubq_s16(
+            vreinterpretq_s16_u16(vmovl_u8(vzip_u8(u4, u4).val[0])), bias);
+        int16x8_t nv = vsubq_s16(
+            vreinterpretq_s16_u16(vmovl_u8(vzip_u8(v4, v4).val[0])), bias);
+
+        int32x4_t yLo = vmull_n_s16(vget_low_s16(ny), kYuvY);
+        int32x4_t yHi = vmull_n_s16(vget_high_s16(ny), kYuvY);
+        uint8x8x4_t px;
+        px.val[0] = YuvChannelNeon(
+            vmlal_n_s16(yLo, vget_low_s16(nv), kYuvRV),
+            vmlal_n_s16(yHi, vget_high_s16(nv), kYuvRV));
+        px.val[1] = YuvChannelNeon(
+            vmlsl_n_s16(vmlsl_n_s16(yLo, vget_low_s16(nv), kYuvGV),
+                        vget_low_s16(nu), kYuvGU),
+            vmlsl_n_s16(vmlsl_n_s16(yHi, vget_high_s16(nv), kYuvGV),
+                        vget_high_s16(nu), kYuvGU));
+        px.val[2] = YuvChannelNeon(
+            vmlal_n_s16(yLo, vget_low_s16(nu), kYuvBU),
+            vmlal_n_s16(yHi, vget_high_s16(nu), kYuvBU));
+        px.val[3] = vdup_n_u8(0xFF);
+        vst4_u8(dst + x * 4, px);
+    }
+    YuvToRgbaRowScalar(y + x, u + (x >> 1) * uvStep, v + (x >> 1) * uvStep,
+                       uvStep, dst + x * 4, width - x);
+}
+#endif // PIXEL_KERNELS_NEON
+
+#ifdef PIXEL_KERNELS_SSE2
+/*
+ * SSE2: 4 pixels per 128 bit register, channels handled in 32 or 16 bit
+ * lanes in place
+ */
+static void SwizzleRowSse2(const uint8_t* src, uint8_t* dst, int32_t width) {
+    const __m128i agMask = _mm_set1_epi32(0xFF00FF00);
+    const __m128i rbMask = _mm_set1_epi32(0x00FF00FF);
+    int32_t x = 0;
+    for (; x + 4 <= width; x += 4) {
+        __m128i px = _mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(src + x * 4));
+        __m128i rb = _mm_and_si128(px, rbMask);
+        rb = _mm_or_si128(_mm_slli_epi32(rb, 16), _mm_srli_epi32(rb, 16));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x * 4),
+                         _mm_or_si128(_mm_and_si128(px, agMask), rb));
+    }
+    SwizzleRowScalar(src + x * 4, dst + x * 4, width - x);
+}
+
+// 2 pixels in 16 bit lanes: color * alpha, alpha * 255, then Div255()
+static inline __m128i PremultiplyHalfSse2(__m128i px) {
+    const __m128i alphaLanes = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+    __m128i alpha = _mm_shufflehi_epi16(
+        _mm_shufflelo_epi16(px, _MM_SHUFFLE(3, 3, 3, 3)),
+        _MM_SHUFFLE(3, 3, 3, 3));
+    __m128i factor = _mm_or_si128(_mm_andnot_si128(alphaLanes, alpha),
+                                  _mm_and_si128(alphaLanes,
+                                                _mm_set1_epi16(255)));
+    __m128i t = _mm_add_epi16(_mm_mullo_epi16(px, factor),
+                              _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+static void PremultiplyRowSse2(const uint8_t* src, uint8_t* dst,
+                               int32_t width) {
+    const __m128i zero = _mm_setzero_si128();
+    int32_t x = 0;
+    for (; x + 4 <= width; x += 4) {
+        __m128i px = _mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(src + x * 4));
+        __m128i lo = PremultiplyHalfSse2(_mm_unpacklo_epi8(px, zero));
+        __m128i hi = PremultiplyHalfSse2(_mm_unpackhi_epi8(px, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x * 4),
+                         _mm_packus_epi16(lo, hi));
+    }
+    PremultiplyRowScalar(src + x * 4, dst + x * 4, width - x);
+}
+
+// 4 pixels to 565 in the low half of each 32 bit lane, sign extended
+static inline __m128i Pack565QuadSse2(__m128i px) {
+    __m128i r = _mm_slli_epi32(_mm_and_si128(px, _mm_set1_epi32(0xF8)), 8);
+    __m128i g = _mm_slli_epi32(
+        _mm_and_si128(_mm_srli_epi32(px, 10), _mm_set1_epi32(0x3F)), 5);
+    __m128i b = _mm_and_si128(_mm_srli_epi32(px, 19), _mm_set1_epi32(0x1F));
+    __m128i rgb = _mm_or_si128(_mm_or_si128(r, g), b);
+    return _mm_srai_epi32(_mm_slli_epi32(rgb, 16), 16);
+}
+
+static void PackRgb565RowSse2(const uint8_t* src, uint16_t* dst,
+                              int32_t width, const uint8_t* dither) {
+    __m128i add = dither ?
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(dither)) :
+        _mm_setzero_si128();
+    int32_t x = 0;
+    for (; x + 8 <= width; x += 8) {
+        __m128i lo = _mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(src + x * 4));
+        __m128i hi = _mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(src + x * 4 + 16));
+        lo = Pack565QuadSse2(_mm_adds_epu8(lo, add));
+        hi = Pack565QuadSse2(_mm_adds_epu8(hi, add));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x),
+                         _mm_packs_epi32(lo, hi));
+    }
+    PackRgb565RowScalar(src + x * 4, dst + x, width - x, dither);
+}
+
+// pmaddwd factors: low for the first interleaved channel, high the second
+static inline int32_t FactorPair(int32_t low, int32_t high) {
+    return static_cast<int32_t>((static_cast<uint32_t>(high) << 16) |
+                                (static_cast<uint32_t>(low) & 0xFFFF));
+}
+
+// c0 * f0 + c1 * f1 for 8 pixels, as 2 x 4 int32 >> 10, saturated to 8 bits
+static inline __m128i YuvChannelSse2(__m128i c0, __m128i c1, __m128i factors,
+                                     __m128i extraLo, __m128i extraHi) {
+    __m128i lo = _mm_add_epi32(
+        _mm_madd_epi16(_mm_unpacklo_epi16(c0, c1), factors), extraLo);
+    __m128i hi = _mm_add_epi32(
+        _mm_madd_epi16(_mm_unpackhi_epi16(c0, c1), factors), extraHi);
+    __m128i packed = _mm_packs_epi32(_mm_srai_epi32(lo, 10),
+                                     _mm_srai_epi32(hi, 10));
+    return _mm_packus_epi16(packed, packed);
+}
+
+static inline __m128i LoadChroma8Sse2(const uint8_t* c, int32_t step) {
+    __m128i c4 = _mm_cvtsi32_si128(static_cast<int>(LoadChroma4(c, step)));
+    return _mm_sub_epi16(
+        _mm_unpacklo_epi8(_mm_unpacklo_epi8(c4, c4), _mm_setzero_si128()),
+        _mm_set1_epi16(128));
+}
+
+static void YuvToRgbaRowSse2(const uint8_t* y, const uint8_t* u,
+                             const uint8_t* v, int32_t uvStep,
+                             uint8_t* dst, int32_t width) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i rFactors = _mm_set1_epi32(FactorPair(kYuvY, kYuvRV));
+    const __m128i gFactors = _mm_set1_epi32(FactorPair(kYuvY, -kYuvGV));
+    const __m128i guFactors = _mm_set1_epi32(FactorPair(-kYuvGU, 0));
+    const __m128i bFactors = _mm_set1_epi32(FactorPair(kYuvY, kYuvBU));
+    int32_t x = 0;
+    for (; x + 8 <= width; x += 8) {
+        __m128i ny = _mm_max_epi16(
+            _mm_sub_epi16(
+                _mm_unpacklo_epi8(
+                    _mm_loadl_epi64(reinterpret_cast<const __m128i*>(y + x)),
+                    zero),
+                _mm_set1_epi16(16)),
+            zero);
+        __m128i nu = LoadChroma8Sse2(u + (x >> 1) * uvStep, uvStep);
+        __m128i nv = LoadChroma8Sse2(v + (x >> 1) * uvStep, uvStep);
+
+        __m128i r = YuvChannelSse2(ny, nv, rFactors, zero, zero);
+        __m128i g = YuvChannelSse2(
+            ny, nv, gFactors,
+            _mm_madd_epi16(_mm_unpacklo_epi16(nu, zero), guFactors),
+            _mm_madd_epi16(_mm_unpackhi_epi16(nu, zero), guFactors));
+        __m128i b = YuvChannelSse2(ny, nu, bFactors, zero, zero);
+
+        __m128i rg = _mm_unpacklo_epi8(r, g);
+        __m128i ba = _mm_unpacklo_epi8(b, _mm_set1_epi8(-1));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x * 4),
+                         _mm_unpacklo_epi16(rg, ba));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x * 4 + 16),
+                         _mm_unpackhi_epi16(rg, ba));
+    }
+    YuvToRgbaRowScalar(y + x, u + (x >> 1) * uvStep, v + (x >> 1) * uvStep,
+                       uvStep, dst + x * 4, width - x);
+}
+#endif // PIXEL_KERNELS_SSE2
+
+static const PixelKernels kScalarKernels = {
+    "scalar", SwizzleRowScalar, PremultiplyRowScalar, PackRgb565RowScalar,
+    YuvToRgbaRowScalar
+};
+
+static const PixelKernels& SelectPixelKernels(void) {
+#ifdef PIXEL_KERNELS_NEON
+    static const PixelKernels kNeonKernels = {
+        "neon", SwizzleRowNeon, PremultiplyRowNeon, PackRgb565RowNeon,
+        YuvToRgbaRowNeon
+    };
+#if defined(__ANDROID__) && defined(__arm__)
+    // armeabi-v7a does not guarantee NEON, ask the CPU
+    if (!(android_getCpuFeatures() & ANDROID_CPU_ARM_FEATURE_NEON)) {
+        return kScalarKernels;
+    }
+#endif
+    return kNeonKernels;
+#elif defined(PIXEL_KERNELS_SSE2)
+    static const PixelKernels kSse2Kernels = {
+        "sse2", SwizzleRowSse2, PremultiplyRowSse2, PackRgb565RowSse2,
+        YuvToRgbaRowSse2
+    };
+    return kSse2Kernels;
+#else
+    return kScalarKernels;
+#endif
+}
+
+const PixelKernels& GetPixelKernels(void) {
+    static const PixelKernels& kernels = SelectPixelKernels();
+    return kernels;
+}
+
+const PixelKernels& GetScalarPixelKernels(void) {
+    return kScalarKernels;
+}
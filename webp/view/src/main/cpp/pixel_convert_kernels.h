@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __PIXEL_CONVERT_KERNELS_H__
+#define __PIXEL_CONVERT_KERNELS_H__
+
+#include <cstdint>
+
+/*
+ * Row kernels behind ConvertPixels(), width pixels per call. 8 bit RGBA rows
+ * are R, G, B, A in memory; RGB565 is a native uint16_t with red on top.
+ * Every vectorized kernel is bit-exact with the scalar one.
+ */
+
+// RGBA <-> BGRA: swap the first and third bytes, src may be dst
+typedef void (*SwizzleRowFunc)(const uint8_t* src, uint8_t* dst,
+                               int32_t width);
+
+// color * alpha / 255, rounded; alpha last (RGBA or BGRA), src may be dst
+typedef void (*PremultiplyRowFunc)(const uint8_t* src, uint8_t* dst,
+                                   int32_t width);
+
+/*
+ * RGBA -> RGB565. dither: nullptr, or 16 bytes added (saturated) to 4
+ * consecutive pixels before truncation, starting at the row's first pixel
+ */
+typedef void (*PackRgb565RowFunc)(const uint8_t* src, uint16_t* dst,
+                                  int32_t width, const uint8_t* dither);
+
+/*
+ * BT.601 limited range YUV -> opaque RGBA, 2x horizontally subsampled chroma:
+ * pixel x uses u[(x / 2) * uvStep] and v[(x / 2) * uvStep]
+ */
+typedef void (*YuvToRgbaRowFunc)(const uint8_t* y, const uint8_t* u,
+                                 const uint8_t* v, int32_t uvStep,
+                                 uint8_t* dst, int32_t width);
+
+struct PixelKernels {
+    const char* name_;
+    SwizzleRowFunc     swizzle_;
+    PremultiplyRowFunc premultiply_;
+    PackRgb565RowFunc  packRgb565_;
+    YuvToRgbaRowFunc   yuvToRgba_;
+};
+
+/*
+ * Kernels best fitting the running CPU, selected once at first call:
+ *   NEON on ARM, SSE2 on x86, plain C elsewhere
+ */
+const PixelKernels& GetPixelKernels(void);
+
+// Portable C kernels, also the reference for the vectorized ones
+const PixelKernels& GetScalarPixelKernels(void);
+
+#endif // __PIXEL_CONVERT_KERNELS_H__
@@ -0,0 +1,277 @@
+/*
+ * Copyright (C) The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include "webp_animation.h"
+
+// frames this short play as 100 ms, as browsers do
+static const int32_t kMinFrameDuration = 10;
+static const int32_t kShortFrameDuration = 100;
+
+WebpAnimation* WebpAnimation::Create(std::shared_ptr<const WebpInput> input,
+                                     uint32_t cacheFrames) {
+    if (!input || !input->Features().has_animation) {
+        return nullptr;
+    }
+    WebPData data = { input->Data(), input->Size() };
+    WebPDemuxer* demux = WebPDemux(&data);
+    if (!demux) {
+        return nullptr;
+    }
+    std::unique_ptr<WebpAnimation> animation(
+        new WebpAnimation(input, demux, cacheFrames));
+    if (!animation->ParseFrames()) {
+        return nullptr;
+    }
+    return animation.release();
+}
+
+WebpAnimation::WebpAnimation(std::shared_ptr<const WebpInput> input,
+                             WebPDemuxer* demux, uint32_t cacheFrames)
+    : input_(input), demux_(demux), width_(0), height_(0), loopCount_(0),
+      duration_(0), canvasIndex_(-1), cacheFrames_(cacheFrames) {
+}
+
+WebpAnimation::~WebpAnimation() {
+    WebPDemuxDelete(demux_);
+}
+
+/*
+ * ParseFrames():
+ *    read the frames geometry and timing from the container, and find the
+ *    keyframes the same way libwebp's animation decoder does
+ */
+bool WebpAnimation::ParseFrames(void) {
+    width_ = WebPDemuxGetI(demux_, WEBP_FF_CANVAS_WIDTH);
+    height_ = WebPDemuxGetI(demux_, WEBP_FF_CANVAS_HEIGHT);
+    loopCount_ = WebPDemuxGetI(demux_, WEBP_FF_LOOP_COUNT);
+    uint32_t count = WebPDemuxGetI(demux_, WEBP_FF_FRAME_COUNT);
+    if (width_ <= 0 || height_ <= 0 || !count) {
+        return false;
+    }
+
+    frames_.resize(count);
+    for (uint32_t i = 0; i < count; i++) {
+        WebPIterator iter;
+        if (!WebPDemuxGetFrame(demux_, i + 1, &iter)) {
+            return false;
+        }
+        FrameInfo& frame = frames_[i];
+        frame.start_ = duration_;
+        frame.duration_ = iter.duration <= kMinFrameDuration ?
+                          kShortFrameDuration : iter.duration;
+        frame.x_ = iter.x_offset;
+        frame.y_ = iter.y_offset;
+        frame.width_ = iter.width;
+        frame.height_ = iter.height;
+        frame.blend_ = iter.has_alpha && iter.blend_method == WEBP_MUX_BLEND;
+        frame.dispose_ = iter.dispose_method == WEBP_MUX_DISPOSE_BACKGROUND;
+        bool complete = iter.complete;
+        WebPDemuxReleaseIterator(&iter);
+        if (!complete) {
+            return false;
+        }
+        duration_ += frame.duration_;
+
+        bool full = frame.width_ == width_ && frame.height_ == height_;
+        if (!i || (!frame.blend_ && full)) {
+            frame.key_ = true;
+        } else {
+            const FrameInfo& prev = frames_[i - 1];
+            frame.key_ = prev.dispose_ &&
+                         ((prev.width_ == width_ && prev.height_ == height_) ||
+                          prev.key_);
+        }
+    }
+
+    size_t size = static_cast<size_t>(width_) * height_ * 4;
+    canvas_.reset(new uint8_t[size]);
+    blendBuf_.reset(new uint8_t[size]);
+    return true;
+}
+
+uint32_t WebpAnimation::FrameAt(int32_t timeMs) const {
+    auto next = std::upper_bound(frames_.begin(), frames_.end(), timeMs,
+                                 [](int32_t time, const FrameInfo& frame) {
+                                     return time < frame.start_;
+                                 });
+    return next == frames_.begin() ? 0 : (next - frames_.begin()) - 1;
+}
+
+/*
+ * GetFrame():
+ *    bring the canvas to frame index from the cheapest state: the cache, the
+ *    current canvas, a cached earlier canvas or the last keyframe
+ */
+const uint8_t* WebpAnimation::GetFrame(uint32_t index) {
+    if (index >= frames_.size()) {
+        return nullptr;
+    }
+    if (canvasIndex_ == index) {
+        return canvas_.get();
+    }
+
+    // latest state to composite from: cached or current, not after index
+    uint32_t key = index;
+    while (!frames_[key].key_) {
+        key--;
+    }
+    auto from = cache_.end();
+    int64_t fromIndex = canvasIndex_ <= index ? canvasIndex_ : -1;
+    for (auto it = cache_.begin(); it != cache_.end(); ++it) {
+        if (it->index_ <= index && it->index_ > fromIndex) {
+            from = it;
+            fromIndex = it->index_;
+        }
+    }
+
+    if (from != cache_.end()) {
+        // exchange with the current canvas, which is cached instead
+        std::swap(from->pixels_, canvas_);
+        if (canvasIndex_ < 0) {
+            cache_.erase(from);
+        } else {
+            from->index_ = canvasIndex_;
+            cache_.splice(cache_.begin(), cache_, from);
+        }
+        canvasIndex_ = fromIndex;
+        if (fromIndex == index) {
+            return canvas_.get();
+        }
+    }
+
+    uint32_t next;
+    if (fromIndex >= key) {
+        next = canvasIndex_ + 1;
+    } else {
+        CacheCanvas();
+        memset(canvas_.get(), 0, static_cast<size_t>(width_) * height_ * 4);
+        next = key;
+    }
+    for (uint32_t i = next; i <= index; i++) {
+        if (i != key) {
+            // canvas_ holds frame i - 1: keep it if displayed or a keyframe
+            if (i == next || frames_[i - 1].key_) {
+                CacheCanvas();
+            }
+            const FrameInfo& prev = frames_[i - 1];
+            if (prev.dispose_) {
+                ClearRect(prev.x_, prev.y_, prev.width_, prev.height_);
+            }
+        }
+        if (!CompositeFrame(i)) {
+            canvasIndex_ = -1;
+            return nullptr;
+        }
+        canvasIndex_ = i;
+    }
+    return canvas_.get();
+}
+
+/*
+ * CompositeFrame():
+ *    decode frame index onto the canvas: in place if it replaces its
+ *    rectangle, through blendBuf_ if it is alpha blended
+ */
+bool WebpAnimation::CompositeFrame(uint32_t index) {
+    const FrameInfo& frame = frames_[index];
+    WebPIterator iter;
+    if (!WebPDemuxGetFrame(demux_, index + 1, &iter)) {
+        return false;
+    }
+    int32_t stride = width_ * 4;
+    uint8_t* dst = canvas_.get() + frame.y_ * stride + frame.x_ * 4;
+    uint8_t* decoded;
+    if (!frame.blend_) {
+        size_t size = (frame.height_ - 1) * stride + frame.width_ * 4;
+        decoded = WebPDecodeRGBAInto(iter.fragment.bytes, iter.fragment.size,
+                                     dst, size, stride);
+    } else {
+        size_t size = frame.height_ * frame.width_ * 4;
+        decoded = WebPDecodeRGBAInto(iter.fragment.bytes, iter.fragment.size,
+                                     blendBuf_.get(), size, frame.width_ * 4);
+    }
+    WebPDemuxReleaseIterator(&iter);
+    if (!decoded) {
+        return false;
+    }
+    if (!frame.blend_) {
+        return true;
+    }
+
+    // non premultiplied "src over dst", as libwebp's animation decoder
+    const uint8_t* src = blendBuf_.get();
+    for (int32_t y = 0; y < frame.height_; y++) {
+        uint8_t* d = dst + y * stride;
+        for (int32_t x = 0; x < frame.width_; x++, src += 4, d += 4) {
+            uint32_t srcA = src[3];
+            if (!srcA) {
+                continue;
+            }
+            uint32_t dstA = (d[3] * (256 - srcA)) >> 8;
+            uint32_t blendA = srcA + dstA;
+            uint32_t scale = (1u << 24) / blendA;
+            for (int c = 0; c < 3; c++) {
+                d[c] = static_cast<uint8_t>(
+                    ((src[c] * srcA + d[c] * dstA) * scale) >> 24);
+            }
+            d[3] = static_cast<uint8_t>(blendA);
+        }
+    }
+    return true;
+}
+
+void WebpAnimation::ClearRect(int32_t x, int32_t y,
+                              int32_t width, int32_t height) {
+    int32_t stride = width_ * 4;
+    uint8_t* dst = canvas_.get() + y * stride + x * 4;
+    for (int32_t row = 0; row < height; row++, dst += stride) {
+        memset(dst, 0, width * 4);
+    }
+}
+
+/*
+ * CacheCanvas():
+ *    copy the current canvas into the cache, evicting the least recently used
+ *    canvas that is not a keyframe first
+ */
+void WebpAnimation::CacheCanvas(void) {
+    if (!cacheFrames_ || canvasIndex_ < 0) {
+        return;
+    }
+    for (auto& cached : cache_) {
+        if (cached.index_ == canvasIndex_) {
+            return;
+        }
+    }
+    size_t size = static_cast<size_t>(width_) * height_ * 4;
+    if (cache_.size() < cacheFrames_) {
+        cache_.emplace_front();
+        cache_.front().pixels_.reset(new uint8_t[size]);
+    } else {
+        auto victim = std::prev(cache_.end());
+        for (auto it = cache_.rbegin(); it != cache_.rend(); ++it) {
+            if (!frames_[it->index_].key_) {
+                victim = std::prev(it.base());
+                break;
+            }
+        }
+        cache_.splice(cache_.begin(), cache_, victim);
+    }
+    cache_.front().index_ = static_cast<uint32_t>(canvasIndex_);
+    memcpy(cache_.front().pixels_.get(), canvas_.get(), size);
+}
@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __WEBP_ANIMATION_H__
+#define __WEBP_ANIMATION_H__
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <vector>
+#include <webp/demux.h>
+#include "webp_input_cache.h"
+
+/*
+ * Animated webp (ANIM/ANMF) frame source:
+ *     Frames are demuxed from the resident input and composited onto a canvas
+ *     of the animation size, RGBA non premultiplied, honoring each frame's
+ *     offset, alpha blending and disposal. Any frame can be reached in any
+ *     order: compositing restarts from the closest keyframe (a frame that does
+ *     not depend on the previous canvas) or from a later cached canvas.
+ *     The last displayed canvases are kept in a bounded cache where keyframes
+ *     are evicted last, so a short animation loops without decoding and a seek
+ *     never goes back further than one keyframe interval.
+ *     Frame timestamps are in milliseconds from the start of a loop.
+ */
+class WebpAnimation {
+  public:
+    static const uint32_t kDefaultCacheFrames = 8;
+
+    // nullptr if input is not an animation
+    static WebpAnimation* Create(std::shared_ptr<const WebpInput> input,
+                                 uint32_t cacheFrames = kDefaultCacheFrames);
+    ~WebpAnimation();
+
+    int32_t  CanvasWidth(void) const { return width_; }
+    int32_t  CanvasHeight(void) const { return height_; }
+    uint32_t FrameCount(void) const { return frames_.size(); }
+    // 0: forever
+    uint32_t LoopCount(void) const { return loopCount_; }
+    int32_t  LoopDuration(void) const { return duration_; }
+
+    int32_t  FrameStart(uint32_t index) const { return frames_[index].start_; }
+    int32_t  FrameDuration(uint32_t index) const {
+        return frames_[index].duration_;
+    }
+    bool     IsKeyFrame(uint32_t index) const { return frames_[index].key_; }
+
+    // frame on display timeMs into the loop
+    uint32_t FrameAt(int32_t timeMs) const;
+
+    /*
+     * Canvas of frame index, width * 4 bytes per row, nullptr on decode
+     * error. Valid until the next call.
+     */
+    const uint8_t* GetFrame(uint32_t index);
+
+  private:
+    struct FrameInfo {
+        int32_t start_, duration_;
+        int32_t x_, y_, width_, height_;
+        bool    blend_;      // alpha blend over the canvas, or replace
+        bool    dispose_;    // cleared to transparent before the next frame
+        bool    key_;
+    };
+    struct CachedCanvas {
+        uint32_t index_;
+        std::unique_ptr<uint8_t[]> pixels_;
+    };
+
+    WebpAnimation(std::shared_ptr<const WebpInput> input, WebPDemuxer* demux,
+                  uint32_t cacheFrames);
+    bool     ParseFrames(void);
+    bool     CompositeFrame(uint32_t index);
+    void     ClearRect(int32_t x, int32_t y, int32_t width, int32_t height);
+    void     CacheCanvas(void);
+
+    std::shared_ptr<const WebpInput> input_;
+    WebPDemuxer* demux_;
+    int32_t  width_, height_;
+    uint32_t loopCount_;
+    int32_t  duration_;
+    std::vector<FrameInfo> frames_;
+
+    // canvas_ holds frame canvasIndex_ (-1 if none)
+    std::unique_ptr<uint8_t[]> canvas_;
+    int64_t  canvasIndex_;
+    std::unique_ptr<uint8_t[]> blendBuf_;
+
+    // most recently used first
+    uint32_t cacheFrames_;
+    std::list<CachedCanvas> cache_;
+};
+#endif // __WEBP_ANIMATION_H__
@@ -13,181 +13,320 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include <algorithm>
 #include <cassert>
-#include <pthread.h>
+#include <cstring>
 #include <webp/decode.h>
 #include "webp_decode.h"
 
 WebpDecoder::WebpDecoder(const char** files, uint32_t count,
                          DecodeSurfaceDescriptor* frameBuf,
-                         AAssetManager* assetMgr)
-    : assetMgr_(assetMgr),
-      buf_(nullptr), stopPending_(false),
-      state_(state_idle), worker_(nullptr) {
-    for (auto i = 0; i < count; i++) {
-        files_.push(files[i]);
-    }
-    if (count && assetMgr && frameBuf) {
-        bufInfo_ = *frameBuf;
-        switch (bufInfo_.format_) {
-            case SurfaceFormat::SURFACE_FORMAT_RGB_565:
-                bytePerPix_ = 2;
-                break;
-            case SurfaceFormat::SURFACE_FORMAT_RGBA_8888:
-            case SurfaceFormat::SURFACE_FORMAT_RGBX_8888:
-                bytePerPix_ = 4;
-                break;
-            default:
-                assert(0);
-                return;
-        }
-        // allocate a private decode buffer
-        uint32_t size = bufInfo_.height_ * bufInfo_.stride_ * bytePerPix_;
-        buf_ = new uint8_t [size];
-        assert(buf_);
+                         WebpInputCache* inputCache,
+                         uint32_t threadCount,
+                         uint32_t prefetchCount)
+    : inputCache_(inputCache), files_(files, files + count), nextFile_(0),
+      bytePerPix_(0), lastGoodFile_(nullptr), slotCount_(0), displaySlot_(0), stopping_(false) {
+    if (!count || !inputCache || !frameBuf || (prefetchCount && !threadCount)) {
+        assert(0);
+        return;
+    }
+    bufInfo_ = *frameBuf;
+    switch (bufInfo_.format_) {
+        case SurfaceFormat::SURFACE_FORMAT_RGB_565:
+            bytePerPix_ = 2;
+            break;
+        case SurfaceFormat::SURFACE_FORMAT_RGBA_8888:
+        case SurfaceFormat::SURFACE_FORMAT_RGBX_8888:
+            bytePerPix_ = 4;
+            break;
+        default:
+            assert(0);
+            return;
+    }
+    if (!prefetchCount) {
+        // incremental mode: the caller provides the frame buffers
+        return;
+    }
+
+    // allocate the private decode buffers once, they are recycled forever
+    uint32_t size = bufInfo_.height_ * bufInfo_.stride_ * bytePerPix_;
+    slotCount_ = prefetchCount;
+    slots_.reset(new FrameSlot[slotCount_]);
+    for (uint32_t i = 0; i < slotCount_; i++) {
+        slots_[i].buf_ = new uint8_t [size];
+        slots_[i].file_ = nullptr;
+        slots_[i].state_.store(state_idle, std::memory_order_relaxed);
+        QueueDecode(i);
+    }
+    for (uint32_t i = 0; i < threadCount; i++) {
+        workers_.emplace_back(&WebpDecoder::DecodeLoop, this);
     }
 }
 
 /*
- * GetDecodedFrame():  return decoded frame if available,
+ * GetDecodedFrame():  return the next frame to display if it is decoded,
  *                     return nullptr otherwise
  */
 uint8_t* WebpDecoder::GetDecodedFrame(void) {
-    return (state_ == state_ready ? buf_ : nullptr);
+    if (!slotCount_) {
+        return nullptr;
+    }
+    // skip pictures that failed to decode, one round at most
+    for (uint32_t i = 0; i < slotCount_; i++) {
+        FrameSlot& slot = slots_[displaySlot_];
+        DecodeState state = slot.state_.load(std::memory_order_acquire);
+        if (state == state_ready) {
+            return slot.buf_;
+        }
+        if (state != state_failed) {
+            break;
+        }
+        ReleaseFrame();
+    }
+    return nullptr;
 }
 
 /*
- * DecodeFrame():
- *    thread function to decode a picture
- *    directly pass through to internal decoding function
+ * TakeAnimation():
+ *    the animations are known once their turn comes in the prefetch ring, or
+ *    from the cached input features in incremental mode
  */
-void* DecodeFrame(void * decoder) {
-    reinterpret_cast<WebpDecoder*>(decoder)->DecodeFrameInternal();
-    return nullptr;
+const char* WebpDecoder::TakeAnimation(void) {
+    if (!slotCount_) {
+        if (!bytePerPix_) {
+            return nullptr;
+        }
+        std::shared_ptr<const WebpInput> input =
+            inputCache_->Get(files_[nextFile_]);
+        if (!input || !input->Features().has_animation) {
+            return nullptr;
+        }
+        return NextFile();
+    }
+    FrameSlot& slot = slots_[displaySlot_];
+    if (slot.state_.load(std::memory_order_acquire) != state_animated) {
+        return nullptr;
+    }
+    const char* file = slot.file_;
+    ReleaseFrame();
+    return file;
+}
+
+/*
+ * ReleaseFrame():
+ *    the current frame is on the display, its buffer goes to the picture
+ *    prefetchCount after it
+ */
+void WebpDecoder::ReleaseFrame(void) {
+    if (!slotCount_) {
+        return;
+    }
+    QueueDecode(displaySlot_);
+    displaySlot_ = (displaySlot_ + 1) % slotCount_;
+}
+
+const char* WebpDecoder::NextFile(void) {
+    const char* file = files_[nextFile_];
+    nextFile_ = (nextFile_ + 1) % files_.size();
+    return file;
+}
+
+void WebpDecoder::QueueDecode(uint32_t slot) {
+    slots_[slot].file_ = NextFile();
+    slots_[slot].state_.store(state_decoding, std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> lock(jobLock_);
+    jobs_.push_back(slot);
+    jobCond_.notify_one();
+}
+
+/*
+ * DecodeLoop():
+ *    worker thread function: decode the queued slots until the decoder is
+ *    destroyed
+ */
+void WebpDecoder::DecodeLoop(void) {
+    while (true) {
+        uint32_t slot;
+        {
+            std::unique_lock<std::mutex> lock(jobLock_);
+            jobCond_.wait(lock, [this] { return stopping_ || !jobs_.empty(); });
+            if (stopping_) {
+                return;
+            }
+            slot = jobs_.front();
+            jobs_.pop_front();
+        }
+        FrameSlot& frame = slots_[slot];
+        frame.state_.store(DecodeFrameInternal(frame.file_, frame.buf_),
+                           std::memory_order_release);
+    }
 }
 
 /*
  * DecodeFrameInternal():
- *    Main decoding function from app side, and executing inside its own thread
+ *    Decode one picture into dst, executing inside a worker thread.
+ *    The memory layout and size of dst are the same as andriod native
+ *    window to save copying when possible; the decoded frames are scaled
+ *    up/down by webp decoder to fix the display window size.
  */
-void WebpDecoder::DecodeFrameInternal() {
-    const char * webpFile = files_.front();
-    files_.pop();
-    files_.push(webpFile);
-
-    AAsset* frameFile = AAssetManager_open(assetMgr_, webpFile, AASSET_MODE_BUFFER);
-    assert(frameFile != NULL);
-    int32_t len = AAsset_getLength(frameFile);
-    uint8_t *buf = new uint8_t[len];
-    assert(buf);
-    len = AAsset_read(frameFile, buf, len);
-    assert(len > 0);
-    AAsset_close(frameFile);
+DecodeState WebpDecoder::DecodeFrameInternal(const char* webpFile,
+                                             uint8_t* dst) {
+    std::shared_ptr<const WebpInput> input = inputCache_->Get(webpFile);
+    assert(input);
+    if (!input) {
+        return state_failed;
+    }
+    if (input->Features().has_animation) {
+        return state_animated;
+    }
 
     WebPDecoderConfig config;
-    if (!WebPInitDecoderConfig(&config)) {
-        assert(0);
+    if (!InitDecoderConfig(*input, dst, bufInfo_.stride_, &config)) {
+        return state_failed;
     }
+    VP8StatusCode status = WebPDecode(input->Data(), input->Size(), &config);
+    WebPFreeDecBuffer(&config.output);
 
-    VP8StatusCode  status = WebPGetFeatures(buf, len, &config.input);
     assert(status == VP8_STATUS_OK);
+    return status == VP8_STATUS_OK ? state_ready : state_failed;
+}
+
+/*
+ * InitDecoderConfig():
+ *    decode options shared by both modes: the picture is scaled to the surface
+ *    size and written in its pixel format at dst, stride in pixels
+ */
+bool WebpDecoder::InitDecoderConfig(const WebpInput& input, uint8_t* dst,
+                                    int32_t stride,
+                                    WebPDecoderConfig* config) {
+    if (!WebPInitDecoderConfig(config)) {
+        assert(0);
+        return false;
+    }
+    config->input = input.Features();
 
     // let's decode it into a buffer ...
-    config.options.bypass_filtering = 1;
-    config.options.no_fancy_upsampling = 1;
-    config.options.flip = 0;
-    config.options.use_scaling = 1;
-    config.options.scaled_width = bufInfo_.width_;
-    config.options.scaled_height = bufInfo_.height_;
+    config->options.bypass_filtering = 1;
+    config->options.no_fancy_upsampling = 1;
+    config->options.flip = 0;
+    config->options.use_scaling = 1;
+    config->options.scaled_width = bufInfo_.width_;
+    config->options.scaled_height = bufInfo_.height_;
 
     // this does not seems to have difference on Nexus 5
-    config.options.use_threads = 1;
+    config->options.use_threads = 1;
     switch (bufInfo_.format_) {
         case SurfaceFormat::SURFACE_FORMAT_RGB_565:
-            config.output.colorspace = MODE_RGB_565;
+            config->output.colorspace = MODE_RGB_565;
             break;
         case SurfaceFormat::SURFACE_FORMAT_RGBA_8888:
         case SurfaceFormat::SURFACE_FORMAT_RGBX_8888:
-            config.output.colorspace = MODE_RGBA;
+            config->output.colorspace = MODE_RGBA;
             break;
         default:
             assert( 0 );
-            delete  [] buf;
-            return;
+            return false;
     }
-    config.output.width = bufInfo_.width_;
-    config.output.height = bufInfo_.height_;
-    config.output.is_external_memory = 1;
-    config.output.private_memory = reinterpret_cast<uint8_t*>(buf_);
-    config.output.u.RGBA.stride = bufInfo_.stride_ * bytePerPix_;
-    config.output.u.RGBA.rgba  = config.output.private_memory;
-    config.output.u.RGBA.size  = config.output.height *
-                                 config.output.u.RGBA.stride;
-
-    status = WebPDecode(buf, len, &config);
-    WebPFreeDecBuffer(&config.output);
-    delete [] buf;
+    config->output.width = bufInfo_.width_;
+    config->output.height = bufInfo_.height_;
+    config->output.is_external_memory = 1;
+    config->output.private_memory = dst;
+    config->output.u.RGBA.stride = stride * bytePerPix_;
+    config->output.u.RGBA.rgba  = config->output.private_memory;
+    config->output.u.RGBA.size  = config->output.height *
+                                  config->output.u.RGBA.stride;
+    return true;
+}
 
-    // only change state when it is decoded OK. Our small decoder engine will be
-    // in decoding state when error happens
-    assert(status == VP8_STATUS_OK);
-    if (status == VP8_STATUS_OK) {
-        state_ = state_ready;
+/*
+ * DecodeNextFrame():
+ *    Incremental mode, decode the next picture of the rotation into dst on
+ *    the calling thread. When that fails dst may hold some of its rows, or
+ *    whatever the window buffer held before: the last good picture is
+ *    decoded over them so the caller can post dst either way.
+ */
+bool WebpDecoder::DecodeNextFrame(uint8_t* dst, int32_t stride,
+                                  DecodeRowsCallback onRows, void* ctx) {
+    assert(!slotCount_);
+    if (!bytePerPix_ || slotCount_ || !dst) {
+        return false;
+    }
+    const char* file = NextFile();
+    std::shared_ptr<const WebpInput> input = inputCache_->Get(file);
+    if (input && DecodeIncremental(*input, dst, stride, onRows, ctx)) {
+        lastGoodFile_ = file;
+        return true;
     }
 
-    delete worker_;
-    worker_ = nullptr;
-
-    // if we were asked to release while we are busy decoding (at this point,
-    // this is dangling pointer), we perform the release here to complete the
-    // request.
-    if (stopPending_) {
-        stopPending_ = false;
-        delete  this;
+    input = lastGoodFile_ ? inputCache_->Get(lastGoodFile_) : nullptr;
+    if (!input || !DecodeIncremental(*input, dst, stride, nullptr, nullptr)) {
+        for (int32_t row = 0; row < bufInfo_.height_; row++) {
+            memset(dst + row * stride * bytePerPix_, 0,
+                   bufInfo_.width_ * bytePerPix_);
+        }
     }
+    return false;
 }
 
 /*
- * DecodeFrame(void):
- *     Start to decode a picture into internal frame memory
- *     The internal memory layout and size are the same as andriod native
- *     window to save copying when possible.
- *
- *     The decoded frames are scaled up/down by webp decoder to fix the display
- *     window size.
+ * DecodeIncremental():
+ *    The compressed input is handed to the incremental decoder
+ *    kIncrementalChunk bytes at a time, and onRows is called each time more
+ *    rows of dst are final, so they can be presented before the rest of the
+ *    picture is decoded.
  */
-bool WebpDecoder::DecodeFrame(void) {
-    if (state_ == state_decoding)
+bool WebpDecoder::DecodeIncremental(const WebpInput& input, uint8_t* dst,
+                                    int32_t stride, DecodeRowsCallback onRows,
+                                    void* ctx) {
+    WebPDecoderConfig config;
+    if (!InitDecoderConfig(input, dst, stride, &config)) {
+        return false;
+    }
+    WebPIDecoder* idec = WebPIDecode(nullptr, 0, &config);
+    if (!idec) {
         return false;
-    pthread_t       worker_;
-    pthread_attr_t  attrib;
-    pthread_attr_init( &attrib);
-    pthread_attr_setdetachstate(&attrib, PTHREAD_CREATE_DETACHED);
-    int status = pthread_create(&worker_, &attrib, ::DecodeFrame, this);
-    pthread_attr_destroy(&attrib);
-
-    if (status == 0) {
-        state_ = state_decoding;
-        return true;
     }
 
-    // create thread failed...
-    assert(false);
-    return false;
+    // the input is resident: let the decoder read it in place, growing
+    VP8StatusCode status = VP8_STATUS_SUSPENDED;
+    int32_t rows = 0;
+    size_t fed = 0;
+    while (status == VP8_STATUS_SUSPENDED && fed < input.Size()) {
+        fed = std::min(fed + kIncrementalChunk, input.Size());
+        status = WebPIUpdate(idec, input.Data(), fed);
+        int lastRow = 0;
+        if (!WebPIDecGetRGB(idec, &lastRow, nullptr, nullptr, nullptr) ||
+            lastRow <= rows) {
+            continue;
+        }
+        if (onRows) {
+            onRows(ctx, rows, lastRow);
+        }
+        rows = lastRow;
+    }
+    WebPIDelete(idec);
+    WebPFreeDecBuffer(&config.output);
+    return status == VP8_STATUS_OK;
 }
 
 /*
  * DestroyDecoder(void):
- *     Self-delete if decoder is idle
- *     Otherwise set up a flag to let decoding thread perform self-delete when
- *     it finishes. Upon returning from the function, the class pointer is invalid
+ *     Drop the queued decodes, wait for the ones in progress and delete the
+ *     decoder. Upon returning from the function, the class pointer is invalid
  *     and should not be used
  */
 bool WebpDecoder::DestroyDecoder(void) {
-    if (state_ == state_decoding) {
-        stopPending_ = true;
-        return false;
+    {
+        std::lock_guard<std::mutex> lock(jobLock_);
+        stopping_ = true;
+        jobs_.clear();
+    }
+    jobCond_.notify_all();
+    for (auto& worker : workers_) {
+        worker.join();
     }
+    workers_.clear();
 
     delete this;
     return true;
@@ -197,7 +336,7 @@ bool WebpDecoder::DestroyDecoder(void) {
  * private destructor prevent object directly call delete
  */
 WebpDecoder::~WebpDecoder() {
-    if (buf_)  delete [] buf_;
-    buf_ = nullptr;
+    for (uint32_t i = 0; i < slotCount_; i++) {
+        delete [] slots_[i].buf_;
+    }
 }
-
@@ -15,10 +15,18 @@
  */
 #ifndef __WEBP_DECODE_H__
 #define __WEBP_DECODE_H__
-#include <queue>
-#include <android/asset_manager.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "webp_input_cache.h"
 
-enum DecodeState { state_idle, state_decoding, state_ready};
+enum DecodeState {
+    state_idle, state_decoding, state_ready, state_failed, state_animated
+};
 enum class SurfaceFormat : unsigned int {
     SURFACE_FORMAT_RGBA_8888,
     SURFACE_FORMAT_RGBX_8888,
@@ -33,41 +41,100 @@ struct DecodeSurfaceDescriptor {
 
 /*
  * Webp decoder wrapper:
- *     Select a picture to decode in its own thread. The thread is deleted
- *     once a picture is decoded into its internal memory. The next picture
- *     will be decoded when:
- *       - the decoded frame is retrieved
- *       - Another DecodeFrame() is called [this is trigger]
+ *     A pool of long-lived worker threads decodes pictures ahead of display:
+ *     the next prefetchCount pictures of the files rotation are decoded into
+ *     a ring of as many preallocated frame buffers, in display order.
+ *       - GetDecodedFrame() polls the next picture, it never waits on decode
+ *       - ReleaseFrame() hands that picture's buffer back once it is
+ *         displayed; the buffer is queued to decode the picture
+ *         prefetchCount ahead
+ *     With prefetchCount 0 the decoder runs in incremental mode instead: no
+ *     thread nor frame buffer is created, DecodeNextFrame() decodes the next
+ *     picture on the calling thread straight into the caller's buffer (the
+ *     locked window) as its input is fed to libwebp's incremental decoder,
+ *     reporting rows as they complete. For large surfaces, where the copy
+ *     and the private frames cost more than the decode latency.
+ *     Animated pictures are not decoded: TakeAnimation() hands them over when
+ *     they are next in the rotation, to be played with WebpAnimation.
+ *    The compressed pictures come from inputCache, which must outlive the
+ *    decoder; it is kept across decoders so a new one starts warm.
  *    when display format changes, call DestroyDecoder() to release this decoder
  *    and allocate a new deocder object.
  */
+// rows [firstRow, endRow) of the destination are decoded
+typedef void (*DecodeRowsCallback)(void* ctx, int32_t firstRow, int32_t endRow);
+
 class WebpDecoder {
   public:
+    static const uint32_t kDefaultThreadCount = 2;
+    static const uint32_t kDefaultPrefetchCount = 3;
+    static const size_t   kIncrementalChunk = 8 * 1024;
+
     explicit WebpDecoder(const char** files, uint32_t count,
                          DecodeSurfaceDescriptor* surfDesc,
-                         AAssetManager* assetMgr);
-    // Start decode a picture
-    bool     DecodeFrame(void);
+                         WebpInputCache* inputCache,
+                         uint32_t threadCount = kDefaultThreadCount,
+                         uint32_t prefetchCount = kDefaultPrefetchCount);
 
-    // Poll to see if a picture is decoded and ready to be used/displayed
+    // Poll to see if the next picture is decoded and ready to be used/displayed
     uint8_t *GetDecodedFrame(void);
 
-    // WebpDecoder internal decoding function, no called from user
-    void     DecodeFrameInternal(void);
+    // The picture from GetDecodedFrame() is displayed, recycle its buffer
+    void     ReleaseFrame(void);
+
+    // if the next picture is an animation, skip it and return its file
+    const char* TakeAnimation(void);
+
+    /*
+     * incremental mode: decode the next picture into dst, stride in pixels.
+     * false if it failed: dst then holds the last picture decoded fine
+     * again (black if none was), never a partially decoded one
+     */
+    bool     DecodeNextFrame(uint8_t* dst, int32_t stride,
+                             DecodeRowsCallback onRows, void* ctx);
 
-    // Release this decoder after usage
+    // Release this decoder after usage: pending decodes are cancelled
     bool     DestroyDecoder(void);
 
   private:
+    struct FrameSlot {
+        uint8_t*    buf_;
+        const char* file_;
+        std::atomic<DecodeState> state_;
+    };
+
+    // WebpDecoder internal decoding functions, run by the workers
+    void     DecodeLoop(void);
+    DecodeState DecodeFrameInternal(const char* file, uint8_t* dst);
+    bool     InitDecoderConfig(const WebpInput& input, uint8_t* dst,
+                               int32_t stride, WebPDecoderConfig* config);
+    bool     DecodeIncremental(const WebpInput& input, uint8_t* dst,
+                               int32_t stride, DecodeRowsCallback onRows,
+                               void* ctx);
+
+    // give the slot the next file of the rotation and queue it for decoding
+    void     QueueDecode(uint32_t slot);
+    const char* NextFile(void);
+
     DecodeSurfaceDescriptor bufInfo_;
-    AAssetManager*          assetMgr_;
-    std::queue<const char*> files_;
-    uint8_t*  buf_;
-    bool      stopPending_;
-    DecodeState state_;
-
-    uint32_t   bytePerPix_;
-    pthread_t* worker_;
+    WebpInputCache*         inputCache_;
+    std::vector<const char*> files_;
+    uint32_t  nextFile_;
+    uint32_t  bytePerPix_;
+    const char* lastGoodFile_;  // incremental mode
+
+    // ring of decode buffers; displaySlot_ is only used by the display side
+    std::unique_ptr<FrameSlot[]> slots_;
+    uint32_t  slotCount_;
+    uint32_t  displaySlot_;
+
+    // slots waiting for a worker, in display order
+    std::mutex               jobLock_;
+    std::condition_variable  jobCond_;
+    std::deque<uint32_t>     jobs_;
+    bool                     stopping_;
+    std::vector<std::thread> workers_;
+
     /*
      * private destructor prevent object directly call delete
      */
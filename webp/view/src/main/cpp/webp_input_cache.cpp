@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "webp_input_cache.h"
+
+WebpInput::~WebpInput() {
+    if (asset_) {
+        AAsset_close(asset_);
+    }
+}
+
+WebpInputCache::WebpInputCache(AAssetManager* assetMgr, size_t budget)
+    : assetMgr_(assetMgr), budget_(budget) {
+    stats_.hits_ = stats_.misses_ = stats_.evictions_ = 0;
+    stats_.residentBytes_ = 0;
+}
+
+std::shared_ptr<const WebpInput> WebpInputCache::Get(const char* file) {
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        auto it = index_.find(file);
+        if (it != index_.end()) {
+            lru_.splice(lru_.begin(), lru_, it->second);
+            stats_.hits_++;
+            return it->second->second;
+        }
+        stats_.misses_++;
+    }
+
+    // open and parse without holding the lock: other workers keep hitting
+    std::shared_ptr<WebpInput> input = Load(file);
+    if (!input) {
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock(lock_);
+    auto it = index_.find(file);
+    if (it != index_.end()) {
+        // another worker loaded it meanwhile, keep a single copy
+        lru_.splice(lru_.begin(), lru_, it->second);
+        return it->second->second;
+    }
+    lru_.emplace_front(file, input);
+    index_[file] = lru_.begin();
+    stats_.residentBytes_ += input->Size();
+    Evict();
+    return input;
+}
+
+/*
+ * Load():
+ *    map the asset, fall back to a private copy if the asset manager can not
+ *    provide a buffer for it
+ */
+std::shared_ptr<WebpInput> WebpInputCache::Load(const char* file) {
+    std::shared_ptr<WebpInput> input(new WebpInput);
+    input->asset_ = AAssetManager_open(assetMgr_, file, AASSET_MODE_BUFFER);
+    if (!input->asset_) {
+        return nullptr;
+    }
+    off_t len = AAsset_getLength(input->asset_);
+    if (len <= 0) {
+        return nullptr;
+    }
+    input->size_ = static_cast<size_t>(len);
+    input->data_ = static_cast<const uint8_t*>(AAsset_getBuffer(input->asset_));
+    if (!input->data_) {
+        input->copy_.reset(new uint8_t[input->size_]);
+        if (AAsset_read(input->asset_, input->copy_.get(), input->size_) != len) {
+            return nullptr;
+        }
+        input->data_ = input->copy_.get();
+        AAsset_close(input->asset_);
+        input->asset_ = nullptr;
+    }
+
+    if (WebPGetFeatures(input->data_, input->size_, &input->features_) !=
+        VP8_STATUS_OK) {
+        return nullptr;
+    }
+    return input;
+}
+
+/*
+ * Evict():
+ *    drop the least recently used files until the budget is met; the most
+ *    recent one always stays. Called with lock_ held
+ */
+void WebpInputCache::Evict(void) {
+    while (stats_.residentBytes_ > budget_ && lru_.size() > 1) {
+        stats_.residentBytes_ -= lru_.back().second->Size();
+        index_.erase(lru_.back().first);
+        lru_.pop_back();
+        stats_.evictions_++;
+    }
+}
+
+WebpInputCacheStats WebpInputCache::GetStats(void) {
+    std::lock_guard<std::mutex> lock(lock_);
+    return stats_;
+}
@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __WEBP_INPUT_CACHE_H__
+#define __WEBP_INPUT_CACHE_H__
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <android/asset_manager.h>
+#include <webp/decode.h>
+
+/*
+ * Compressed webp file held in memory, with its parsed bitstream header.
+ * The bytes stay valid as long as the caller holds the shared pointer, even
+ * if the cache evicts the file meanwhile.
+ */
+class WebpInput {
+  public:
+    ~WebpInput();
+
+    const uint8_t* Data(void) const { return data_; }
+    size_t         Size(void) const { return size_; }
+    const WebPBitstreamFeatures& Features(void) const { return features_; }
+
+  private:
+    friend class WebpInputCache;
+    WebpInput() : asset_(nullptr), data_(nullptr), size_(0) {}
+
+    AAsset*        asset_;     // open while data_ is its mapped buffer
+    std::unique_ptr<uint8_t[]> copy_;  // when the asset could not be mapped
+    const uint8_t* data_;
+    size_t         size_;
+    WebPBitstreamFeatures features_;
+};
+
+struct WebpInputCacheStats {
+    uint64_t hits_, misses_, evictions_;
+    size_t   residentBytes_;
+};
+
+/*
+ * Input side cache of the slideshow files:
+ *    Files are opened in AASSET_MODE_BUFFER and used through
+ *    AAsset_getBuffer(): uncompressed assets are mmap-ed straight from the apk,
+ *    so nothing is allocated or copied per decode; the compressed ones are
+ *    inflated once by the asset manager. WebPGetFeatures() runs once per file.
+ *    Files stay resident up to budget bytes, the least recently used ones are
+ *    evicted first. Safe to call from several decode threads.
+ */
+class WebpInputCache {
+  public:
+    static const size_t kDefaultBudget = 8 * 1024 * 1024;
+
+    explicit WebpInputCache(AAssetManager* assetMgr,
+                            size_t budget = kDefaultBudget);
+
+    // nullptr if the file can not be opened or is not a webp picture
+    std::shared_ptr<const WebpInput> Get(const char* file);
+
+    WebpInputCacheStats GetStats(void);
+
+  private:
+    std::shared_ptr<WebpInput> Load(const char* file);
+    void     Evict(void);
+
+    AAssetManager* assetMgr_;
+    size_t         budget_;
+
+    // most recently used file first
+    typedef std::pair<std::string, std::shared_ptr<WebpInput>> Entry;
+    std::mutex lock_;
+    std::list<Entry> lru_;
+    std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+    WebpInputCacheStats stats_;
+};
+#endif // __WEBP_INPUT_CACHE_H__
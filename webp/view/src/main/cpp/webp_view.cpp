@@ -14,11 +14,16 @@
  * limitations under the License.
  */
 
+#include <algorithm>
 #include <cstdio>
 #include <cassert>
+#include <memory>
+#include <vector>
 #include <android/native_window.h>
 #include <android_native_app_glue.h>
 #include <android/log.h>
+#include "pixel_convert.h"
+#include "webp_animation.h"
 #include "webp_decode.h"
 
 #define  LOG_TAG    "libwebp-view"
@@ -39,6 +44,16 @@ const char * frames[] = {
 const int kFRAME_COUNT = sizeof(frames) / sizeof(frames[0]);
 const int kFRAME_DISPLAY_TIME = 2;
 
+/*
+ * surfaces of at least that many pixels decode incrementally into the window
+ * instead of prefetching: each prefetched frame costs a full surface of memory
+ * and one extra copy
+ */
+const int32_t kINCREMENTAL_DECODE_PIXELS = 1920 * 1200;
+
+// threads converting the animation frames into the window format
+const uint32_t kCONVERT_THREADS = 2;
+
 /*
  * main object handles Android window frame update, and use webp to decode
  * pictures
@@ -47,12 +62,25 @@ class Engine {
   public:
     explicit Engine(android_app* app) :
                 app_(app),
+                inputCache_(app->activity->assetManager),
                 decoder_(nullptr),
+                incremental_(false),
+                firstRows_(0),
+                firstRowsUs_(0),
+                animEndMs_(0),
+                shownFrame_(-1),
+                srcXCanvasWidth_(0),
                 animating_(false) {
         memset(&frameStartTime_, 0, sizeof(frameStartTime_));
+        memset(&animStats_, 0, sizeof(animStats_));
     }
 
-    ~Engine() {}
+    ~Engine() {
+        // the decoding threads use inputCache_
+        if (decoder_) {
+            decoder_->DestroyDecoder();
+        }
+    }
 
     struct android_app* AndroidApp(void) const { return app_; }
     void StartAnimation(bool start) { animating_ = start; }
@@ -69,8 +97,36 @@ class Engine {
 
   private:
     void UpdateFrameBuffer(ANativeWindow_Buffer* buf, uint8_t* src);
+    bool DecodeIntoWindow(void);
+    static void OnRowsDecoded(void* ctx, int32_t firstRow, int32_t endRow);
+    bool StartAnimationPlayback(const char* file);
+    bool UpdateAnimation(void);
+    void UpdateFrameBuffer(ANativeWindow_Buffer* buf, const uint8_t* canvas,
+                           int32_t width, int32_t height);
+
     struct android_app* app_;
+    WebpInputCache inputCache_;
     WebpDecoder* decoder_;
+    bool incremental_;
+
+    // incremental mode: decode start, first rows completed and their latency
+    struct timespec decodeStartTime_;
+    int32_t firstRows_;
+    int64_t firstRowsUs_;
+
+    // animated picture playing instead of the slideshow, if any
+    std::unique_ptr<WebpAnimation> animation_;
+    struct timespec animStartTime_;
+    int64_t animEndMs_;
+    int64_t shownFrame_;   // counted from the start, across loops
+    struct {
+        uint32_t shown_, skipped_, late_;
+        int64_t  decodeUs_, maxDecodeUs_;
+    } animStats_;
+    std::vector<uint32_t> scaled_;   // the canvas at the window size
+    // canvas column of each window column, for srcXCanvasWidth_ wide canvases
+    std::vector<int32_t> srcX_;
+    int32_t srcXCanvasWidth_;
     bool animating_;
     struct timespec frameStartTime_;
 };
@@ -171,6 +227,12 @@ bool Engine::PrepareDrawing(void) {
     // create decoder
     if (decoder_) {
         decoder_->DestroyDecoder();
+        decoder_ = nullptr;
+        WebpInputCacheStats stats = inputCache_.GetStats();
+        LOGI("webp input cache: %llu hits, %llu misses, %llu evictions, "
+             "%zu bytes resident",
+             (unsigned long long)stats.hits_, (unsigned long long)stats.misses_,
+             (unsigned long long)stats.evictions_, stats.residentBytes_);
     }
     ANativeWindow_Buffer buf;
     if (ANativeWindow_lock(app_->window, &buf, NULL) < 0) {
@@ -196,28 +258,44 @@ bool Engine::PrepareDrawing(void) {
     descriptor.height_ = buf.height;
     descriptor.stride_ = buf.stride;
 
+    incremental_ = (buf.width * buf.height >= kINCREMENTAL_DECODE_PIXELS);
     decoder_ = new WebpDecoder(frames, kFRAME_COUNT, &descriptor,
-                               app_->activity->assetManager);
+                               &inputCache_,
+                               WebpDecoder::kDefaultThreadCount,
+                               incremental_ ? 0 :
+                               WebpDecoder::kDefaultPrefetchCount);
     assert(decoder_);
     if (!decoder_) {
         return false;
     }
-    decoder_->DecodeFrame();
 
     return true;
 }
 
+static int64_t ElapsedUs(const struct timespec& start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start.tv_sec) * 1000000LL +
+           (now.tv_nsec - start.tv_nsec) / 1000;
+}
+
 /*
  * Only copy decoded webp picture when:
  *  - current frame has been on for kFrame_DISPLAY_TIME seconds
  *  - a new picture is decoded
- * After copying, start decoding the next frame
+ * After copying, the frame buffer goes back to the decoder to prefetch the
+ * next pictures.
+ * In incremental mode the next picture is decoded into the window instead.
+ * An animated picture plays until it is over, then the slideshow resumes
  */
 bool Engine::UpdateDisplay(void) {
     if (!app_->window || !decoder_) {
         assert(0);
         return false;
     }
+    if (animation_) {
+        return UpdateAnimation();
+    }
     struct timespec curTime;
     clock_gettime(CLOCK_MONOTONIC, &curTime);
     if (curTime.tv_sec <
@@ -225,6 +303,13 @@ bool Engine::UpdateDisplay(void) {
         // current frame is displayed less than required duration
         return false;
     }
+    const char* animation = decoder_->TakeAnimation();
+    if (animation && StartAnimationPlayback(animation)) {
+        return UpdateAnimation();
+    }
+    if (incremental_) {
+        return DecodeIntoWindow();
+    }
     uint8_t *frame = decoder_->GetDecodedFrame();
     if (!frame)
         return false;
@@ -238,11 +323,181 @@ bool Engine::UpdateDisplay(void) {
     ANativeWindow_unlockAndPost(app_->window);
     clock_gettime(CLOCK_MONOTONIC, &frameStartTime_);
 
-    // start decoding next frame
-    decoder_->DecodeFrame();
+    // recycle the frame buffer for a later picture
+    decoder_->ReleaseFrame();
     return true;
 }
 
+/*
+ * DecodeIntoWindow():
+ *     Incremental mode: decode the next picture straight into the locked
+ *     window buffer, no private frame and no copy. Picture and window have the
+ *     same geometry and format, the decoder was created from it.
+ */
+bool Engine::DecodeIntoWindow(void) {
+    ANativeWindow_Buffer buffer;
+    if (ANativeWindow_lock(app_->window, &buffer, nullptr) < 0) {
+        LOGW("Unable to lock window buffer");
+        return false;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &decodeStartTime_);
+    firstRows_ = 0;
+    bool decoded = decoder_->DecodeNextFrame(
+        reinterpret_cast<uint8_t*>(buffer.bits), buffer.stride,
+        OnRowsDecoded, this);
+    int64_t totalUs = ElapsedUs(decodeStartTime_);
+    ANativeWindow_unlockAndPost(app_->window);
+    clock_gettime(CLOCK_MONOTONIC, &frameStartTime_);
+
+    if (!decoded) {
+        // the window got the previous picture again, not a partial one
+        LOGW("Unable to decode the picture into the window, skipped");
+        return false;
+    }
+    LOGI("first %d rows after %lld us, %d rows after %lld us",
+         firstRows_, (long long)firstRowsUs_, buffer.height,
+         (long long)totalUs);
+    return true;
+}
+
+void Engine::OnRowsDecoded(void* ctx, int32_t firstRow, int32_t endRow) {
+    Engine* engine = reinterpret_cast<Engine*>(ctx);
+    if (!engine->firstRows_) {
+        engine->firstRowsUs_ = ElapsedUs(engine->decodeStartTime_);
+        engine->firstRows_ = endRow - firstRow;
+    }
+}
+
+/*
+ * StartAnimationPlayback():
+ *     play whole loops for at least kFRAME_DISPLAY_TIME, but no more loops
+ *     than the animation asks for
+ */
+bool Engine::StartAnimationPlayback(const char* file) {
+    animation_.reset(WebpAnimation::Create(inputCache_.Get(file)));
+    if (!animation_) {
+        LOGW("Unable to play animation %s", file);
+        return false;
+    }
+    int64_t duration = animation_->LoopDuration();
+    int64_t loops = (kFRAME_DISPLAY_TIME * 1000 + duration - 1) / duration;
+    if (animation_->LoopCount() && loops > animation_->LoopCount()) {
+        loops = animation_->LoopCount();
+    }
+    animEndMs_ = loops * duration;
+    shownFrame_ = -1;
+    memset(&animStats_, 0, sizeof(animStats_));
+    clock_gettime(CLOCK_MONOTONIC, &animStartTime_);
+    LOGI("playing %s: %dx%d, %u frames, %lld ms loop", file,
+         animation_->CanvasWidth(), animation_->CanvasHeight(),
+         animation_->FrameCount(), (long long)duration);
+    return true;
+}
+
+/*
+ * UpdateAnimation():
+ *     frame scheduler: show the frame due now. When compositing falls behind,
+ *     the frames due meanwhile are skipped; a frame presented after its own
+ *     display time is over counts as late
+ */
+bool Engine::UpdateAnimation(void) {
+    int64_t nowMs = ElapsedUs(animStartTime_) / 1000;
+    if (nowMs >= animEndMs_) {
+        LOGI("animation: %u frames shown, %u skipped, %u late, "
+             "decode avg %lld us max %lld us",
+             animStats_.shown_, animStats_.skipped_, animStats_.late_,
+             (long long)(animStats_.shown_ ?
+                         animStats_.decodeUs_ / animStats_.shown_ : 0),
+             (long long)animStats_.maxDecodeUs_);
+        animation_.reset();
+        // the next picture is due now
+        memset(&frameStartTime_, 0, sizeof(frameStartTime_));
+        return false;
+    }
+    int64_t duration = animation_->LoopDuration();
+    uint32_t index = animation_->FrameAt(nowMs % duration);
+    int64_t frame = nowMs / duration * animation_->FrameCount() + index;
+    if (frame == shownFrame_) {
+        return false;
+    }
+    if (shownFrame_ >= 0 && frame > shownFrame_ + 1) {
+        animStats_.skipped_ += frame - shownFrame_ - 1;
+    }
+    shownFrame_ = frame;
+
+    struct timespec decodeStart;
+    clock_gettime(CLOCK_MONOTONIC, &decodeStart);
+    const uint8_t* canvas = animation_->GetFrame(index);
+    int64_t decodeUs = ElapsedUs(decodeStart);
+    if (!canvas) {
+        LOGW("Unable to decode animation frame %u", index);
+        animEndMs_ = 0;
+        return false;
+    }
+    animStats_.decodeUs_ += decodeUs;
+    animStats_.maxDecodeUs_ = std::max(animStats_.maxDecodeUs_, decodeUs);
+
+    ANativeWindow_Buffer buffer;
+    if (ANativeWindow_lock(app_->window, &buffer, nullptr) < 0) {
+        LOGW("Unable to lock window buffer");
+        return false;
+    }
+    UpdateFrameBuffer(&buffer, canvas, animation_->CanvasWidth(),
+                      animation_->CanvasHeight());
+    ANativeWindow_unlockAndPost(app_->window);
+
+    animStats_.shown_++;
+    int64_t deadlineMs = nowMs / duration * duration +
+                         animation_->FrameStart(index) +
+                         animation_->FrameDuration(index);
+    if (ElapsedUs(animStartTime_) / 1000 > deadlineMs) {
+        animStats_.late_++;
+    }
+    return true;
+}
+
+/*
+ * UpdateFrameBuffer():
+ *     Present an animation canvas: scaled to the window, nearest pixel, and
+ *     composed over black as the canvas has transparent areas
+ */
+void Engine::UpdateFrameBuffer(ANativeWindow_Buffer* buf,
+                               const uint8_t* canvas,
+                               int32_t width, int32_t height) {
+    // nearest pixel scaling to the window size, still straight RGBA
+    scaled_.resize(buf->width * buf->height);
+    if (srcX_.size() != static_cast<size_t>(buf->width) ||
+        srcXCanvasWidth_ != width) {
+        srcX_.resize(buf->width);
+        for (int32_t x = 0; x < buf->width; x++) {
+            srcX_[x] = x * width / buf->width;
+        }
+        srcXCanvasWidth_ = width;
+    }
+    for (int32_t y = 0; y < buf->height; y++) {
+        const uint32_t* src = reinterpret_cast<const uint32_t*>(canvas) +
+                              y * height / buf->height * width;
+        uint32_t* dst = scaled_.data() + y * buf->width;
+        for (int32_t x = 0; x < buf->width; x++) {
+            dst[x] = src[srcX_[x]];
+        }
+    }
+
+    // the window format, premultiplied (over black), dithered into 565
+    bool is565 = (buf->format == WINDOW_FORMAT_RGB_565);
+    PixelImage src = MakePixelImage(PixelFormat::PIXEL_FORMAT_RGBA_8888,
+                                    buf->width, buf->height,
+                                    reinterpret_cast<uint8_t*>(scaled_.data()),
+                                    buf->width * 4);
+    PixelImage dst = MakePixelImage(is565 ? PixelFormat::PIXEL_FORMAT_RGB_565 :
+                                            PixelFormat::PIXEL_FORMAT_RGBA_8888,
+                                    buf->width, buf->height,
+                                    static_cast<uint8_t*>(buf->bits),
+                                    buf->stride * (is565 ? 2 : 4));
+    ConvertPixels(src, dst, PIXEL_CONVERT_PREMULTIPLY | PIXEL_CONVERT_DITHER,
+                  kCONVERT_THREADS);
+}
+
 /*
  * UpdateFrameBuffer():
  *     Internal function to perform bits copying onto current frame buffer